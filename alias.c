@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include "alias.h"
+
+/* ============================================================================
+ * COSTRUZIONE
+ * ============================================================================ */
+
+void alias_costruisci(Tabella_alias* a, const uint16_t* pesi, int n) {
+    uint64_t scalato[ALIAS_MAX];
+    int piccoli[ALIAS_MAX];
+    int grandi[ALIAS_MAX];
+    int num_piccoli = 0;
+    int num_grandi  = 0;
+    uint64_t totale = 0;
+    int i;
+
+    a->n = n;
+    for (i = 0; i < n; i++) {
+        totale += pesi[i];
+    }
+
+    if (totale == 0) { // Nessun peso: si estrae sempre l'indice 0
+        for (i = 0; i < n; i++) {
+            a->soglia[i] = 0;
+            a->alias[i]  = 0;
+        }
+        a->soglia[0] = ALIAS_SCALA;
+        return;
+    }
+
+    /* Ogni colonna vale "totale": le colonne sotto la media prendono in prestito da quelle sopra */
+    for (i = 0; i < n; i++) {
+        scalato[i] = (uint64_t)pesi[i] * (uint64_t)n;
+        if (scalato[i] < totale) {
+            piccoli[num_piccoli++] = i;
+        } else {
+            grandi[num_grandi++] = i;
+        }
+    }
+
+    while (num_piccoli > 0 && num_grandi > 0) {
+        int s = piccoli[--num_piccoli];
+        int l = grandi[num_grandi - 1];
+
+        a->soglia[s] = (uint32_t)(scalato[s] * ALIAS_SCALA / totale);
+        a->alias[s]  = (uint8_t)l;
+        scalato[l]  -= totale - scalato[s];
+        if (scalato[l] < totale) {
+            num_grandi--;
+            piccoli[num_piccoli++] = l;
+        }
+    }
+
+    /* Le colonne rimaste sono piene (a meno di arrotondamenti) */
+    while (num_grandi > 0) {
+        int l = grandi[--num_grandi];
+        a->soglia[l] = ALIAS_SCALA;
+        a->alias[l]  = (uint8_t)l;
+    }
+    while (num_piccoli > 0) {
+        int s = piccoli[--num_piccoli];
+        a->soglia[s] = ALIAS_SCALA;
+        a->alias[s]  = (uint8_t)s;
+    }
+}
+
+/* ============================================================================
+ * ESTRAZIONE
+ * ============================================================================ */
+
+int alias_estrai(const Tabella_alias* a, uint32_t r) {
+    /* Le cifre basse scelgono la colonna, le successive decidono tra colonna e alias */
+    uint32_t colonna = r % (uint32_t)a->n;
+    uint32_t moneta  = (r / (uint32_t)a->n) % ALIAS_SCALA;
+
+    return moneta < a->soglia[colonna] ? (int)colonna : a->alias[colonna];
+}
+
+void alias_riempi(const Tabella_alias* a, uint8_t* uscita, size_t passo, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        *uscita = (uint8_t)alias_estrai(a, (uint32_t)rand());
+        uscita += passo;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * TABELLE ALIAS
+ *
+ * Estraggono un indice con una distribuzione qualsiasi in tempo costante,
+ * con un solo numero casuale per estrazione (metodo di Walker/Vose). La
+ * tabella si costruisce una volta dai pesi, in O(n), e va ricostruita solo
+ * quando i pesi cambiano.
+ * ============================================================================ */
+
+/* Indici massimi di una tabella */
+#define ALIAS_MAX     64
+
+/* Le soglie sono in 1/ALIAS_SCALA */
+#define ALIAS_SCALA   65536u
+
+// Ogni colonna tiene il suo indice con probabilita' soglia / ALIAS_SCALA,
+// altrimenti restituisce il suo alias
+typedef struct {
+    uint32_t soglia[ALIAS_MAX];
+    uint8_t alias[ALIAS_MAX];
+    int n;
+} Tabella_alias;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//costruisce la tabella per n pesi (1 <= n <= ALIAS_MAX); con tutti i pesi nulli estrae sempre 0
+void alias_costruisci(Tabella_alias* a, const uint16_t* pesi, int n);
+
+//estrae un indice dal numero casuale r (servono almeno 31 bit casuali, come quelli di rand())
+int alias_estrai(const Tabella_alias* a, uint32_t r);
+
+//riempie n byte distanti passo byte l'uno dall'altro con indici estratti, un rand() ciascuno
+void alias_riempi(const Tabella_alias* a, uint8_t* uscita, size_t passo, int n);
+
+#endif
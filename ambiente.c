@@ -0,0 +1,483 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ambiente.h"
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+/* Stato completo di un ambiente: mappa e giocatore stanno in poche cache line */
+typedef struct {
+    uint64_t rng;                        /* Stato del generatore xorshift64* */
+    uint8_t tipo[ZONE_MINIME];           /* Tipo di zona (uguale nei due mondi) */
+    uint8_t nemico_mr[ZONE_MINIME];      /* Nemici del Mondo Reale */
+    uint8_t nemico_ss[ZONE_MINIME];      /* Nemici del Soprasotto */
+    uint8_t oggetto[ZONE_MINIME];        /* Oggetti del Mondo Reale */
+    uint8_t mondo;                       /* MONDO_REALE o SOPRASOTTO */
+    uint8_t posizione;                   /* Indice della zona corrente */
+    uint8_t zaino[ZAINO_SLOT_MAX];       /* Inventario oggetti, solo i primi posti_zaino usati */
+    uint32_t effetti_attivi;             /* Bit dei tipi non cumulabili con l'effetto in corso */
+    int16_t punti_vita;
+    int16_t attacco;
+    int16_t difesa;
+    int16_t fortuna;
+    int16_t attacco_temporaneo;          /* Bonus degli oggetti temporanei, tolti a fine combattimento */
+    int16_t difesa_temporanea;
+    int16_t fortuna_temporanea;
+    int16_t hp_nemico;                   /* PV del nemico affrontato, 0 fuori dal combattimento */
+    uint16_t passi;                      /* Passi eseguiti nell'episodio corrente */
+} Ambiente;
+
+struct Ambienti {
+    int n;
+    int posti_zaino;                     /* Da registro_dimensione_zaino alla creazione */
+    int nemico_finale;                   /* Da registro_nemico_finale alla creazione */
+    Ambiente* amb;
+};
+
+/* ============================================================================
+ * GENERATORE DI NUMERI CASUALI
+ * ============================================================================ */
+
+/**
+ * Mescola un seme con splitmix64, cosi' semi vicini danno stati scorrelati
+ * @param x Seme di partenza
+ * @return Stato iniziale non nullo per xorshift64*
+ */
+static uint64_t mescola_seme(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x != 0 ? x : 1;
+}
+
+/**
+ * Avanza il generatore xorshift64* e ne restituisce i 32 bit alti
+ * @param rng Stato del generatore
+ * @return Numero casuale a 32 bit
+ */
+static uint32_t casuale(uint64_t* rng) {
+    uint64_t x = *rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *rng = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * Estrae un numero in [0, max) senza divisioni (moltiplica e sposta)
+ * @param rng Stato del generatore
+ * @param max Estremo superiore escluso
+ * @return Numero casuale tra 0 e max - 1
+ */
+static uint32_t estrai(uint64_t* rng, uint32_t max) {
+    return (uint32_t)((uint64_t)casuale(rng) * max >> 32);
+}
+
+/**
+ * Lancia un dado da 20 facce
+ * @return Numero casuale tra 1 e 20 (inclusi)
+ */
+static int lancia_dado(uint64_t* rng) {
+    return (int)estrai(rng, 20) + 1;
+}
+
+/* ============================================================================
+ * GENERAZIONE EPISODIO
+ * ============================================================================ */
+
+// Estrae le zone con le tabelle del registro, come genera_contenuti_mappa senza
+// obiettivi, e mette il nemico finale in una zona a caso del Soprasotto
+static void genera_mappa(const Ambienti* a, Ambiente* e) {
+    int i;
+    int posizione_finale = (int)estrai(&e->rng, ZONE_MINIME);
+
+    for (i = 0; i < ZONE_MINIME; i++) {
+        Contenuto_zona zona;
+        uint32_t casuali[4];
+
+        casuali[0] = casuale(&e->rng);
+        casuali[1] = casuale(&e->rng);
+        casuali[2] = casuale(&e->rng);
+        casuali[3] = casuale(&e->rng);
+        registro_estrai_zona(&zona, casuali);
+
+        e->tipo[i]      = zona.tipo;
+        e->nemico_mr[i] = zona.nemico_mr;
+        e->oggetto[i]   = zona.oggetto;
+        e->nemico_ss[i] = i == posizione_finale ? (uint8_t)a->nemico_finale : zona.nemico_ss;
+    }
+}
+
+// Inizia un nuovo episodio: nuova mappa e nuovo giocatore nella prima zona del Mondo Reale
+static void inizia_episodio(const Ambienti* a, Ambiente* e, uint64_t seme) {
+    e->rng = mescola_seme(seme);
+    genera_mappa(a, e);
+
+    e->mondo      = MONDO_REALE;
+    e->posizione  = 0;
+    e->attacco    = (int16_t)lancia_dado(&e->rng);
+    e->difesa     = (int16_t)lancia_dado(&e->rng);
+    e->fortuna    = (int16_t)lancia_dado(&e->rng);
+    e->punti_vita = PV_INIZIALI;
+    e->hp_nemico  = 0;
+    e->passi      = 0;
+    e->effetti_attivi     = 0;
+    e->attacco_temporaneo = 0;
+    e->difesa_temporanea  = 0;
+    e->fortuna_temporanea = 0;
+    memset(e->zaino, NESSUN_OGGETTO, sizeof(e->zaino));
+}
+
+/* ============================================================================
+ * REGOLE DI GIOCO
+ * ============================================================================ */
+
+/**
+ * Restituisce il puntatore al nemico della zona corrente nel mondo corrente
+ * @param e Ambiente
+ * @return Puntatore alla cella del nemico, modificabile
+ */
+static uint8_t* nemico_corrente(Ambiente* e) {
+    return e->mondo == MONDO_REALE ? &e->nemico_mr[e->posizione] : &e->nemico_ss[e->posizione];
+}
+
+/**
+ * Toglie i bonus degli oggetti temporanei come termina_effetti_temporanei
+ * @param e Ambiente
+ */
+static void termina_effetti_temporanei(Ambiente* e) {
+    uint32_t attivi = e->effetti_attivi;
+
+    while (attivi != 0) { // I non cumulabili temporanei tornano utilizzabili
+        int tipo = __builtin_ctz(attivi);
+        attivi &= attivi - 1u;
+        if (registro_oggetto(tipo)->temporaneo) {
+            e->effetti_attivi &= ~(1u << tipo);
+        }
+    }
+
+    e->attacco = (int16_t)(e->attacco - e->attacco_temporaneo);
+    e->difesa  = (int16_t)(e->difesa  - e->difesa_temporanea);
+    e->fortuna = (int16_t)(e->fortuna - e->fortuna_temporanea);
+    e->attacco_temporaneo = 0;
+    e->difesa_temporanea  = 0;
+    e->fortuna_temporanea = 0;
+}
+
+/**
+ * Esegue un round di combattimento come nel ciclo di combatti_nemico
+ * @param e Ambiente
+ * @param azione AMB_ATTACCO_BASE, AMB_ATTACCO_POTENZIATO o AMB_DIFESA
+ * @param finito Impostato a 1 se l'episodio termina (vittoria o morte)
+ * @return Ricompensa del round
+ */
+static float round_combattimento(Ambiente* e, int azione, uint8_t* finito) {
+    uint8_t* nemico = nemico_corrente(e);
+    const Statistiche_nemico* s;
+    int difesa_bonus = 0;
+    int danno;
+
+    if (*nemico == NESSUN_NEMICO) {
+        return RICOMPENSA_AZIONE_NON_VALIDA;
+    }
+
+    if (azione == AMB_ATTACCO_POTENZIATO && e->punti_vita <= COSTO_ATTACCO_POTENZIATO) {
+        return RICOMPENSA_AZIONE_NON_VALIDA;
+    }
+
+    s = registro_nemico(*nemico);
+    if (e->hp_nemico == 0) { // Inizio del combattimento
+        e->hp_nemico = s->hp;
+    }
+
+    switch (azione) {
+        case AMB_ATTACCO_BASE:
+            danno = (e->attacco + lancia_dado(&e->rng))
+                    - (s->difesa + lancia_dado(&e->rng));
+            break;
+        case AMB_ATTACCO_POTENZIATO:
+            e->punti_vita -= COSTO_ATTACCO_POTENZIATO;
+            danno = ((int)((double)e->attacco * MOLTIPLICATORE_POTENZIATO) + lancia_dado(&e->rng))
+                    - (s->difesa + lancia_dado(&e->rng));
+            break;
+        default:
+            difesa_bonus = BONUS_DIFESA_TEMPORANEO;
+            danno = 0;
+            break;
+    }
+
+    if (danno > 0) {
+        e->hp_nemico = (int16_t)(e->hp_nemico - danno);
+    }
+
+    if (e->hp_nemico <= 0) { // Nemico sconfitto
+        int era_finale = s->finale;
+
+        e->hp_nemico = 0;
+        termina_effetti_temporanei(e);
+        if (estrai(&e->rng, 2) == 0) { // Il nemico si dissolve
+            *nemico = NESSUN_NEMICO;
+        }
+        if (era_finale) {
+            *finito = 1;
+            return RICOMPENSA_VITTORIA;
+        }
+        return RICOMPENSA_NEMICO_SCONFITTO;
+    }
+
+    /* Contrattacco del nemico */
+    danno = (s->attacco + lancia_dado(&e->rng))
+            - (e->difesa + difesa_bonus + lancia_dado(&e->rng));
+    if (danno > 0) {
+        e->punti_vita = (int16_t)(e->punti_vita - danno);
+    }
+
+    if (e->punti_vita <= 0) {
+        *finito = 1;
+        return RICOMPENSA_MORTE;
+    }
+    return 0.0f;
+}
+
+/**
+ * Consuma un oggetto e ne applica l'effetto del registro come applica_effetto
+ * @param e Ambiente
+ * @param slot Slot dello zaino da consumare
+ * @return 1 se l'oggetto e' stato usato, 0 se lo slot era vuoto o l'effetto
+ *         non cumulabile e' gia' in corso (l'oggetto resta nello zaino)
+ */
+static int usa_oggetto(Ambiente* e, int slot) {
+    int oggetto = e->zaino[slot];
+    const Effetto_oggetto* effetto;
+    uint32_t bit;
+    int punti_vita;
+
+    if (oggetto == NESSUN_OGGETTO) {
+        return 0;
+    }
+
+    effetto = registro_oggetto(oggetto);
+    bit     = 1u << oggetto;
+    if (!effetto->cumulabile) {
+        if (e->effetti_attivi & bit) {
+            return 0;
+        }
+        e->effetti_attivi |= bit;
+    }
+
+    e->attacco = (int16_t)(e->attacco + effetto->attacco);
+    e->difesa  = (int16_t)(e->difesa  + effetto->difesa);
+    e->fortuna = (int16_t)(e->fortuna + effetto->fortuna);
+    if (effetto->temporaneo) {
+        e->attacco_temporaneo = (int16_t)(e->attacco_temporaneo + effetto->attacco);
+        e->difesa_temporanea  = (int16_t)(e->difesa_temporanea  + effetto->difesa);
+        e->fortuna_temporanea = (int16_t)(e->fortuna_temporanea + effetto->fortuna);
+    }
+
+    /* I punti vita restano anche per gli oggetti temporanei, senza superare il massimo */
+    punti_vita = e->punti_vita + effetto->punti_vita;
+    if (punti_vita > PV_INIZIALI) punti_vita = PV_INIZIALI;
+    if (punti_vita < 1) punti_vita = 1;
+    e->punti_vita = (int16_t)punti_vita;
+
+    e->zaino[slot] = NESSUN_OGGETTO;
+    return 1;
+}
+
+/**
+ * Esegue una singola azione nell'ambiente
+ * @param a Ambienti (posti dello zaino)
+ * @param e Ambiente
+ * @param azione Azione scelta dall'agente
+ * @param finito Impostato a 1 se l'episodio termina
+ * @return Ricompensa ottenuta
+ */
+static float esegui_azione(const Ambienti* a, Ambiente* e, int azione, uint8_t* finito) {
+    int in_combattimento = e->hp_nemico > 0;
+    int nemico_presente  = *nemico_corrente(e) != NESSUN_NEMICO;
+    int i;
+
+    switch (azione) {
+        case AMB_AVANZA:
+            if (nemico_presente || e->posizione + 1 >= ZONE_MINIME) {
+                return RICOMPENSA_AZIONE_NON_VALIDA;
+            }
+            e->posizione++;
+            return 0.0f;
+
+        case AMB_INDIETREGGIA:
+            if (nemico_presente || e->posizione == 0) {
+                return RICOMPENSA_AZIONE_NON_VALIDA;
+            }
+            e->posizione--;
+            return 0.0f;
+
+        case AMB_CAMBIA_MONDO:
+            /* Dal Mondo Reale serve la zona libera, dal Soprasotto si puo' tentare la fuga */
+            if (in_combattimento || (nemico_presente && e->mondo == MONDO_REALE)) {
+                return RICOMPENSA_AZIONE_NON_VALIDA;
+            }
+            if (e->mondo == MONDO_REALE) {
+                e->mondo = SOPRASOTTO;
+            } else if (lancia_dado(&e->rng) < e->fortuna) {
+                e->mondo = MONDO_REALE;
+            }
+            return 0.0f;
+
+        case AMB_ATTACCO_BASE:
+        case AMB_ATTACCO_POTENZIATO:
+        case AMB_DIFESA:
+            return round_combattimento(e, azione, finito);
+
+        case AMB_RACCOGLI:
+            if (e->mondo != MONDO_REALE || nemico_presente
+                || e->oggetto[e->posizione] == NESSUN_OGGETTO) {
+                return RICOMPENSA_AZIONE_NON_VALIDA;
+            }
+            for (i = 0; i < a->posti_zaino; i++) {
+                if (e->zaino[i] == NESSUN_OGGETTO) {
+                    e->zaino[i] = e->oggetto[e->posizione];
+                    e->oggetto[e->posizione] = NESSUN_OGGETTO;
+                    return 0.0f;
+                }
+            }
+            return RICOMPENSA_AZIONE_NON_VALIDA; // Zaino pieno
+
+        case AMB_PASSA:
+            return nemico_presente ? RICOMPENSA_AZIONE_NON_VALIDA : 0.0f;
+
+        default:
+            if (azione >= AMB_USA_SLOT && azione < AMB_USA_SLOT + a->posti_zaino
+                && usa_oggetto(e, azione - AMB_USA_SLOT)) {
+                return 0.0f;
+            }
+            return RICOMPENSA_AZIONE_NON_VALIDA;
+    }
+}
+
+/**
+ * Scrive l'osservazione dell'ambiente i nel buffer a struttura di array
+ * @param a Ambienti (numero di ambienti e posti dello zaino)
+ * @param e Ambiente
+ * @param oss Buffer di (AMB_OSS_ZAINO + posti dello zaino) * n elementi
+ * @param i Indice dell'ambiente
+ */
+static void scrivi_osservazione(const Ambienti* a, const Ambiente* e, int16_t* oss, int i) {
+    int n = a->n;
+    int s;
+
+    oss[AMB_OSS_MONDO * n + i]      = e->mondo;
+    oss[AMB_OSS_POSIZIONE * n + i]  = e->posizione;
+    oss[AMB_OSS_TIPO_ZONA * n + i]  = e->tipo[e->posizione];
+    oss[AMB_OSS_NEMICO * n + i]     = e->mondo == MONDO_REALE ? e->nemico_mr[e->posizione]
+                                                              : e->nemico_ss[e->posizione];
+    oss[AMB_OSS_OGGETTO * n + i]    = e->mondo == MONDO_REALE ? e->oggetto[e->posizione]
+                                                              : NESSUN_OGGETTO;
+    oss[AMB_OSS_PUNTI_VITA * n + i] = e->punti_vita;
+    oss[AMB_OSS_ATTACCO * n + i]    = e->attacco;
+    oss[AMB_OSS_DIFESA * n + i]     = e->difesa;
+    oss[AMB_OSS_FORTUNA * n + i]    = e->fortuna;
+    oss[AMB_OSS_HP_NEMICO * n + i]  = e->hp_nemico;
+    for (s = 0; s < a->posti_zaino; s++) {
+        oss[(AMB_OSS_ZAINO + s) * n + i] = e->zaino[s];
+    }
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+Ambienti* ambienti_crea(int n) {
+    Ambienti* a;
+    int i;
+
+    if (n <= 0) {
+        return NULL;
+    }
+
+    a = (Ambienti*)malloc(sizeof(Ambienti));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    a->amb = (Ambiente*)malloc((size_t)n * sizeof(Ambiente));
+    if (a->amb == NULL) {
+        free(a);
+        return NULL;
+    }
+
+    a->n             = n;
+    a->posti_zaino   = registro_dimensione_zaino();
+    a->nemico_finale = registro_nemico_finale();
+    for (i = 0; i < n; i++) {
+        inizia_episodio(a, &a->amb[i], (uint64_t)i);
+    }
+    return a;
+}
+
+void ambienti_distruggi(Ambienti* a) {
+    if (a == NULL) {
+        return;
+    }
+    free(a->amb);
+    free(a);
+}
+
+int ambienti_numero(const Ambienti* a) {
+    return a != NULL ? a->n : 0;
+}
+
+int ambienti_posti_zaino(const Ambienti* a) {
+    return a != NULL ? a->posti_zaino : 0;
+}
+
+void ambiente_reset(Ambienti* a, int i, uint64_t seme, int16_t* oss) {
+    if (a == NULL || i < 0 || i >= a->n) {
+        return;
+    }
+    inizia_episodio(a, &a->amb[i], seme);
+    if (oss != NULL) {
+        scrivi_osservazione(a, &a->amb[i], oss, i);
+    }
+}
+
+void ambienti_reset(Ambienti* a, uint64_t seme, int16_t* oss) {
+    int i;
+
+    if (a == NULL) {
+        return;
+    }
+    for (i = 0; i < a->n; i++) {
+        ambiente_reset(a, i, seme + (uint64_t)i, oss);
+    }
+}
+
+void ambienti_step(Ambienti* a, const uint8_t* azioni,
+                   int16_t* oss, float* ricompense, uint8_t* finiti) {
+    ambienti_step_intervallo(a, 0, a->n, azioni, oss, ricompense, finiti);
+}
+
+void ambienti_step_intervallo(Ambienti* a, int da, int fino_a, const uint8_t* azioni,
+                              int16_t* oss, float* ricompense, uint8_t* finiti) {
+    int i;
+
+    for (i = da; i < fino_a; i++) {
+        Ambiente* e = &a->amb[i];
+        uint8_t finito = 0;
+        float r = RICOMPENSA_PASSO + esegui_azione(a, e, azioni[i], &finito);
+
+        if (++e->passi >= AMB_PASSI_MAX) { // Troncamento dell'episodio
+            finito = 1;
+        }
+        if (finito) { // Il nuovo seme viene dallo stato corrente, l'episodio resta riproducibile
+            inizia_episodio(a, e, e->rng);
+        }
+
+        ricompense[i] = r;
+        finiti[i]     = finito;
+        scrivi_osservazione(a, e, oss, i);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef AMBIENTE_H
+#define AMBIENTE_H
+
+#include <stdint.h>
+#include "gamelib.h"
+#include "registro.h"
+
+/* ============================================================================
+ * AMBIENTE HEADLESS PER ESPERIMENTI DI APPRENDIMENTO
+ *
+ * Riproduce le regole di gioca() (movimento, portali, combattimento, oggetti)
+ * senza stampe e senza scanf: ogni chiamata a ambienti_step() esegue una
+ * azione per ciascuno degli N ambienti e scrive le osservazioni direttamente
+ * nel buffer fornito dal chiamante.
+ *
+ * Nemici, oggetti, pesi di comparsa e posti dello zaino vengono dal registro
+ * (registro.h), come nella partita: le zone si estraggono con le sue tabelle,
+ * il nemico finale va in una zona a caso del Soprasotto e sconfiggerlo chiude
+ * l'episodio con la vittoria, gli oggetti applicano il loro effetto (i
+ * temporanei fino alla fine del combattimento). La voce "mappa" non si
+ * applica: gli obiettivi di difficolta' passano per generatore.c, che usa
+ * rand() e non e' riproducibile per ambiente. Il registro va caricato prima
+ * di ambienti_crea e non va ricaricato finche' gli ambienti esistono.
+ * ============================================================================ */
+
+/* Ricompense */
+#define RICOMPENSA_VITTORIA           10.0f
+#define RICOMPENSA_NEMICO_SCONFITTO    1.0f
+#define RICOMPENSA_MORTE             -10.0f
+#define RICOMPENSA_AZIONE_NON_VALIDA  -0.1f
+#define RICOMPENSA_PASSO              -0.01f
+
+/* Numero massimo di passi prima del troncamento dell'episodio */
+#define AMB_PASSI_MAX               500
+
+// Azioni disponibili in ogni passo (equivalenti alle scelte dei menu di gioca)
+typedef enum {
+    AMB_AVANZA,
+    AMB_INDIETREGGIA,
+    AMB_CAMBIA_MONDO,
+    AMB_ATTACCO_BASE,
+    AMB_ATTACCO_POTENZIATO,
+    AMB_DIFESA,
+    AMB_RACCOGLI,
+    AMB_PASSA,
+    AMB_USA_SLOT,                        /* AMB_USA_SLOT + i usa lo slot i dello zaino */
+    AMB_NUM_AZIONI = AMB_USA_SLOT + ZAINO_SLOT_MAX /* Massimo, valide fino a AMB_USA_SLOT + ambienti_posti_zaino */
+} Azione_ambiente;
+
+// Caratteristiche osservate: il buffer e' una struttura di array, la
+// caratteristica f dell'ambiente i si trova in oss[f * n + i]. Vengono scritte
+// solo le prime AMB_OSS_ZAINO + ambienti_posti_zaino caratteristiche, un
+// buffer di AMB_NUM_OSS * n elementi basta per qualsiasi registro
+typedef enum {
+    AMB_OSS_MONDO,
+    AMB_OSS_POSIZIONE,
+    AMB_OSS_TIPO_ZONA,
+    AMB_OSS_NEMICO,
+    AMB_OSS_OGGETTO,
+    AMB_OSS_PUNTI_VITA,
+    AMB_OSS_ATTACCO,
+    AMB_OSS_DIFESA,
+    AMB_OSS_FORTUNA,
+    AMB_OSS_HP_NEMICO,                   /* > 0 solo durante un combattimento */
+    AMB_OSS_ZAINO,                       /* AMB_OSS_ZAINO + i = oggetto nello slot i */
+    AMB_NUM_OSS = AMB_OSS_ZAINO + ZAINO_SLOT_MAX   /* Massimo, vedi sopra */
+} Osservazione_ambiente;
+
+typedef struct Ambienti Ambienti;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//crea n ambienti indipendenti, restituisce NULL se la memoria non basta
+Ambienti* ambienti_crea(int n);
+
+//libera tutti gli ambienti
+void ambienti_distruggi(Ambienti* a);
+
+//restituisce il numero di ambienti gestiti
+int ambienti_numero(const Ambienti* a);
+
+//restituisce i posti dello zaino letti dal registro alla creazione: le azioni e
+//le caratteristiche degli slot successivi non esistono
+int ambienti_posti_zaino(const Ambienti* a);
+
+//reinizializza l'ambiente i con il seme dato; se oss non e' NULL scrive la sua osservazione
+void ambiente_reset(Ambienti* a, int i, uint64_t seme, int16_t* oss);
+
+//reinizializza tutti gli ambienti (seme + i per l'ambiente i) e scrive le osservazioni
+void ambienti_reset(Ambienti* a, uint64_t seme, int16_t* oss);
+
+//esegue un'azione per ogni ambiente; gli episodi terminati ripartono da soli
+//e l'osservazione restituita e' gia' quella del nuovo episodio
+void ambienti_step(Ambienti* a, const uint8_t* azioni,
+                   int16_t* oss, float* ricompense, uint8_t* finiti);
+
+//come ambienti_step ma solo per gli ambienti da <= i < fino_a; intervalli
+//disgiunti possono avanzare in parallelo su thread diversi
+void ambienti_step_intervallo(Ambienti* a, int da, int fino_a, const uint8_t* azioni,
+                              int16_t* oss, float* ricompense, uint8_t* finiti);
+
+#endif
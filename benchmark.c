@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ambiente.h"
+#include "esecutore.h"
+#include "gamelib.h"
+#include "mappa_condivisa.h"
+
+/* ============================================================================
+ * BENCHMARK DELL'ESECUTORE
+ *
+ * Senza opzioni avanza molti ambienti headless con una politica casuale,
+ * distribuendo blocchi di ambienti sui lavoratori, e stampa i passi al
+ * secondo. Con --sessioni fa giocare molte partite come le connessioni del
+ * server con --lavoratori: a ogni giro ogni sessione riceve RIGHE_PER_GIRO
+ * scelte casuali in un suo compito, e stampa le righe al secondo. Provando
+ * 1, 2, 4... lavoratori si vede quanto scala.
+ *
+ *     gcc -O2 -pthread benchmark.c ambiente.c esecutore.c gamelib.c registro.c alias.c generatore.c mappa_condivisa.c ramo.c salvataggio.c classifica.c metriche.c cronaca.c giornale.c messaggi.c schermo.c crc32.c -o benchmark
+ *     ./benchmark [ambienti] [passi] [lavoratori]
+ *     ./benchmark --sessioni [sessioni] [giri] [lavoratori]
+ * ============================================================================ */
+
+/* I blocchi sono multipli di 64 ambienti: nessuna linea di cache condivisa tra blocchi */
+#define AMBIENTI_PER_ALLINEAMENTO  64
+#define BLOCCHI_PER_LAVORATORE      4
+
+/* Righe consegnate a ogni sessione in un giro, come quelle lette in un giro di epoll */
+#define RIGHE_PER_GIRO              8
+
+// Un blocco di ambienti consecutivi avanzato da un solo compito
+typedef struct {
+    Compito compito;                     /* Primo campo: il compito e' anche il blocco */
+    Ambienti* ambienti;
+    int da;
+    int fino_a;
+    uint64_t rng;
+    uint8_t* azioni;
+    int16_t* oss;
+    float* ricompense;
+    uint8_t* finiti;
+    long episodi;
+    double totale;
+} Blocco;
+
+// Una partita avanzata da un solo compito, come una connessione del server
+typedef struct {
+    Compito compito;                     /* Primo campo: il compito e' anche la sessione */
+    Partita* partita;                    /* NULL se la memoria non e' bastata */
+    const Mappa_condivisa* mappa;
+    uint64_t rng;
+    long righe;
+    long partite;                        /* Partite concluse e ricominciate */
+} Sessione;
+
+/**
+ * Sceglie le azioni del blocco e avanza i suoi ambienti di un passo
+ * @param c Compito del blocco
+ */
+static void avanza_blocco(Compito* c) {
+    Blocco* b = (Blocco*)c;
+    int n = ambienti_numero(b->ambienti);
+    int i;
+
+    for (i = b->da; i < b->fino_a; i++) {
+        b->rng ^= b->rng << 13;
+        b->rng ^= b->rng >> 7;
+        b->rng ^= b->rng << 17;
+        if (b->oss[AMB_OSS_NEMICO * n + i] != 0) {
+            b->azioni[i] = AMB_ATTACCO_BASE;
+        } else {
+            b->azioni[i] = (uint8_t)(b->rng % 4 == 0 ? AMB_CAMBIA_MONDO : (b->rng % 3 == 0 ? AMB_RACCOGLI : AMB_AVANZA));
+        }
+    }
+
+    ambienti_step_intervallo(b->ambienti, b->da, b->fino_a, b->azioni, b->oss, b->ricompense, b->finiti);
+
+    for (i = b->da; i < b->fino_a; i++) {
+        b->totale  += b->ricompense[i];
+        b->episodi += b->finiti[i];
+    }
+}
+
+/**
+ * Crea la partita di una sessione e la porta ai turni di gioco con due giocatori
+ * @param s Sessione
+ */
+static void apri_sessione(Sessione* s) {
+    static const char* const impostazione[] = {"1", "2", "A", "4", "B", "4", "2"};
+    size_t i;
+
+    s->partita = partita_crea();
+    if (s->partita == NULL) {
+        return;
+    }
+    partita_usa_mappa_condivisa(s->partita, s->mappa);
+    partita_apri(s->partita);
+    for (i = 0; i < sizeof(impostazione) / sizeof(impostazione[0]); i++) {
+        partita_invia(s->partita, impostazione[i]);
+    }
+    partita_svuota_uscita(s->partita);
+}
+
+/**
+ * Consegna alla partita della sessione le scelte casuali di un giro,
+ * ricominciando quando la partita finisce
+ * @param c Compito della sessione
+ */
+static void avanza_sessione(Compito* c) {
+    Sessione* s = (Sessione*)c;
+    char scelta[4];
+    int i;
+
+    for (i = 0; i < RIGHE_PER_GIRO && s->partita != NULL; i++) {
+        s->rng ^= s->rng << 13;
+        s->rng ^= s->rng >> 7;
+        s->rng ^= s->rng << 17;
+        scelta[0] = (char)('1' + s->rng % 9);
+        scelta[1] = '\0';
+
+        if (!partita_invia(s->partita, scelta) || !partita_in_gioco(s->partita)) {
+            partita_distruggi(s->partita);
+            apri_sessione(s);
+            s->partite++;
+        } else {
+            partita_svuota_uscita(s->partita);
+        }
+        s->righe++;
+    }
+}
+
+/**
+ * Misura le righe al secondo di molte sessioni eseguite dall'esecutore
+ * @param n Numero di sessioni
+ * @param giri Giri in cui ogni sessione riceve RIGHE_PER_GIRO righe
+ * @param lavoratori Lavoratori dell'esecutore (0 = uno per core)
+ * @return 0 se riuscito, 1 in caso di errore
+ */
+static int misura_sessioni(int n, int giri, int lavoratori) {
+    Esecutore* es = esecutore_crea(lavoratori);
+    Mappa_condivisa* mappa = mappa_condivisa_genera(7, ZONE_MINIME);
+    Sessione* sessioni = (Sessione*)calloc((size_t)(n > 0 ? n : 1), sizeof(Sessione));
+    long righe = 0;
+    long partite = 0;
+    double secondi;
+    struct timespec inizio, fine;
+    int i, k;
+
+    if (es == NULL || mappa == NULL || sessioni == NULL) {
+        fprintf(stderr, "Errore: impossibile preparare il benchmark!\n");
+        return 1;
+    }
+
+    srand(42); // I dadi delle partite non dipendono dal seme della mappa
+    for (k = 0; k < n; k++) {
+        compito_inizializza(&sessioni[k].compito, avanza_sessione);
+        sessioni[k].mappa = mappa;
+        sessioni[k].rng   = (uint64_t)k * 0x9E3779B97F4A7C15u + 1u;
+        apri_sessione(&sessioni[k]);
+        if (sessioni[k].partita == NULL) {
+            fprintf(stderr, "Errore: impossibile preparare il benchmark!\n");
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &inizio);
+    for (i = 0; i < giri; i++) {
+        for (k = 0; k < n; k++) {
+            esecutore_invia(es, &sessioni[k].compito);
+        }
+        esecutore_attendi(es);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &fine);
+
+    for (k = 0; k < n; k++) {
+        righe   += sessioni[k].righe;
+        partite += sessioni[k].partite;
+        partita_distruggi(sessioni[k].partita);
+    }
+    secondi = (double)(fine.tv_sec - inizio.tv_sec) + (double)(fine.tv_nsec - inizio.tv_nsec) / 1e9;
+
+    printf("Lavoratori: %d  Sessioni: %d  Giri: %d\n", esecutore_lavoratori(es), n, giri);
+    printf("%.2f milioni di righe/s  (partite concluse: %ld)\n", (double)righe / secondi / 1e6, partite);
+
+    esecutore_distruggi(es);
+    mappa_condivisa_distruggi(mappa);
+    free(sessioni);
+    return 0;
+}
+
+/**
+ * Misura i passi al secondo di molti ambienti avanzati a blocchi dall'esecutore
+ * @param n Numero di ambienti
+ * @param passi Passi di ogni ambiente
+ * @param lavoratori Lavoratori dell'esecutore (0 = uno per core)
+ * @return 0 se riuscito, 1 in caso di errore
+ */
+static int misura_ambienti(int n, int passi, int lavoratori) {
+    Esecutore* es   = esecutore_crea(lavoratori);
+    Ambienti* a     = ambienti_crea(n);
+    int16_t* oss    = (int16_t*)malloc((size_t)AMB_NUM_OSS * (size_t)n * sizeof(int16_t));
+    float* ricompense = (float*)malloc((size_t)n * sizeof(float));
+    uint8_t* finiti = (uint8_t*)malloc((size_t)n);
+    uint8_t* azioni = (uint8_t*)malloc((size_t)n);
+    Blocco* blocchi;
+    int num_blocchi;
+    int dimensione;
+    int i, k;
+    long episodi = 0;
+    double totale = 0.0;
+    double secondi;
+    struct timespec inizio, fine;
+
+    if (es == NULL || a == NULL || oss == NULL || ricompense == NULL || finiti == NULL || azioni == NULL) {
+        fprintf(stderr, "Errore: impossibile preparare il benchmark!\n");
+        return 1;
+    }
+
+    /* Divide gli ambienti in blocchi allineati, alcuni per lavoratore per bilanciare con i furti */
+    num_blocchi = esecutore_lavoratori(es) * BLOCCHI_PER_LAVORATORE;
+    dimensione  = (n + num_blocchi - 1) / num_blocchi;
+    dimensione  = (dimensione + AMBIENTI_PER_ALLINEAMENTO - 1) / AMBIENTI_PER_ALLINEAMENTO * AMBIENTI_PER_ALLINEAMENTO;
+    num_blocchi = (n + dimensione - 1) / dimensione;
+
+    blocchi = (Blocco*)calloc((size_t)num_blocchi, sizeof(Blocco));
+    if (blocchi == NULL) {
+        fprintf(stderr, "Errore: impossibile preparare il benchmark!\n");
+        return 1;
+    }
+    for (k = 0; k < num_blocchi; k++) {
+        Blocco* b = &blocchi[k];
+        compito_inizializza(&b->compito, avanza_blocco);
+        b->ambienti   = a;
+        b->da         = k * dimensione;
+        b->fino_a     = b->da + dimensione < n ? b->da + dimensione : n;
+        b->rng        = 0x2545F4914F6CDD1DULL + (uint64_t)k;
+        b->azioni     = azioni;
+        b->oss        = oss;
+        b->ricompense = ricompense;
+        b->finiti     = finiti;
+    }
+
+    ambienti_reset(a, 42, oss);
+
+    clock_gettime(CLOCK_MONOTONIC, &inizio);
+    for (i = 0; i < passi; i++) {
+        for (k = 0; k < num_blocchi; k++) {
+            esecutore_invia(es, &blocchi[k].compito);
+        }
+        esecutore_attendi(es);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &fine);
+
+    for (k = 0; k < num_blocchi; k++) {
+        episodi += blocchi[k].episodi;
+        totale  += blocchi[k].totale;
+    }
+    secondi = (double)(fine.tv_sec - inizio.tv_sec) + (double)(fine.tv_nsec - inizio.tv_nsec) / 1e9;
+
+    printf("Lavoratori: %d  Ambienti: %d  Passi: %d  Blocchi: %d\n",
+           esecutore_lavoratori(es), n, passi, num_blocchi);
+    printf("%.1f milioni di passi/s  (episodi conclusi: %ld, ricompensa media: %.3f)\n",
+           (double)n * passi / secondi / 1e6, episodi, totale / ((double)n * passi));
+
+    esecutore_distruggi(es);
+    ambienti_distruggi(a);
+    free(blocchi);
+    free(oss);
+    free(ricompense);
+    free(finiti);
+    free(azioni);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--sessioni") == 0) {
+        return misura_sessioni(argc > 2 ? atoi(argv[2]) : 4096,
+                               argc > 3 ? atoi(argv[3]) : 200,
+                               argc > 4 ? atoi(argv[4]) : 0);
+    }
+    return misura_ambienti(argc > 1 ? atoi(argv[1]) : 65536,
+                           argc > 2 ? atoi(argv[2]) : 500,
+                           argc > 3 ? atoi(argv[3]) : 0);
+}
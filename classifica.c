@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "classifica.h"
+
+/* Firma all'inizio di ogni record del file delle partite ("CLS1") */
+#define FIRMA_RECORD       0x31534C43u
+
+/* Byte di un record: divide la pagina, quindi un record allineato non sta mai su due pagine */
+#define DIMENSIONE_RECORD  128
+
+/* Firma e versione dell'indice */
+#define FIRMA_INDICE       "COSIDX1\n"
+#define LUNGHEZZA_FIRMA    8
+
+/* Record letti al massimo per ogni passo di classifica_aggiorna */
+#define RECORD_PER_PASSO   256
+
+/* Attese di una voce dell'indice in scrittura prima di considerarla persa (processo morto a meta') */
+#define ATTESE_VOCE        100000
+
+/* Stato di una voce dell'indice */
+#define VOCE_VUOTA         0u
+#define VOCE_IN_SCRITTURA  1u
+#define VOCE_PRONTA        2u
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Record del file delle partite: la firma e il CRC32 dei byte dopo il CRC
+// permettono di riconoscere un record anche dopo un tratto rovinato.
+typedef struct {
+    uint32_t firma;
+    uint32_t crc;
+    Esito_partita esito;
+    unsigned char riserva[DIMENSIONE_RECORD - 8 - sizeof(Esito_partita)];
+} Record_partita;
+
+_Static_assert(sizeof(Record_partita) == DIMENSIONE_RECORD, "un record deve occupare DIMENSIONE_RECORD byte");
+
+// Testata dell'indice, all'inizio del file mappato
+typedef struct {
+    char firma[LUNGHEZZA_FIRMA];
+    uint32_t voci;                       /* CLASSIFICA_VOCI_MAX alla creazione */
+    uint32_t dimensione_record;
+    uint64_t inode;                      /* File delle partite indicizzato */
+    _Atomic uint64_t indicizzati;        /* Byte del file delle partite gia' presi da un processo */
+    _Atomic uint64_t partite;            /* Partite sommate nell'indice */
+    _Atomic uint64_t vinte;              /* Di cui con un vincitore */
+    unsigned char riserva[16];
+} Testata_indice;
+
+// Voce della tabella hash dell'indice: nome e hash si scrivono una volta
+// sola mentre la voce e' VOCE_IN_SCRITTURA, i contatori solo con operazioni atomiche.
+typedef struct {
+    _Atomic uint32_t stato;
+    uint32_t hash;
+    _Atomic uint32_t vittorie;
+    _Atomic uint32_t miglior_turni;      /* UINT32_MAX finche' non c'e' una vittoria */
+    _Atomic int64_t ultima_vittoria;
+    char nome[NOME_MAX];
+} Voce_indice;
+
+struct Classifica {
+    int fd;                              /* File delle partite, in O_APPEND */
+    Testata_indice* testata;             /* Indice mappato, condiviso con gli altri processi */
+    Voce_indice* voci;
+    size_t dimensione_indice;
+};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Calcola l'hash FNV-1a di un nome (mai 0)
+ * @param nome Nome del vincitore
+ * @return Hash del nome
+ */
+static uint32_t hash_nome(const char* nome) {
+    uint32_t h = 2166136261u;
+
+    while (*nome != '\0') {
+        h = (h ^ (unsigned char)*nome++) * 16777619u;
+    }
+    return h != 0 ? h : 1;
+}
+
+/**
+ * Controlla se alla posizione data del buffer comincia un record valido
+ * @param dati Byte letti dal file delle partite
+ * @param esito Dove copiare la partita del record, se valido
+ * @return 1 se il record e' valido, 0 altrimenti
+ */
+static int record_valido(const unsigned char* dati, Esito_partita* esito) {
+    Record_partita r;
+
+    memcpy(&r, dati, sizeof(r));
+    if (r.firma != FIRMA_RECORD || crc32_aggiorna(0, dati + 8, DIMENSIONE_RECORD - 8) != r.crc) {
+        return 0;
+    }
+    *esito = r.esito;
+    esito->vincitore[NOME_MAX - 1] = '\0';
+    return 1;
+}
+
+/**
+ * Legge un tratto del file delle partite
+ * @param fd File delle partite
+ * @param dati Buffer di almeno n byte
+ * @param n Byte da leggere
+ * @param da Posizione nel file
+ * @return Byte letti (meno di n alla fine del file), -1 in caso di errore
+ */
+static ssize_t leggi_tratto(int fd, unsigned char* dati, size_t n, uint64_t da) {
+    size_t letti = 0;
+
+    while (letti < n) {
+        ssize_t r = pread(fd, dati + letti, n - letti, (off_t)(da + letti));
+
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+        letti += (size_t)r;
+    }
+    return (ssize_t)letti;
+}
+
+/**
+ * Mappa l'indice esistente, se e' valido per il file delle partite
+ * @param c Classifica (riceve testata, voci e dimensione)
+ * @param percorso Percorso dell'indice
+ * @param dati Stato del file delle partite
+ * @return 1 se mappato, 0 se non esiste, -1 se non e' valido
+ */
+static int mappa_indice(Classifica* c, const char* percorso, const struct stat* dati) {
+    struct stat st;
+    Testata_indice* t;
+    int fd = open(percorso, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != c->dimensione_indice) {
+        close(fd);
+        return -1;
+    }
+    t = (Testata_indice*)mmap(NULL, c->dimensione_indice, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(t->firma, FIRMA_INDICE, LUNGHEZZA_FIRMA) != 0 || t->voci != CLASSIFICA_VOCI_MAX
+        || t->dimensione_record != DIMENSIONE_RECORD || t->inode != (uint64_t)dati->st_ino
+        || atomic_load(&t->indicizzati) > (uint64_t)dati->st_size) {
+        munmap(t, c->dimensione_indice);
+        return -1;
+    }
+    c->testata = t;
+    c->voci    = (Voce_indice*)(t + 1);
+    return 1;
+}
+
+/**
+ * Crea un indice vuoto e lo mette al suo posto solo quando e' completo
+ * @param c Classifica (per la dimensione)
+ * @param percorso Percorso dell'indice
+ * @param dati Stato del file delle partite
+ * @param sostituisci 1 per prendere il posto di un indice non valido, 0 se un indice creato
+ *                    intanto da un altro processo va tenuto
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int crea_indice(const Classifica* c, const char* percorso, const struct stat* dati, int sostituisci) {
+    Testata_indice t;
+    char* provvisorio = (char*)malloc(strlen(percorso) + 24);
+    int fd;
+    int esito;
+
+    if (provvisorio == NULL) {
+        return -1;
+    }
+    sprintf(provvisorio, "%s.%ld", percorso, (long)getpid());
+    fd = open(provvisorio, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(provvisorio);
+        return -1;
+    }
+    memset(&t, 0, sizeof(t));
+    memcpy(t.firma, FIRMA_INDICE, LUNGHEZZA_FIRMA);
+    t.voci              = CLASSIFICA_VOCI_MAX;
+    t.dimensione_record = DIMENSIONE_RECORD;
+    t.inode             = (uint64_t)dati->st_ino;
+    esito = ftruncate(fd, (off_t)c->dimensione_indice) == 0
+            && pwrite(fd, &t, sizeof(t), 0) == (ssize_t)sizeof(t) ? 0 : -1;
+    close(fd);
+
+    // link non sostituisce un indice arrivato nel frattempo, rename si'
+    if (esito == 0) {
+        if (sostituisci) {
+            esito = rename(provvisorio, percorso);
+        } else if (link(provvisorio, percorso) < 0 && errno != EEXIST) {
+            esito = -1;
+        }
+    }
+    unlink(provvisorio);
+    free(provvisorio);
+    return esito;
+}
+
+/**
+ * Cerca la voce di un vincitore, occupandone una libera se non c'e'
+ * @param c Classifica
+ * @param nome Nome del vincitore
+ * @param crea 1 per occupare una voce libera se il nome manca
+ * @return Voce del vincitore, NULL se manca (o se l'indice e' pieno)
+ */
+static Voce_indice* voce_vincitore(const Classifica* c, const char* nome, int crea) {
+    uint32_t h = hash_nome(nome);
+    uint32_t i = h & (CLASSIFICA_VOCI_MAX - 1);
+    uint32_t prove;
+
+    for (prove = 0; prove < CLASSIFICA_VOCI_MAX; prove++) {
+        Voce_indice* v = &c->voci[i];
+        uint32_t stato = atomic_load(&v->stato);
+        int attese = 0;
+
+        if (stato == VOCE_VUOTA) {
+            if (!crea) {
+                return NULL;
+            }
+            if (atomic_compare_exchange_strong(&v->stato, &stato, VOCE_IN_SCRITTURA)) {
+                v->hash = h;
+                snprintf(v->nome, NOME_MAX, "%s", nome);
+                atomic_store(&v->miglior_turni, UINT32_MAX);
+                atomic_store(&v->stato, VOCE_PRONTA);
+                return v;
+            }
+        }
+        // Un altro processo sta scrivendo il nome: potrebbe essere lo stesso
+        while (stato == VOCE_IN_SCRITTURA && attese++ < ATTESE_VOCE) {
+            sched_yield();
+            stato = atomic_load(&v->stato);
+        }
+        if (stato == VOCE_PRONTA && v->hash == h && strncmp(v->nome, nome, NOME_MAX) == 0) {
+            return v;
+        }
+        i = (i + 1) & (CLASSIFICA_VOCI_MAX - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Somma una partita nell'indice
+ * @param c Classifica
+ * @param e Partita letta dal file
+ */
+static void somma_partita(Classifica* c, const Esito_partita* e) {
+    Voce_indice* v;
+    uint32_t turni;
+    int64_t quando;
+
+    atomic_fetch_add(&c->testata->partite, 1);
+    if (e->vincitore[0] == '\0') {
+        return;
+    }
+    atomic_fetch_add(&c->testata->vinte, 1);
+    v = voce_vincitore(c, e->vincitore, 1);
+    if (v == NULL) { // Indice pieno: la partita resta solo nei totali
+        return;
+    }
+    atomic_fetch_add(&v->vittorie, 1);
+    turni = atomic_load(&v->miglior_turni);
+    while (e->turni < turni && !atomic_compare_exchange_weak(&v->miglior_turni, &turni, e->turni)) {
+    }
+    quando = atomic_load(&v->ultima_vittoria);
+    while (e->quando > quando && !atomic_compare_exchange_weak(&v->ultima_vittoria, &quando, e->quando)) {
+    }
+}
+
+/**
+ * Copia una voce dell'indice in una voce della classifica
+ * @param v Voce dell'indice (pronta)
+ * @param voce Voce da riempire
+ */
+static void copia_voce(const Voce_indice* v, Voce_classifica* voce) {
+    memcpy(voce->nome, v->nome, NOME_MAX);
+    voce->nome[NOME_MAX - 1] = '\0';
+    voce->vittorie           = atomic_load(&v->vittorie);
+    voce->miglior_turni      = atomic_load(&v->miglior_turni);
+    voce->ultima_vittoria    = atomic_load(&v->ultima_vittoria);
+}
+
+/**
+ * Confronta due vincitori per la classifica
+ * @param a Primo vincitore
+ * @param b Secondo vincitore
+ * @return 1 se a va prima di b
+ */
+static int viene_prima(const Voce_classifica* a, const Voce_classifica* b) {
+    if (a->vittorie != b->vittorie) {
+        return a->vittorie > b->vittorie;
+    }
+    if (a->miglior_turni != b->miglior_turni) {
+        return a->miglior_turni < b->miglior_turni;
+    }
+    return strcmp(a->nome, b->nome) < 0;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+// Apre il file delle partite e mappa l'indice, creandolo o ricostruendolo se serve
+Classifica* classifica_apri(const char* percorso) {
+    Classifica* c;
+    struct stat st;
+    char* percorso_indice;
+    int mappato = 0;
+    int tentativi;
+
+    if (percorso == NULL) {
+        percorso = CLASSIFICA_PREDEFINITA;
+    }
+    c = (Classifica*)calloc(1, sizeof(Classifica));
+    percorso_indice = (char*)malloc(strlen(percorso) + 8);
+    if (c == NULL || percorso_indice == NULL) {
+        free(c);
+        free(percorso_indice);
+        return NULL;
+    }
+    sprintf(percorso_indice, "%s.indice", percorso);
+    c->dimensione_indice = sizeof(Testata_indice) + CLASSIFICA_VOCI_MAX * sizeof(Voce_indice);
+
+    c->fd = open(percorso, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (c->fd < 0 || fstat(c->fd, &st) < 0) {
+        if (c->fd >= 0) {
+            close(c->fd);
+        }
+        free(percorso_indice);
+        free(c);
+        return NULL;
+    }
+
+    // Un indice mancante si crea, uno non valido si sostituisce; poi si riprova a mapparlo
+    for (tentativi = 0; tentativi < 3 && mappato != 1; tentativi++) {
+        mappato = mappa_indice(c, percorso_indice, &st);
+        if (mappato != 1 && crea_indice(c, percorso_indice, &st, mappato < 0) < 0) {
+            break;
+        }
+    }
+    free(percorso_indice);
+    if (mappato != 1) {
+        close(c->fd);
+        free(c);
+        return NULL;
+    }
+
+    classifica_aggiorna(c); // Un indice appena creato si riempie con le partite gia' nel file
+    return c;
+}
+
+// Chiude file e indice
+void classifica_chiudi(Classifica* c) {
+    if (c == NULL) {
+        return;
+    }
+    munmap(c->testata, c->dimensione_indice);
+    close(c->fd);
+    free(c);
+}
+
+// Accoda la partita con una sola write: in O_APPEND le write di processi diversi non si mescolano
+int classifica_registra(Classifica* c, const Esito_partita* esito) {
+    Record_partita r;
+    ssize_t scritti;
+
+    memset(&r, 0, sizeof(r));
+    r.firma = FIRMA_RECORD;
+    r.esito = *esito;
+    r.crc   = crc32_aggiorna(0, (const unsigned char*)&r + 8, DIMENSIONE_RECORD - 8);
+
+    do {
+        scritti = write(c->fd, &r, sizeof(r));
+    } while (scritti < 0 && errno == EINTR);
+    return scritti == (ssize_t)sizeof(r) ? 0 : -1;
+}
+
+// Legge i record dopo i byte gia' indicizzati, se ne prende il tratto e li somma
+void classifica_aggiorna(Classifica* c) {
+    unsigned char dati[RECORD_PER_PASSO * DIMENSIONE_RECORD];
+    Esito_partita esiti[RECORD_PER_PASSO];
+
+    while (1) {
+        struct stat st;
+        uint64_t da = atomic_load(&c->testata->indicizzati);
+        uint64_t fine;
+        ssize_t letti;
+        size_t pos = 0;
+        int n = 0;
+        int i;
+
+        if (fstat(c->fd, &st) < 0 || (uint64_t)st.st_size <= da) {
+            return;
+        }
+        letti = leggi_tratto(c->fd, dati, sizeof(dati), da);
+        if (letti < DIMENSIONE_RECORD) {
+            return;
+        }
+
+        // Un tratto rovinato si salta un byte alla volta, fino alla firma di un record valido
+        fine = da;
+        while (pos + DIMENSIONE_RECORD <= (size_t)letti) {
+            if (record_valido(dati + pos, &esiti[n])) {
+                n++;
+                pos += DIMENSIONE_RECORD;
+                fine = da + pos;
+            } else {
+                pos++;
+            }
+        }
+        // I byte non validi in fondo al file possono essere una write ancora in corso: restano per dopo,
+        // a meno che il file non continui oltre il tratto letto
+        if (da + (uint64_t)letti < (uint64_t)st.st_size && fine < da + pos) {
+            fine = da + pos;
+        }
+        if (fine == da) {
+            return;
+        }
+        if (!atomic_compare_exchange_strong(&c->testata->indicizzati, &da, fine)) {
+            continue; // Un altro processo ha preso questo tratto
+        }
+        for (i = 0; i < n; i++) {
+            somma_partita(c, &esiti[i]);
+        }
+    }
+}
+
+// Totali dell'indice
+uint64_t classifica_partite(const Classifica* c, uint64_t* vinte) {
+    if (vinte != NULL) {
+        *vinte = atomic_load(&c->testata->vinte);
+    }
+    return atomic_load(&c->testata->partite);
+}
+
+// Scorre tutte le voci tenendo le prime n in ordine (n e' piccolo)
+int classifica_migliori(const Classifica* c, Voce_classifica* voci, int n) {
+    Voce_classifica voce;
+    int trovate = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < CLASSIFICA_VOCI_MAX; i++) {
+        if (atomic_load(&c->voci[i].stato) != VOCE_PRONTA || atomic_load(&c->voci[i].vittorie) == 0) {
+            continue;
+        }
+        copia_voce(&c->voci[i], &voce);
+        if (trovate == n && (n == 0 || !viene_prima(&voce, &voci[n - 1]))) {
+            continue;
+        }
+        j = trovate < n ? trovate++ : n - 1;
+        while (j > 0 && viene_prima(&voce, &voci[j - 1])) {
+            voci[j] = voci[j - 1];
+            j--;
+        }
+        voci[j] = voce;
+    }
+    return trovate;
+}
+
+// Cerca il vincitore nella tabella hash dell'indice
+int classifica_giocatore(const Classifica* c, const char* nome, Voce_classifica* voce) {
+    const Voce_indice* v = voce_vincitore(c, nome, 0);
+
+    if (v == NULL || atomic_load(&v->vittorie) == 0) {
+        return 0;
+    }
+    copia_voce(v, voce);
+    return 1;
+}
+
+// Legge solo la coda del file, con un record in piu' per ritrovare l'inizio dei record dopo un tratto rovinato
+int classifica_ultime(const Classifica* c, Esito_partita* esiti, int n) {
+    struct stat st;
+    unsigned char* dati;
+    Esito_partita* trovati;
+    size_t dimensione;
+    ssize_t letti;
+    size_t pos = 0;
+    int num_trovati = 0;
+    int i;
+
+    if (n <= 0 || fstat(c->fd, &st) < 0) {
+        return 0;
+    }
+    dimensione = (size_t)(n + 1) * DIMENSIONE_RECORD;
+    if (dimensione > (size_t)st.st_size) {
+        dimensione = (size_t)st.st_size;
+    }
+    dati    = (unsigned char*)malloc(dimensione + 1);
+    trovati = (Esito_partita*)malloc((size_t)(n + 1) * sizeof(Esito_partita));
+    if (dati == NULL || trovati == NULL) {
+        free(dati);
+        free(trovati);
+        return 0;
+    }
+    letti = leggi_tratto(c->fd, dati, dimensione, (uint64_t)st.st_size - dimensione);
+    while (letti > 0 && pos + DIMENSIONE_RECORD <= (size_t)letti) {
+        if (record_valido(dati + pos, &trovati[num_trovati])) {
+            num_trovati++;
+            pos += DIMENSIONE_RECORD;
+        } else {
+            pos++;
+        }
+    }
+    for (i = 0; i < n && i < num_trovati; i++) {
+        esiti[i] = trovati[num_trovati - 1 - i];
+    }
+    free(dati);
+    free(trovati);
+    return i;
+}
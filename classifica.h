@@ -0,0 +1,89 @@
+#ifndef CLASSIFICA_H
+#define CLASSIFICA_H
+
+#include <stdint.h>
+#include "registro.h"
+
+/* ============================================================================
+ * CLASSIFICA PERSISTENTE DELLE PARTITE
+ *
+ * Ogni partita conclusa diventa un record di dimensione fissa in un file di
+ * soli accodamenti: vincitore (vuoto se sono caduti tutti), round giocati,
+ * morti e statistiche e zaino del vincitore alla fine. Il file e' aperto in
+ * O_APPEND e ogni record parte con una sola write, quindi piu' processi
+ * possono registrare partite nello stesso file senza lock: il kernel
+ * assegna a ogni write la sua posizione in fondo. Firma e CRC32 di ogni
+ * record fanno scartare quelli scritti a meta' da un crash.
+ *
+ * Accanto al file sta un indice (percorso + ".indice") mappato con mmap e
+ * condiviso da tutti i processi: una tabella hash a indirizzamento aperto
+ * con vittorie, record di round e ultima vittoria di ogni vincitore, piu'
+ * il totale delle partite. L'indice avanza con classifica_aggiorna: chi la
+ * chiama legge i record nuovi, si prende il tratto letto con un
+ * compare-and-swap sui byte gia' indicizzati e somma i record con
+ * operazioni atomiche, quindi due processi non contano mai due volte lo
+ * stesso record e nessuno aspetta l'altro. Se l'indice si perde o si
+ * rovina viene ricostruito dal file delle partite.
+ * ============================================================================ */
+
+/* File della classifica se non ne viene indicato un altro */
+#define CLASSIFICA_PREDEFINITA  "cosestrane.classifica"
+
+/* Vincitori diversi che l'indice puo' contare (potenza di 2) */
+#define CLASSIFICA_VOCI_MAX     16384
+
+// Partita conclusa, come viene registrata
+typedef struct {
+    int64_t quando;                      /* Ora della fine (secondi dall'epoca) */
+    char vincitore[NOME_MAX];            /* Nome del vincitore, vuoto se sono caduti tutti */
+    uint32_t turni;                      /* Round giocati */
+    uint16_t giocatori;                  /* Giocatori all'inizio */
+    uint16_t morti;                      /* Giocatori caduti */
+    int16_t attacco_psichico;            /* Statistiche finali del vincitore */
+    int16_t difesa_psichica;
+    int16_t fortuna;
+    int16_t punti_vita;
+    uint8_t zaino[ZAINO_SLOT_MAX];       /* Oggetti nello zaino del vincitore (NESSUN_OGGETTO = slot vuoto) */
+} Esito_partita;
+
+// Risultati di un vincitore secondo l'indice
+typedef struct {
+    char nome[NOME_MAX];
+    uint32_t vittorie;
+    uint32_t miglior_turni;              /* Meno round impiegati per vincere */
+    int64_t ultima_vittoria;             /* Ora dell'ultima vittoria */
+} Voce_classifica;
+
+// Classifica aperta; definita in classifica.c
+typedef struct Classifica Classifica;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//apre il file della classifica (NULL per CLASSIFICA_PREDEFINITA) e il suo indice, creandoli se non
+//esistono; NULL in caso di errore
+Classifica* classifica_apri(const char* percorso);
+
+//chiude la classifica; i record gia' registrati restano nel file
+void classifica_chiudi(Classifica* c);
+
+//accoda una partita conclusa al file; 0 se riuscito, -1 in caso di errore
+int classifica_registra(Classifica* c, const Esito_partita* esito);
+
+//porta l'indice alla fine del file, sommando le partite registrate da tutti i processi
+void classifica_aggiorna(Classifica* c);
+
+//partite contate dall'indice; in *vinte, se non e' NULL, quelle con un vincitore
+uint64_t classifica_partite(const Classifica* c, uint64_t* vinte);
+
+//riempie voci con i primi n vincitori per vittorie (a parita', meno round); restituisce quanti ne ha scritti
+int classifica_migliori(const Classifica* c, Voce_classifica* voci, int n);
+
+//cerca un vincitore nell'indice; 1 se trovato, 0 se non ha mai vinto
+int classifica_giocatore(const Classifica* c, const char* nome, Voce_classifica* voce);
+
+//riempie esiti con le ultime n partite del file, dalla piu' recente; restituisce quante ne ha scritte
+int classifica_ultime(const Classifica* c, Esito_partita* esiti, int n);
+
+#endif
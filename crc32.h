@@ -0,0 +1,22 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * CRC32
+ *
+ * Il CRC32 (polinomio 0xEDB88320) con cui salvataggi, classifica e cronaca
+ * controllano i propri record. La tabella e' costante e gia' calcolata,
+ * quindi si puo' usare da piu' thread senza inizializzazione.
+ * ============================================================================ */
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//aggiorna il CRC dei byte precedenti (0 per il primo blocco) con n byte
+uint32_t crc32_aggiorna(uint32_t crc, const unsigned char* dati, size_t n);
+
+#endif
@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "cronaca.h"
+
+/* Firma all'inizio di ogni blocco ("CEV1") */
+#define FIRMA_BLOCCO        0x31564543u
+
+/* Byte dell'intestazione di un blocco: firma, lunghezza, CRC32, eventi */
+#define INTESTAZIONE        16
+
+/* Byte al massimo di un varint a 64 bit */
+#define VARINT_MAX          10
+
+/* Byte al massimo di una colonna codificata: con le ripetizioni due varint per evento */
+#define COLONNA_MAX         (2 * VARINT_MAX * EVENTI_BLOCCO)
+
+/* Byte al massimo del contenuto di un blocco */
+#define CONTENUTO_MAX       (1 + NUM_COLONNE * (1 + VARINT_MAX + COLONNA_MAX))
+
+/* Nanosecondi dopo cui un blocco non pieno si spedisce comunque, al prossimo evento */
+#define ETA_MASSIMA_NS      1000000000LL
+
+// Codifiche di una colonna
+typedef enum {
+    CODIFICA_VALORI = 0,                 /* Ogni valore, varint con zigzag */
+    CODIFICA_DIFFERENZE,                 /* Differenza dal valore precedente, varint con zigzag */
+    CODIFICA_RIPETIZIONI,                /* Coppie valore (varint con zigzag) e ripetizioni (varint) */
+    NUM_CODIFICHE
+} Codifica_colonna;
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Eventi di un thread in attesa di essere scritti, gia' divisi in colonne
+typedef struct Blocco_cronaca {
+    int64_t colonne[NUM_COLONNE][EVENTI_BLOCCO];
+    int eventi;
+    struct Blocco_cronaca* succ;         /* Blocco successivo nella coda o tra quelli liberi */
+} Blocco_cronaca;
+
+// Posto di un thread: il blocco che sta riempiendo
+typedef struct Thread_cronaca {
+    Blocco_cronaca* blocco;              /* NULL finche' il thread non registra un evento */
+    struct Thread_cronaca* succ;         /* Thread registrato prima */
+} Thread_cronaca;
+
+/* ============================================================================
+ * VARIABILI GLOBALI
+ * ============================================================================ */
+
+int cronaca_attiva = 0;
+
+/* Posto del thread corrente, registrato al primo evento e mai liberato */
+static _Thread_local Thread_cronaca* thread_corrente = NULL;
+
+/* Posti di tutti i thread, protetti da mutex */
+static Thread_cronaca* threads = NULL;
+
+static int fd_cronaca = -1;
+static pthread_t scrittore;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sveglia = PTHREAD_COND_INITIALIZER;   /* C'e' un blocco da scrivere o bisogna terminare */
+static Blocco_cronaca* coda_testa = NULL;                   /* Blocchi pieni, dal piu' vecchio */
+static Blocco_cronaca* coda_fondo = NULL;
+static int blocchi_in_coda = 0;
+static Blocco_cronaca* liberi = NULL;                       /* Blocchi gia' scritti, da riempire di nuovo */
+static int termina = 0;
+static uint64_t eventi_scartati = 0;
+
+/* Memoria del thread di scrittura: il blocco codificato e due colonne di prova */
+static unsigned char* codificato = NULL;
+static unsigned char* prova = NULL;
+static unsigned char* migliore = NULL;
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Scrive un intero a 32 bit little endian
+ * @param dati Destinazione (4 byte)
+ * @param valore Intero
+ */
+static void metti_u32(unsigned char* dati, uint32_t valore) {
+    dati[0] = (unsigned char)valore;
+    dati[1] = (unsigned char)(valore >> 8);
+    dati[2] = (unsigned char)(valore >> 16);
+    dati[3] = (unsigned char)(valore >> 24);
+}
+
+/**
+ * Legge un intero a 32 bit little endian
+ * @param dati Sorgente (4 byte)
+ * @return Intero
+ */
+static uint32_t prendi_u32(const unsigned char* dati) {
+    return (uint32_t)dati[0] | (uint32_t)dati[1] << 8 | (uint32_t)dati[2] << 16 | (uint32_t)dati[3] << 24;
+}
+
+/**
+ * Scrive un varint (7 bit per byte, il bit alto dice che ne segue un altro)
+ * @param dati Destinazione (almeno VARINT_MAX byte)
+ * @param valore Intero
+ * @return Byte scritti
+ */
+static size_t metti_varint(unsigned char* dati, uint64_t valore) {
+    size_t n = 0;
+
+    while (valore >= 0x80) {
+        dati[n++] = (unsigned char)(valore | 0x80);
+        valore >>= 7;
+    }
+    dati[n++] = (unsigned char)valore;
+    return n;
+}
+
+/**
+ * Legge un varint
+ * @param dati Posizione di lettura, avanzata dopo il varint
+ * @param fine Fine dei dati leggibili
+ * @param valore Intero letto
+ * @return 1 se riuscito, 0 se il varint e' troncato o troppo lungo
+ */
+static int prendi_varint(const unsigned char** dati, const unsigned char* fine, uint64_t* valore) {
+    const unsigned char* d = *dati;
+    uint64_t v = 0;
+    int spostamento = 0;
+
+    while (d < fine && spostamento < 64) {
+        v |= (uint64_t)(*d & 0x7F) << spostamento;
+        if ((*d++ & 0x80) == 0) {
+            *dati   = d;
+            *valore = v;
+            return 1;
+        }
+        spostamento += 7;
+    }
+    return 0;
+}
+
+/**
+ * Trasforma un intero con segno in uno senza segno piccolo se il valore e' vicino a zero
+ * @param valore Intero (come bit di un int64_t)
+ * @return 0, -1, 1, -2... diventano 0, 1, 2, 3...
+ */
+static uint64_t zigzag(uint64_t valore) {
+    return (valore << 1) ^ (0 - (valore >> 63));
+}
+
+/**
+ * Inverso di zigzag
+ * @param valore Intero codificato
+ * @return Intero originale (come bit di un int64_t)
+ */
+static uint64_t dezigzag(uint64_t valore) {
+    return (valore >> 1) ^ (0 - (valore & 1));
+}
+
+/**
+ * Codifica una colonna di un blocco
+ * @param valori Valori della colonna
+ * @param n Numero di valori
+ * @param codifica Codifica da usare
+ * @param dati Destinazione (almeno COLONNA_MAX byte)
+ * @return Byte scritti
+ */
+static size_t codifica(const int64_t* valori, int n, Codifica_colonna codifica, unsigned char* dati) {
+    uint64_t precedente = 0;
+    size_t lunghezza = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < n; i = j) {
+        j = i + 1;
+        switch (codifica) {
+            case CODIFICA_VALORI:
+                lunghezza += metti_varint(dati + lunghezza, zigzag((uint64_t)valori[i]));
+                break;
+            case CODIFICA_DIFFERENZE:
+                lunghezza += metti_varint(dati + lunghezza, zigzag((uint64_t)valori[i] - precedente));
+                precedente = (uint64_t)valori[i];
+                break;
+            default:
+                while (j < n && valori[j] == valori[i]) {
+                    j++;
+                }
+                lunghezza += metti_varint(dati + lunghezza, zigzag((uint64_t)valori[i]));
+                lunghezza += metti_varint(dati + lunghezza, (uint64_t)(j - i));
+                break;
+        }
+    }
+    return lunghezza;
+}
+
+/**
+ * Decodifica una colonna di un blocco
+ * @param dati Colonna codificata
+ * @param fine Fine della colonna
+ * @param codifica Codifica della colonna
+ * @param valori Valori decodificati
+ * @param n Numero di valori attesi
+ * @return 1 se la colonna contiene esattamente n valori, 0 altrimenti
+ */
+static int decodifica(const unsigned char* dati, const unsigned char* fine, int codifica, int64_t* valori, int n) {
+    uint64_t precedente = 0;
+    uint64_t v;
+    uint64_t ripetizioni;
+    int i = 0;
+
+    while (dati < fine) {
+        if (i >= n || !prendi_varint(&dati, fine, &v)) {
+            return 0;
+        }
+        v = dezigzag(v);
+        switch (codifica) {
+            case CODIFICA_VALORI:
+                valori[i++] = (int64_t)v;
+                break;
+            case CODIFICA_DIFFERENZE:
+                precedente += v;
+                valori[i++] = (int64_t)precedente;
+                break;
+            case CODIFICA_RIPETIZIONI:
+                if (!prendi_varint(&dati, fine, &ripetizioni) || ripetizioni == 0 || ripetizioni > (uint64_t)(n - i)) {
+                    return 0;
+                }
+                while (ripetizioni-- > 0) {
+                    valori[i++] = (int64_t)v;
+                }
+                break;
+            default:
+                return 0;
+        }
+    }
+    return i == n;
+}
+
+/**
+ * Codifica un blocco: per ogni colonna la codifica piu' corta
+ * @param b Blocco con almeno un evento
+ * @return Byte del blocco codificato in codificato, intestazione compresa
+ */
+static size_t codifica_blocco(const Blocco_cronaca* b) {
+    size_t lunghezza = INTESTAZIONE;
+    int colonna;
+
+    codificato[lunghezza++] = NUM_COLONNE;
+    for (colonna = 0; colonna < NUM_COLONNE; colonna++) {
+        Codifica_colonna scelta = CODIFICA_VALORI;
+        size_t corta = codifica(b->colonne[colonna], b->eventi, CODIFICA_VALORI, migliore);
+        int c;
+
+        for (c = CODIFICA_VALORI + 1; c < NUM_CODIFICHE; c++) {
+            size_t n = codifica(b->colonne[colonna], b->eventi, (Codifica_colonna)c, prova);
+
+            if (n < corta) { // Si tiene la prova come migliore e si riusa l'altra memoria
+                unsigned char* scambio = migliore;
+
+                migliore = prova;
+                prova    = scambio;
+                corta    = n;
+                scelta   = (Codifica_colonna)c;
+            }
+        }
+        codificato[lunghezza++] = (unsigned char)scelta;
+        lunghezza += metti_varint(codificato + lunghezza, corta);
+        memcpy(codificato + lunghezza, migliore, corta);
+        lunghezza += corta;
+    }
+
+    metti_u32(codificato, FIRMA_BLOCCO);
+    metti_u32(codificato + 4, (uint32_t)(lunghezza - INTESTAZIONE));
+    metti_u32(codificato + 8, crc32_aggiorna(0, codificato + INTESTAZIONE, lunghezza - INTESTAZIONE));
+    metti_u32(codificato + 12, (uint32_t)b->eventi);
+    return lunghezza;
+}
+
+/**
+ * Scrive tutti i byte sul file, ripetendo le write interrotte o parziali
+ * @param fd File
+ * @param dati Byte
+ * @param n Numero di byte
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int scrivi_tutto(int fd, const unsigned char* dati, size_t n) {
+    while (n > 0) {
+        ssize_t scritti = write(fd, dati, n);
+
+        if (scritti < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        dati += scritti;
+        n    -= (size_t)scritti;
+    }
+    return 0;
+}
+
+/**
+ * Ciclo del thread di scrittura: codifica e scrive i blocchi in coda, finche' non resta niente da scrivere
+ * dopo la chiusura. Un blocco che il disco rifiuta va perso, con un messaggio
+ * @param arg Non usato
+ * @return NULL
+ */
+static void* ciclo_scrittore(void* arg) {
+    Blocco_cronaca* b;
+    size_t n;
+
+    (void)arg;
+    pthread_mutex_lock(&mutex);
+    while (1) {
+        while (coda_testa == NULL && !termina) {
+            pthread_cond_wait(&sveglia, &mutex);
+        }
+        if (coda_testa == NULL) {
+            break;
+        }
+        b          = coda_testa;
+        coda_testa = b->succ;
+        if (coda_testa == NULL) {
+            coda_fondo = NULL;
+        }
+        blocchi_in_coda--;
+        pthread_mutex_unlock(&mutex);
+
+        n = codifica_blocco(b);
+        if (scrivi_tutto(fd_cronaca, codificato, n) < 0) {
+            perror("cronaca");
+        }
+
+        pthread_mutex_lock(&mutex);
+        b->eventi = 0;
+        b->succ   = liberi;
+        liberi    = b;
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/**
+ * Mette un blocco in fondo alla coda del thread di scrittura e lo sveglia (con mutex preso)
+ * @param b Blocco con almeno un evento
+ */
+static void accoda_blocco(Blocco_cronaca* b) {
+    b->succ = NULL;
+    if (coda_fondo != NULL) {
+        coda_fondo->succ = b;
+    } else {
+        coda_testa = b;
+    }
+    coda_fondo = b;
+    blocchi_in_coda++;
+    pthread_cond_signal(&sveglia);
+}
+
+/**
+ * Consegna al thread di scrittura il blocco di un thread e gliene da' uno vuoto
+ * Se la coda e' piena, o non c'e' memoria per un blocco nuovo, gli eventi del blocco si scartano
+ * e il thread continua a riempire lo stesso blocco
+ * @param b Blocco del thread, NULL se non ne ha ancora uno
+ * @return Blocco vuoto da riempire, NULL se non c'e' memoria
+ */
+static Blocco_cronaca* consegna_blocco(Blocco_cronaca* b) {
+    Blocco_cronaca* nuovo;
+
+    pthread_mutex_lock(&mutex);
+    nuovo = liberi;
+    if (nuovo != NULL) {
+        liberi = nuovo->succ;
+    } else if (b == NULL || blocchi_in_coda < CRONACA_CODA_MAX) {
+        nuovo = (Blocco_cronaca*)malloc(sizeof(Blocco_cronaca));
+    }
+    if (b != NULL) {
+        if (nuovo == NULL || blocchi_in_coda >= CRONACA_CODA_MAX) {
+            eventi_scartati += (uint64_t)b->eventi;
+            if (nuovo != NULL) {
+                nuovo->succ = liberi;
+                liberi      = nuovo;
+            }
+            nuovo = b;
+        } else {
+            accoda_blocco(b);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (nuovo != NULL) {
+        nuovo->eventi = 0;
+    }
+    return nuovo;
+}
+
+/**
+ * Posto del thread corrente, registrato al primo uso
+ * @return Posto del thread, NULL se non c'e' memoria
+ */
+static Thread_cronaca* posto_thread(void) {
+    Thread_cronaca* t = thread_corrente;
+
+    if (t == NULL) {
+        t = (Thread_cronaca*)calloc(1, sizeof(Thread_cronaca));
+        if (t == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&mutex);
+        t->succ = threads;
+        threads = t;
+        pthread_mutex_unlock(&mutex);
+        thread_corrente = t;
+    }
+    return t;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+// Apre il file della cronaca e avvia il thread di scrittura
+int cronaca_apri(const char* percorso) {
+    if (cronaca_attiva) {
+        return -1;
+    }
+    codificato = (unsigned char*)malloc(INTESTAZIONE + CONTENUTO_MAX);
+    prova      = (unsigned char*)malloc(COLONNA_MAX);
+    migliore   = (unsigned char*)malloc(COLONNA_MAX);
+    fd_cronaca = open(percorso, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (codificato == NULL || prova == NULL || migliore == NULL || fd_cronaca < 0) {
+        if (fd_cronaca < 0) {
+            perror(percorso);
+        } else {
+            close(fd_cronaca);
+            fd_cronaca = -1;
+        }
+        free(codificato);
+        free(prova);
+        free(migliore);
+        return -1;
+    }
+    termina = 0;
+    if (pthread_create(&scrittore, NULL, ciclo_scrittore, NULL) != 0) {
+        close(fd_cronaca);
+        fd_cronaca = -1;
+        free(codificato);
+        free(prova);
+        free(migliore);
+        return -1;
+    }
+    cronaca_attiva = 1;
+    return 0;
+}
+
+// Scrive i blocchi di tutti i thread, ferma il thread di scrittura e chiude il file
+void cronaca_chiudi(void) {
+    Thread_cronaca* t;
+    Blocco_cronaca* b;
+
+    if (!cronaca_attiva) {
+        return;
+    }
+    cronaca_attiva = 0;
+
+    pthread_mutex_lock(&mutex);
+    for (t = threads; t != NULL; t = t->succ) { // Gli ultimi blocchi si scrivono anche oltre CRONACA_CODA_MAX
+        if (t->blocco != NULL && t->blocco->eventi > 0) {
+            accoda_blocco(t->blocco);
+        } else if (t->blocco != NULL) {
+            t->blocco->succ = liberi;
+            liberi          = t->blocco;
+        }
+        t->blocco = NULL;
+    }
+    termina = 1;
+    pthread_cond_signal(&sveglia);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(scrittore, NULL);
+
+    while (liberi != NULL) {
+        b      = liberi;
+        liberi = b->succ;
+        free(b);
+    }
+    if (eventi_scartati > 0) {
+        fprintf(stderr, "Cronaca: %llu eventi scartati perche' il disco non teneva il passo\n",
+                (unsigned long long)eventi_scartati);
+        eventi_scartati = 0;
+    }
+    close(fd_cronaca);
+    fd_cronaca = -1;
+    free(codificato);
+    free(prova);
+    free(migliore);
+    codificato = NULL;
+    prova      = NULL;
+    migliore   = NULL;
+}
+
+// Aggiunge un evento al blocco del thread corrente
+void cronaca_scrivi(Evento_cronaca* e) {
+    Thread_cronaca* t;
+    Blocco_cronaca* b;
+    struct timespec adesso;
+    int i;
+
+    if (!cronaca_attiva || (t = posto_thread()) == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &adesso);
+    e->tempo = (int64_t)adesso.tv_sec * 1000000000LL + adesso.tv_nsec;
+
+    b = t->blocco;
+    if (b == NULL || (b->eventi > 0 && e->tempo - b->colonne[COLONNA_TEMPO][0] > ETA_MASSIMA_NS)) {
+        b = t->blocco = consegna_blocco(b);
+        if (b == NULL) {
+            return;
+        }
+    }
+
+    i = b->eventi;
+    b->colonne[COLONNA_TEMPO][i]     = e->tempo;
+    b->colonne[COLONNA_SESSIONE][i]  = (int64_t)e->sessione;
+    b->colonne[COLONNA_TIPO][i]      = e->tipo;
+    b->colonne[COLONNA_TURNO][i]     = e->turno;
+    b->colonne[COLONNA_GIOCATORE][i] = e->giocatore;
+    b->colonne[COLONNA_MONDO][i]     = e->mondo;
+    b->colonne[COLONNA_ZONA][i]      = e->zona;
+    b->colonne[COLONNA_A][i]         = e->a;
+    b->colonne[COLONNA_B][i]         = e->b;
+    b->colonne[COLONNA_C][i]         = e->c;
+    b->colonne[COLONNA_D][i]         = e->d;
+    b->eventi = i + 1;
+    if (b->eventi == EVENTI_BLOCCO) {
+        t->blocco = consegna_blocco(b);
+    }
+}
+
+// Consegna al thread di scrittura il blocco non pieno del thread corrente
+void cronaca_spedisci(void) {
+    Thread_cronaca* t = thread_corrente;
+
+    if (cronaca_attiva && t != NULL && t->blocco != NULL && t->blocco->eventi > 0) {
+        t->blocco = consegna_blocco(t->blocco);
+    }
+}
+
+// Legge tutti i blocchi validi del file
+long cronaca_leggi(const char* percorso, Lettore_cronaca leggi, void* contesto) {
+    int64_t (*colonne)[EVENTI_BLOCCO];
+    const unsigned char* dati;
+    struct stat info;
+    size_t dimensione;
+    size_t pos = 0;
+    long letti = 0;
+    int fd = open(percorso, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    dimensione = (size_t)info.st_size;
+    if (dimensione == 0) {
+        close(fd);
+        return 0;
+    }
+    dati = (const unsigned char*)mmap(NULL, dimensione, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    colonne = (int64_t (*)[EVENTI_BLOCCO])calloc(NUM_COLONNE, sizeof(*colonne));
+    if (dati == MAP_FAILED || colonne == NULL) {
+        if (dati != MAP_FAILED) {
+            munmap((void*)dati, dimensione);
+        }
+        free(colonne);
+        return -1;
+    }
+
+    while (pos + INTESTAZIONE <= dimensione) {
+        const unsigned char* d = dati + pos + INTESTAZIONE;
+        const unsigned char* fine;
+        size_t lunghezza = prendi_u32(dati + pos + 4);
+        uint32_t eventi = prendi_u32(dati + pos + 12);
+        uint64_t n;
+        int valido;
+        int num_colonne;
+        int colonna;
+        uint32_t i;
+
+        if (prendi_u32(dati + pos) != FIRMA_BLOCCO || lunghezza > dimensione - pos - INTESTAZIONE
+            || eventi == 0 || eventi > EVENTI_BLOCCO || crc32_aggiorna(0, d, lunghezza) != prendi_u32(dati + pos + 8)) {
+            pos++; // Blocco rovinato: si cerca la firma del prossimo
+            continue;
+        }
+        fine        = d + lunghezza;
+        num_colonne = d < fine ? *d++ : 0;
+        valido      = 1;
+        memset(colonne, 0, NUM_COLONNE * sizeof(*colonne));
+        for (colonna = 0; colonna < num_colonne && valido; colonna++) { // Colonne sconosciute si saltano
+            int tipo_codifica = d < fine ? *d++ : -1;
+
+            valido = tipo_codifica >= 0 && prendi_varint(&d, fine, &n) && n <= (uint64_t)(fine - d);
+            if (valido && colonna < NUM_COLONNE) {
+                valido = decodifica(d, d + n, tipo_codifica, colonne[colonna], (int)eventi);
+            }
+            if (valido) {
+                d += n;
+            }
+        }
+        if (!valido) {
+            pos++;
+            continue;
+        }
+
+        for (i = 0; i < eventi; i++) {
+            Evento_cronaca e;
+
+            e.tempo     = colonne[COLONNA_TEMPO][i];
+            e.sessione  = (uint64_t)colonne[COLONNA_SESSIONE][i];
+            e.tipo      = (int32_t)colonne[COLONNA_TIPO][i];
+            e.turno     = (int32_t)colonne[COLONNA_TURNO][i];
+            e.giocatore = (int32_t)colonne[COLONNA_GIOCATORE][i];
+            e.mondo     = (int32_t)colonne[COLONNA_MONDO][i];
+            e.zona      = (int32_t)colonne[COLONNA_ZONA][i];
+            e.a         = (int32_t)colonne[COLONNA_A][i];
+            e.b         = (int32_t)colonne[COLONNA_B][i];
+            e.c         = (int32_t)colonne[COLONNA_C][i];
+            e.d         = (int32_t)colonne[COLONNA_D][i];
+            leggi(contesto, &e);
+        }
+        letti += (long)eventi;
+        pos   += INTESTAZIONE + lunghezza;
+    }
+
+    munmap((void*)dati, dimensione);
+    free(colonne);
+    return letti;
+}
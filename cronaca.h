@@ -0,0 +1,107 @@
+#ifndef CRONACA_H
+#define CRONACA_H
+
+#include <stdint.h>
+
+/* ============================================================================
+ * CRONACA DELLE PARTITE (EVENTI PER L'ANALISI)
+ *
+ * Un flusso di eventi tipizzati (inizio partita, mosse, tiri di portale,
+ * colpi dei combattimenti, oggetti raccolti e usati, morti, fine della
+ * partita) per analizzare le partite in blocco senza leggere il testo.
+ *
+ * Ogni thread riempie un suo blocco di EVENTI_BLOCCO eventi, gia' diviso in
+ * colonne: registrare un evento sono poche store, senza lock. Un blocco
+ * pieno (o con il primo evento piu' vecchio di un secondo) passa a un
+ * thread di scrittura, che codifica ogni colonna nel modo piu' corto tra
+ * valori, differenze dal precedente e ripetizioni (varint con zigzag) e
+ * accoda il blocco al file con una sola write in O_APPEND. Se il disco non
+ * tiene il passo i blocchi oltre CRONACA_CODA_MAX vengono scartati, e
+ * contati, invece di far aspettare il gioco.
+ *
+ * Il file e' una sequenza di blocchi indipendenti, ognuno con firma,
+ * lunghezza, numero di eventi e CRC32: piu' processi possono scrivere nello
+ * stesso file, e un blocco rovinato da un crash si salta.
+ *
+ * Formato di un blocco (interi little endian):
+ *   u32 firma "CEV1", u32 byte del contenuto, u32 CRC32 del contenuto,
+ *   u32 eventi, poi il contenuto: u8 numero di colonne e per ogni colonna
+ *   u8 codifica, varint byte della colonna, dati della colonna.
+ * ============================================================================ */
+
+/* Eventi di un blocco */
+#define EVENTI_BLOCCO      4096
+
+/* Blocchi in attesa del thread di scrittura oltre i quali si scartano */
+#define CRONACA_CODA_MAX   32
+
+// Tipi di evento
+typedef enum {
+    CRONACA_INIZIO = 1,                  /* a = giocatori, b = zone del Mondo Reale */
+    CRONACA_MOSSA,                       /* a = +1 avanti, -1 indietro; mondo e zona di arrivo */
+    CRONACA_PORTALE,                     /* a = dado (0 verso il Soprasotto), b = fortuna, c = 1 se riuscito; mondo e zona dopo */
+    CRONACA_COMBATTIMENTO,               /* a = nemico, b = PV, c = attacco, d = difesa del nemico */
+    CRONACA_ATTACCO,                     /* a = 1 base, 2 potenziato, b = dado del giocatore, c = dado del nemico, d = danno */
+    CRONACA_CONTRATTACCO,                /* a = 1 se in difesa, b = dado del nemico, c = dado del giocatore, d = danno */
+    CRONACA_RACCOLTA,                    /* a = oggetto, b = slot */
+    CRONACA_USO,                         /* a = oggetto, b = slot */
+    CRONACA_MORTE,                       /* a = nemico */
+    CRONACA_VITTORIA,                    /* a = nemico finale, b = PV rimasti */
+    CRONACA_SCONFITTA                    /* Tutti i giocatori caduti; a = giocatori */
+} Tipo_cronaca;
+
+// Colonne di un blocco, nell'ordine del file
+typedef enum {
+    COLONNA_TEMPO = 0,                   /* Nanosecondi dall'epoca */
+    COLONNA_SESSIONE,
+    COLONNA_TIPO,
+    COLONNA_TURNO,
+    COLONNA_GIOCATORE,
+    COLONNA_MONDO,
+    COLONNA_ZONA,
+    COLONNA_A,
+    COLONNA_B,
+    COLONNA_C,
+    COLONNA_D,
+    NUM_COLONNE
+} Colonna_cronaca;
+
+// Un evento
+typedef struct {
+    int64_t tempo;                       /* Nanosecondi dall'epoca (lo mette cronaca_scrivi) */
+    uint64_t sessione;                   /* Identificativo della partita */
+    int32_t tipo;                        /* Tipo_cronaca */
+    int32_t turno;                       /* Round della partita */
+    int32_t giocatore;                   /* Indice del giocatore, -1 se nessuno */
+    int32_t mondo;                       /* Tipo_mondo del giocatore, -1 se nessuno */
+    int32_t zona;                        /* Tipo_zona in cui si trova il giocatore, -1 se nessuna */
+    int32_t a, b, c, d;                  /* Valori del tipo di evento */
+} Evento_cronaca;
+
+/* 1 mentre la cronaca e' aperta */
+extern int cronaca_attiva;
+
+// Funzione chiamata da cronaca_leggi per ogni evento, nell'ordine del file
+typedef void (*Lettore_cronaca)(void* contesto, const Evento_cronaca* e);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//apre (o crea) il file della cronaca e avvia il thread di scrittura; 0 se riuscito, -1 in caso di errore
+int cronaca_apri(const char* percorso);
+
+//scrive gli eventi rimasti nei blocchi dei thread e chiude il file; va chiamata quando i thread hanno smesso di giocare
+void cronaca_chiudi(void);
+
+//registra un evento del thread corrente (solo con la cronaca aperta)
+void cronaca_scrivi(Evento_cronaca* e);
+
+//affida al thread di scrittura il blocco del thread corrente anche se non e' pieno (per esempio quando il server e' fermo)
+void cronaca_spedisci(void);
+
+//passa a leggi tutti gli eventi dei blocchi validi del file, saltando quelli rovinati;
+//restituisce il numero di eventi letti, -1 se il file non si puo' leggere
+long cronaca_leggi(const char* percorso, Lettore_cronaca leggi, void* contesto);
+
+#endif
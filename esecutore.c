@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esecutore.h"
+
+#define LINEA_CACHE          64
+#define GIRI_PRIMA_DI_DORMIRE 256   /* Tentativi a vuoto prima di addormentarsi */
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Coda a doppia estremita' di Chase-Lev: il proprietario inserisce e preleva
+// dal fondo, gli altri lavoratori rubano dalla cima. In piu' una pila senza
+// lock raccoglie i compiti inviati da altri thread.
+typedef struct {
+    _Alignas(LINEA_CACHE) _Atomic int64_t cima;
+    _Alignas(LINEA_CACHE) _Atomic int64_t fondo;
+    _Alignas(LINEA_CACHE) _Atomic(Compito*) in_arrivo;
+    _Alignas(LINEA_CACHE) _Atomic(Compito*) posti[ESECUTORE_CAPACITA_CODA];
+} Coda_lavoro;
+
+typedef struct {
+    Coda_lavoro coda;
+    Esecutore* esecutore;
+    int indice;
+    uint64_t rng;                        /* Per scegliere la vittima dei furti */
+    pthread_t thread;
+} Lavoratore;
+
+struct Esecutore {
+    Lavoratore* lavoratori;
+    int n;
+    int avviati;
+    _Alignas(LINEA_CACHE) _Atomic long pendenti;      /* Compiti inviati e non ancora conclusi */
+    _Alignas(LINEA_CACHE) _Atomic unsigned long epoca; /* Cresce a ogni invio, sveglia chi dorme */
+    _Atomic int dormienti;
+    _Atomic int termina;
+    _Atomic unsigned prossimo;                       /* Distribuzione dei compiti senza preferenza */
+    pthread_mutex_t mutex;
+    pthread_cond_t sveglia;
+    pthread_cond_t finito;
+};
+
+/* Lavoratore che esegue il thread corrente (NULL fuori dall'esecutore) */
+static _Thread_local Lavoratore* lavoratore_corrente = NULL;
+
+/* ============================================================================
+ * CODA DI LAVORO
+ * ============================================================================ */
+
+/**
+ * Inserisce un compito in fondo alla coda (solo il proprietario)
+ * @param q Coda del lavoratore
+ * @param c Compito
+ * @return 1 se inserito, 0 se la coda e' piena
+ */
+static int coda_inserisci(Coda_lavoro* q, Compito* c) {
+    int64_t b = atomic_load_explicit(&q->fondo, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->cima, memory_order_acquire);
+
+    if (b - t >= ESECUTORE_CAPACITA_CODA) {
+        return 0;
+    }
+    atomic_store_explicit(&q->posti[b & (ESECUTORE_CAPACITA_CODA - 1)], c, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->fondo, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * Preleva l'ultimo compito inserito (solo il proprietario)
+ * @param q Coda del lavoratore
+ * @return Compito prelevato, NULL se la coda e' vuota
+ */
+static Compito* coda_preleva(Coda_lavoro* q) {
+    int64_t b = atomic_load_explicit(&q->fondo, memory_order_relaxed) - 1;
+    int64_t t;
+    Compito* c = NULL;
+
+    atomic_store_explicit(&q->fondo, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&q->cima, memory_order_relaxed);
+
+    if (t <= b) {
+        c = atomic_load_explicit(&q->posti[b & (ESECUTORE_CAPACITA_CODA - 1)], memory_order_relaxed);
+        if (t == b) { // Ultimo elemento: si contende con i ladri
+            if (!atomic_compare_exchange_strong_explicit(&q->cima, &t, t + 1,
+                                                         memory_order_seq_cst, memory_order_relaxed)) {
+                c = NULL;
+            }
+            atomic_store_explicit(&q->fondo, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&q->fondo, b + 1, memory_order_relaxed);
+    }
+    return c;
+}
+
+/**
+ * Ruba il compito piu' vecchio dalla cima della coda di un altro lavoratore
+ * @param q Coda della vittima
+ * @return Compito rubato, NULL se la coda e' vuota o il furto e' fallito
+ */
+static Compito* coda_ruba(Coda_lavoro* q) {
+    int64_t t = atomic_load_explicit(&q->cima, memory_order_acquire);
+    int64_t b;
+    Compito* c;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&q->fondo, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    c = atomic_load_explicit(&q->posti[t & (ESECUTORE_CAPACITA_CODA - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->cima, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * Aggiunge un compito alla pila dei compiti in arrivo (qualsiasi thread)
+ * @param q Coda del lavoratore destinatario
+ * @param c Compito
+ */
+static void coda_consegna(Coda_lavoro* q, Compito* c) {
+    Compito* testa = atomic_load_explicit(&q->in_arrivo, memory_order_relaxed);
+
+    do {
+        c->succ = testa;
+    } while (!atomic_compare_exchange_weak_explicit(&q->in_arrivo, &testa, c,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Sposta nella coda del lavoratore i compiti in arrivo prelevati da q
+ * La pila viene presa tutta insieme, quindi non ci sono problemi ABA
+ * @param w Lavoratore che riceve i compiti
+ * @param q Coda da cui prendere i compiti in arrivo (la propria o di una vittima)
+ * @return 1 se e' stato spostato almeno un compito
+ */
+static int raccogli_in_arrivo(Lavoratore* w, Coda_lavoro* q) {
+    Compito* c = atomic_exchange_explicit(&q->in_arrivo, NULL, memory_order_acquire);
+    int preso = c != NULL;
+
+    while (c != NULL) {
+        Compito* succ = c->succ;
+        if (!coda_inserisci(&w->coda, c)) { // Coda piena: il resto torna in arrivo
+            while (c != NULL) {
+                succ = c->succ;
+                coda_consegna(&w->coda, c);
+                c = succ;
+            }
+            break;
+        }
+        c = succ;
+    }
+    return preso;
+}
+
+/* ============================================================================
+ * LAVORATORI
+ * ============================================================================ */
+
+/**
+ * Cerca un compito rubandolo agli altri lavoratori, partendo da una vittima a caso
+ * @param w Lavoratore che cerca lavoro
+ * @param anche_in_arrivo 1 per prendere anche i compiti in arrivo destinati agli altri
+ * @return Compito trovato o NULL
+ */
+static Compito* cerca_lavoro(Lavoratore* w, int anche_in_arrivo) {
+    Esecutore* es = w->esecutore;
+    int inizio;
+    int k;
+
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    inizio = (int)(w->rng % (uint64_t)es->n);
+
+    for (k = 0; k < es->n; k++) {
+        Lavoratore* vittima = &es->lavoratori[(inizio + k) % es->n];
+        Compito* c;
+
+        if (vittima == w) {
+            continue;
+        }
+        c = coda_ruba(&vittima->coda);
+        if (c != NULL) {
+            return c;
+        }
+        if (anche_in_arrivo && raccogli_in_arrivo(w, &vittima->coda)) {
+            return coda_preleva(&w->coda);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Esegue un compito e aggiorna il conteggio dei compiti pendenti
+ * @param w Lavoratore che lo esegue
+ * @param c Compito
+ */
+static void esegui_compito(Lavoratore* w, Compito* c) {
+    Esecutore* es = w->esecutore;
+
+    c->lavoratore = w->indice;
+    c->esegui(c);
+
+    if (atomic_fetch_sub(&es->pendenti, 1) == 1) { // Era l'ultimo: sveglia chi attende
+        pthread_mutex_lock(&es->mutex);
+        pthread_cond_broadcast(&es->finito);
+        pthread_mutex_unlock(&es->mutex);
+    }
+}
+
+/**
+ * Ciclo di un lavoratore: coda propria, poi compiti in arrivo, poi furti, poi sonno
+ * @param arg Lavoratore
+ * @return NULL
+ */
+static void* ciclo_lavoratore(void* arg) {
+    Lavoratore* w = (Lavoratore*)arg;
+    Esecutore* es = w->esecutore;
+    int a_vuoto = 0;
+
+    lavoratore_corrente = w;
+
+    while (!atomic_load_explicit(&es->termina, memory_order_acquire)) {
+        unsigned long epoca = atomic_load(&es->epoca);
+        Compito* c = coda_preleva(&w->coda);
+
+        if (c == NULL && raccogli_in_arrivo(w, &w->coda)) {
+            c = coda_preleva(&w->coda);
+        }
+        if (c == NULL) { // I compiti in arrivo altrui si rubano solo dopo un giro a vuoto, per rispettare l'affinita'
+            c = cerca_lavoro(w, a_vuoto > 0);
+        }
+
+        if (c != NULL) {
+            esegui_compito(w, c);
+            a_vuoto = 0;
+            continue;
+        }
+
+        if (++a_vuoto < GIRI_PRIMA_DI_DORMIRE) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&es->mutex);
+        atomic_fetch_add(&es->dormienti, 1);
+        while (atomic_load(&es->epoca) == epoca && !atomic_load(&es->termina)) {
+            pthread_cond_wait(&es->sveglia, &es->mutex);
+        }
+        atomic_fetch_sub(&es->dormienti, 1);
+        pthread_mutex_unlock(&es->mutex);
+        a_vuoto = 0;
+    }
+    return NULL;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+void compito_inizializza(Compito* c, void (*esegui)(Compito* c)) {
+    c->esegui     = esegui;
+    c->lavoratore = -1;
+    c->succ       = NULL;
+}
+
+Esecutore* esecutore_crea(int n) {
+    Esecutore* es;
+    size_t dimensione;
+    int i;
+
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n <= 0) {
+        n = 1;
+    }
+    if (n > ESECUTORE_MAX_LAVORATORI) {
+        n = ESECUTORE_MAX_LAVORATORI;
+    }
+
+    es = (Esecutore*)aligned_alloc(LINEA_CACHE, (sizeof(Esecutore) + LINEA_CACHE - 1) / LINEA_CACHE * LINEA_CACHE);
+    if (es == NULL) {
+        return NULL;
+    }
+    memset(es, 0, sizeof(Esecutore));
+
+    dimensione = (size_t)n * sizeof(Lavoratore);
+    es->lavoratori = (Lavoratore*)aligned_alloc(LINEA_CACHE, (dimensione + LINEA_CACHE - 1) / LINEA_CACHE * LINEA_CACHE);
+    if (es->lavoratori == NULL) {
+        free(es);
+        return NULL;
+    }
+    memset(es->lavoratori, 0, dimensione);
+
+    es->n = n;
+    pthread_mutex_init(&es->mutex, NULL);
+    pthread_cond_init(&es->sveglia, NULL);
+    pthread_cond_init(&es->finito, NULL);
+
+    for (i = 0; i < n; i++) {
+        Lavoratore* w = &es->lavoratori[i];
+        w->esecutore = es;
+        w->indice    = i;
+        w->rng       = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+    }
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&es->lavoratori[i].thread, NULL, ciclo_lavoratore, &es->lavoratori[i]) != 0) {
+            break;
+        }
+        es->avviati++;
+    }
+    if (es->avviati < n) {
+        esecutore_distruggi(es);
+        return NULL;
+    }
+    return es;
+}
+
+void esecutore_distruggi(Esecutore* es) {
+    int i;
+
+    if (es == NULL) {
+        return;
+    }
+    if (es->avviati == es->n) {
+        esecutore_attendi(es);
+    }
+
+    pthread_mutex_lock(&es->mutex);
+    atomic_store(&es->termina, 1);
+    pthread_cond_broadcast(&es->sveglia);
+    pthread_mutex_unlock(&es->mutex);
+
+    for (i = 0; i < es->avviati; i++) {
+        pthread_join(es->lavoratori[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&es->finito);
+    pthread_cond_destroy(&es->sveglia);
+    pthread_mutex_destroy(&es->mutex);
+    free(es->lavoratori);
+    free(es);
+}
+
+int esecutore_lavoratori(const Esecutore* es) {
+    return es != NULL ? es->n : 0;
+}
+
+void esecutore_invia(Esecutore* es, Compito* c) {
+    Lavoratore* w = lavoratore_corrente;
+
+    atomic_fetch_add(&es->pendenti, 1);
+
+    if (w != NULL && w->esecutore == es && (c->lavoratore < 0 || c->lavoratore == w->indice)) {
+        if (!coda_inserisci(&w->coda, c)) {
+            coda_consegna(&w->coda, c);
+        }
+    } else { // Torna al lavoratore che lo ha eseguito l'ultima volta
+        int destinatario = c->lavoratore;
+        if (destinatario < 0 || destinatario >= es->n) {
+            destinatario = (int)(atomic_fetch_add_explicit(&es->prossimo, 1, memory_order_relaxed) % (unsigned)es->n);
+        }
+        coda_consegna(&es->lavoratori[destinatario].coda, c);
+    }
+
+    atomic_fetch_add(&es->epoca, 1);
+    if (atomic_load(&es->dormienti) > 0) {
+        pthread_mutex_lock(&es->mutex);
+        pthread_cond_broadcast(&es->sveglia);
+        pthread_mutex_unlock(&es->mutex);
+    }
+}
+
+void esecutore_attendi(Esecutore* es) {
+    pthread_mutex_lock(&es->mutex);
+    while (atomic_load(&es->pendenti) != 0) {
+        pthread_cond_wait(&es->finito, &es->mutex);
+    }
+    pthread_mutex_unlock(&es->mutex);
+}
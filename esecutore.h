@@ -0,0 +1,54 @@
+#ifndef ESECUTORE_H
+#define ESECUTORE_H
+
+/* ============================================================================
+ * ESECUTORE A FURTO DI LAVORO
+ *
+ * Un gruppo di thread lavoratori esegue compiti pronti (turni dei bot, blocchi
+ * di simulazione, eventi delle sessioni). Ogni lavoratore ha la sua coda a
+ * doppia estremita': prende dal fondo i compiti propri e, quando resta senza
+ * lavoro, ruba dalla cima delle code degli altri.
+ *
+ * Un compito rimesso in coda torna al lavoratore che lo ha eseguito l'ultima
+ * volta, cosi' i dati della sessione restano nella sua cache.
+ * ============================================================================ */
+
+/* Posti nella coda di ciascun lavoratore (potenza di 2) */
+#define ESECUTORE_CAPACITA_CODA   4096
+
+/* Numero massimo di lavoratori */
+#define ESECUTORE_MAX_LAVORATORI   256
+
+typedef struct Esecutore Esecutore;
+
+// Un compito da eseguire: va incluso nella struttura dati della sessione e
+// deve restare valido finche' non e' stato eseguito
+typedef struct Compito {
+    void (*esegui)(struct Compito* c);  /* Funzione da chiamare */
+    int lavoratore;                     /* Ultimo lavoratore che lo ha eseguito, -1 se nessuno */
+    struct Compito* succ;               /* Uso interno (coda dei compiti in arrivo) */
+} Compito;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//prepara un compito che chiamera' esegui, senza preferenza di lavoratore
+void compito_inizializza(Compito* c, void (*esegui)(Compito* c));
+
+//avvia n lavoratori (0 = uno per core), restituisce NULL in caso di errore
+Esecutore* esecutore_crea(int n);
+
+//attende i compiti ancora in coda, ferma i lavoratori e libera l'esecutore
+void esecutore_distruggi(Esecutore* e);
+
+//restituisce il numero di lavoratori
+int esecutore_lavoratori(const Esecutore* e);
+
+//mette in coda un compito; puo' essere chiamata da qualsiasi thread, anche da dentro un compito
+void esecutore_invia(Esecutore* e, Compito* c);
+
+//attende che tutti i compiti inviati finora (e quelli che generano) siano stati eseguiti
+void esecutore_attendi(Esecutore* e);
+
+#endif
@@ -1,39 +1,254 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include "classifica.h"
+#include "cronaca.h"
 #include "gamelib.h"
+#include "generatore.h"
+#include "giornale.h"
+#include "mappa_condivisa.h"
+#include "messaggi.h"
+#include "metriche.h"
+#include "ramo.h"
+#include "registro.h"
+#include "schermo.h"
+
+/* ============================================================================
+ * STRUTTURE DATI INTERNE
+ * ============================================================================ */
+
+// Stati della macchina a stati della partita: indicano che tipo di input la partita sta aspettando
+typedef enum {
+    STATO_INATTIVA,                      /* Nessun input atteso */
+    STATO_MENU_PRINCIPALE,               /* Sessione remota: attende una scelta dal menu principale */
+
+    /* Impostazione (imposta_gioco) */
+    STATO_NUMERO_GIOCATORI,
+    STATO_NOME_GIOCATORE,
+    STATO_ABILITA_GIOCATORE,
+    STATO_MENU_MAPPA,
+    STATO_INSERISCI_POSIZIONE,
+    STATO_INSERISCI_TIPO,
+    STATO_INSERISCI_NEMICO,
+    STATO_INSERISCI_OGGETTO,
+    STATO_CANCELLA_POSIZIONE,
+    STATO_SCELTA_MAPPA,
+    STATO_STAMPA_ZONA_POSIZIONE,
+
+    /* Turni di gioco (gioca) */
+    STATO_AZIONE,                        /* Attende una scelta dal menu del turno (1-9) */
+    STATO_COMBATTIMENTO,                 /* Attende un'azione di combattimento (1-4) */
+    STATO_ZAINO,                         /* Attende lo slot dell'oggetto da usare */
+
+    STATO_CHIUSA                         /* Sessione remota terminata */
+} Stato_partita;
+
+// Buffer in cui si accumula il testo prodotto da una partita
+typedef struct {
+    char* dati;
+    size_t lunghezza;
+    size_t capacita;
+} Buffer_testo;
+
+// Zaino di un giocatore: i bit di occupati segnano gli slot pieni, cosi' il
+// primo slot libero si trova con una sola istruzione, e conteggio dice quanti
+// oggetti di ogni tipo contiene senza scorrere gli slot
+typedef struct {
+    uint32_t occupati;                   /* Bit i a 1 = slot i pieno */
+    uint32_t effetti_attivi;             /* Bit t a 1 = effetto non cumulabile del tipo t in corso */
+    uint8_t slot[ZAINO_SLOT_MAX];        /* Tipo_oggetto di ogni slot */
+    uint8_t conteggio[OGGETTI_MAX];      /* Oggetti per tipo */
+    int16_t attacco_temporaneo;          /* Bonus da togliere alla fine del combattimento */
+    int16_t difesa_temporanea;
+    int16_t fortuna_temporanea;
+} Zaino;
+
+// Posto della coda degli eventi: il numero di sequenza dice se e' libero o pieno
+typedef struct {
+    _Atomic unsigned int sequenza;
+    Evento_turno evento;
+} Posto_evento;
+
+// Coda limitata con piu' produttori e un consumatore. Il posto i e' libero per
+// la posizione pos quando sequenza + i == pos e pieno quando sequenza + i == pos + 1:
+// lo scostamento di i rende valida la coda azzerata, senza inizializzazione.
+typedef struct {
+    _Atomic unsigned int coda;               /* Prossima posizione da scrivere (produttori) */
+    unsigned int testa;                      /* Prossima posizione da leggere (consumatore) */
+    Posto_evento posti[CODA_EVENTI_MAX];
+} Coda_eventi;
+
+// Tipi di modifica registrati nel diario delle mosse
+typedef enum {
+    DELTA_POSIZIONE,                     /* Mondo, zona e occupante precedente prima di uno spostamento */
+    DELTA_STATISTICHE,                   /* Attacco, difesa, fortuna e PV */
+    DELTA_EFFETTI,                       /* Effetti attivi e bonus temporanei dello zaino */
+    DELTA_SLOT,                          /* Oggetto in uno slot dello zaino */
+    DELTA_NEMICO,                        /* Nemico tolto da una zona */
+    DELTA_OGGETTO,                       /* Oggetto tolto da una zona del Mondo Reale */
+    DELTA_MORTE,                         /* Giocatore tolto dai vivi: occupante precedente, posto e chi lo ha preso */
+    DELTA_ORDINE                         /* Ordine del round prima di mescolarne uno nuovo */
+} Tipo_delta;
+
+// Modifica reversibile dello stato: contiene solo cio' che serve a rimettere il valore di prima
+typedef struct {
+    uint8_t tipo;                        /* Tipo_delta */
+    uint8_t mondo;                       /* Mondo della posizione o della zona */
+    int16_t valori[4];                   /* Statistiche, bonus temporanei, o slot e oggetto */
+    int giocatore;                       /* Giocatore toccato (DELTA_ORDINE: lunghezza dell'ordine) */
+    uint32_t extra;                      /* Effetti attivi (DELTA_ORDINE: inizio dell'ordine salvato) */
+    void* zona;                          /* Posizione precedente o zona modificata */
+} Delta_partita;
+
+// Stato all'inizio di un turno, a cui riporta il riavvolgimento
+typedef struct {
+    size_t delta;                        /* Modifiche registrate prima del turno */
+    size_t ordini;                       /* Interi degli ordini salvati prima del turno */
+    uint64_t rng;
+    int turno;
+    int idx_turno;
+    int num_vivi_round;
+    int giocatore_corrente;
+    Stato_partita stato_ritorno;         /* Resti dell'ultimo combattimento, che fanno parte delle istantanee */
+    Tipo_nemico nemico;
+    int hp_nemico;
+    int attacco_nemico;
+    int difesa_nemico;
+} Segno_turno;
+
+// Diario delle mosse della partita in corso: annullare N turni costa quanto le loro modifiche
+typedef struct {
+    Delta_partita* delta;
+    size_t num_delta;
+    size_t capacita_delta;
+    Segno_turno* segni;                  /* Un segno per ogni turno iniziato */
+    size_t num_segni;
+    size_t capacita_segni;
+    int* ordini;                         /* Ordini dei round sostituiti, per DELTA_ORDINE */
+    size_t num_ordini;
+    size_t capacita_ordini;
+    int guasto;                          /* 1 se una registrazione e' fallita per mancanza di memoria */
+} Diario_partita;
+
+// Testo di stampa_mappa per un mondo: ogni zona formattata a parte e la mappa intera gia' composta
+typedef struct {
+    char** zone;                         /* Testo di ogni zona nell'ordine della mappa, NULL se da riformattare */
+    int num_zone;
+    int capacita_zone;
+    int attiva;                          /* 1 se zone segue la lista del mondo, 0 se la cache e' vuota */
+    Buffer_testo mappa;                  /* Mappa intera, come la scrive stampa_mappa */
+    int mappa_valida;
+} Mappa_stampata;
+
+// Stato completo di una partita: mappe, giocatori e punto in cui si trova il turno
+struct Partita {
+    Zona_mondoreale* prima_zona_mondoreale;  /* Mappa del Mondo Reale */
+    Zona_soprasotto* prima_zona_soprasotto;  /* Mappa del Soprasotto */
+    Giocatore* giocatori;                    /* Tabella dei giocatori, allocata in un blocco unico */
+    char (*nomi)[NOME_MAX];                  /* Nomi dei giocatori, separati dai dati di gioco */
+    Zaino* zaini;                            /* Zaini dei giocatori, con lo stesso indice */
+    int dimensione_zaino;                    /* Posti di ogni zaino, fissati alla creazione */
+    int num_giocatori;
+    int* vivi;                               /* Indici dei giocatori vivi, in ordine qualsiasi */
+    int* posto_vivo;                         /* Posizione di ogni giocatore in vivi, -1 se morto */
+    int num_vivi;
+    int* occupante_succ;                     /* Lista dei giocatori nella stessa zona (-1 = fine) */
+    int* occupante_prec;
+    const Mappa_condivisa* mappa_condivisa;  /* Mappa del giorno usata al posto di una propria, o NULL */
+    Modifiche_mappa* modifiche;              /* Cambiamenti della sessione alla mappa condivisa in uso */
+    int mappa_chiusa;
+    int gioco_impostato;
+    Mappa_stampata stampe[2];                /* Testo delle mappe per mondo, per stampa_mappa */
+
+    /* Macchina a stati */
+    Stato_partita stato;
+    Stato_partita stato_ritorno;             /* Stato a cui tornare dopo la scelta dallo zaino */
+    int con_menu;                            /* 1 per le sessioni remote, che tornano al menu principale */
+
+    /* Impostazione in corso */
+    int giocatore_in_impostazione;
+    int undici_disponibile;
+    int input_posizione;                     /* Valori raccolti per inserire una zona */
+    int input_tipo;
+    int input_nemico;
+
+    /* Turni di gioco */
+    int turno;                               /* Numero del round corrente */
+    int* ordine_turno;                       /* Ordine mescolato del round corrente */
+    int idx_turno;
+    int num_vivi_round;                      /* Fisso per tutto il round */
+    int giocatore_corrente;
+    int nemico_presente;
+    int mossa_effettuata;
+    int appena_mosso_con_nemico;
+
+    /* Combattimento in corso */
+    Tipo_nemico nemico;
+    int hp_nemico;
+    int attacco_nemico;
+    int difesa_nemico;
+
+    uint64_t rng;                            /* Stato del generatore xorshift64* dei dadi */
+    Diario_partita diario;                   /* Modifiche dei turni giocati, per annullarli */
+
+    Coda_eventi eventi;                      /* Azioni di turno in attesa */
+    Buffer_testo uscita;                     /* Testo in attesa di essere consegnato */
+    int messaggi_compatti;                   /* L'uscita e' fatta di messaggi compatti (messaggi.h) */
+    uint64_t messaggi_definiti[MESSAGGI_MAX / 64];  /* Identificativi gia' definiti al client */
+    uint64_t sessione;                       /* Identificativo della partita nelle tracce delle metriche */
+};
 
 /* ============================================================================
  * VARIABILI GLOBALI STATICHE
  * ============================================================================ */
 
-/* Puntatori alle mappe dei due mondi */
-static Zona_mondoreale* prima_zona_mondoreale = NULL;
-static Zona_soprasotto* prima_zona_soprasotto = NULL;
+/* Partita giocata dal menu principale (imposta_gioco, gioca, termina_gioco) */
+static Partita partita_console;
+
+/* Identificativo dell'ultima partita creata */
+static _Atomic uint64_t ultima_sessione = 0;
 
-/* Array dei giocatori attivi */
-static Giocatore* giocatori[4] = {NULL, NULL, NULL, NULL};
+/* Classifica in cui si registrano le partite concluse, NULL se non disponibile */
+static Classifica* classifica_gioco = NULL;
 
-/* Contatori e flag di stato */
-static int num_giocatori = 0;
-static int mappa_chiusa  = 0;
-static int gioco_impostato = 0;
+/* Schermo a pannelli della partita da console, NULL per il testo che scorre */
+static Schermo* schermo_console = NULL;
 
-/* Statistiche di gioco */
-static char ultimo_vincitore[3][NOME_MAX] = {"Nessuno", "Nessuno", "Nessuno"};
-static int partite_giocate = 0;
+static void torna_al_menu(Partita* p);
+static void annuncia_turno(Partita* p);
 
 /* ============================================================================
  * FUNZIONI DI UTILITA' GENERALI
  * ============================================================================ */
 
+/**
+ * Estrae un numero casuale con il generatore della partita, che fa parte
+ * del suo stato: riavvolgendo un turno si riavvolgono anche i dadi
+ * @param p Partita
+ * @param n Numero di valori possibili
+ * @return Numero casuale tra 0 e n-1 (inclusi)
+ */
+static int estrai(Partita* p, int n) {
+    uint64_t x = p->rng;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    p->rng = x;
+    return (int)((((x * 0x2545F4914F6CDD1DULL) >> 32) * (uint64_t)(unsigned int)n) >> 32);
+}
+
 /**
  * Lancia un dado da 20 facce
+ * @param p Partita
  * @return Numero casuale tra 1 e 20 (inclusi)
  */
-static int lancia_dado(void) {
-    return (rand() % 20) + 1;
+static int lancia_dado(Partita* p) {
+    return estrai(p, 20) + 1;
 }
 
 /**
@@ -60,16 +275,10 @@ static const char* tipo_zona_to_string(Tipo_zona tipo) {
 /**
  * Converte un tipo di nemico in stringa leggibile
  * @param tipo Il tipo di nemico da convertire
- * @return Stringa descrittiva del tipo di nemico
+ * @return Nome del nemico nel registro
  */
 static const char* tipo_nemico_to_string(Tipo_nemico tipo) {
-    switch (tipo) {
-        case NESSUN_NEMICO: return "Nessun nemico";
-        case BILLI:         return "Billi";
-        case DEMOCANE:      return "Democane";
-        case DEMOTORZONE:   return "Demotorzone";
-        default:            return "Sconosciuto";
-    }
+    return registro_nome_nemico((int)tipo);
 }
 
 /**
@@ -78,27 +287,54 @@ static const char* tipo_nemico_to_string(Tipo_nemico tipo) {
  * @return Stringa descrittiva del tipo di oggetto
  */
 static const char* tipo_oggetto_to_string(Tipo_oggetto tipo) {
-    switch (tipo) {
-        case NESSUN_OGGETTO:         return "Nessun oggetto";
-        case BICICLETTA:             return "Bicicletta";
-        case MAGLIETTA_FUOCOINFERNO: return "Maglietta Fuocoinferno";
-        case BUSSOLA:                return "Bussola";
-        case SCHITARRATA_METALLICA:  return "Schitarrata Metallica";
-        default:                     return "Sconosciuto";
-    }
+    return registro_nome_oggetto((int)tipo);
 }
 
 /* ============================================================================
  * FUNZIONI DI CONTEGGIO
  * ============================================================================ */
 
+/**
+ * Registra un evento nella cronaca delle partite, se e' aperta
+ * @param p Partita
+ * @param g Giocatore dell'evento, NULL se riguarda la partita
+ * @param tipo Tipo di evento
+ * @param a Primo valore del tipo di evento (cronaca.h)
+ * @param b Secondo valore
+ * @param c Terzo valore
+ * @param d Quarto valore
+ */
+static void racconta(const Partita* p, const Giocatore* g, Tipo_cronaca tipo, int a, int b, int c, int d) {
+    Evento_cronaca e;
+
+    if (!cronaca_attiva) {
+        return;
+    }
+    e.sessione  = p->sessione;
+    e.tipo      = (int32_t)tipo;
+    e.turno     = p->turno;
+    e.giocatore = g != NULL ? (int32_t)(g - p->giocatori) : -1;
+    e.mondo     = g != NULL ? (int32_t)g->mondo : -1;
+    e.zona      = -1;
+    if (g != NULL && g->mondo == MONDO_REALE && g->pos_mondoreale != NULL) {
+        e.zona = (int32_t)g->pos_mondoreale->tipo;
+    } else if (g != NULL && g->mondo == SOPRASOTTO && g->pos_soprasotto != NULL) {
+        e.zona = (int32_t)g->pos_soprasotto->tipo;
+    }
+    e.a = a;
+    e.b = b;
+    e.c = c;
+    e.d = d;
+    cronaca_scrivi(&e);
+}
+
 /**
  * Conta il numero totale di zone nella mappa del Mondo Reale
  * @return Numero di zone presenti
  */
-static int conta_zone_mondoreale(void) {
+static int conta_zone_mondoreale(Partita* p) {
     int count = 0;
-    Zona_mondoreale* current = prima_zona_mondoreale;
+    Zona_mondoreale* current = p->prima_zona_mondoreale;
 
     while (current != NULL) {
         count++;
@@ -109,15 +345,15 @@ static int conta_zone_mondoreale(void) {
 }
 
 /**
- * Conta il numero di Demotorzone presenti nella mappa del Soprasotto
- * @return Numero di Demotorzone trovati (deve essere esattamente 1)
+ * Conta il numero di nemici finali (Demotorzone) presenti nella mappa del Soprasotto
+ * @return Numero di nemici finali trovati (deve essere esattamente 1)
  */
-static int conta_demotorzone(void) {
+static int conta_demotorzone(Partita* p) {
     int count = 0;
-    Zona_soprasotto* current = prima_zona_soprasotto;
+    Zona_soprasotto* current = p->prima_zona_soprasotto;
 
     while (current != NULL) {
-        if (current->nemico == DEMOTORZONE) {
+        if (registro_nemico(current->nemico)->finale) {
             count++;
         }
         current = current->avanti;
@@ -131,68 +367,136 @@ static int conta_demotorzone(void) {
  * ============================================================================ */
 
 /**
- * Genera un tipo di nemico casuale per il Mondo Reale
- * Probabilita': 40% nessuno, 30% Democane, 30% Billi
+ * Genera un tipo di nemico casuale per il Soprasotto
+ * Se deve_avere_demotorzone e' true, genera sempre il nemico finale del registro
+ * Altrimenti usa i pesi del registro (predefiniti: 50% nessuno, 50% Democane)
+ * @param deve_avere_demotorzone Flag per forzare la generazione del Demotorzone
  * @return Tipo di nemico generato
  */
-static Tipo_nemico genera_nemico_mondoreale(void) {
-    int prob = rand() % 100;
-
-    if (prob < PROB_NESSUN_NEMICO_MR) {
-        return NESSUN_NEMICO;
-    } else if (prob < PROB_NESSUN_NEMICO_MR + PROB_DEMOCANE_MR) {
-        return DEMOCANE;
-    } else {
-        return BILLI;
+static Tipo_nemico genera_nemico_soprasotto(int deve_avere_demotorzone) {
+    if (deve_avere_demotorzone) {
+        return (Tipo_nemico)registro_nemico_finale();
     }
+    return (Tipo_nemico)registro_estrai_nemico(SOPRASOTTO);
 }
 
+/* ============================================================================
+ * TESTO DELLE MAPPE IN CACHE
+ *
+ * stampa_mappa scrive il testo gia' composto della mappa; chi cambia una
+ * zona invalida solo la sua voce (e la mappa intera), chi inserisce o
+ * cancella una zona sposta le voci successive. Le voci non contengono il
+ * numero della zona, quindi uno spostamento non le invalida.
+ * ============================================================================ */
+
 /**
- * Genera un tipo di nemico casuale per il Soprasotto
- * Se deve_avere_demotorzone e' true, genera sempre un Demotorzone
- * Altrimenti: 50% nessuno, 50% Democane
- * @param deve_avere_demotorzone Flag per forzare la generazione del Demotorzone
- * @return Tipo di nemico generato
+ * Svuota la cache del testo della mappa di un mondo
+ * @param st Testo della mappa
  */
-static Tipo_nemico genera_nemico_soprasotto(int deve_avere_demotorzone) {
-    int prob;
+static void svuota_mappa_stampata(Mappa_stampata* st) {
+    int i;
 
-    if (deve_avere_demotorzone) {
-        return DEMOTORZONE;
+    for (i = 0; i < st->num_zone; i++) {
+        free(st->zone[i]);
     }
+    free(st->zone);
+    free(st->mappa.dati);
+    memset(st, 0, sizeof(*st));
+}
+
+/**
+ * Svuota la cache del testo delle mappe di entrambi i mondi
+ * @param p Partita
+ */
+static void svuota_mappe_stampate(Partita* p) {
+    svuota_mappa_stampata(&p->stampe[MONDO_REALE]);
+    svuota_mappa_stampata(&p->stampe[SOPRASOTTO]);
+}
 
-    prob = rand() % 100;
+/**
+ * Invalida la voce di una zona nella cache del testo della mappa
+ * @param p Partita
+ * @param mondo Mondo della zona
+ * @param zona Zona cambiata
+ */
+static void invalida_zona_stampata(Partita* p, Tipo_mondo mondo, const void* zona) {
+    Mappa_stampata* st = &p->stampe[mondo];
+    int i = 0;
 
-    if (prob < PROB_NESSUN_NEMICO_SS) {
-        return NESSUN_NEMICO;
+    st->mappa_valida = 0;
+    if (!st->attiva) {
+        return;
+    }
+    if (mondo == MONDO_REALE) {
+        const Zona_mondoreale* mr;
+
+        for (mr = p->prima_zona_mondoreale; mr != NULL && mr != zona; mr = mr->avanti) {
+            i++;
+        }
     } else {
-        return DEMOCANE;
+        const Zona_soprasotto* ss;
+
+        for (ss = p->prima_zona_soprasotto; ss != NULL && ss != zona; ss = ss->avanti) {
+            i++;
+        }
+    }
+    if (i < st->num_zone) {
+        free(st->zone[i]);
+        st->zone[i] = NULL;
     }
 }
 
 /**
- * Genera un tipo di oggetto casuale
- * Probabilita':
- * - 50% nessuno
- * - 15% Bicicletta
- * - 15% Maglietta Fuocoinferno
- * - 10% Bussola
- * - 10% Schitarrata Metallica
- * @return Tipo di oggetto generato
+ * Fa posto nella cache del testo delle mappe a una zona appena inserita in entrambi i mondi
+ * @param p Partita
+ * @param indice Indice della nuova zona (da 0)
  */
-static Tipo_oggetto genera_oggetto(void) {
-    int prob = rand() % 100;
+static void zona_stampata_inserita(Partita* p, int indice) {
+    int m;
 
-    if (prob < PROB_NESSUN_OGGETTO) {
-        return NESSUN_OGGETTO;
-    } else if (prob < PROB_NESSUN_OGGETTO + PROB_BICICLETTA) {
-        return BICICLETTA;
-    } else if (prob < PROB_NESSUN_OGGETTO + PROB_BICICLETTA + PROB_MAGLIETTA) {
-        return MAGLIETTA_FUOCOINFERNO;
-    } else if (prob < PROB_NESSUN_OGGETTO + PROB_BICICLETTA + PROB_MAGLIETTA + PROB_BUSSOLA) {
-        return BUSSOLA;
-    } else {
-        return SCHITARRATA_METALLICA;
+    for (m = 0; m < 2; m++) {
+        Mappa_stampata* st = &p->stampe[m];
+
+        st->mappa_valida = 0;
+        if (!st->attiva) {
+            continue;
+        }
+        if (st->num_zone == st->capacita_zone) {
+            int nuova_capacita = st->capacita_zone > 0 ? st->capacita_zone * 2 : 16;
+            char** zone = (char**)realloc(st->zone, (size_t)nuova_capacita * sizeof(char*));
+
+            if (zone == NULL) { // Senza memoria la cache si ricostruisce da capo alla prossima stampa
+                svuota_mappe_stampate(p);
+                return;
+            }
+            metrica_allocazione((size_t)nuova_capacita * sizeof(char*));
+            st->zone          = zone;
+            st->capacita_zone = nuova_capacita;
+        }
+        memmove(st->zone + indice + 1, st->zone + indice, (size_t)(st->num_zone - indice) * sizeof(char*));
+        st->zone[indice] = NULL;
+        st->num_zone++;
+    }
+}
+
+/**
+ * Toglie dalla cache del testo delle mappe una zona appena cancellata da entrambi i mondi
+ * @param p Partita
+ * @param indice Indice della zona cancellata (da 0)
+ */
+static void zona_stampata_cancellata(Partita* p, int indice) {
+    int m;
+
+    for (m = 0; m < 2; m++) {
+        Mappa_stampata* st = &p->stampe[m];
+
+        st->mappa_valida = 0;
+        if (!st->attiva || indice >= st->num_zone) {
+            continue;
+        }
+        free(st->zone[indice]);
+        memmove(st->zone + indice, st->zone + indice + 1, (size_t)(st->num_zone - indice - 1) * sizeof(char*));
+        st->num_zone--;
     }
 }
 
@@ -202,91 +506,360 @@ static Tipo_oggetto genera_oggetto(void) {
 
 /**
  * Libera tutta la memoria allocata per le mappe dei due mondi
- * Attraversa entrambe le liste e dealloca tutte le zone
+ * Attraversa entrambe le liste e dealloca tutte le zone (di una mappa condivisa solo le modifiche)
  */
-static void libera_mappe(void) {
-    Zona_mondoreale* current_mr = prima_zona_mondoreale;
+static void libera_mappe(Partita* p) {
+    svuota_mappe_stampate(p);
+    if (p->modifiche != NULL) { // Mappa condivisa: si liberano solo le modifiche della sessione
+        modifiche_distruggi(p->modifiche);
+        p->modifiche             = NULL;
+        p->prima_zona_mondoreale = NULL;
+        p->prima_zona_soprasotto = NULL;
+        return;
+    }
+
+    Zona_mondoreale* current_mr = p->prima_zona_mondoreale;
     while (current_mr != NULL) {
         Zona_mondoreale* temp = current_mr;
         current_mr = current_mr->avanti;
         free(temp);
     }
-    prima_zona_mondoreale = NULL;
+    p->prima_zona_mondoreale = NULL;
 
-    Zona_soprasotto* current_ss = prima_zona_soprasotto;
+    Zona_soprasotto* current_ss = p->prima_zona_soprasotto;
     while (current_ss != NULL) {
         Zona_soprasotto* temp = current_ss;
         current_ss = current_ss->avanti;
         free(temp);
     }
-    prima_zona_soprasotto = NULL;
+    p->prima_zona_soprasotto = NULL;
 }
 
 /**
  * Libera tutta la memoria allocata per i giocatori
  * Resetta anche il contatore dei giocatori
  */
-static void libera_giocatori(void) {
+static void libera_giocatori(Partita* p) {
+    free(p->giocatori);
+    free(p->nomi);
+    free(p->zaini);
+    free(p->vivi); // posto_vivo, ordine_turno e le liste degli occupanti stanno nello stesso blocco
+    p->giocatori      = NULL;
+    p->nomi           = NULL;
+    p->zaini          = NULL;
+    p->vivi           = NULL;
+    p->posto_vivo     = NULL;
+    p->ordine_turno   = NULL;
+    p->occupante_succ = NULL;
+    p->occupante_prec = NULL;
+    p->num_giocatori = 0;
+    p->num_vivi      = 0;
+}
+
+/**
+ * Alloca la tabella per n giocatori, tutti vivi
+ * Giocatori, nomi, zaini e indici stanno in quattro soli blocchi, senza allocazioni
+ * per giocatore; la tabella dei giocatori parte da un inizio di linea di cache
+ * @param p Partita
+ * @param n Numero di giocatori
+ * @return 1 se l'allocazione e' riuscita, 0 altrimenti
+ */
+static int crea_giocatori(Partita* p, int n) {
+    size_t dimensione = ((size_t)n * sizeof(Giocatore) + 63) / 64 * 64;
     int i;
-    for (i = 0; i < 4; i++) {
-        if (giocatori[i] != NULL) {
-            free(giocatori[i]);
-            giocatori[i] = NULL;
+
+    libera_giocatori(p);
+    p->giocatori = (Giocatore*)aligned_alloc(64, dimensione);
+    p->nomi      = (char (*)[NOME_MAX])calloc((size_t)n, NOME_MAX);
+    p->zaini     = (Zaino*)calloc((size_t)n, sizeof(Zaino));
+    p->vivi      = (int*)malloc((size_t)n * 5 * sizeof(int));
+    if (p->giocatori == NULL || p->nomi == NULL || p->zaini == NULL || p->vivi == NULL) {
+        libera_giocatori(p);
+        return 0;
+    }
+    metrica_allocazione(dimensione + (size_t)n * (NOME_MAX + sizeof(Zaino) + 5 * sizeof(int)));
+    metrica_conta(METRICA_ALLOCAZIONI, 3); // Quattro blocchi in tutto
+    memset(p->giocatori, 0, dimensione);
+    p->posto_vivo   = p->vivi + n;
+    p->ordine_turno   = p->vivi + 2 * n;
+    p->occupante_succ = p->vivi + 3 * n;
+    p->occupante_prec = p->vivi + 4 * n;
+
+    for (i = 0; i < n; i++) {
+        p->vivi[i]           = i;
+        p->posto_vivo[i]     = i;
+        p->occupante_succ[i] = -1;
+        p->occupante_prec[i] = -1;
+    }
+    p->num_giocatori    = n;
+    p->num_vivi         = n;
+    p->dimensione_zaino = registro_dimensione_zaino();
+    return 1;
+}
+
+/**
+ * Restituisce il nome di un giocatore, conservato fuori dalla struttura Giocatore
+ * @param p Partita
+ * @param g Giocatore
+ * @return Nome del giocatore
+ */
+static char* nome_giocatore(Partita* p, const Giocatore* g) {
+    return p->nomi[g - p->giocatori];
+}
+
+/**
+ * Controlla se un giocatore e' ancora in gioco
+ * @param p Partita
+ * @param i Indice del giocatore
+ * @return 1 se vivo, 0 altrimenti
+ */
+static int giocatore_vivo(const Partita* p, int i) {
+    return p->posto_vivo[i] >= 0;
+}
+
+/**
+ * Toglie un giocatore morto dai vivi in tempo costante, scambiandolo con l'ultimo
+ * @param p Partita
+ * @param i Indice del giocatore
+ */
+static void rimuovi_giocatore(Partita* p, int i) {
+    int posto  = p->posto_vivo[i];
+    int ultimo = p->vivi[p->num_vivi - 1];
+
+    p->vivi[posto]       = ultimo;
+    p->posto_vivo[ultimo] = posto;
+    p->posto_vivo[i]     = -1;
+    p->num_vivi--;
+}
+
+/* ============================================================================
+ * USCITA DI TESTO E LETTURA INPUT
+ * ============================================================================ */
+
+/**
+ * Garantisce spazio nel buffer di uscita per altri n byte e il terminatore
+ * @param p Partita
+ * @param n Byte da aggiungere
+ * @return 0 se riuscito, -1 se la memoria non basta
+ */
+static int riserva_uscita(Partita* p, size_t n) {
+    Buffer_testo* b = &p->uscita;
+    size_t nuova_capacita = b->capacita > 0 ? b->capacita : 1024;
+    char* dati;
+
+    if (b->lunghezza + n + 1 <= b->capacita) {
+        return 0;
+    }
+    while (nuova_capacita < b->lunghezza + n + 1) {
+        nuova_capacita *= 2;
+    }
+
+    dati = (char*)realloc(b->dati, nuova_capacita);
+    if (dati == NULL) {
+        return -1;
+    }
+    metrica_allocazione(nuova_capacita);
+    b->dati     = dati;
+    b->capacita = nuova_capacita;
+    return 0;
+}
+
+/**
+ * Accoda all'uscita il messaggio compatto di un formato, preceduto dalla sua definizione al primo uso
+ * Se la tabella dei formati e' piena il testo si manda libero
+ * @param p Partita
+ * @param formato Stringa di formato come per printf
+ * @param args Argomenti del formato
+ */
+static void scrivi_compatto(Partita* p, const char* formato, va_list args) {
+    Buffer_testo* b = &p->uscita;
+    int id = messaggi_interna(formato);
+    va_list copia;
+    char* testo;
+    int n;
+
+    if (id < 0) {
+        va_copy(copia, args);
+        n = vsnprintf(NULL, 0, formato, copia);
+        va_end(copia);
+        if (n < 0 || (testo = (char*)malloc((size_t)n + 1)) == NULL) {
+            return;
         }
+        metrica_allocazione((size_t)n + 1);
+        vsnprintf(testo, (size_t)n + 1, formato, args);
+        n = messaggi_testo(NULL, 0, testo);
+        if (riserva_uscita(p, (size_t)n) == 0) {
+            b->lunghezza += (size_t)messaggi_testo(b->dati + b->lunghezza, b->capacita - b->lunghezza, testo);
+        }
+        free(testo);
+        return;
+    }
+
+    if (!(p->messaggi_definiti[id / 64] >> (id % 64) & 1)) {
+        n = messaggi_definizione(NULL, 0, id);
+        if (riserva_uscita(p, (size_t)n) < 0) {
+            return;
+        }
+        b->lunghezza += (size_t)messaggi_definizione(b->dati + b->lunghezza, b->capacita - b->lunghezza, id);
+        p->messaggi_definiti[id / 64] |= 1ULL << (id % 64);
+    }
+
+    va_copy(copia, args);
+    n = messaggi_codifica(b->dati != NULL ? b->dati + b->lunghezza : NULL, b->capacita - b->lunghezza, id, copia);
+    va_end(copia);
+    if (b->lunghezza + (size_t)n + 1 > b->capacita) { // Spazio insufficiente: ingrandisce il buffer e riscrive
+        if (riserva_uscita(p, (size_t)n) < 0) {
+            return;
+        }
+        messaggi_codifica(b->dati + b->lunghezza, b->capacita - b->lunghezza, id, args);
+    }
+    b->lunghezza += (size_t)n;
+}
+
+/**
+ * Accoda testo formattato all'uscita della partita
+ * Il testo resta nel buffer finche' il chiamante non lo legge con partita_uscita
+ * @param p Partita a cui appartiene il testo
+ * @param formato Stringa di formato come per printf
+ */
+static void scrivi(Partita* p, const char* formato, ...) {
+    Buffer_testo* b = &p->uscita;
+    va_list args;
+    int n;
+
+    if (p->messaggi_compatti) {
+        va_start(args, formato);
+        scrivi_compatto(p, formato, args);
+        va_end(args);
+        return;
+    }
+
+    va_start(args, formato);
+    n = vsnprintf(b->dati != NULL ? b->dati + b->lunghezza : NULL,
+                  b->capacita - b->lunghezza, formato, args);
+    va_end(args);
+
+    if (n < 0) {
+        return;
+    }
+
+    if (b->lunghezza + (size_t)n + 1 > b->capacita) { // Spazio insufficiente: ingrandisce il buffer e riscrive
+        if (riserva_uscita(p, (size_t)n) < 0) {
+            return;
+        }
+        va_start(args, formato);
+        vsnprintf(b->dati + b->lunghezza, b->capacita - b->lunghezza, formato, args);
+        va_end(args);
+    }
+
+    b->lunghezza += (size_t)n;
+}
+
+/**
+ * Accoda all'uscita un testo gia' pronto, con una sola copia
+ * @param p Partita
+ * @param testo Testo terminato da '\0'
+ * @param lunghezza Byte del testo
+ */
+static void scrivi_blocco(Partita* p, const char* testo, size_t lunghezza) {
+    Buffer_testo* b = &p->uscita;
+
+    if (p->messaggi_compatti) {
+        scrivi(p, "%s", testo);
+        return;
     }
-    num_giocatori = 0;
+    if (riserva_uscita(p, lunghezza) < 0) {
+        return;
+    }
+    memcpy(b->dati + b->lunghezza, testo, lunghezza + 1);
+    b->lunghezza += lunghezza;
+}
+
+/**
+ * Controlla se una riga di input contiene solo spazi
+ * Come scanf, la macchina a stati ignora le righe vuote
+ * @param riga Riga da controllare
+ * @return 1 se la riga e' vuota, 0 altrimenti
+ */
+static int riga_vuota(const char* riga) {
+    while (*riga != '\0') {
+        if (!isspace((unsigned char)*riga)) {
+            return 0;
+        }
+        riga++;
+    }
+    return 1;
+}
+
+/**
+ * Interpreta una riga di input come numero intero, come scanf("%d")
+ * @param riga Riga inserita dal giocatore
+ * @param valore Numero letto (parametro di output)
+ * @return 1 se la lettura e' riuscita, 0 altrimenti
+ */
+static int leggi_intero(const char* riga, int* valore) {
+    return sscanf(riga, "%d", valore) == 1;
 }
 
 /* ============================================================================
  * FUNZIONI DI CREAZIONE E MODIFICA MAPPA
  * ============================================================================ */
 
-// Genera una mappa casuale per entrambi i mondi
-static void genera_mappa(void) {
-    int i;
-    int posizione_demotorzone;
+/**
+ * Costruisce le liste delle zone dei due mondi dai contenuti dati
+ * @param p Partita (la mappa precedente viene liberata)
+ * @param contenuti Contenuto di ogni zona
+ * @param n Numero di zone
+ * @param posizione_finale Zona del Soprasotto in cui mettere il nemico finale, -1 se e' gia' nei contenuti
+ * @return 1 se riuscito, 0 se la memoria non basta (senza mappa)
+ */
+static int costruisci_mappa(Partita* p, const Contenuto_zona* contenuti, int n, int posizione_finale) {
     Zona_mondoreale* ultima_mr = NULL;
     Zona_soprasotto* ultima_ss = NULL;
+    int i;
 
-    libera_mappe();
-
-    posizione_demotorzone = rand() % ZONE_MINIME;
+    libera_mappe(p);
 
-    for (i = 0; i < ZONE_MINIME; i++) {
+    for (i = 0; i < n; i++) {
         Zona_mondoreale* nuova_mr = (Zona_mondoreale*)malloc(sizeof(Zona_mondoreale));
         if (nuova_mr == NULL) {
-            printf("Errore: memoria insufficiente durante la creazione della mappa!\n");
-            libera_mappe();
-            return;
+            libera_mappe(p);
+            return 0;
         }
 
         Zona_soprasotto* nuova_ss = (Zona_soprasotto*)malloc(sizeof(Zona_soprasotto));
         if (nuova_ss == NULL) {
-            printf("Errore: memoria insufficiente durante la creazione della mappa!\n");
             free(nuova_mr);
-            libera_mappe();
-            return;
+            libera_mappe(p);
+            return 0;
         }
+        metrica_allocazione(sizeof(Zona_mondoreale));
+        metrica_allocazione(sizeof(Zona_soprasotto));
 
-        nuova_mr->tipo     = (Tipo_zona)(rand() % 10);
-        nuova_mr->nemico   = genera_nemico_mondoreale();
-        nuova_mr->oggetto  = genera_oggetto();
+        nuova_mr->tipo     = (Tipo_zona)contenuti[i].tipo;
+        nuova_mr->nemico   = (Tipo_nemico)contenuti[i].nemico_mr;
+        nuova_mr->oggetto  = (Tipo_oggetto)contenuti[i].oggetto;
         nuova_mr->avanti   = NULL;
         nuova_mr->indietro = NULL;
         nuova_mr->link_soprasotto = NULL;
+        nuova_mr->primo_occupante = -1;
+        nuova_mr->num_occupanti   = 0;
 
         nuova_ss->tipo     = nuova_mr->tipo;
-        nuova_ss->nemico   = genera_nemico_soprasotto(i == posizione_demotorzone);
+        nuova_ss->nemico   = i == posizione_finale ? (Tipo_nemico)registro_nemico_finale()
+                                                   : (Tipo_nemico)contenuti[i].nemico_ss;
         nuova_ss->avanti   = NULL;
         nuova_ss->indietro = NULL;
         nuova_ss->link_mondoreale = NULL;
+        nuova_ss->primo_occupante = -1;
+        nuova_ss->num_occupanti   = 0;
 
         nuova_mr->link_soprasotto = nuova_ss;
         nuova_ss->link_mondoreale = nuova_mr;
 
-        if (prima_zona_mondoreale == NULL) {
-            prima_zona_mondoreale = nuova_mr;
-            prima_zona_soprasotto = nuova_ss;
+        if (p->prima_zona_mondoreale == NULL) {
+            p->prima_zona_mondoreale = nuova_mr;
+            p->prima_zona_soprasotto = nuova_ss;
         } else {
             ultima_mr->avanti  = nuova_mr;
             nuova_mr->indietro = ultima_mr;
@@ -298,111 +871,98 @@ static void genera_mappa(void) {
         ultima_mr = nuova_mr;
         ultima_ss = nuova_ss;
     }
-
-    printf("\nMappa generata con successo! %d zone create per ciascun mondo.\n", ZONE_MINIME);
+    return 1;
 }
 
-// Inserisce una nuova zona in una posizione specifica della mappa
-static void inserisci_zona(void) {
-    int posizione;
-    int tipo_input, nemico_input, oggetto_input;
-    int i;
-    int num_zone;
-    Zona_mondoreale* nuova_mr;
-    Zona_soprasotto* nuova_ss;
-
-    if (mappa_chiusa) {
-        printf("\nErrore: la mappa e' gia' stata chiusa!\n");
-        printf("Non puoi piu' modificarla.\n");
-        return;
-    }
+// Genera una mappa casuale per entrambi i mondi
+static void genera_mappa(Partita* p) {
+    int posizione_demotorzone;
+    int obiettivi_rispettati;
+    Contenuto_zona contenuti[ZONE_MINIME];
 
-    num_zone = conta_zone_mondoreale();
+    obiettivi_rispettati = genera_contenuti_mappa(contenuti, ZONE_MINIME, &posizione_demotorzone);
+    metrica_conta(METRICA_MAPPE_GENERATE, 1);
 
-    printf("\nInserisci la posizione (1-%d): ", num_zone + 1);
-    if (scanf("%d", &posizione) != 1) {
-        while (getchar() != '\n');
-        printf("Errore: devi inserire un numero intero!\n");
+    if (!costruisci_mappa(p, contenuti, ZONE_MINIME, posizione_demotorzone)) {
+        scrivi(p, "Errore: memoria insufficiente durante la creazione della mappa!\n");
         return;
     }
-    while (getchar() != '\n');
 
-    if (posizione < 1 || posizione > num_zone + 1) {
-        printf("Errore: posizione non valida! Deve essere tra 1 e %d.\n", num_zone + 1);
-        return;
+    scrivi(p, "\nMappa generata con successo! %d zone create per ciascun mondo.\n", ZONE_MINIME);
+    if (obiettivi_rispettati < 0) {
+        scrivi(p, "Attenzione: memoria insufficiente per gli obiettivi di difficolta', la mappa usa solo i pesi di comparsa.\n");
+    } else if (!obiettivi_rispettati) {
+        scrivi(p, "Attenzione: gli obiettivi di difficolta' non sono raggiungibili, questa e' la mappa piu' vicina.\n");
     }
+}
 
-    printf("\nTipo di zona (0-9):\n");
-    printf("0=Bosco, 1=Scuola, 2=Laboratorio, 3=Caverna, 4=Strada\n");
-    printf("5=Giardino, 6=Supermercato, 7=Centrale Elettrica\n");
-    printf("8=Deposito Abbandonato, 9=Stazione Polizia\n");
-    printf("Scegli: ");
-    if (scanf("%d", &tipo_input) != 1 || tipo_input < 0 || tipo_input > 9) {
-        while (getchar() != '\n');
-        printf("Errore: tipo non valido! Deve essere tra 0 e 9.\n");
-        return;
+// Chiede la posizione in cui inserire una nuova zona; restituisce 0 se la mappa non e' modificabile
+static int chiedi_inserimento_zona(Partita* p) {
+    if (p->mappa_chiusa) {
+        scrivi(p, "\nErrore: la mappa e' gia' stata chiusa!\n");
+        scrivi(p, "Non puoi piu' modificarla.\n");
+        return 0;
     }
-    while (getchar() != '\n');
 
-    printf("\nNemico Mondo Reale (0=Nessuno, 1=Billi, 2=Democane): ");
-    if (scanf("%d", &nemico_input) != 1 || nemico_input < 0 || nemico_input > 2) {
-        while (getchar() != '\n');
-        printf("Errore: nemico non valido! Deve essere 0, 1 o 2.\n");
-        return;
-    }
-    while (getchar() != '\n');
+    scrivi(p, "\nInserisci la posizione (1-%d): ", conta_zone_mondoreale(p) + 1);
+    return 1;
+}
 
-    printf("\nOggetto (0=Nessuno, 1=Bicicletta, 2=Maglietta, 3=Bussola, 4=Schitarrata): ");
-    if (scanf("%d", &oggetto_input) != 1 || oggetto_input < 0 || oggetto_input > 4) {
-        while (getchar() != '\n');
-        printf("Errore: oggetto non valido! Deve essere tra 0 e 4.\n");
-        return;
-    }
-    while (getchar() != '\n');
+// Inserisce una nuova zona nella posizione scelta, con i valori raccolti dalla macchina a stati
+static void inserisci_zona(Partita* p, int posizione, int tipo_input, int nemico_input, int oggetto_input) {
+    int i;
+    Zona_mondoreale* nuova_mr;
+    Zona_soprasotto* nuova_ss;
 
     nuova_mr = (Zona_mondoreale*)malloc(sizeof(Zona_mondoreale));
     if (nuova_mr == NULL) {
-        printf("Errore: memoria insufficiente!\n");
+        scrivi(p, "Errore: memoria insufficiente!\n");
         return;
     }
 
     nuova_ss = (Zona_soprasotto*)malloc(sizeof(Zona_soprasotto));
     if (nuova_ss == NULL) {
-        printf("Errore: memoria insufficiente!\n");
+        scrivi(p, "Errore: memoria insufficiente!\n");
         free(nuova_mr);
         return;
     }
+    metrica_allocazione(sizeof(Zona_mondoreale));
+    metrica_allocazione(sizeof(Zona_soprasotto));
 
     nuova_mr->tipo     = (Tipo_zona)tipo_input;
     nuova_mr->nemico   = (Tipo_nemico)nemico_input;
     nuova_mr->oggetto  = (Tipo_oggetto)oggetto_input;
     nuova_mr->avanti   = NULL;
     nuova_mr->indietro = NULL;
+    nuova_mr->primo_occupante = -1;
+    nuova_mr->num_occupanti   = 0;
 
     nuova_ss->tipo     = (Tipo_zona)tipo_input;
     nuova_ss->nemico   = genera_nemico_soprasotto(0); /* Il Demotorzone si inserisce solo via genera_mappa */
     nuova_ss->avanti   = NULL;
     nuova_ss->indietro = NULL;
+    nuova_ss->primo_occupante = -1;
+    nuova_ss->num_occupanti   = 0;
 
     nuova_mr->link_soprasotto = nuova_ss;
     nuova_ss->link_mondoreale = nuova_mr;
 
     if (posizione == 1) { // Inserimento in testa
-        nuova_mr->avanti = prima_zona_mondoreale;
-        nuova_ss->avanti = prima_zona_soprasotto;
+        nuova_mr->avanti = p->prima_zona_mondoreale;
+        nuova_ss->avanti = p->prima_zona_soprasotto;
 
-        if (prima_zona_mondoreale != NULL) { // Aggiorna il link indietro della vecchia prima zona del Mondo Reale
-            prima_zona_mondoreale->indietro = nuova_mr;
+        if (p->prima_zona_mondoreale != NULL) { // Aggiorna il link indietro della vecchia prima zona del Mondo Reale
+            p->prima_zona_mondoreale->indietro = nuova_mr;
         }
-        if (prima_zona_soprasotto != NULL) {// Aggiorna il link indietro della vecchia prima zona del Soprasotto
-            prima_zona_soprasotto->indietro = nuova_ss;
+        if (p->prima_zona_soprasotto != NULL) {// Aggiorna il link indietro della vecchia prima zona del Soprasotto
+            p->prima_zona_soprasotto->indietro = nuova_ss;
         }
 
-        prima_zona_mondoreale = nuova_mr;
-        prima_zona_soprasotto = nuova_ss;
+        p->prima_zona_mondoreale = nuova_mr;
+        p->prima_zona_soprasotto = nuova_ss;
     } else { // Inserimento in posizione intermedia o in coda
-        Zona_mondoreale* current_mr = prima_zona_mondoreale;
-        Zona_soprasotto* current_ss = prima_zona_soprasotto;
+        Zona_mondoreale* current_mr = p->prima_zona_mondoreale;
+        Zona_soprasotto* current_ss = p->prima_zona_soprasotto;
 
         for (i = 1; i < posizione - 1 && current_mr != NULL; i++) { // Posizione - 1 perché vogliamo fermarci alla zona precedente a quella di inserimento
             current_mr = current_mr->avanti;
@@ -428,45 +988,43 @@ static void inserisci_zona(void) {
         }
     }
 
-    printf("\nZona inserita con successo in posizione %d!\n", posizione);
+    zona_stampata_inserita(p, posizione - 1);
+    scrivi(p, "\nZona inserita con successo in posizione %d!\n", posizione);
 }
 
-// Cancella una zona in una posizione specifica della mappa
-static void cancella_zona(void) {
-    int posizione;
-    int i;
-    int num_zone;
-    Zona_mondoreale* current_mr;
-    Zona_soprasotto* current_ss;
-
-    if (mappa_chiusa) {
-        printf("\nErrore: la mappa e' gia' stata chiusa!\n");
-        printf("Non puoi piu' modificarla.\n");
-        return;
+// Chiede la posizione della zona da cancellare; restituisce 0 se non c'e' niente da cancellare
+static int chiedi_cancellazione_zona(Partita* p) {
+    if (p->mappa_chiusa) {
+        scrivi(p, "\nErrore: la mappa e' gia' stata chiusa!\n");
+        scrivi(p, "Non puoi piu' modificarla.\n");
+        return 0;
     }
 
-    if (prima_zona_mondoreale == NULL) {
-        printf("\nErrore: non ci sono zone da cancellare!\n");
-        return;
+    if (p->prima_zona_mondoreale == NULL) {
+        scrivi(p, "\nErrore: non ci sono zone da cancellare!\n");
+        return 0;
     }
 
-    num_zone = conta_zone_mondoreale();
+    scrivi(p, "\nInserisci la posizione da cancellare (1-%d): ", conta_zone_mondoreale(p));
+    return 1;
+}
+
+// Cancella la zona nella posizione scelta da entrambe le mappe
+static void cancella_zona(Partita* p, int posizione) {
+    int i;
+    int num_zone;
+    Zona_mondoreale* current_mr;
+    Zona_soprasotto* current_ss;
 
-    printf("\nInserisci la posizione da cancellare (1-%d): ", num_zone);
-    if (scanf("%d", &posizione) != 1) {
-        while (getchar() != '\n');
-        printf("Errore: devi inserire un numero intero!\n");
-        return;
-    }
-    while (getchar() != '\n');
+    num_zone = conta_zone_mondoreale(p);
 
     if (posizione < 1 || posizione > num_zone) {
-        printf("Errore: posizione non valida! Deve essere tra 1 e %d.\n", num_zone);
+        scrivi(p, "Errore: posizione non valida! Deve essere tra 1 e %d.\n", num_zone);
         return;
     }
 
-    current_mr = prima_zona_mondoreale;
-    current_ss = prima_zona_soprasotto;
+    current_mr = p->prima_zona_mondoreale;
+    current_ss = p->prima_zona_soprasotto;
 
     for (i = 1; i < posizione && current_mr != NULL; i++) {
         current_mr = current_mr->avanti;
@@ -474,14 +1032,14 @@ static void cancella_zona(void) {
     }
 
     if (current_mr == NULL) {
-        printf("Errore: posizione non trovata!\n");
+        scrivi(p, "Errore: posizione non trovata!\n");
         return;
     }
 
     if (current_mr->indietro != NULL) {
         current_mr->indietro->avanti = current_mr->avanti;
     } else {
-        prima_zona_mondoreale = current_mr->avanti;
+        p->prima_zona_mondoreale = current_mr->avanti;
     }
 
     if (current_mr->avanti != NULL) {
@@ -491,7 +1049,7 @@ static void cancella_zona(void) {
     if (current_ss->indietro != NULL) {
         current_ss->indietro->avanti = current_ss->avanti;
     } else {
-        prima_zona_soprasotto = current_ss->avanti;
+        p->prima_zona_soprasotto = current_ss->avanti;
     }
 
     if (current_ss->avanti != NULL) {
@@ -500,1517 +1058,3817 @@ static void cancella_zona(void) {
 
     free(current_mr);
     free(current_ss);
+    zona_stampata_cancellata(p, posizione - 1);
 
-    printf("\nZona cancellata con successo!\n");
+    scrivi(p, "\nZona cancellata con successo!\n");
 }
 
 /* ============================================================================
- * FUNZIONI DI VISUALIZZAZIONE MAPPA
+ * DIARIO DELLE MOSSE: REGISTRAZIONE
+ *
+ * Durante i turni ogni funzione che cambia lo stato registra prima il valore
+ * che sta per cambiare; all'inizio di ogni turno un segno ricorda dove
+ * arriva il diario e i contatori del turno, compreso lo stato dei dadi.
+ * Riavvolgere N turni annulla le modifiche all'indietro fino al segno, senza
+ * rigiocare la partita. Nell'impostazione il diario e' spento.
  * ============================================================================ */
 
-//
-static void stampa_mappa(void) {
-    int scelta;
-    int count = 1;
-
-    printf("\nQuale mappa vuoi visualizzare?\n");
-    printf("1) Mondo Reale\n");
-    printf("2) Soprasotto\n");
-    printf("Scegli: ");
+/**
+ * Ingrandisce un array del diario se non c'e' posto per altri elementi
+ * @param dati Array da ingrandire
+ * @param capacita Elementi allocati
+ * @param necessari Elementi che devono entrarci
+ * @param dimensione Byte di un elemento
+ * @return 1 se c'e' posto, 0 se la memoria non basta
+ */
+static int ingrandisci_diario(void** dati, size_t* capacita, size_t necessari, size_t dimensione) {
+    size_t nuova_capacita = *capacita > 0 ? *capacita : 64;
+    void* nuovi;
 
-    if (scanf("%d", &scelta) != 1) {
-        while (getchar() != '\n');
-        printf("Errore: devi inserire 1 o 2!\n");
-        return;
+    if (necessari <= *capacita) {
+        return 1;
     }
-    while (getchar() != '\n');
-
-    if (scelta == 1) { // Visualizza la mappa del Mondo Reale
-        Zona_mondoreale* current = prima_zona_mondoreale;
-
-        printf("\n=== MAPPA MONDO REALE ===\n\n");
-
-        if (current == NULL) {
-            printf("La mappa e' vuota.\n");
-            return;
-        }
+    while (nuova_capacita < necessari) {
+        nuova_capacita *= 2;
+    }
+    nuovi = realloc(*dati, nuova_capacita * dimensione);
+    if (nuovi == NULL) {
+        return 0;
+    }
+    metrica_allocazione(nuova_capacita * dimensione);
+    *dati     = nuovi;
+    *capacita = nuova_capacita;
+    return 1;
+}
 
-        while (current != NULL) {
-            printf("Zona %d:\n", count);
-            printf("  Tipo: %s\n",    tipo_zona_to_string(current->tipo));
-            printf("  Nemico: %s\n",  tipo_nemico_to_string(current->nemico));
-            printf("  Oggetto: %s\n", tipo_oggetto_to_string(current->oggetto));
-            printf("\n");
-            current = current->avanti;
-            count++;
-        }
-    } else if (scelta == 2) { // Visualizza la mappa del Soprasotto
-        Zona_soprasotto* current = prima_zona_soprasotto;
+/**
+ * Svuota il diario per una nuova partita, tenendo la memoria
+ * @param p Partita
+ */
+static void azzera_diario(Partita* p) {
+    p->diario.num_delta  = 0;
+    p->diario.num_segni  = 0;
+    p->diario.num_ordini = 0;
+    p->diario.guasto     = 0;
+}
 
-        printf("\n=== MAPPA SOPRASOTTO ===\n\n");
+/**
+ * Libera la memoria del diario
+ * @param p Partita
+ */
+static void libera_diario(Partita* p) {
+    free(p->diario.delta);
+    free(p->diario.segni);
+    free(p->diario.ordini);
+    memset(&p->diario, 0, sizeof(p->diario));
+}
 
-        if (current == NULL) {
-            printf("La mappa e' vuota.\n");
-            return;
-        }
+/**
+ * Aggiunge una modifica al diario, se la partita e' nei turni di gioco
+ * @param p Partita
+ * @param d Modifica da registrare
+ */
+static void registra(Partita* p, const Delta_partita* d) {
+    Diario_partita* diario = &p->diario;
 
-        while (current != NULL) {
-            printf("Zona %d:\n", count);
-            printf("  Tipo: %s\n",   tipo_zona_to_string(current->tipo));
-            printf("  Nemico: %s\n", tipo_nemico_to_string(current->nemico));
-            printf("\n");
-            current = current->avanti;
-            count++;
-        }
-    } else {
-        printf("Errore: scelta non valida! Inserisci 1 o 2.\n");
+    if (diario->num_segni == 0 || diario->guasto) {
+        return;
+    }
+    if (!ingrandisci_diario((void**)&diario->delta, &diario->capacita_delta,
+                            diario->num_delta + 1, sizeof(Delta_partita))) {
+        diario->guasto = 1; // Un diario incompleto non puo' piu' riavvolgere
+        return;
     }
+    diario->delta[diario->num_delta++] = *d;
 }
 
-// Visualizza i dettagli di una zona specifica in entrambe le mappe
-static void stampa_zona(void) {
-    int posizione;
+/**
+ * Segna l'inizio del turno del giocatore corrente
+ * @param p Partita
+ */
+static void registra_segno(Partita* p) {
+    Diario_partita* diario = &p->diario;
+    Segno_turno* s;
+
+    if (diario->guasto) {
+        return;
+    }
+    if (!ingrandisci_diario((void**)&diario->segni, &diario->capacita_segni,
+                            diario->num_segni + 1, sizeof(Segno_turno))) {
+        diario->guasto = 1;
+        return;
+    }
+    s = &diario->segni[diario->num_segni++];
+    s->delta              = diario->num_delta;
+    s->ordini             = diario->num_ordini;
+    s->rng                = p->rng;
+    s->turno              = p->turno;
+    s->idx_turno          = p->idx_turno;
+    s->num_vivi_round     = p->num_vivi_round;
+    s->giocatore_corrente = p->giocatore_corrente;
+    s->stato_ritorno      = p->stato_ritorno;
+    s->nemico             = p->nemico;
+    s->hp_nemico          = p->hp_nemico;
+    s->attacco_nemico     = p->attacco_nemico;
+    s->difesa_nemico      = p->difesa_nemico;
+}
+
+/**
+ * Registra la posizione del giocatore prima di spostarlo
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void registra_posizione(Partita* p, const Giocatore* g) {
+    Delta_partita d = {0};
+
+    d.tipo      = DELTA_POSIZIONE;
+    d.mondo     = g->mondo;
+    d.giocatore = (int)(g - p->giocatori);
+    d.valori[0] = (int16_t)p->occupante_prec[d.giocatore];
+    d.zona      = g->mondo == MONDO_REALE ? (void*)g->pos_mondoreale : (void*)g->pos_soprasotto;
+    registra(p, &d);
+}
+
+/**
+ * Registra le statistiche del giocatore prima di cambiarle
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void registra_statistiche(Partita* p, const Giocatore* g) {
+    Delta_partita d = {0};
+
+    d.tipo      = DELTA_STATISTICHE;
+    d.giocatore = (int)(g - p->giocatori);
+    d.valori[0] = g->attacco_psichico;
+    d.valori[1] = g->difesa_psichica;
+    d.valori[2] = g->fortuna;
+    d.valori[3] = g->punti_vita;
+    registra(p, &d);
+}
+
+/**
+ * Registra effetti attivi e bonus temporanei dello zaino prima di cambiarli
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void registra_effetti(Partita* p, const Giocatore* g) {
+    const Zaino* z = &p->zaini[g - p->giocatori];
+    Delta_partita d = {0};
+
+    d.tipo      = DELTA_EFFETTI;
+    d.giocatore = (int)(g - p->giocatori);
+    d.extra     = z->effetti_attivi;
+    d.valori[0] = z->attacco_temporaneo;
+    d.valori[1] = z->difesa_temporanea;
+    d.valori[2] = z->fortuna_temporanea;
+    registra(p, &d);
+}
+
+/**
+ * Registra il contenuto di uno slot dello zaino prima di cambiarlo
+ * @param p Partita
+ * @param g Giocatore
+ * @param slot Slot
+ */
+static void registra_slot(Partita* p, const Giocatore* g, int slot) {
+    const Zaino* z = &p->zaini[g - p->giocatori];
+    Delta_partita d = {0};
+
+    d.tipo      = DELTA_SLOT;
+    d.giocatore = (int)(g - p->giocatori);
+    d.valori[0] = (int16_t)slot;
+    d.valori[1] = (int16_t)((z->occupati >> slot) & 1u ? z->slot[slot] : NESSUN_OGGETTO);
+    registra(p, &d);
+}
+
+/**
+ * Registra il nemico o l'oggetto della zona del giocatore prima di toglierlo
+ * @param p Partita
+ * @param g Giocatore
+ * @param tipo DELTA_NEMICO o DELTA_OGGETTO
+ * @param valore Nemico o oggetto presente
+ */
+static void registra_zona(Partita* p, const Giocatore* g, Tipo_delta tipo, int valore) {
+    Delta_partita d = {0};
+
+    d.tipo      = (uint8_t)tipo;
+    d.mondo     = g->mondo;
+    d.valori[0] = (int16_t)valore;
+    d.zona      = g->mondo == MONDO_REALE ? (void*)g->pos_mondoreale : (void*)g->pos_soprasotto;
+    registra(p, &d);
+}
+
+/**
+ * Registra la morte di un giocatore, prima di toglierlo dalla zona e dai vivi
+ * Salva il posto nella zona e nei vivi, e chi prendera' il suo posto tra i vivi
+ * @param p Partita
+ * @param i Indice del giocatore
+ */
+static void registra_morte(Partita* p, int i) {
+    Delta_partita d = {0};
+
+    d.tipo      = DELTA_MORTE;
+    d.giocatore = i;
+    d.valori[0] = (int16_t)p->occupante_prec[i];
+    d.valori[1] = (int16_t)p->posto_vivo[i];
+    d.valori[2] = (int16_t)p->vivi[p->num_vivi - 1];
+    registra(p, &d);
+}
+
+/**
+ * Salva l'ordine del round prima di mescolarne uno nuovo
+ * @param p Partita
+ */
+static void registra_ordine(Partita* p) {
+    Diario_partita* diario = &p->diario;
+    Delta_partita d = {0};
+
+    if (diario->num_segni == 0 || diario->guasto) {
+        return;
+    }
+    if (!ingrandisci_diario((void**)&diario->ordini, &diario->capacita_ordini,
+                            diario->num_ordini + (size_t)p->num_vivi_round, sizeof(int))) {
+        diario->guasto = 1;
+        return;
+    }
+    d.tipo      = DELTA_ORDINE;
+    d.giocatore = p->num_vivi_round;
+    d.extra     = (uint32_t)diario->num_ordini;
+    memcpy(diario->ordini + diario->num_ordini, p->ordine_turno, (size_t)p->num_vivi_round * sizeof(int));
+    diario->num_ordini += (size_t)p->num_vivi_round;
+    registra(p, &d);
+}
+
+/* ============================================================================
+ * CONTENUTO DELLE ZONE
+ *
+ * Le zone di una mappa condivisa sono in sola lettura: nemici sconfitti e
+ * oggetti raccolti dalla sessione stanno nelle sue modifiche, che vengono
+ * lette per prime.
+ * ============================================================================ */
+
+/**
+ * Nemico presente in una zona del Mondo Reale
+ * @param p Partita
+ * @param zona Zona
+ * @return Tipo di nemico, NESSUN_NEMICO se la sessione lo ha gia' tolto
+ */
+static Tipo_nemico nemico_mondoreale(const Partita* p, const Zona_mondoreale* zona) {
+    if (p->modifiche != NULL
+        && modifiche_nemico_sconfitto(p->modifiche, MONDO_REALE, mappa_condivisa_indice_mr(p->mappa_condivisa, zona))) {
+        return NESSUN_NEMICO;
+    }
+    return zona->nemico;
+}
+
+/**
+ * Nemico presente in una zona del Soprasotto
+ * @param p Partita
+ * @param zona Zona
+ * @return Tipo di nemico, NESSUN_NEMICO se la sessione lo ha gia' tolto
+ */
+static Tipo_nemico nemico_soprasotto(const Partita* p, const Zona_soprasotto* zona) {
+    if (p->modifiche != NULL
+        && modifiche_nemico_sconfitto(p->modifiche, SOPRASOTTO, mappa_condivisa_indice_ss(p->mappa_condivisa, zona))) {
+        return NESSUN_NEMICO;
+    }
+    return zona->nemico;
+}
+
+/**
+ * Oggetto presente in una zona del Mondo Reale
+ * @param p Partita
+ * @param zona Zona
+ * @return Tipo di oggetto, NESSUN_OGGETTO se la sessione lo ha gia' raccolto
+ */
+static Tipo_oggetto oggetto_mondoreale(const Partita* p, const Zona_mondoreale* zona) {
+    if (p->modifiche != NULL
+        && modifiche_oggetto_raccolto(p->modifiche, mappa_condivisa_indice_mr(p->mappa_condivisa, zona))) {
+        return NESSUN_OGGETTO;
+    }
+    return zona->oggetto;
+}
+
+/**
+ * Indice della zona corrente del giocatore nella mappa condivisa
+ * @param p Partita che usa una mappa condivisa
+ * @param g Giocatore
+ * @return Indice della zona nel mondo del giocatore
+ */
+static int indice_zona_condivisa(const Partita* p, const Giocatore* g) {
+    return g->mondo == MONDO_REALE ? mappa_condivisa_indice_mr(p->mappa_condivisa, g->pos_mondoreale)
+                                   : mappa_condivisa_indice_ss(p->mappa_condivisa, g->pos_soprasotto);
+}
+
+/**
+ * Toglie il nemico dalla zona in cui si trova il giocatore
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void togli_nemico(Partita* p, Giocatore* g) {
+    registra_zona(p, g, DELTA_NEMICO, g->mondo == MONDO_REALE ? (int)nemico_mondoreale(p, g->pos_mondoreale)
+                                                              : (int)nemico_soprasotto(p, g->pos_soprasotto));
+    if (p->modifiche != NULL) {
+        modifiche_sconfiggi_nemico(p->modifiche, (Tipo_mondo)g->mondo, indice_zona_condivisa(p, g));
+    } else if (g->mondo == MONDO_REALE) {
+        g->pos_mondoreale->nemico = NESSUN_NEMICO;
+        invalida_zona_stampata(p, MONDO_REALE, g->pos_mondoreale);
+    } else {
+        g->pos_soprasotto->nemico = NESSUN_NEMICO;
+        invalida_zona_stampata(p, SOPRASOTTO, g->pos_soprasotto);
+    }
+}
+
+/**
+ * Toglie l'oggetto dalla zona del Mondo Reale in cui si trova il giocatore
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void togli_oggetto(Partita* p, Giocatore* g) {
+    registra_zona(p, g, DELTA_OGGETTO, (int)oggetto_mondoreale(p, g->pos_mondoreale));
+    if (p->modifiche != NULL) {
+        modifiche_raccogli_oggetto(p->modifiche, indice_zona_condivisa(p, g));
+    } else {
+        g->pos_mondoreale->oggetto = NESSUN_OGGETTO;
+        invalida_zona_stampata(p, MONDO_REALE, g->pos_mondoreale);
+    }
+}
+
+/* ============================================================================
+ * OCCUPAZIONE DELLE ZONE
+ *
+ * Ogni zona tiene la testa di una lista doppiamente collegata dei giocatori
+ * presenti; i collegamenti stanno in due array della partita indicizzati per
+ * giocatore, quindi entrare e uscire da una zona costa O(1) senza allocare.
+ * Con una mappa condivisa le teste stanno nella tabella delle modifiche.
+ * ============================================================================ */
+
+/**
+ * Trova la lista degli occupanti della zona in cui si trova il giocatore
+ * @param p Partita
+ * @param g Giocatore
+ * @param primo Riceve il puntatore alla testa della lista
+ * @param numero Riceve il puntatore al contatore degli occupanti
+ * @return 1 se il giocatore e' in una zona, 0 altrimenti
+ */
+static int occupanti_zona_corrente(Partita* p, Giocatore* g, int** primo, int** numero) {
+    if (p->modifiche != NULL && (g->mondo == MONDO_REALE ? g->pos_mondoreale != NULL : g->pos_soprasotto != NULL)) {
+        modifiche_occupanti(p->modifiche, (Tipo_mondo)g->mondo, indice_zona_condivisa(p, g), primo, numero);
+        return 1;
+    }
+    if (g->mondo == MONDO_REALE && g->pos_mondoreale != NULL) {
+        *primo  = &g->pos_mondoreale->primo_occupante;
+        *numero = &g->pos_mondoreale->num_occupanti;
+        return 1;
+    }
+    if (g->mondo == SOPRASOTTO && g->pos_soprasotto != NULL) {
+        *primo  = &g->pos_soprasotto->primo_occupante;
+        *numero = &g->pos_soprasotto->num_occupanti;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Registra il giocatore tra gli occupanti della sua zona corrente, subito dopo un altro occupante
+ * Va chiamata dopo aver aggiornato la posizione
+ * @param p Partita
+ * @param g Giocatore
+ * @param precedente Occupante dopo cui inserirlo, -1 per metterlo in testa
+ */
+static void entra_zona_dopo(Partita* p, Giocatore* g, int precedente) {
+    int i = (int)(g - p->giocatori);
+    int* primo;
+    int* numero;
+    int successivo;
+
+    if (!occupanti_zona_corrente(p, g, &primo, &numero)) {
+        return;
+    }
+    successivo = precedente >= 0 ? p->occupante_succ[precedente] : *primo;
+    p->occupante_prec[i] = precedente;
+    p->occupante_succ[i] = successivo;
+    if (successivo >= 0) {
+        p->occupante_prec[successivo] = i;
+    }
+    if (precedente >= 0) {
+        p->occupante_succ[precedente] = i;
+    } else {
+        *primo = i;
+    }
+    (*numero)++;
+}
+
+/**
+ * Registra il giocatore in testa agli occupanti della sua zona corrente
+ * Va chiamata dopo aver aggiornato la posizione
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void entra_zona(Partita* p, Giocatore* g) {
+    entra_zona_dopo(p, g, -1);
+}
+
+/**
+ * Toglie il giocatore dagli occupanti della sua zona corrente
+ * Va chiamata prima di cambiare la posizione
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void esci_zona(Partita* p, Giocatore* g) {
+    int i = (int)(g - p->giocatori);
+    int* primo;
+    int* numero;
+
+    if (!occupanti_zona_corrente(p, g, &primo, &numero)) {
+        return;
+    }
+    if (p->occupante_prec[i] >= 0) {
+        p->occupante_succ[p->occupante_prec[i]] = p->occupante_succ[i];
+    } else {
+        *primo = p->occupante_succ[i];
+    }
+    if (p->occupante_succ[i] >= 0) {
+        p->occupante_prec[p->occupante_succ[i]] = p->occupante_prec[i];
+    }
+    p->occupante_succ[i] = -1;
+    p->occupante_prec[i] = -1;
+    (*numero)--;
+    if (*numero == 0 && p->modifiche != NULL) { // Libera il posto nella tabella delle modifiche
+        modifiche_rilascia_occupanti(p->modifiche, (Tipo_mondo)g->mondo, indice_zona_condivisa(p, g));
+    }
+}
+
+/**
+ * Svuota le liste degli occupanti di tutte le zone di entrambi i mondi
+ * @param p Partita
+ */
+static void azzera_occupanti(Partita* p) {
+    Zona_mondoreale* mr;
+    Zona_soprasotto* ss;
+
+    if (p->modifiche != NULL) { // Nuova partita sulla mappa condivisa: nemici e oggetti tornano al loro posto
+        modifiche_azzera(p->modifiche);
+        return;
+    }
+
+    for (mr = p->prima_zona_mondoreale; mr != NULL; mr = mr->avanti) {
+        mr->primo_occupante = -1;
+        mr->num_occupanti   = 0;
+    }
+    for (ss = p->prima_zona_soprasotto; ss != NULL; ss = ss->avanti) {
+        ss->primo_occupante = -1;
+        ss->num_occupanti   = 0;
+    }
+}
+
+/**
+ * Elenca gli altri giocatori presenti nella zona del giocatore
+ * @param p Partita
+ * @param g Giocatore
+ */
+static void stampa_altri_giocatori(Partita* p, Giocatore* g) {
+    int* primo;
+    int* numero;
+    int j;
+    int stampati = 0;
+
+    if (!occupanti_zona_corrente(p, g, &primo, &numero) || *numero <= 1) {
+        return;
+    }
+
+    scrivi(p, "\nAltri giocatori in questa zona: ");
+    for (j = *primo; j >= 0; j = p->occupante_succ[j]) {
+        if (&p->giocatori[j] != g) {
+            scrivi(p, "%s%s", stampati > 0 ? ", " : "", p->nomi[j]);
+            stampati++;
+        }
+    }
+    scrivi(p, "\n");
+}
+
+/* ============================================================================
+ * ZAINI
+ *
+ * Gli effetti degli oggetti vengono dal registro e si applicano sommando i
+ * campi dell'effetto, senza casi per tipo di oggetto.
+ * ============================================================================ */
+
+/**
+ * Restituisce lo zaino di un giocatore, conservato fuori dalla struttura Giocatore
+ * @param p Partita
+ * @param g Giocatore
+ * @return Zaino del giocatore
+ */
+static Zaino* zaino_giocatore(Partita* p, const Giocatore* g) {
+    return &p->zaini[g - p->giocatori];
+}
+
+/**
+ * Trova il primo slot libero dello zaino in tempo costante
+ * @param p Partita (per il numero di posti)
+ * @param z Zaino
+ * @return Indice dello slot, -1 se lo zaino e' pieno
+ */
+static int slot_libero(const Partita* p, const Zaino* z) {
+    uint32_t posti  = p->dimensione_zaino >= 32 ? 0xFFFFFFFFu : (1u << p->dimensione_zaino) - 1u;
+    uint32_t liberi = ~z->occupati & posti;
+
+    return liberi != 0 ? __builtin_ctz(liberi) : -1;
+}
+
+/**
+ * Mette un oggetto in uno slot libero dello zaino
+ * @param z Zaino
+ * @param slot Slot libero
+ * @param tipo Tipo di oggetto
+ */
+static void metti_nello_zaino(Zaino* z, int slot, Tipo_oggetto tipo) {
+    z->slot[slot]       = (uint8_t)tipo;
+    z->occupati        |= 1u << slot;
+    z->conteggio[tipo]++;
+}
+
+/**
+ * Toglie l'oggetto da uno slot pieno dello zaino
+ * @param z Zaino
+ * @param slot Slot da svuotare
+ */
+static void togli_dallo_zaino(Zaino* z, int slot) {
+    z->conteggio[z->slot[slot]]--;
+    z->slot[slot]  = NESSUN_OGGETTO;
+    z->occupati   &= ~(1u << slot);
+}
+
+/**
+ * Restituisce l'oggetto in uno slot dello zaino
+ * @param z Zaino
+ * @param slot Slot
+ * @return Tipo di oggetto, NESSUN_OGGETTO se lo slot e' vuoto
+ */
+static Tipo_oggetto oggetto_nello_slot(const Zaino* z, int slot) {
+    return (z->occupati >> slot) & 1u ? (Tipo_oggetto)z->slot[slot] : NESSUN_OGGETTO;
+}
+
+/**
+ * Applica l'effetto di un oggetto al giocatore
+ * I bonus temporanei vengono ricordati nello zaino per toglierli a fine combattimento
+ * @param g Giocatore
+ * @param z Zaino del giocatore
+ * @param tipo Tipo di oggetto
+ * @return 1 se applicato, 0 se l'effetto non e' cumulabile ed e' gia' in corso
+ */
+static int applica_effetto(Giocatore* g, Zaino* z, Tipo_oggetto tipo) {
+    const Effetto_oggetto* e = registro_oggetto((int)tipo);
+    uint32_t bit = 1u << tipo;
+    int punti_vita;
+
+    if (!e->cumulabile) {
+        if (z->effetti_attivi & bit) {
+            return 0;
+        }
+        z->effetti_attivi |= bit;
+    }
+
+    g->attacco_psichico = (int16_t)(g->attacco_psichico + e->attacco);
+    g->difesa_psichica  = (int16_t)(g->difesa_psichica  + e->difesa);
+    g->fortuna          = (int16_t)(g->fortuna          + e->fortuna);
+    if (e->temporaneo) {
+        z->attacco_temporaneo = (int16_t)(z->attacco_temporaneo + e->attacco);
+        z->difesa_temporanea  = (int16_t)(z->difesa_temporanea  + e->difesa);
+        z->fortuna_temporanea = (int16_t)(z->fortuna_temporanea + e->fortuna);
+    }
+
+    /* I punti vita restano anche per gli oggetti temporanei, senza superare il massimo */
+    punti_vita = g->punti_vita + e->punti_vita;
+    if (punti_vita > PV_INIZIALI) punti_vita = PV_INIZIALI;
+    if (punti_vita < 1) punti_vita = 1;
+    g->punti_vita = (int16_t)punti_vita;
+    return 1;
+}
+
+/**
+ * Toglie i bonus temporanei alla fine di un combattimento
+ * @param g Giocatore
+ * @param z Zaino del giocatore
+ * @return 1 se c'erano effetti temporanei, 0 altrimenti
+ */
+static int termina_effetti_temporanei(Giocatore* g, Zaino* z) {
+    uint32_t attivi = z->effetti_attivi;
+    int presenti = z->attacco_temporaneo != 0 || z->difesa_temporanea != 0 || z->fortuna_temporanea != 0;
+
+    while (attivi != 0) { // I non cumulabili temporanei tornano utilizzabili
+        int tipo = __builtin_ctz(attivi);
+        attivi &= attivi - 1u;
+        if (registro_oggetto(tipo)->temporaneo) {
+            z->effetti_attivi &= ~(1u << tipo);
+            presenti = 1;
+        }
+    }
+
+    g->attacco_psichico = (int16_t)(g->attacco_psichico - z->attacco_temporaneo);
+    g->difesa_psichica  = (int16_t)(g->difesa_psichica  - z->difesa_temporanea);
+    g->fortuna          = (int16_t)(g->fortuna          - z->fortuna_temporanea);
+    z->attacco_temporaneo = 0;
+    z->difesa_temporanea  = 0;
+    z->fortuna_temporanea = 0;
+    return presenti;
+}
+
+/**
+ * Stampa le variazioni di statistiche date da un effetto
+ * @param p Partita
+ * @param e Effetto dell'oggetto
+ */
+static void stampa_effetto(Partita* p, const Effetto_oggetto* e) {
+    const char* separatore = "";
+
+    if (e->attacco != 0) {
+        scrivi(p, "Attacco Psichico %+d", e->attacco);
+        separatore = ", ";
+    }
+    if (e->difesa != 0) {
+        scrivi(p, "%sDifesa Psichica %+d", separatore, e->difesa);
+        separatore = ", ";
+    }
+    if (e->fortuna != 0) {
+        scrivi(p, "%sFortuna %+d", separatore, e->fortuna);
+        separatore = ", ";
+    }
+    if (e->punti_vita != 0) {
+        scrivi(p, "%sPunti Vita %+d", separatore, e->punti_vita);
+        separatore = ", ";
+    }
+    if (separatore[0] == '\0') {
+        scrivi(p, "Non succede niente di particolare.\n");
+    } else {
+        scrivi(p, e->temporaneo ? " (fino alla fine del combattimento)\n" : " (PERMANENTE)\n");
+    }
+}
+
+/* ============================================================================
+ * DIARIO DELLE MOSSE: RIAVVOLGIMENTO
+ * ============================================================================ */
+
+/**
+ * Annulla una modifica registrata nel diario
+ * Le modifiche vanno annullate dall'ultima alla prima
+ * @param p Partita
+ * @param d Modifica da annullare
+ */
+static void annulla_delta(Partita* p, const Delta_partita* d) {
+    Giocatore* g = &p->giocatori[d->giocatore];
+    Zaino* z     = &p->zaini[d->giocatore];
+
+    switch ((Tipo_delta)d->tipo) {
+        case DELTA_POSIZIONE:
+            esci_zona(p, g);
+            g->mondo          = d->mondo;
+            g->pos_mondoreale = d->mondo == MONDO_REALE ? (Zona_mondoreale*)d->zona : NULL;
+            g->pos_soprasotto = d->mondo == SOPRASOTTO ? (Zona_soprasotto*)d->zona : NULL;
+            entra_zona_dopo(p, g, d->valori[0]);
+            break;
+
+        case DELTA_STATISTICHE:
+            g->attacco_psichico = d->valori[0];
+            g->difesa_psichica  = d->valori[1];
+            g->fortuna          = d->valori[2];
+            g->punti_vita       = d->valori[3];
+            break;
+
+        case DELTA_EFFETTI:
+            z->effetti_attivi     = d->extra;
+            z->attacco_temporaneo = d->valori[0];
+            z->difesa_temporanea  = d->valori[1];
+            z->fortuna_temporanea = d->valori[2];
+            break;
+
+        case DELTA_SLOT:
+            if ((z->occupati >> d->valori[0]) & 1u) {
+                togli_dallo_zaino(z, d->valori[0]);
+            }
+            if (d->valori[1] != NESSUN_OGGETTO) {
+                metti_nello_zaino(z, d->valori[0], (Tipo_oggetto)d->valori[1]);
+            }
+            break;
+
+        case DELTA_NEMICO:
+            if (p->modifiche != NULL) {
+                modifiche_ripristina_nemico(p->modifiche, (Tipo_mondo)d->mondo,
+                    d->mondo == MONDO_REALE ? mappa_condivisa_indice_mr(p->mappa_condivisa, (Zona_mondoreale*)d->zona)
+                                            : mappa_condivisa_indice_ss(p->mappa_condivisa, (Zona_soprasotto*)d->zona));
+            } else if (d->mondo == MONDO_REALE) {
+                ((Zona_mondoreale*)d->zona)->nemico = (Tipo_nemico)d->valori[0];
+                invalida_zona_stampata(p, MONDO_REALE, d->zona);
+            } else {
+                ((Zona_soprasotto*)d->zona)->nemico = (Tipo_nemico)d->valori[0];
+                invalida_zona_stampata(p, SOPRASOTTO, d->zona);
+            }
+            break;
+
+        case DELTA_OGGETTO:
+            if (p->modifiche != NULL) {
+                modifiche_ripristina_oggetto(p->modifiche,
+                                             mappa_condivisa_indice_mr(p->mappa_condivisa, (Zona_mondoreale*)d->zona));
+            } else {
+                ((Zona_mondoreale*)d->zona)->oggetto = (Tipo_oggetto)d->valori[0];
+                invalida_zona_stampata(p, MONDO_REALE, d->zona);
+            }
+            break;
+
+        case DELTA_MORTE: // Disfa lo scambio di rimuovi_giocatore: il mescolamento dei round dipende dall'ordine dei vivi
+            if (d->valori[2] != d->giocatore) {
+                p->vivi[p->num_vivi]        = d->valori[2];
+                p->posto_vivo[d->valori[2]] = p->num_vivi;
+            }
+            p->vivi[d->valori[1]]       = d->giocatore;
+            p->posto_vivo[d->giocatore] = d->valori[1];
+            p->num_vivi++;
+            entra_zona_dopo(p, g, d->valori[0]);
+            break;
+
+        case DELTA_ORDINE:
+            memcpy(p->ordine_turno, p->diario.ordini + d->extra, (size_t)d->giocatore * sizeof(int));
+            break;
+    }
+}
+
+/* ============================================================================
+ * ISTANTANEE DELLA PARTITA
+ *
+ * Un'istantanea contiene tutto cio' che serve a continuare una partita nei
+ * turni di gioco: contenuto delle zone come lo vede la sessione, giocatori
+ * con zaini, vivi e ordine del round, contatori del turno e stato dei dadi.
+ * Il diario delle mosse non ne fa parte. I campi sono scritti in ordine fisso
+ * nel formato della macchina, dopo un numero di versione.
+ * ============================================================================ */
+
+#define VERSIONE_ISTANTANEA  1
+
+// Istantanea in costruzione
+typedef struct {
+    unsigned char* dati;
+    size_t lunghezza;
+    size_t capacita;
+    int errore;                          /* 1 se la memoria non e' bastata */
+} Scrittore_istantanea;
+
+// Istantanea in lettura
+typedef struct {
+    const unsigned char* dati;
+    size_t lunghezza;
+    size_t pos;
+    int errore;                          /* 1 se l'istantanea e' finita prima del previsto */
+} Lettore_istantanea;
+
+/**
+ * Aggiunge byte all'istantanea in costruzione
+ * @param s Scrittore
+ * @param dati Byte da aggiungere
+ * @param n Numero di byte
+ */
+static void scrivi_dati(Scrittore_istantanea* s, const void* dati, size_t n) {
+    if (s->errore) {
+        return;
+    }
+    if (s->lunghezza + n > s->capacita) {
+        size_t nuova_capacita = s->capacita > 0 ? s->capacita : 1024;
+        unsigned char* nuovi;
+
+        while (nuova_capacita < s->lunghezza + n) {
+            nuova_capacita *= 2;
+        }
+        nuovi = (unsigned char*)realloc(s->dati, nuova_capacita);
+        if (nuovi == NULL) {
+            s->errore = 1;
+            return;
+        }
+        metrica_allocazione(nuova_capacita);
+        s->dati     = nuovi;
+        s->capacita = nuova_capacita;
+    }
+    memcpy(s->dati + s->lunghezza, dati, n);
+    s->lunghezza += n;
+}
+
+/**
+ * Aggiunge un intero a 32 bit all'istantanea
+ * @param s Scrittore
+ * @param valore Valore
+ */
+static void scrivi_intero(Scrittore_istantanea* s, int valore) {
+    int32_t v = valore;
+
+    scrivi_dati(s, &v, sizeof(v));
+}
+
+/**
+ * Legge byte dall'istantanea; se non ce ne sono abbastanza li azzera e segna l'errore
+ * @param l Lettore
+ * @param dati Destinazione
+ * @param n Numero di byte
+ */
+static void leggi_dati(Lettore_istantanea* l, void* dati, size_t n) {
+    if (l->errore || l->lunghezza - l->pos < n) {
+        l->errore = 1;
+        memset(dati, 0, n);
+        return;
+    }
+    memcpy(dati, l->dati + l->pos, n);
+    l->pos += n;
+}
+
+/**
+ * Legge un intero a 32 bit dall'istantanea e ne controlla l'intervallo
+ * @param l Lettore
+ * @param minimo Valore minimo ammesso
+ * @param massimo Valore massimo ammesso
+ * @return Valore letto (minimo se fuori intervallo, con l'errore segnato)
+ */
+static int leggi_campo(Lettore_istantanea* l, int minimo, int massimo) {
+    int32_t v;
+
+    leggi_dati(l, &v, sizeof(v));
+    if (v < minimo || v > massimo) {
+        l->errore = 1;
+        return minimo;
+    }
+    return v;
+}
+
+/**
+ * Indice nella mappa della zona in cui si trova un giocatore
+ * @param p Partita
+ * @param g Giocatore
+ * @return Indice della zona nel suo mondo, -1 se non e' in nessuna zona
+ */
+static int indice_zona_giocatore(const Partita* p, const Giocatore* g) {
+    Zona_mondoreale* mr;
+    Zona_soprasotto* ss;
+    int i = 0;
+
+    if (g->mondo == MONDO_REALE) {
+        for (mr = p->prima_zona_mondoreale; mr != NULL && mr != g->pos_mondoreale; mr = mr->avanti) {
+            i++;
+        }
+        return mr != NULL ? i : -1;
+    }
+    for (ss = p->prima_zona_soprasotto; ss != NULL && ss != g->pos_soprasotto; ss = ss->avanti) {
+        i++;
+    }
+    return ss != NULL ? i : -1;
+}
+
+/**
+ * Scrive l'istantanea della partita
+ * @param p Partita nei turni di gioco
+ * @param s Scrittore
+ */
+static void scrivi_istantanea(Partita* p, Scrittore_istantanea* s) {
+    Zona_mondoreale* mr;
+    Zona_soprasotto* ss;
+    int n = 0;
+    int i;
+    int v;
+
+    scrivi_intero(s, VERSIONE_ISTANTANEA);
+    scrivi_intero(s, (int)p->stato);
+    scrivi_intero(s, (int)p->stato_ritorno);
+    scrivi_intero(s, p->con_menu);
+    scrivi_intero(s, p->turno);
+    scrivi_intero(s, p->idx_turno);
+    scrivi_intero(s, p->num_vivi_round);
+    scrivi_intero(s, p->giocatore_corrente);
+    scrivi_intero(s, p->nemico_presente);
+    scrivi_intero(s, p->mossa_effettuata);
+    scrivi_intero(s, p->appena_mosso_con_nemico);
+    scrivi_intero(s, (int)p->nemico);
+    scrivi_intero(s, p->hp_nemico);
+    scrivi_intero(s, p->attacco_nemico);
+    scrivi_intero(s, p->difesa_nemico);
+    scrivi_dati(s, &p->rng, sizeof(p->rng));
+
+    for (mr = p->prima_zona_mondoreale; mr != NULL; mr = mr->avanti) {
+        n++;
+    }
+    scrivi_intero(s, n);
+    for (mr = p->prima_zona_mondoreale, ss = p->prima_zona_soprasotto; mr != NULL; mr = mr->avanti, ss = ss->avanti) {
+        Contenuto_zona z;
+
+        z.tipo      = (uint8_t)mr->tipo;
+        z.nemico_mr = (uint8_t)nemico_mondoreale(p, mr);
+        z.nemico_ss = (uint8_t)nemico_soprasotto(p, ss);
+        z.oggetto   = (uint8_t)oggetto_mondoreale(p, mr);
+        scrivi_dati(s, &z, sizeof(z));
+    }
+
+    scrivi_intero(s, p->num_giocatori);
+    scrivi_intero(s, p->dimensione_zaino);
+    scrivi_intero(s, p->num_vivi);
+    for (i = 0; i < p->num_vivi; i++) { // Nell'ordine attuale: i prossimi round si mescolano partendo da qui
+        scrivi_intero(s, p->vivi[i]);
+    }
+    for (i = 0; i < p->num_vivi_round; i++) {
+        scrivi_intero(s, p->ordine_turno[i]);
+    }
+    for (i = 0; i < p->num_vivi; i++) { // Occupanti di ogni zona dall'ultimo al primo: rientrando in quest'ordine le liste tornano uguali
+        v = p->vivi[i];
+        if (p->occupante_prec[v] >= 0) {
+            continue;
+        }
+        while (p->occupante_succ[v] >= 0) {
+            v = p->occupante_succ[v];
+        }
+        for (; v >= 0; v = p->occupante_prec[v]) {
+            scrivi_intero(s, v);
+        }
+    }
+    for (i = 0; i < p->num_giocatori; i++) {
+        const Giocatore* g = &p->giocatori[i];
+
+        scrivi_dati(s, p->nomi[i], NOME_MAX);
+        scrivi_intero(s, g->attacco_psichico);
+        scrivi_intero(s, g->difesa_psichica);
+        scrivi_intero(s, g->fortuna);
+        scrivi_intero(s, g->punti_vita);
+        scrivi_intero(s, g->mondo);
+        scrivi_intero(s, indice_zona_giocatore(p, g));
+        scrivi_dati(s, &p->zaini[i], sizeof(Zaino));
+    }
+}
+
+/**
+ * Ricostruisce la mappa dai contenuti di un'istantanea
+ * Con una mappa condivisa le differenze diventano le modifiche della sessione
+ * @param p Partita senza mappa propria
+ * @param zone Contenuti letti
+ * @param n Numero di zone
+ * @return 1 se riuscito, 0 se la memoria non basta o i contenuti non sono di questa mappa
+ */
+static int ripristina_mappa(Partita* p, const Contenuto_zona* zone, int n) {
+    Zona_mondoreale* mr;
+    Zona_soprasotto* ss;
+    int i;
+
+    if (p->mappa_condivisa == NULL) {
+        return costruisci_mappa(p, zone, n, -1);
+    }
+
+    if (n != mappa_condivisa_num_zone(p->mappa_condivisa)) {
+        return 0;
+    }
+    p->modifiche = modifiche_crea(p->mappa_condivisa, p->num_giocatori);
+    if (p->modifiche == NULL) {
+        return 0;
+    }
+    p->prima_zona_mondoreale = mappa_condivisa_mondoreale(p->mappa_condivisa);
+    p->prima_zona_soprasotto = mappa_condivisa_soprasotto(p->mappa_condivisa);
+
+    for (i = 0, mr = p->prima_zona_mondoreale, ss = p->prima_zona_soprasotto; i < n; i++, mr++, ss++) {
+        if (zone[i].tipo != mr->tipo
+            || (zone[i].nemico_mr != mr->nemico && zone[i].nemico_mr != NESSUN_NEMICO)
+            || (zone[i].nemico_ss != ss->nemico && zone[i].nemico_ss != NESSUN_NEMICO)
+            || (zone[i].oggetto != mr->oggetto && zone[i].oggetto != NESSUN_OGGETTO)) {
+            return 0; // L'istantanea e' di un'altra mappa del giorno
+        }
+        if (zone[i].nemico_mr != mr->nemico) {
+            modifiche_sconfiggi_nemico(p->modifiche, MONDO_REALE, i);
+        }
+        if (zone[i].nemico_ss != ss->nemico) {
+            modifiche_sconfiggi_nemico(p->modifiche, SOPRASOTTO, i);
+        }
+        if (zone[i].oggetto != mr->oggetto) {
+            modifiche_raccogli_oggetto(p->modifiche, i);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Legge un'istantanea in una partita appena creata
+ * @param p Partita senza giocatori e senza mappa propria
+ * @param l Lettore
+ * @return 1 se riuscito, 0 se l'istantanea non e' valida o la memoria non basta
+ */
+static int leggi_istantanea(Partita* p, Lettore_istantanea* l) {
+    Contenuto_zona* zone = NULL;
+    Zona_mondoreale** zone_mr = NULL;
+    Zona_soprasotto** zone_ss = NULL;
+    int* ingressi = NULL;
+    int num_zone;
+    int num_giocatori;
+    uint32_t posti;
+    int ok = 0;
+    int i;
+    int j;
+
+    if (leggi_campo(l, VERSIONE_ISTANTANEA, VERSIONE_ISTANTANEA) != VERSIONE_ISTANTANEA || l->errore) {
+        return 0;
+    }
+    p->stato                   = (Stato_partita)leggi_campo(l, STATO_AZIONE, STATO_ZAINO);
+    p->stato_ritorno           = (Stato_partita)leggi_campo(l, STATO_INATTIVA, STATO_CHIUSA);
+    p->con_menu                = leggi_campo(l, 0, 1);
+    p->turno                   = leggi_campo(l, 0, INT32_MAX);
+    p->idx_turno               = leggi_campo(l, 0, GIOCATORI_MAX - 1);
+    p->num_vivi_round          = leggi_campo(l, 0, GIOCATORI_MAX);
+    p->giocatore_corrente      = leggi_campo(l, 0, GIOCATORI_MAX - 1);
+    p->nemico_presente         = leggi_campo(l, 0, 1);
+    p->mossa_effettuata        = leggi_campo(l, 0, 1);
+    p->appena_mosso_con_nemico = leggi_campo(l, 0, 1);
+    p->nemico                  = (Tipo_nemico)leggi_campo(l, 0, registro_num_nemici() - 1);
+    p->hp_nemico               = leggi_campo(l, INT16_MIN, INT16_MAX);
+    p->attacco_nemico          = leggi_campo(l, INT16_MIN, INT16_MAX);
+    p->difesa_nemico           = leggi_campo(l, INT16_MIN, INT16_MAX);
+    leggi_dati(l, &p->rng, sizeof(p->rng));
+
+    num_zone = leggi_campo(l, 1, MAPPA_CONDIVISA_ZONE_MAX);
+    if (l->errore || p->rng == 0 || (size_t)num_zone * sizeof(Contenuto_zona) > l->lunghezza - l->pos) {
+        return 0;
+    }
+    zone = (Contenuto_zona*)malloc((size_t)num_zone * sizeof(Contenuto_zona));
+    if (zone == NULL) {
+        return 0;
+    }
+    metrica_allocazione((size_t)num_zone * sizeof(Contenuto_zona));
+    leggi_dati(l, zone, (size_t)num_zone * sizeof(Contenuto_zona));
+    for (i = 0; i < num_zone; i++) {
+        if (zone[i].tipo >= TIPI_ZONA || zone[i].nemico_mr >= registro_num_nemici()
+            || zone[i].nemico_ss >= registro_num_nemici() || zone[i].oggetto >= registro_num_oggetti()) {
+            l->errore = 1;
+        }
+    }
+
+    num_giocatori = leggi_campo(l, 1, GIOCATORI_MAX);
+    if (l->errore || !crea_giocatori(p, num_giocatori)) {
+        free(zone);
+        return 0;
+    }
+    p->dimensione_zaino = leggi_campo(l, 1, ZAINO_SLOT_MAX);
+    posti = p->dimensione_zaino >= 32 ? 0xFFFFFFFFu : (1u << p->dimensione_zaino) - 1u;
+    p->num_vivi         = leggi_campo(l, 0, num_giocatori);
+    for (i = 0; i < num_giocatori; i++) {
+        p->posto_vivo[i] = -1;
+    }
+    for (i = 0; i < p->num_vivi; i++) {
+        p->vivi[i] = leggi_campo(l, 0, num_giocatori - 1);
+        if (p->posto_vivo[p->vivi[i]] >= 0) { // Lo stesso giocatore due volte
+            l->errore = 1;
+        }
+        p->posto_vivo[p->vivi[i]] = i;
+    }
+    if (p->num_vivi_round > num_giocatori || p->giocatore_corrente >= num_giocatori) {
+        l->errore = 1;
+    }
+    for (i = 0; i < p->num_vivi_round && !l->errore; i++) {
+        p->ordine_turno[i] = leggi_campo(l, 0, num_giocatori - 1);
+    }
+    ingressi = (int*)malloc((size_t)num_giocatori * sizeof(int));
+    if (ingressi == NULL) {
+        l->errore = 1;
+    } else {
+        metrica_allocazione((size_t)num_giocatori * sizeof(int));
+    }
+    for (i = 0; i < p->num_vivi && !l->errore; i++) { // Per i vivi gia' letti posto_vivo diventa -2 - posto
+        ingressi[i] = leggi_campo(l, 0, num_giocatori - 1);
+        if (p->posto_vivo[ingressi[i]] < 0) { // Non e' vivo o e' gia' entrato
+            l->errore = 1;
+        } else {
+            p->posto_vivo[ingressi[i]] = -2 - p->posto_vivo[ingressi[i]];
+        }
+    }
+    for (i = 0; i < p->num_vivi && !l->errore; i++) {
+        p->posto_vivo[ingressi[i]] = -2 - p->posto_vivo[ingressi[i]];
+    }
+
+    if (!l->errore && ripristina_mappa(p, zone, num_zone)) {
+        zone_mr = (Zona_mondoreale**)malloc((size_t)num_zone * sizeof(Zona_mondoreale*));
+        zone_ss = (Zona_soprasotto**)malloc((size_t)num_zone * sizeof(Zona_soprasotto*));
+        ok = zone_mr != NULL && zone_ss != NULL;
+        if (ok) {
+            metrica_allocazione((size_t)num_zone * (sizeof(Zona_mondoreale*) + sizeof(Zona_soprasotto*)));
+            metrica_conta(METRICA_ALLOCAZIONI, 1); // Due blocchi
+        }
+    }
+    if (ok) {
+        Zona_mondoreale* mr = p->prima_zona_mondoreale;
+        Zona_soprasotto* ss = p->prima_zona_soprasotto;
+
+        for (i = 0; i < num_zone; i++, mr = mr->avanti, ss = ss->avanti) {
+            zone_mr[i] = mr;
+            zone_ss[i] = ss;
+        }
+        for (i = 0; i < num_giocatori; i++) {
+            Giocatore* g = &p->giocatori[i];
+            int posizione;
+
+            leggi_dati(l, p->nomi[i], NOME_MAX);
+            p->nomi[i][NOME_MAX - 1] = '\0';
+            g->attacco_psichico = (int16_t)leggi_campo(l, INT16_MIN, INT16_MAX);
+            g->difesa_psichica  = (int16_t)leggi_campo(l, INT16_MIN, INT16_MAX);
+            g->fortuna          = (int16_t)leggi_campo(l, INT16_MIN, INT16_MAX);
+            g->punti_vita       = (int16_t)leggi_campo(l, INT16_MIN, INT16_MAX);
+            g->mondo            = (uint8_t)leggi_campo(l, MONDO_REALE, SOPRASOTTO);
+            posizione           = leggi_campo(l, -1, num_zone - 1);
+            g->pos_mondoreale   = g->mondo == MONDO_REALE && posizione >= 0 ? zone_mr[posizione] : NULL;
+            g->pos_soprasotto   = g->mondo == SOPRASOTTO && posizione >= 0 ? zone_ss[posizione] : NULL;
+            leggi_dati(l, &p->zaini[i], sizeof(Zaino));
+            if (p->zaini[i].occupati & ~posti) { // Slot pieni oltre la dimensione dello zaino
+                l->errore = 1;
+            }
+            for (j = 0; j < ZAINO_SLOT_MAX; j++) {
+                if (p->zaini[i].slot[j] >= registro_num_oggetti()) {
+                    l->errore = 1;
+                }
+            }
+        }
+        ok = !l->errore && l->pos == l->lunghezza;
+    }
+    if (ok) { // Gli occupanti si ricostruiscono dalle posizioni dei vivi
+        if (p->modifiche == NULL) { // Sulla mappa condivisa azzerare cancellerebbe anche nemici e oggetti appena ripristinati
+            azzera_occupanti(p);
+        }
+        for (i = 0; i < p->num_vivi; i++) {
+            entra_zona(p, &p->giocatori[ingressi[i]]);
+        }
+        p->mappa_chiusa    = 1;
+        p->gioco_impostato = 1;
+        azzera_diario(p);
+    } else {
+        libera_giocatori(p);
+        libera_mappe(p);
+    }
+
+    free(zone);
+    free(zone_mr);
+    free(zone_ss);
+    free(ingressi);
+    return ok;
+}
+
+/* ============================================================================
+ * FUNZIONI DI VISUALIZZAZIONE MAPPA
+ * ============================================================================ */
+
+/**
+ * Formatta il testo di una zona per la mappa, senza il suo numero
+ * @param mondo Mondo della zona
+ * @param zona Zona del Mondo Reale o del Soprasotto
+ * @return Testo allocato, NULL se la memoria non basta
+ */
+static char* formatta_zona_stampata(Tipo_mondo mondo, const void* zona) {
+    char testo[512];
+    char* copia;
+    int n;
+
+    if (mondo == MONDO_REALE) {
+        const Zona_mondoreale* mr = (const Zona_mondoreale*)zona;
+
+        n = snprintf(testo, sizeof(testo), "  Tipo: %s\n  Nemico: %s\n  Oggetto: %s\n\n", tipo_zona_to_string(mr->tipo),
+                     tipo_nemico_to_string(mr->nemico), tipo_oggetto_to_string(mr->oggetto));
+    } else {
+        const Zona_soprasotto* ss = (const Zona_soprasotto*)zona;
+
+        n = snprintf(testo, sizeof(testo), "  Tipo: %s\n  Nemico: %s\n\n", tipo_zona_to_string(ss->tipo),
+                     tipo_nemico_to_string(ss->nemico));
+    }
+    if (n < 0) {
+        return NULL;
+    }
+    copia = (char*)malloc((size_t)n + 1);
+    if (copia != NULL) {
+        metrica_allocazione((size_t)n + 1);
+        memcpy(copia, testo, (size_t)n + 1);
+    }
+    return copia;
+}
+
+/**
+ * Aggiunge byte al testo di una mappa in costruzione
+ * @param b Testo della mappa
+ * @param dati Byte
+ * @param n Numero di byte
+ * @return 0 se riuscito, -1 se la memoria non basta
+ */
+static int aggiungi_a_mappa(Buffer_testo* b, const char* dati, size_t n) {
+    if (b->lunghezza + n + 1 > b->capacita) {
+        size_t nuova_capacita = b->capacita > 0 ? b->capacita : 1024;
+        char* nuovi;
+
+        while (nuova_capacita < b->lunghezza + n + 1) {
+            nuova_capacita *= 2;
+        }
+        nuovi = (char*)realloc(b->dati, nuova_capacita);
+        if (nuovi == NULL) {
+            return -1;
+        }
+        metrica_allocazione(nuova_capacita);
+        b->dati     = nuovi;
+        b->capacita = nuova_capacita;
+    }
+    memcpy(b->dati + b->lunghezza, dati, n);
+    b->lunghezza += n;
+    b->dati[b->lunghezza] = '\0';
+    return 0;
+}
+
+/**
+ * Compone il testo di una mappa, riformattando solo le zone invalidate
+ * @param p Partita
+ * @param mondo Mondo della mappa
+ * @return 0 se riuscito, -1 se la memoria non basta
+ */
+static int componi_mappa_stampata(Partita* p, Tipo_mondo mondo) {
+    Mappa_stampata* st = &p->stampe[mondo];
+    const Zona_mondoreale* mr = p->prima_zona_mondoreale;
+    const Zona_soprasotto* ss = p->prima_zona_soprasotto;
+    const char* intestazione = mondo == MONDO_REALE ? "\n=== MAPPA MONDO REALE ===\n\n" : "\n=== MAPPA SOPRASOTTO ===\n\n";
+    int num_zone = conta_zone_mondoreale(p);
+    char numero[32];
+    int i;
+
+    if (st->attiva && st->num_zone != num_zone) { // La mappa e' cambiata senza passare dalla cache: si riparte
+        svuota_mappa_stampata(st);
+    }
+    if (!st->attiva) { // Prima stampa: tutte le voci da formattare
+        st->zone = num_zone > 0 ? (char**)calloc((size_t)num_zone, sizeof(char*)) : NULL;
+        if (num_zone > 0 && st->zone == NULL) {
+            return -1;
+        }
+        if (num_zone > 0) {
+            metrica_allocazione((size_t)num_zone * sizeof(char*));
+        }
+        st->num_zone      = num_zone;
+        st->capacita_zone = num_zone;
+        st->attiva        = 1;
+    }
+
+    st->mappa.lunghezza = 0;
+    if (aggiungi_a_mappa(&st->mappa, intestazione, strlen(intestazione)) < 0) {
+        return -1;
+    }
+    if (st->num_zone == 0 && aggiungi_a_mappa(&st->mappa, "La mappa e' vuota.\n", 19) < 0) {
+        return -1;
+    }
+    for (i = 0; i < st->num_zone; i++) {
+        const void* zona = mondo == MONDO_REALE ? (const void*)mr : (const void*)ss;
+        int n;
+
+        if (st->zone[i] == NULL && (st->zone[i] = formatta_zona_stampata(mondo, zona)) == NULL) {
+            return -1;
+        }
+        n = snprintf(numero, sizeof(numero), "Zona %d:\n", i + 1);
+        if (aggiungi_a_mappa(&st->mappa, numero, (size_t)n) < 0
+            || aggiungi_a_mappa(&st->mappa, st->zone[i], strlen(st->zone[i])) < 0) {
+            return -1;
+        }
+        mr = mr->avanti;
+        ss = ss->avanti;
+    }
+    st->mappa_valida = 1;
+    return 0;
+}
+
+// Visualizza tutte le zone della mappa scelta (1 = Mondo Reale, 2 = Soprasotto) dal testo in cache
+static void stampa_mappa(Partita* p, int scelta) {
+    Tipo_mondo mondo = scelta == 1 ? MONDO_REALE : SOPRASOTTO;
+    Mappa_stampata* st = &p->stampe[mondo];
+
+    if (scelta != 1 && scelta != 2) {
+        scrivi(p, "Errore: scelta non valida! Inserisci 1 o 2.\n");
+        return;
+    }
+    if (!st->mappa_valida && componi_mappa_stampata(p, mondo) < 0) {
+        svuota_mappe_stampate(p);
+        scrivi(p, "Errore: memoria insufficiente!\n");
+        return;
+    }
+    scrivi_blocco(p, st->mappa.dati, st->mappa.lunghezza);
+}
+
+// Chiede la posizione della zona da visualizzare; restituisce 0 se la mappa e' vuota
+static int chiedi_zona_da_stampare(Partita* p) {
+    int num_zone = conta_zone_mondoreale(p);
+
+    if (num_zone == 0) {
+        scrivi(p, "\nLa mappa e' vuota! Non ci sono zone da visualizzare.\n");
+        return 0;
+    }
+
+    scrivi(p, "\nInserisci la posizione della zona (1-%d): ", num_zone);
+    return 1;
+}
+
+// Visualizza i dettagli di una zona specifica in entrambe le mappe
+static void stampa_zona(Partita* p, int posizione) {
+    int i;
+    int num_zone;
+    Zona_mondoreale* current_mr;
+
+    num_zone = conta_zone_mondoreale(p);
+
+    if (posizione < 1 || posizione > num_zone) {
+        scrivi(p, "Errore: posizione non valida! Deve essere tra 1 e %d.\n", num_zone);
+        return;
+    }
+
+    current_mr = p->prima_zona_mondoreale;
+
+    for (i = 1; i < posizione && current_mr != NULL; i++) {
+        current_mr = current_mr->avanti;
+    }
+
+    if (current_mr == NULL) {
+        scrivi(p, "Errore: zona non trovata!\n");
+        return;
+    }
+
+    scrivi(p, "\n=== ZONA %d - MONDO REALE ===\n", posizione);
+    scrivi(p, "Tipo: %s\n",    tipo_zona_to_string(current_mr->tipo));
+    scrivi(p, "Nemico: %s\n",  tipo_nemico_to_string(current_mr->nemico));
+    scrivi(p, "Oggetto: %s\n", tipo_oggetto_to_string(current_mr->oggetto));
+
+    scrivi(p, "\n=== ZONA %d - SOPRASOTTO ===\n", posizione);
+    scrivi(p, "Tipo: %s\n",   tipo_zona_to_string(current_mr->link_soprasotto->tipo));
+    scrivi(p, "Nemico: %s\n", tipo_nemico_to_string(current_mr->link_soprasotto->nemico));
+    scrivi(p, "\n");
+}
+
+// Valida la mappa e la chiude per le modifiche, rendendola pronta per il gioco
+static void chiudi_mappa(Partita* p) {
+    int num_zone        = conta_zone_mondoreale(p);
+    int num_demotorzone = conta_demotorzone(p);
+
+    if (num_zone < ZONE_MINIME) {
+        scrivi(p, "\nErrore: la mappa deve avere almeno %d zone!\n", ZONE_MINIME);
+        scrivi(p, "Attualmente ne hai %d. Aggiungine altre %d.\n",
+               num_zone, ZONE_MINIME - num_zone);
+        return;
+    }
+
+    if (num_demotorzone != 1) {
+        scrivi(p, "\nErrore: la mappa deve avere esattamente 1 Demotorzone nel Soprasotto!\n");
+        if (num_demotorzone == 0) {
+            scrivi(p, "Attualmente non ce ne sono. Devi generare nuovamente la mappa\n");
+            scrivi(p, "o inserire manualmente una zona con Demotorzone nel Soprasotto.\n");
+        } else {
+            scrivi(p, "Attualmente ne hai %d. Devi generare nuovamente la mappa.\n", num_demotorzone);
+        }
+        return;
+    }
+
+    p->mappa_chiusa = 1;
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                     MAPPA VALIDATA E CHIUSA                                    \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\nLa mappa e' pronta! Hai creato %d zone.\n", num_zone);
+    scrivi(p, "Il Demotorzone ti aspetta nel Soprasotto...\n");
+    scrivi(p, "Il gioco e' pronto per iniziare!\n");
+    scrivi(p, "================================================================================\n");
+}
+
+// Collega la partita alla mappa condivisa, con modifiche vuote, e conclude l'impostazione
+static void usa_mappa_condivisa(Partita* p) {
+    p->modifiche = modifiche_crea(p->mappa_condivisa, p->num_giocatori);
+    if (p->modifiche == NULL) {
+        scrivi(p, "\nErrore: memoria insufficiente per giocare la mappa del giorno!\n");
+        torna_al_menu(p);
+        return;
+    }
+    p->prima_zona_mondoreale = mappa_condivisa_mondoreale(p->mappa_condivisa);
+    p->prima_zona_soprasotto = mappa_condivisa_soprasotto(p->mappa_condivisa);
+    p->mappa_chiusa          = 1;
+    p->gioco_impostato       = 1;
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                        MAPPA DEL GIORNO                                        \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\nOggi tutti giocano sulla stessa mappa: %d zone per ciascun mondo.\n",
+           mappa_condivisa_num_zone(p->mappa_condivisa));
+    scrivi(p, "Il Demotorzone ti aspetta nel Soprasotto...\n");
+    scrivi(p, "\nIl gioco e' pronto. Torna al menu principale e scegli \"Gioca\"!\n");
+    torna_al_menu(p);
+}
+
+/* ============================================================================
+ * MACCHINA A STATI DELL'IMPOSTAZIONE
+ * ============================================================================ */
+
+// Chiede il nome del prossimo giocatore da configurare
+static void chiedi_nome_giocatore(Partita* p) {
+    int i = p->giocatore_in_impostazione;
+
+    scrivi(p, "\n--- Giocatore %d ---\n", i + 1);
+    scrivi(p, "Inserisci il nome (max %d caratteri): ", NOME_MAX - 1);
+    p->stato = STATO_NOME_GIOCATORE;
+}
+
+// Registra il nome del giocatore, tira le sue abilita' e chiede se modificarle
+static void ricevi_nome_giocatore(Partita* p, const char* riga) {
+    Giocatore* g = &p->giocatori[p->giocatore_in_impostazione];
+    char* nome = nome_giocatore(p, g);
+    size_t len;
+
+    strncpy(nome, riga, NOME_MAX - 1);
+    nome[NOME_MAX - 1] = '\0';
+    len = strcspn(nome, "\r\n");// Rimuove il newline (e il ritorno a capo dei client telnet) se presente
+    nome[len] = '\0';
+
+    g->attacco_psichico = (int16_t)lancia_dado(p);
+    g->difesa_psichica  = (int16_t)lancia_dado(p);
+    g->fortuna          = (int16_t)lancia_dado(p);
+    g->punti_vita       = PV_INIZIALI;
+
+    scrivi(p, "\nAbilita' iniziali (lancio dado da 20):\n");
+    scrivi(p, "  Attacco Psichico: %d\n", g->attacco_psichico);
+    scrivi(p, "  Difesa Psichica:  %d\n", g->difesa_psichica);
+    scrivi(p, "  Fortuna:          %d\n", g->fortuna);
+    scrivi(p, "  Punti Vita:       %d\n", g->punti_vita);
+
+    scrivi(p, "\nVuoi modificare le tue abilita'?\n");
+    scrivi(p, "1) +%d Attacco, -%d Difesa\n", MODIFICA_ATTACCO_DIFESA, MODIFICA_ATTACCO_DIFESA);
+    scrivi(p, "2) +%d Difesa, -%d Attacco\n", MODIFICA_ATTACCO_DIFESA, MODIFICA_ATTACCO_DIFESA);
+    if (p->undici_disponibile) {
+        scrivi(p, "3) Diventa UndiciVirgolaCinque (+%d Attacco, +%d Difesa, -%d Fortuna)\n",
+               BONUS_UNDICI_ATTACCO, BONUS_UNDICI_DIFESA, MALUS_UNDICI_FORTUNA);
+    }
+    scrivi(p, "4) Nessuna modifica\n");
+    scrivi(p, "Scegli: ");
+    p->stato = STATO_ABILITA_GIOCATORE;
+}
+
+// Mostra il menu di creazione della mappa
+static void stampa_menu_mappa(Partita* p) {
+    scrivi(p, "\n--- Menu Creazione Mappa ---\n");
+    scrivi(p, "1) Genera mappa casuale (%d zone)\n", ZONE_MINIME);
+    scrivi(p, "2) Inserisci zona manualmente\n");
+    scrivi(p, "3) Cancella zona\n");
+    scrivi(p, "4) Visualizza mappa completa\n");
+    scrivi(p, "5) Visualizza singola zona\n");
+    scrivi(p, "6) Chiudi mappa e termina impostazione\n");
+    scrivi(p, "Scegli: ");
+    p->stato = STATO_MENU_MAPPA;
+}
+
+// Applica la modifica di abilita' scelta e passa al prossimo giocatore o alla creazione della mappa
+static void ricevi_abilita_giocatore(Partita* p, int scelta_abilita) {
+    int i = p->giocatore_in_impostazione;
+    Giocatore* g = &p->giocatori[i];
+
+    switch (scelta_abilita) {
+        case 1:
+            g->attacco_psichico += MODIFICA_ATTACCO_DIFESA;
+            g->difesa_psichica  -= MODIFICA_ATTACCO_DIFESA;
+            if (g->difesa_psichica < 1) {
+                g->difesa_psichica = 1;
+            }
+            scrivi(p, "Abilita' modificate! Sei ora piu' offensivo.\n");
+            break;
+        case 2:
+            g->difesa_psichica  += MODIFICA_ATTACCO_DIFESA;
+            g->attacco_psichico -= MODIFICA_ATTACCO_DIFESA;
+            if (g->attacco_psichico < 1) {
+                g->attacco_psichico = 1;
+            }
+            scrivi(p, "Abilita' modificate! Sei ora piu' difensivo.\n");
+            break;
+        case 3:
+            if (p->undici_disponibile) {
+                g->attacco_psichico += BONUS_UNDICI_ATTACCO;
+                g->difesa_psichica  += BONUS_UNDICI_DIFESA;
+                g->fortuna          -= MALUS_UNDICI_FORTUNA;
+                if (g->fortuna < 1) {
+                    g->fortuna = 1;
+                }
+                strncpy(nome_giocatore(p, g), "UndiciVirgolaCinque", NOME_MAX - 1);
+                p->undici_disponibile = 0;
+                scrivi(p, "\n*** SEI DIVENTATO UNDICIVIRGOLACINQUE! ***\n");
+                scrivi(p, "Poteri aumentati, ma la fortuna ti ha abbandonato!\n");
+            } else {
+                scrivi(p, "UndiciVirgolaCinque non e' piu' disponibile!\n");
+                scrivi(p, "Un altro giocatore ha gia' preso questo ruolo.\n");
+            }
+            break;
+        default:
+            scrivi(p, "Nessuna modifica applicata.\n");
+            break;
+    }
+    // Imposta la posizione iniziale del giocatore nel Mondo Reale (prima zona)
+    g->mondo          = MONDO_REALE;
+    g->pos_mondoreale = NULL;
+    g->pos_soprasotto = NULL;
+    memset(&p->zaini[i], 0, sizeof(Zaino));
+
+    scrivi(p, "\nGiocatore %d configurato con successo!\n", i + 1);
+    scrivi(p, "Abilita' finali:\n");
+    scrivi(p, "  Attacco: %d | Difesa: %d | Fortuna: %d\n",
+           g->attacco_psichico,
+           g->difesa_psichica,
+           g->fortuna);
+
+    p->giocatore_in_impostazione++;
+    if (p->giocatore_in_impostazione < p->num_giocatori) {
+        chiedi_nome_giocatore(p);
+        return;
+    }
+
+    if (p->mappa_condivisa != NULL) { // Mappa del giorno: niente da creare
+        usa_mappa_condivisa(p);
+        return;
+    }
+
+    /* ========================================================================
+     * FASE 2: CREAZIONE MAPPA
+     * ======================================================================== */
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                         CREAZIONE MAPPA                                        \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\nOra devi creare la mappa del gioco.\n");
+    scrivi(p, "Puoi generare una mappa casuale o costruirla manualmente.\n");
+    scrivi(p, "Ricorda: servono almeno %d zone e 1 Demotorzone!\n", ZONE_MINIME);
+    stampa_menu_mappa(p);
+}
+
+// Esegue la scelta del menu di creazione della mappa
+static void gestisci_menu_mappa(Partita* p, int scelta_menu) {
+    switch (scelta_menu) {
+        case 1:
+            genera_mappa(p);
+            break;
+        case 2:
+            if (chiedi_inserimento_zona(p)) {
+                p->stato = STATO_INSERISCI_POSIZIONE;
+                return;
+            }
+            break;
+        case 3:
+            if (chiedi_cancellazione_zona(p)) {
+                p->stato = STATO_CANCELLA_POSIZIONE;
+                return;
+            }
+            break;
+        case 4:
+            scrivi(p, "\nQuale mappa vuoi visualizzare?\n");
+            scrivi(p, "1) Mondo Reale\n");
+            scrivi(p, "2) Soprasotto\n");
+            scrivi(p, "Scegli: ");
+            p->stato = STATO_SCELTA_MAPPA;
+            return;
+        case 5:
+            if (chiedi_zona_da_stampare(p)) {
+                p->stato = STATO_STAMPA_ZONA_POSIZIONE;
+                return;
+            }
+            break;
+        case 6:
+            chiudi_mappa(p);
+            if (p->mappa_chiusa) {
+                p->gioco_impostato = 1;
+                scrivi(p, "\n");
+                scrivi(p, "================================================================================\n");
+                scrivi(p, "                   IMPOSTAZIONE COMPLETATA!                                     \n");
+                scrivi(p, "================================================================================\n");
+                scrivi(p, "\nIl gioco e' pronto. Torna al menu principale e scegli \"Gioca\"!\n");
+                torna_al_menu(p);
+                return;
+            }
+            break;
+        default:
+            scrivi(p, "Scelta non valida! Inserisci un numero da 1 a 6.\n");
+            break;
+    }
+    stampa_menu_mappa(p);
+}
+
+// Inizia l'impostazione di una nuova partita, scartando giocatori e mappe precedenti
+static void avvia_impostazione(Partita* p) {
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                         IMPOSTAZIONE GIOCO                                     \n");
+    scrivi(p, "================================================================================\n");
+
+    libera_giocatori(p);
+    libera_mappe(p);
+    azzera_diario(p);
+    p->rng                       = ((uint64_t)rand() << 31 ^ (uint64_t)rand()) | 1u; // Mai nullo per xorshift
+    p->mappa_chiusa              = 0;
+    p->gioco_impostato           = 0;
+    p->num_giocatori             = 0;
+    p->giocatore_in_impostazione = 0;
+    p->undici_disponibile        = 1;
+
+    /* ========================================================================
+     * FASE 1: CONFIGURAZIONE GIOCATORI
+     * ======================================================================== */
+
+    scrivi(p, "\nInserisci il numero di giocatori (1-%d): ", GIOCATORI_MAX);
+    p->stato = STATO_NUMERO_GIOCATORI;
+}
+
+// Elenca i codici dei nemici che si possono mettere a mano in una zona (tutti tranne i finali), con i nomi se richiesto
+static void elenca_nemici_inseribili(Partita* p, int con_nomi) {
+    int num = registro_num_nemici();
+    int ultimo = 0;
+    int i;
+
+    for (i = 1; i < num; i++) {
+        if (!registro_nemico(i)->finale) {
+            ultimo = i;
+        }
+    }
+
+    scrivi(p, con_nomi ? "0=Nessuno" : "0");
+    for (i = 1; i < num; i++) {
+        if (registro_nemico(i)->finale) {
+            continue;
+        }
+        if (con_nomi) {
+            scrivi(p, ", %d=%s", i, tipo_nemico_to_string((Tipo_nemico)i));
+        } else {
+            scrivi(p, i == ultimo ? " o %d" : ", %d", i);
+        }
+    }
+}
+
+// Chiede il nemico da mettere nella zona del Mondo Reale che si sta inserendo
+static void chiedi_nemico_zona(Partita* p) {
+    scrivi(p, "\nNemico Mondo Reale (");
+    elenca_nemici_inseribili(p, 1);
+    scrivi(p, "): ");
+}
+
+// Chiede l'oggetto da mettere nella zona del Mondo Reale che si sta inserendo
+static void chiedi_oggetto_zona(Partita* p) {
+    int i;
+
+    scrivi(p, "\nOggetto (0=Nessuno");
+    for (i = 1; i < registro_num_oggetti(); i++) {
+        scrivi(p, ", %d=%s", i, tipo_oggetto_to_string((Tipo_oggetto)i));
+    }
+    scrivi(p, "): ");
+}
+
+// Consegna una riga di input alla fase di impostazione in corso
+static void gestisci_impostazione(Partita* p, const char* riga) {
+    int valore = 0;
+    int input_valido;
+
+    if (p->stato == STATO_NOME_GIOCATORE) { // Il nome si legge come riga intera, anche vuota
+        ricevi_nome_giocatore(p, riga);
+        return;
+    }
+
+    if (riga_vuota(riga)) {
+        return;
+    }
+
+    input_valido = leggi_intero(riga, &valore);
+
+    switch (p->stato) {
+        case STATO_NUMERO_GIOCATORI:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero intero!\n");
+            } else if (valore < 1 || valore > GIOCATORI_MAX) {
+                scrivi(p, "Errore: il numero di giocatori deve essere tra 1 e %d!\n", GIOCATORI_MAX);
+            } else if (!crea_giocatori(p, valore)) {
+                scrivi(p, "Errore: memoria insufficiente per creare i giocatori!\n");
+                torna_al_menu(p);
+                return;
+            } else {
+                chiedi_nome_giocatore(p);
+                return;
+            }
+            scrivi(p, "\nInserisci il numero di giocatori (1-%d): ", GIOCATORI_MAX);
+            break;
+
+        case STATO_ABILITA_GIOCATORE:
+            ricevi_abilita_giocatore(p, input_valido ? valore : 4);
+            break;
+
+        case STATO_MENU_MAPPA:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero intero!\n");
+                stampa_menu_mappa(p);
+            } else {
+                gestisci_menu_mappa(p, valore);
+            }
+            break;
+
+        case STATO_INSERISCI_POSIZIONE:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero intero!\n");
+            } else if (valore < 1 || valore > conta_zone_mondoreale(p) + 1) {
+                scrivi(p, "Errore: posizione non valida! Deve essere tra 1 e %d.\n",
+                       conta_zone_mondoreale(p) + 1);
+            } else {
+                p->input_posizione = valore;
+                scrivi(p, "\nTipo di zona (0-9):\n");
+                scrivi(p, "0=Bosco, 1=Scuola, 2=Laboratorio, 3=Caverna, 4=Strada\n");
+                scrivi(p, "5=Giardino, 6=Supermercato, 7=Centrale Elettrica\n");
+                scrivi(p, "8=Deposito Abbandonato, 9=Stazione Polizia\n");
+                scrivi(p, "Scegli: ");
+                p->stato = STATO_INSERISCI_TIPO;
+                return;
+            }
+            stampa_menu_mappa(p);
+            break;
+
+        case STATO_INSERISCI_TIPO:
+            if (!input_valido || valore < 0 || valore > 9) {
+                scrivi(p, "Errore: tipo non valido! Deve essere tra 0 e 9.\n");
+                stampa_menu_mappa(p);
+                return;
+            }
+            p->input_tipo = valore;
+            chiedi_nemico_zona(p);
+            p->stato = STATO_INSERISCI_NEMICO;
+            break;
+
+        case STATO_INSERISCI_NEMICO:
+            if (!input_valido || valore < 0 || valore >= registro_num_nemici() || registro_nemico(valore)->finale) {
+                scrivi(p, "Errore: nemico non valido! Deve essere ");
+                elenca_nemici_inseribili(p, 0);
+                scrivi(p, ".\n");
+                stampa_menu_mappa(p);
+                return;
+            }
+            p->input_nemico = valore;
+            chiedi_oggetto_zona(p);
+            p->stato = STATO_INSERISCI_OGGETTO;
+            break;
+
+        case STATO_INSERISCI_OGGETTO:
+            if (!input_valido || valore < 0 || valore >= registro_num_oggetti()) {
+                scrivi(p, "Errore: oggetto non valido! Deve essere tra 0 e %d.\n", registro_num_oggetti() - 1);
+            } else {
+                inserisci_zona(p, p->input_posizione, p->input_tipo, p->input_nemico, valore);
+            }
+            stampa_menu_mappa(p);
+            break;
+
+        case STATO_CANCELLA_POSIZIONE:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero intero!\n");
+            } else {
+                cancella_zona(p, valore);
+            }
+            stampa_menu_mappa(p);
+            break;
+
+        case STATO_SCELTA_MAPPA:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire 1 o 2!\n");
+            } else {
+                stampa_mappa(p, valore);
+            }
+            stampa_menu_mappa(p);
+            break;
+
+        case STATO_STAMPA_ZONA_POSIZIONE:
+            if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero intero!\n");
+            } else {
+                stampa_zona(p, valore);
+            }
+            stampa_menu_mappa(p);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* ============================================================================
+ * FUNZIONI DI GIOCO - VISUALIZZAZIONE
+ * ============================================================================ */
+
+// Stampa le informazioni dettagliate di un giocatore, inclusi nome, mondo, statistiche e inventario
+static void stampa_giocatore_info(Partita* p, Giocatore* g) {
     int i;
-    int num_zone;
-    Zona_mondoreale* current_mr;
 
-    num_zone = conta_zone_mondoreale();
+    if (g == NULL) {
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                     SCHEDA GIOCATORE                                           \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+    scrivi(p, "Nome: %s\n", nome_giocatore(p, g));
+    scrivi(p, "Mondo attuale: %s\n", g->mondo == MONDO_REALE ? "Mondo Reale" : "Soprasotto");
+    scrivi(p, "\n--- Statistiche ---\n");
+    scrivi(p, "Punti Vita:       %d/%d\n", g->punti_vita, PV_INIZIALI);
+    scrivi(p, "Attacco Psichico: %d\n",    g->attacco_psichico);
+    scrivi(p, "Difesa Psichica:  %d\n",    g->difesa_psichica);
+    scrivi(p, "Fortuna:          %d\n",    g->fortuna);
+    scrivi(p, "\n--- Inventario ---\n");
+
+    for (i = 0; i < p->dimensione_zaino; i++) {
+        scrivi(p, "  Slot %d: %s\n", i + 1, tipo_oggetto_to_string(oggetto_nello_slot(zaino_giocatore(p, g), i)));
+    }
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+}
 
-    if (num_zone == 0) {
-        printf("\nLa mappa e' vuota! Non ci sono zone da visualizzare.\n");
+// Stampa il testo di un nemico presente nella zona; i nemici senza testo nel registro si annunciano per nome
+static void stampa_testo_nemico(Partita* p, Tipo_nemico nemico, Messaggio_nemico momento) {
+    const char* testo = registro_messaggio_nemico((int)nemico, momento);
+
+    if (testo[0] != '\0') {
+        scrivi(p, "%s", testo);
+    } else {
+        scrivi(p, "%s ti sbarra la strada!\n", tipo_nemico_to_string(nemico));
+    }
+}
+
+// Descrive la zona in cui si trova il giocatore: mondo, tipo di zona, nemici, oggetti e altri giocatori presenti
+static void descrivi_zona_corrente(Partita* p, Giocatore* g) {
+    if (g->mondo == MONDO_REALE) {
+        if (g->pos_mondoreale != NULL) {
+            scrivi(p, "\nSei nel MONDO REALE\n");
+            scrivi(p, "Zona: %s\n", tipo_zona_to_string(g->pos_mondoreale->tipo));
+            scrivi(p, "\n");
+
+            if (nemico_mondoreale(p, g->pos_mondoreale) != NESSUN_NEMICO) {// C'e' un nemico nella zona
+                scrivi(p, "*** ATTENZIONE: PRESENZA NEMICA! ***\n\n");
+                stampa_testo_nemico(p, nemico_mondoreale(p, g->pos_mondoreale), MSG_NEMICO_ZONA_MR);
+            } else { // Nessun nemico nella zona
+                scrivi(p, "L'area sembra tranquilla... per ora.\n");
+                scrivi(p, "Nessuna minaccia immediata, ma resta vigile.\n");
+            }
+
+            if (oggetto_mondoreale(p, g->pos_mondoreale) != NESSUN_OGGETTO) { // C'e' un oggetto nella zona
+                scrivi(p, "\n");
+                scrivi(p, ">>> Noti qualcosa che luccica a terra <<<\n");
+                scrivi(p, "E' %s!\n", tipo_oggetto_to_string(oggetto_mondoreale(p, g->pos_mondoreale)));
+                if (nemico_mondoreale(p, g->pos_mondoreale) == NESSUN_NEMICO) {
+                    scrivi(p, "Potresti raccoglierlo se vuoi.\n");
+                } else {
+                    scrivi(p, "Ma prima devi liberarti del nemico!\n");
+                }
+            }
+        } else {
+            scrivi(p, "Errore: posizione non valida!\n");
+        }
+    } else {
+        if (g->pos_soprasotto != NULL) { // Soprasotto
+            scrivi(p, "\nSei nel SOPRASOTTO - La Dimensione Oscura\n");
+            scrivi(p, "Zona: %s (versione distorta e inquietante)\n",
+                   tipo_zona_to_string(g->pos_soprasotto->tipo));
+            scrivi(p, "\n");
+            scrivi(p, "L'aria e' gelida e spettrale.\n");
+            scrivi(p, "Tutto sembra sbagliato qui. Le ombre si muovono da sole.\n");
+            scrivi(p, "Il silenzio e' assordante.\n");
+
+            if (nemico_soprasotto(p, g->pos_soprasotto) != NESSUN_NEMICO) { // C'e' un nemico nel Soprasotto
+                scrivi(p, "\n*** PERICOLO IMMINENTE! ***\n\n");
+                stampa_testo_nemico(p, nemico_soprasotto(p, g->pos_soprasotto), MSG_NEMICO_ZONA_SS);
+            } else {
+                scrivi(p, "\nPer ora non vedi minacce...\n");
+                scrivi(p, "Ma non abbassare la guardia. Qualcosa potrebbe essere in agguato.\n");
+            }
+        } else {
+            scrivi(p, "Errore: posizione non valida!\n");
+        }
+    }
+
+    stampa_altri_giocatori(p, g);
+}
+
+// Stampa le informazioni dettagliate della zona in cui si trova il giocatore, inclusi tipo di zona, nemici presenti e oggetti disponibili
+static void stampa_zona_corrente(Partita* p, Giocatore* g) {
+    if (g == NULL) {
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                     DOVE TI TROVI                                              \n");
+    scrivi(p, "================================================================================\n");
+
+    descrivi_zona_corrente(p, g);
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+}
+
+/* ============================================================================
+ * FUNZIONI DI GIOCO - AZIONI GIOCATORE
+ * ============================================================================ */
+
+// Permette al giocatore di raccogliere un oggetto presente nella zona del Mondo Reale, se non ci sono nemici
+static void raccogli_oggetto(Partita* p, Giocatore* g) {
+    Zaino* z;
+    Tipo_oggetto oggetto;
+    int slot;
+
+    if (g == NULL) {//
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+    if (g->mondo != MONDO_REALE) {// Il giocatore e' nel Soprasotto, non puo' raccogliere oggetti
+        scrivi(p, "\nNel Soprasotto non ci sono oggetti da raccogliere...\n");
+        scrivi(p, "Solo oscurita' e pericolo ti circondano.\n");
+        return;
+    }
+
+    if (g->pos_mondoreale == NULL) {// Non dovrebbe mai succedere, ma meglio controllare
+        scrivi(p, "Errore: posizione non valida!\n");
+        return;
+    }
+
+    if (nemico_mondoreale(p, g->pos_mondoreale) != NESSUN_NEMICO) {// C'e' un nemico nella zona, non si puo' raccogliere
+        scrivi(p, "\n*** IMPOSSIBILE RACCOGLIERE! ***\n");
+        scrivi(p, "C'e' %s qui!\n", tipo_nemico_to_string(nemico_mondoreale(p, g->pos_mondoreale)));
+        scrivi(p, "E' troppo pericoloso raccogliere oggetti ora!\n");
+        scrivi(p, "Sconfiggilo prima di frugare in giro!\n");
+        return;
+    }
+
+    if (oggetto_mondoreale(p, g->pos_mondoreale) == NESSUN_OGGETTO) {// Non c'e' nessun oggetto nella zona
+        scrivi(p, "\nGuardi attentamente in giro ma non trovi nulla di utile.\n");
+        scrivi(p, "La zona e' vuota.\n");
+        return;
+    }
+
+    z    = zaino_giocatore(p, g);
+    slot = slot_libero(p, z);
+    if (slot < 0) {// Nessuno slot vuoto, lo zaino e' pieno
+        scrivi(p, "\n*** ZAINO PIENO! ***\n");
+        scrivi(p, "Il tuo zaino e' pieno zeppo!\n");
+        scrivi(p, "Devi usare qualcosa prima di raccogliere altro.\n");
+        scrivi(p, "Apri l'inventario e utilizza un oggetto per fare spazio.\n");
+        return;
+    }
+
+    oggetto = oggetto_mondoreale(p, g->pos_mondoreale);
+    scrivi(p, "\nTi avvicini cautamente all'oggetto...\n");
+    scrivi(p, "\n>>> RACCOLTO: %s! <<<\n", tipo_oggetto_to_string(oggetto));
+    scrivi(p, "Lo infili nello zaino (slot %d).\n", slot + 1);
+    scrivi(p, "Potrebbe tornare molto utile!\n");
+
+    registra_slot(p, g, slot);
+    metti_nello_zaino(z, slot, oggetto);
+    togli_oggetto(p, g);
+    metrica_conta(METRICA_OGGETTI_RACCOLTI, 1);
+    racconta(p, g, CRONACA_RACCOLTA, (int)oggetto, slot, 0, 0);
+    if (z->conteggio[oggetto] > 1) {
+        scrivi(p, "Ora ne hai %d.\n", z->conteggio[oggetto]);
+    }
+}
+
+// Mostra il contenuto dello zaino e chiede quale oggetto utilizzare
+static void mostra_zaino(Partita* p, Giocatore* g) {
+    int i;
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                        IL TUO ZAINO                                            \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+    for (i = 0; i < p->dimensione_zaino; i++) {// Elenca gli oggetti presenti nello zaino
+        scrivi(p, "%d) %s\n", i + 1, tipo_oggetto_to_string(oggetto_nello_slot(zaino_giocatore(p, g), i)));
+    }
+    scrivi(p, "%d) Annulla\n", p->dimensione_zaino + 1);
+    scrivi(p, "\n");
+    scrivi(p, "Quale oggetto vuoi usare? ");
+}
+
+// Permette al giocatore di utilizzare l'oggetto scelto dal suo zaino, applicando l'effetto del registro e consumando l'oggetto
+static void utilizza_oggetto(Partita* p, Giocatore* g, int scelta) {
+    Zaino* z;
+    Tipo_oggetto oggetto;
+
+    if (g == NULL) {// Controllo di sicurezza
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+    if (scelta < 1 || scelta > p->dimensione_zaino + 1) {
+        scrivi(p, "Scelta non valida!\n");
         return;
     }
 
-    printf("\nInserisci la posizione della zona (1-%d): ", num_zone);
-    if (scanf("%d", &posizione) != 1) {
-        while (getchar() != '\n');
-        printf("Errore: devi inserire un numero intero!\n");
-        return;
+    if (scelta == p->dimensione_zaino + 1) {// Il giocatore ha scelto di annullare
+        scrivi(p, "Operazione annullata.\n");
+        return;
+    }
+
+    z       = zaino_giocatore(p, g);
+    oggetto = oggetto_nello_slot(z, scelta - 1);
+    if (oggetto == NESSUN_OGGETTO) {// Lo slot scelto e' vuoto, non c'e' niente da usare
+        scrivi(p, "\nNessun oggetto in questa posizione dello zaino!\n");
+        return;
+    }
+
+    registra_statistiche(p, g);
+    registra_effetti(p, g);
+    if (!applica_effetto(g, z, oggetto)) {// Effetto non cumulabile gia' in corso: l'oggetto resta nello zaino
+        scrivi(p, "\nL'effetto di %s e' gia' attivo!\n", tipo_oggetto_to_string(oggetto));
+        scrivi(p, "Usarlo di nuovo non servirebbe a niente.\n");
+        return;
+    }
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                    UTILIZZO OGGETTO                                            \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+
+    if (registro_messaggio_oggetto(oggetto)[0] != '\0') {
+        scrivi(p, "%s", registro_messaggio_oggetto(oggetto));
+    } else {
+        scrivi(p, "Usi %s!\n", tipo_oggetto_to_string(oggetto));
+    }
+    stampa_effetto(p, registro_oggetto(oggetto));
+
+    registra_slot(p, g, scelta - 1);
+    togli_dallo_zaino(z, scelta - 1); // Consuma l'oggetto, lo slot torna vuoto
+    metrica_conta(METRICA_OGGETTI_USATI, 1);
+    racconta(p, g, CRONACA_USO, (int)oggetto, scelta - 1, 0, 0);
+
+    scrivi(p, "\nOggetto utilizzato e consumato.\n");
+    scrivi(p, "Lo slot %d del tuo zaino e' ora vuoto.\n", scelta);
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+}
+
+// Controlla se c'e' un nemico nella zona in cui si trova il giocatore, restituendo 1 se c'e' un nemico e 0 altrimenti
+static int ha_nemico_zona(const Partita* p, Giocatore* g) {
+    if (g == NULL) return 0; // Controllo di sicurezza
+
+    if (g->mondo == MONDO_REALE) {// Controlla il Mondo Reale
+        if (g->pos_mondoreale != NULL && nemico_mondoreale(p, g->pos_mondoreale) != NESSUN_NEMICO) {
+            return 1;
+        }
+    } else {// Controlla il Soprasotto
+        if (g->pos_soprasotto != NULL && nemico_soprasotto(p, g->pos_soprasotto) != NESSUN_NEMICO) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Permette al giocatore di avanzare alla zona successiva, se non ci sono nemici che bloccano il passaggio
+static void avanza(Partita* p, Giocatore* g) {
+    if (g == NULL) {
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+
+    if (ha_nemico_zona(p, g)) { // C'e' un nemico nella zona, non si puo' avanzare
+        scrivi(p, "\n*** IMPOSSIBILE AVANZARE! ***\n");
+        scrivi(p, "C'e' un nemico che ti blocca il passaggio!\n");
+        scrivi(p, "Devi sconfiggerlo prima di procedere!\n");
+        return;
+    }
+
+    if (g->mondo == MONDO_REALE) {// Avanza nel Mondo Reale
+        if (g->pos_mondoreale != NULL) {
+            if (g->pos_mondoreale->avanti != NULL) {
+                registra_posizione(p, g);
+                esci_zona(p, g);
+                g->pos_mondoreale = g->pos_mondoreale->avanti;
+                entra_zona(p, g);
+                racconta(p, g, CRONACA_MOSSA, 1, 0, 0, 0);
+                scrivi(p, "\n>>> Ti fai strada verso la zona successiva... <<<\n");
+                stampa_zona_corrente(p, g);
+            } else { // Non c'e' una zona successiva, sei alla fine del percorso
+                scrivi(p, "\n*** FINE DEL PERCORSO ***\n");
+                scrivi(p, "Davanti a te c'e' solo il vuoto.\n");
+                scrivi(p, "Non puoi andare oltre.\n");
+            }
+        }
+    } else {// Avanza nel Soprasotto
+        if (g->pos_soprasotto != NULL) { // Controllo di sicurezza
+            if (g->pos_soprasotto->avanti != NULL) {// C'e' una zona successiva, puoi avanzare
+                registra_posizione(p, g);
+                esci_zona(p, g);
+                g->pos_soprasotto = g->pos_soprasotto->avanti;
+                entra_zona(p, g);
+                racconta(p, g, CRONACA_MOSSA, 1, 0, 0, 0);
+                scrivi(p, "\n>>> Avanzi cautamente nell'oscurita' del Soprasotto... <<<\n");
+                stampa_zona_corrente(p, g);
+            } else {// Non c'e' una zona successiva, sei alla fine del percorso
+                scrivi(p, "\n*** FINE DEL PERCORSO ***\n");
+                scrivi(p, "Davanti a te solo tenebra impenetrabile.\n");
+                scrivi(p, "Non puoi proseguire oltre.\n");
+            }
+        }
+    }
+}
+
+// Permette al giocatore di tornare alla zona precedente, se non ci sono nemici che bloccano il passaggio
+static void indietreggia(Partita* p, Giocatore* g) {
+    if (g == NULL) {// Controllo di sicurezza
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return;
+    }
+
+
+    if (ha_nemico_zona(p, g)) {// C'e' un nemico nella zona, non si puo' indietreggiare
+        scrivi(p, "\n*** IMPOSSIBILE INDIETREGGIARE! ***\n");
+        scrivi(p, "C'e' un nemico che ti blocca!\n");
+        scrivi(p, "Devi sconfiggerlo prima di muoverti!\n");
+        return;
+    }
+
+    if (g->mondo == MONDO_REALE) {// Indietreggia nel Mondo Reale
+        if (g->pos_mondoreale != NULL) {
+            if (g->pos_mondoreale->indietro != NULL) {// C'e' una zona precedente, puoi indietreggiare
+                registra_posizione(p, g);
+                esci_zona(p, g);
+                g->pos_mondoreale = g->pos_mondoreale->indietro;
+                entra_zona(p, g);
+                racconta(p, g, CRONACA_MOSSA, -1, 0, 0, 0);
+                scrivi(p, "\n>>> Torni sui tuoi passi, verso la zona precedente... <<<\n");
+                stampa_zona_corrente(p, g);
+            } else {
+                scrivi(p, "\n*** INIZIO DEL PERCORSO ***\n");
+                scrivi(p, "Sei gia' all'inizio.\n");
+                scrivi(p, "Non puoi tornare piu' indietro.\n");
+            }
+        }
+    } else {// Indietreggia nel Soprasotto
+        if (g->pos_soprasotto != NULL) {
+            if (g->pos_soprasotto->indietro != NULL) {
+                registra_posizione(p, g);
+                esci_zona(p, g);
+                g->pos_soprasotto = g->pos_soprasotto->indietro;
+                entra_zona(p, g);
+                racconta(p, g, CRONACA_MOSSA, -1, 0, 0, 0);
+                scrivi(p, "\n>>> Indietreggi nell'oscurita'... <<<\n");
+                stampa_zona_corrente(p, g);
+            } else {
+                scrivi(p, "\n*** INIZIO DEL PERCORSO ***\n");
+                scrivi(p, "Non puoi tornare piu' indietro.\n");
+                scrivi(p, "Sei vicino al portale di entrata.\n");
+            }
+        }
+    }
+}
+
+// Permette al giocatore di attraversare il portale tra il Mondo Reale e il Soprasotto, se si trovano nelle zone corrette e superano eventuali ostacoli
+static int cambia_mondo(Partita* p, Giocatore* g) {
+    int dado;
+
+    if (g == NULL) {
+        scrivi(p, "Errore: giocatore non valido!\n");
+        return 0;
+    }
+
+    if (g->mondo == MONDO_REALE) {// Dal Mondo Reale al Soprasotto: attraversamento automatico
+        if (g->pos_mondoreale != NULL) {
+            scrivi(p, "\n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "                    ATTRAVERSAMENTO PORTALE                                     \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "Davanti a te si apre un portale dimensionale...\n");
+            scrivi(p, "L'aria trema, la realta' si distorce.\n");
+            scrivi(p, "Colori impossibili danzano ai bordi del portale.\n");
+            scrivi(p, "\n");
+            scrivi(p, "Fai un respiro profondo ed entri.\n");
+            scrivi(p, "\n");
+            scrivi(p, "*** VIENI CATAPULTATO NEL SOPRASOTTO! ***\n");
+            scrivi(p, "\n");
+            scrivi(p, "Tutto e' distorto, oscuro, sbagliato...\n");
+            scrivi(p, "Il freddo ti penetra nelle ossa.\n");
+            scrivi(p, "================================================================================\n");
+
+            metrica_conta(METRICA_PORTALI_TENTATI, 1); // Verso il Soprasotto si passa sempre
+            metrica_conta(METRICA_PORTALI_RIUSCITI, 1);
+            registra_posizione(p, g);
+            esci_zona(p, g);
+            g->pos_soprasotto = g->pos_mondoreale->link_soprasotto;
+            g->pos_mondoreale = NULL; /* FIX: pulisce il riferimento al mondo precedente */
+            g->mondo = SOPRASOTTO;
+            entra_zona(p, g);
+            racconta(p, g, CRONACA_PORTALE, 0, g->fortuna, 1, 0);
+            stampa_zona_corrente(p, g);
+            return 1;
+        }
+    } else {
+        /* Dal Soprasotto al Mondo Reale: tiro di fortuna */
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "                    TENTATIVO DI FUGA                                           \n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "\n");
+        scrivi(p, "Cerchi disperatamente un portale per tornare a casa...\n");
+        scrivi(p, "La paura ti attanaglia, ma devi provare!\n");
+        scrivi(p, "Chiudi gli occhi e ti concentri sulla realta'...\n");
+        scrivi(p, "Visualizzi il Mondo Reale, i colori veri, la luce...\n");
+        scrivi(p, "\n");
+
+        dado = lancia_dado(p);// Tiro di fortuna contro la fortuna del giocatore
+        metrica_conta(METRICA_PORTALI_TENTATI, 1);
+
+        scrivi(p, "[Tiro di Fortuna: %d VS Tua Fortuna: %d]\n\n", dado, g->fortuna);
+
+        if (dado < g->fortuna) {// Successo: il giocatore riesce a tornare al Mondo Reale
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "                         *** CE L'HAI FATTA! ***                                \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "Un portale luminoso si apre davanti a te!\n");
+            scrivi(p, "Ti tuffi attraverso con tutte le tue forze e...\n");
+            scrivi(p, "\n");
+            scrivi(p, "...TORNI AL MONDO REALE!\n");
+            scrivi(p, "\n");
+            scrivi(p, "L'aria fresca, i colori normali, il calore del sole...\n");
+            scrivi(p, "Sei salvo! Almeno per ora.\n");
+            scrivi(p, "================================================================================\n");
+
+            if (g->pos_soprasotto != NULL) {// Controllo di sicurezza
+                metrica_conta(METRICA_PORTALI_RIUSCITI, 1);
+                registra_posizione(p, g);
+                esci_zona(p, g);
+                g->pos_mondoreale = g->pos_soprasotto->link_mondoreale;
+                g->pos_soprasotto = NULL; /* FIX: pulisce il riferimento al mondo precedente */
+                g->mondo = MONDO_REALE;
+                entra_zona(p, g);
+                racconta(p, g, CRONACA_PORTALE, dado, g->fortuna, 1, 0);
+                stampa_zona_corrente(p, g);
+                return 1;
+            }
+        } else {// Fallimento: il giocatore non riesce a tornare al Mondo Reale
+            racconta(p, g, CRONACA_PORTALE, dado, g->fortuna, 0, 0);
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "                        *** NON CE LA FAI! ***                                  \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "Il portale sfarfalla per un momento...\n");
+            scrivi(p, "Quasi... quasi riesci a vederlo...\n");
+            scrivi(p, "Ma poi scompare!\n");
+            scrivi(p, "\n");
+            scrivi(p, "Sei ancora intrappolato nel Soprasotto!\n");
+            scrivi(p, "L'oscurita' ti circonda.\n");
+            scrivi(p, "Dovrai riprovare piu' tardi.\n");
+            scrivi(p, "================================================================================\n");
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/* ============================================================================
+ * SISTEMA DI COMBATTIMENTO
+ * ============================================================================ */
+
+// Inizializza le statistiche di un nemico leggendole dal registro, restituendo HP, attacco e difesa tramite parametri di output
+static void inizializza_statistiche_nemico(Tipo_nemico nemico, int* hp, int* attacco, int* difesa) {
+    const Statistiche_nemico* s = registro_nemico((int)nemico);
+
+    *hp      = s->hp;
+    *attacco = s->attacco;
+    *difesa  = s->difesa;
+}
+
+// Prepara il combattimento contro il nemico presente nella zona del giocatore, restituendo 1 se il combattimento inizia e 0 se non c'e' nessun nemico
+static int inizia_combattimento(Partita* p, Giocatore* g) {
+    Tipo_nemico nemico;
+
+    if (g == NULL) {
+        return 0;
+    }
+
+    if (g->mondo == MONDO_REALE) {// Controlla se c'e' un nemico nel Mondo Reale
+        if (g->pos_mondoreale == NULL || nemico_mondoreale(p, g->pos_mondoreale) == NESSUN_NEMICO) {
+            scrivi(p, "\nNon c'e' nessun nemico da combattere qui!\n");
+            return 0;
+        }
+        nemico = nemico_mondoreale(p, g->pos_mondoreale);
+    } else {// Controlla se c'e' un nemico nel Soprasotto
+        if (g->pos_soprasotto == NULL || nemico_soprasotto(p, g->pos_soprasotto) == NESSUN_NEMICO) {
+            scrivi(p, "\nNon c'e' nessun nemico da combattere qui!\n");
+            return 0;
+        }
+        nemico = nemico_soprasotto(p, g->pos_soprasotto);
     }
-    while (getchar() != '\n');
 
-    if (posizione < 1 || posizione > num_zone) {
-        printf("Errore: posizione non valida! Deve essere tra 1 e %d.\n", num_zone);
-        return;
-    }
+    p->nemico = nemico;
+    inizializza_statistiche_nemico(nemico, &p->hp_nemico, &p->attacco_nemico, &p->difesa_nemico);
+    metrica_combattimento((int)nemico, COMBATTIMENTO_INIZIATO);
+    racconta(p, g, CRONACA_COMBATTIMENTO, (int)nemico, p->hp_nemico, p->attacco_nemico, p->difesa_nemico);
 
-    current_mr = prima_zona_mondoreale;
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                       !!! COMBATTIMENTO !!!                                    \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
 
-    for (i = 1; i < posizione && current_mr != NULL; i++) {
-        current_mr = current_mr->avanti;
+    if (registro_messaggio_nemico(nemico, MSG_NEMICO_COMBATTIMENTO)[0] != '\0') {
+        scrivi(p, "%s", registro_messaggio_nemico(nemico, MSG_NEMICO_COMBATTIMENTO));
+    } else {
+        scrivi(p, "Un nemico ti sbarra la strada!\n");
     }
 
-    if (current_mr == NULL) {
-        printf("Errore: zona non trovata!\n");
-        return;
+    scrivi(p, "\n");
+    scrivi(p, "Statistiche nemico:\n");
+    scrivi(p, "  HP: %d | Attacco: %d | Difesa: %d\n", p->hp_nemico, p->attacco_nemico, p->difesa_nemico);
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    return 1;
+}
+
+// Mostra i punti vita dei due contendenti e le azioni disponibili nel combattimento
+static void stampa_turno_combattimento(Partita* p, Giocatore* g) {
+    scrivi(p, "\n");
+    scrivi(p, "--- Turno di %s ---\n", nome_giocatore(p, g));
+    scrivi(p, "Tuoi PV: %d/%d\n", g->punti_vita, PV_INIZIALI);
+    scrivi(p, "PV Nemico: %d\n", p->hp_nemico);
+    scrivi(p, "\n");
+    scrivi(p, "Azioni disponibili:\n");
+    scrivi(p, "1) Attacco base (danno normale)\n");
+    scrivi(p, "2) Attacco potenziato (-%d PV, danno x%.1f)\n",
+           COSTO_ATTACCO_POTENZIATO, MOLTIPLICATORE_POTENZIATO);
+    scrivi(p, "3) Difesa (+%d difesa per questo turno)\n", BONUS_DIFESA_TEMPORANEO);
+    scrivi(p, "4) Utilizza oggetto dallo zaino\n");
+    scrivi(p, "Scegli azione: ");
+}
+
+// Esegue un round di combattimento con l'azione scelta, restituendo 1 se il giocatore vince, 2 se sconfigge il Demotorzone, -1 se muore e 0 se il combattimento continua
+static int round_combattimento(Partita* p, Giocatore* g, int scelta) {
+    int danno;
+    int dado_giocatore, dado_nemico;
+    int difesa_temporanea_attiva = 0; // Flag per indicare se la difesa temporanea e' attiva (bonus di difesa per un turno)
+
+    registra_statistiche(p, g);
+
+    switch (scelta) {
+        case 1:
+            /* Attacco base */
+            dado_giocatore = lancia_dado(p);
+            dado_nemico    = lancia_dado(p);
+            danno = (g->attacco_psichico + dado_giocatore) - (p->difesa_nemico + dado_nemico);
+
+            if (danno < 0) danno = 0;
+            p->hp_nemico -= danno;
+            racconta(p, g, CRONACA_ATTACCO, scelta, dado_giocatore, dado_nemico, danno);
+            GIORNALE(GIORNALE_DEBUG, "sessione %llu round %lld: attacco %lld, dadi %lld contro %lld, danno %lld",
+                     (long long)p->sessione, p->turno, scelta, dado_giocatore, dado_nemico, danno);
+
+            scrivi(p, "\n>>> ATTACCO BASE! <<<\n");
+            scrivi(p, "Danno inflitto: %d\n", danno);
+            scrivi(p, "(Tuo attacco: %d + dado %d = %d VS Difesa nemica: %d + dado %d = %d)\n",
+                   g->attacco_psichico, dado_giocatore, g->attacco_psichico + dado_giocatore,
+                   p->difesa_nemico,    dado_nemico,    p->difesa_nemico + dado_nemico);
+            break;
+
+        case 2:
+            /* Attacco potenziato */
+            if (g->punti_vita <= COSTO_ATTACCO_POTENZIATO) {// Il giocatore non ha abbastanza PV per usare l'attacco potenziato
+                scrivi(p, "\n*** NON HAI ABBASTANZA PV! ***\n");
+                scrivi(p, "Hai solo %d PV, l'attacco ne costa %d.\n",
+                       g->punti_vita, COSTO_ATTACCO_POTENZIATO);
+                scrivi(p, "Usa l'attacco base o difenditi!\n");
+                return 0;
+            }
+
+            g->punti_vita -= COSTO_ATTACCO_POTENZIATO;
+            metrica_conta(METRICA_ATTACCHI_POTENZIATI, 1);
+            dado_giocatore = lancia_dado(p);
+            dado_nemico    = lancia_dado(p);
+            danno = ((int)((double)g->attacco_psichico * MOLTIPLICATORE_POTENZIATO) + dado_giocatore)
+                    - (p->difesa_nemico + dado_nemico);
+
+            if (danno < 0) danno = 0;
+            p->hp_nemico -= danno;
+            racconta(p, g, CRONACA_ATTACCO, scelta, dado_giocatore, dado_nemico, danno);
+            GIORNALE(GIORNALE_DEBUG, "sessione %llu round %lld: attacco %lld, dadi %lld contro %lld, danno %lld",
+                     (long long)p->sessione, p->turno, scelta, dado_giocatore, dado_nemico, danno);
+
+            scrivi(p, "\n>>> ATTACCO POTENZIATO! <<<\n");
+            scrivi(p, "Sacrifichi %d PV per un attacco devastante!\n", COSTO_ATTACCO_POTENZIATO);
+            scrivi(p, "Danno inflitto: %d\n", danno);
+            break;
+
+        case 3:
+            /* Difesa temporanea: vale solo per il contrattacco di questo round */
+            scrivi(p, "\n>>> POSIZIONE DIFENSIVA! <<<\n");
+            scrivi(p, "Ti metti in guardia!\n");
+            scrivi(p, "Difesa +%d per questo turno.\n", BONUS_DIFESA_TEMPORANEO);
+            g->difesa_psichica += BONUS_DIFESA_TEMPORANEO;
+            difesa_temporanea_attiva = 1;
+            break;
+
+        default:
+            scrivi(p, "Azione non valida!\n");
+            return 0;
     }
 
-    printf("\n=== ZONA %d - MONDO REALE ===\n", posizione);
-    printf("Tipo: %s\n",    tipo_zona_to_string(current_mr->tipo));
-    printf("Nemico: %s\n",  tipo_nemico_to_string(current_mr->nemico));
-    printf("Oggetto: %s\n", tipo_oggetto_to_string(current_mr->oggetto));
+    /* Controlla se il nemico e' morto */
+    if (p->hp_nemico <= 0) {
+        if (difesa_temporanea_attiva) {
+            g->difesa_psichica -= BONUS_DIFESA_TEMPORANEO;
+        }
 
-    printf("\n=== ZONA %d - SOPRASOTTO ===\n", posizione);
-    printf("Tipo: %s\n",   tipo_zona_to_string(current_mr->link_soprasotto->tipo));
-    printf("Nemico: %s\n", tipo_nemico_to_string(current_mr->link_soprasotto->nemico));
-    printf("\n");
-}
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+
+        if (registro_nemico(p->nemico)->finale) {
+            scrivi(p, "                    *** VITTORIA EPICA! ***                                     \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "Il Demotorzone emette un ultimo urlo elettrico!\n");
+            scrivi(p, "Scintille esplodono ovunque mentre crolla a terra!\n");
+            scrivi(p, "\n");
+            scrivi(p, "****************************************************\n");
+            scrivi(p, "*   CE L'HAI FATTA! HAI SCONFITTO IL DEMOTORZONE!  *\n");
+            scrivi(p, "*   HAI SALVATO OCCHINZ!                           *\n");
+            scrivi(p, "****************************************************\n");
+        } else {
+            scrivi(p, "                    *** NEMICO SCONFITTO! ***                                   \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "%s cade a terra, sconfitto!\n", tipo_nemico_to_string(p->nemico));
+            scrivi(p, "Hai vinto il combattimento!\n");
+        }
 
-// Valida la mappa e la chiude per le modifiche, rendendola pronta per il gioco
-static void chiudi_mappa(void) {
-    int num_zone        = conta_zone_mondoreale();
-    int num_demotorzone = conta_demotorzone();
+        /* Possibilita' che il nemico sparisca dalla zona */
+        if (estrai(p, 2) == 0) {
+            scrivi(p, "\nIl corpo del nemico si dissolve nell'aria...\n");
+            scrivi(p, "La zona e' ora sicura.\n");
+            togli_nemico(p, g);
+        } else {// Il nemico rimane a terra, ma potrebbe essere ancora pericoloso
+            scrivi(p, "\nIl nemico giace a terra, ma potrebbe non essere finita...\n");
+            scrivi(p, "Potrebbe ancora essere qui se qualcun altro passa.\n");
+        }
 
-    if (num_zone < ZONE_MINIME) {
-        printf("\nErrore: la mappa deve avere almeno %d zone!\n", ZONE_MINIME);
-        printf("Attualmente ne hai %d. Aggiungine altre %d.\n",
-               num_zone, ZONE_MINIME - num_zone);
-        return;
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+
+        if (registro_nemico(p->nemico)->finale) {
+            return 2;
+        }
+        return 1;
     }
 
-    if (num_demotorzone != 1) {
-        printf("\nErrore: la mappa deve avere esattamente 1 Demotorzone nel Soprasotto!\n");
-        if (num_demotorzone == 0) {
-            printf("Attualmente non ce ne sono. Devi generare nuovamente la mappa\n");
-            printf("o inserire manualmente una zona con Demotorzone nel Soprasotto.\n");
+    /* ========================================================================
+     * TURNO DEL NEMICO
+     * ======================================================================== */
+    scrivi(p, "\n");
+    scrivi(p, "--- Il nemico contrattacca! ---\n");
+    dado_nemico    = lancia_dado(p);
+    dado_giocatore = lancia_dado(p);
+    danno = (p->attacco_nemico + dado_nemico) - (g->difesa_psichica + dado_giocatore);
+
+    if (danno < 0) danno = 0;
+    racconta(p, g, CRONACA_CONTRATTACCO, difesa_temporanea_attiva, dado_nemico, dado_giocatore, danno);
+    GIORNALE(GIORNALE_DEBUG, "sessione %llu round %lld: contrattacco, dadi %lld contro %lld, danno %lld, PV nemico %lld",
+             (long long)p->sessione, p->turno, dado_nemico, dado_giocatore, danno, p->hp_nemico);
+
+    if (danno == 0) {
+        scrivi(p, "\n>>> HAI PARATO L'ATTACCO! <<<\n");
+        scrivi(p, "Nessun danno subito!\n");
+    } else {
+        g->punti_vita = (int16_t)(g->punti_vita - danno);
+
+        if (danno < 5) {
+            scrivi(p, "\n%s ti graffia leggermente.\n", tipo_nemico_to_string(p->nemico));
+            scrivi(p, "Danni subiti: %d\n", danno);
+        } else if (danno < 10) {
+            scrivi(p, "\n%s ti colpisce duramente!\n", tipo_nemico_to_string(p->nemico));
+            scrivi(p, "Danni subiti: %d\n", danno);
+            scrivi(p, "Senti il dolore penetrarti!\n");
         } else {
-            printf("Attualmente ne hai %d. Devi generare nuovamente la mappa.\n", num_demotorzone);
+            scrivi(p, "\n*** COLPO DEVASTANTE! ***\n");
+            scrivi(p, "%s sferra un attacco micidiale!\n", tipo_nemico_to_string(p->nemico));
+            scrivi(p, "Danni subiti: %d\n", danno);
+            scrivi(p, "Barcollando, riesci a rimanere in piedi!\n");
         }
-        return;
     }
 
-    mappa_chiusa = 1;
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                     MAPPA VALIDATA E CHIUSA                                    \n");
-    printf("================================================================================\n");
-    printf("\nLa mappa e' pronta! Hai creato %d zone.\n", num_zone);
-    printf("Il Demotorzone ti aspetta nel Soprasotto...\n");
-    printf("Il gioco e' pronto per iniziare!\n");
-    printf("================================================================================\n");
+    scrivi(p, "(Attacco nemico: %d + dado %d = %d VS Tua difesa: %d + dado %d = %d)\n",
+           p->attacco_nemico,   dado_nemico,    p->attacco_nemico + dado_nemico,
+           g->difesa_psichica,  dado_giocatore, g->difesa_psichica + dado_giocatore);
+
+
+    if (difesa_temporanea_attiva) {// Rimuove il bonus di difesa temporanea alla fine del turno del nemico
+        g->difesa_psichica -= BONUS_DIFESA_TEMPORANEO;
+    }
+
+    /* Controlla se il giocatore e' morto */
+    if (g->punti_vita <= 0) {
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "                    *** SEI STATO SCONFITTO ***                                 \n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "\n");
+        scrivi(p, "Le tue forze ti abbandonano...\n");
+        scrivi(p, "Le ginocchia cedono...\n");
+        scrivi(p, "Tutto diventa nero...\n");
+        scrivi(p, "\n");
+        scrivi(p, ">>> %s e' morto. <<<\n", nome_giocatore(p, g));
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+        return -1;
+    }
+
+    return 0;
 }
 
 /* ============================================================================
- * FUNZIONE PUBBLICA: IMPOSTA_GIOCO
+ * MACCHINA A STATI DEI TURNI
  * ============================================================================ */
 
-// Permette di configurare il gioco, impostare i giocatori e preparare la mappa
-void imposta_gioco(void) {
-    int i;
-    int scelta_menu;
-    int num_input;
-    int scelta_abilita;
-    int undici_disponibile = 1;
-
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                         IMPOSTAZIONE GIOCO                                     \n");
-    printf("================================================================================\n");
-
-    libera_giocatori();
-    libera_mappe();
-    mappa_chiusa    = 0;
-    gioco_impostato = 0;
-    num_giocatori   = 0;
+// Stampa il menu delle azioni disponibili nel turno
+static void stampa_menu_azioni(Partita* p) {
+    scrivi(p, "\n");
+    scrivi(p, "--- Azioni Disponibili ---\n");
+    scrivi(p, "1) Avanza alla zona successiva\n");
+    scrivi(p, "2) Indietreggia alla zona precedente\n");
+    scrivi(p, "3) Cambia mondo (attraversa portale)\n");
+    scrivi(p, "4) Combatti nemico\n");
+    scrivi(p, "5) Visualizza valori giocatore\n");
+    scrivi(p, "6) Visualizza zona corrente\n");
+    scrivi(p, "7) Raccogli oggetto\n");
+    scrivi(p, "8) Utilizza oggetto dallo zaino\n");
+    scrivi(p, "9) Passa il turno\n");
+    scrivi(p, "\n");
+    scrivi(p, "Scegli azione: ");
+}
 
-    /* ========================================================================
-     * FASE 1: CONFIGURAZIONE GIOCATORI
-     * ======================================================================== */
+/**
+ * Registra nella classifica (e nelle metriche) una partita appena conclusa e, se c'e' un vincitore, ne mostra le vittorie
+ * @param p Partita conclusa
+ * @param vincitore Giocatore che ha sconfitto il Demotorzone, NULL se sono caduti tutti
+ */
+static void registra_esito(Partita* p, Giocatore* vincitore) {
+    Esito_partita esito;
+    Voce_classifica voce;
+    int i;
 
-    do {
-        printf("\nInserisci il numero di giocatori (1-4): ");
-        if (scanf("%d", &num_input) != 1) {
-            while (getchar() != '\n');
-            printf("Errore: devi inserire un numero intero!\n");
-            continue;
+    metrica_osserva(ISTOGRAMMA_ROUND_PARTITA, (uint64_t)p->turno);
+    GIORNALE(GIORNALE_INFO, "sessione %llu: partita conclusa dopo %lld round, %lld giocatori caduti, vincitore %lld",
+             (long long)p->sessione, p->turno, p->num_giocatori - p->num_vivi,
+             vincitore != NULL ? (long long)(vincitore - p->giocatori) : -1LL);
+    if (classifica_gioco == NULL) {
+        return;
+    }
+    memset(&esito, 0, sizeof(esito));
+    esito.quando    = (int64_t)time(NULL);
+    esito.turni     = (uint32_t)p->turno;
+    esito.giocatori = (uint16_t)p->num_giocatori;
+    esito.morti     = (uint16_t)(p->num_giocatori - p->num_vivi);
+    if (vincitore != NULL) {
+        snprintf(esito.vincitore, NOME_MAX, "%s", nome_giocatore(p, vincitore));
+        esito.attacco_psichico = vincitore->attacco_psichico;
+        esito.difesa_psichica  = vincitore->difesa_psichica;
+        esito.fortuna          = vincitore->fortuna;
+        esito.punti_vita       = vincitore->punti_vita;
+        for (i = 0; i < p->dimensione_zaino; i++) {
+            esito.zaino[i] = (uint8_t)oggetto_nello_slot(zaino_giocatore(p, vincitore), i);
         }
-        while (getchar() != '\n');
+    }
 
-        if (num_input < 1 || num_input > 4) {
-            printf("Errore: il numero di giocatori deve essere tra 1 e 4!\n");
-        }
-    } while (num_input < 1 || num_input > 4);
+    if (classifica_registra(classifica_gioco, &esito) < 0) {
+        scrivi(p, "\n(Impossibile registrare la partita nella classifica)\n");
+        return;
+    }
+    classifica_aggiorna(classifica_gioco);
+    if (vincitore != NULL && classifica_giocatore(classifica_gioco, esito.vincitore, &voce)) {
+        scrivi(p, "\nVittorie di %s: %u (record: %u round)\n", esito.vincitore, voce.vittorie, voce.miglior_turni);
+    }
+}
 
-    num_giocatori = num_input;
+// Cerca il prossimo giocatore vivo nell'ordine del round (mescolando un nuovo ordine a inizio round), annuncia il suo turno e attende la prima azione
+static void inizia_turno(Partita* p) {
+    int i;
 
-    for (i = 0; i < num_giocatori; i++) {
-        giocatori[i] = (Giocatore*)malloc(sizeof(Giocatore));
-        if (giocatori[i] == NULL) {
-            printf("Errore: memoria insufficiente per creare i giocatori!\n");
-            libera_giocatori();
+    while (1) {
+
+        // Condizione di sconfitta
+        if (p->num_vivi == 0) {
+            scrivi(p, "\n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "                         GAME OVER                                              \n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "\n");
+            scrivi(p, "Tutti i giocatori sono caduti in battaglia...\n");
+            scrivi(p, "Il Demotorzone continua a terrorizzare Occhinz.\n");
+            scrivi(p, "La citta' e' perduta.\n");
+            scrivi(p, "\n");
+            scrivi(p, "Forse la prossima volta...\n");
+            scrivi(p, "================================================================================\n");
+            racconta(p, NULL, CRONACA_SCONFITTA, p->num_giocatori, 0, 0, 0);
+            registra_esito(p, NULL);
+            p->gioco_impostato = 0;
+            torna_al_menu(p);
             return;
         }
 
-        printf("\n--- Giocatore %d ---\n", i + 1);
-        printf("Inserisci il nome (max %d caratteri): ", NOME_MAX - 1);
-        if (fgets(giocatori[i]->nome, NOME_MAX, stdin) != NULL) { 
-            size_t len = strlen(giocatori[i]->nome);
-            if (len > 0 && giocatori[i]->nome[len - 1] == '\n') {// Rimuove il newline se presente
-                giocatori[i]->nome[len - 1] = '\0';
+        // Inizio nuovo round: mescola i vivi e congela num_vivi_round, il costo e' lineare nei soli vivi
+        if (p->idx_turno == 0) {
+            registra_ordine(p);
+            p->num_vivi_round = p->num_vivi;
+            memcpy(p->ordine_turno, p->vivi, (size_t)p->num_vivi * sizeof(int));
+
+            for (i = 0; i < p->num_vivi_round; i++) {// Fisher-Yates shuffle per mescolare l'ordine dei giocatori
+                int r   = estrai(p, p->num_vivi_round);
+                int tmp = p->ordine_turno[i];
+                p->ordine_turno[i] = p->ordine_turno[r];
+                p->ordine_turno[r] = tmp;
             }
-        }
 
-        giocatori[i]->attacco_psichico = lancia_dado();
-        giocatori[i]->difesa_psichica  = lancia_dado();
-        giocatori[i]->fortuna          = lancia_dado();
-        giocatori[i]->punti_vita       = PV_INIZIALI;
+            p->turno++;
+            scrivi(p, "\n");
+            scrivi(p, "================================================================================\n");
+            scrivi(p, "                           ROUND %d                                             \n", p->turno);
+            scrivi(p, "================================================================================\n");
+        }
 
-        printf("\nAbilita' iniziali (lancio dado da 20):\n");
-        printf("  Attacco Psichico: %d\n", giocatori[i]->attacco_psichico);
-        printf("  Difesa Psichica:  %d\n", giocatori[i]->difesa_psichica);
-        printf("  Fortuna:          %d\n", giocatori[i]->fortuna);
-        printf("  Punti Vita:       %d\n", giocatori[i]->punti_vita);
 
-        printf("\nVuoi modificare le tue abilita'?\n");
-        printf("1) +%d Attacco, -%d Difesa\n", MODIFICA_ATTACCO_DIFESA, MODIFICA_ATTACCO_DIFESA);
-        printf("2) +%d Difesa, -%d Attacco\n", MODIFICA_ATTACCO_DIFESA, MODIFICA_ATTACCO_DIFESA);
-        if (undici_disponibile) {
-            printf("3) Diventa UndiciVirgolaCinque (+%d Attacco, +%d Difesa, -%d Fortuna)\n",
-                   BONUS_UNDICI_ATTACCO, BONUS_UNDICI_DIFESA, MALUS_UNDICI_FORTUNA);
+        if (p->idx_turno >= p->num_vivi_round) {//confronto con num_vivi_round, non con num_giocatori
+            p->idx_turno = 0;
+            continue;
         }
-        printf("4) Nessuna modifica\n");
-        printf("Scegli: ");
 
-        if (scanf("%d", &scelta_abilita) != 1) {
-            while (getchar() != '\n');
-            scelta_abilita = 4;
-        }
-        while (getchar() != '\n');
+        p->giocatore_corrente = p->ordine_turno[p->idx_turno];
 
-        switch (scelta_abilita) {
-            case 1:
-                giocatori[i]->attacco_psichico += MODIFICA_ATTACCO_DIFESA;
-                giocatori[i]->difesa_psichica  -= MODIFICA_ATTACCO_DIFESA;
-                if (giocatori[i]->difesa_psichica < 1) {
-                    giocatori[i]->difesa_psichica = 1;
-                }
-                printf("Abilita' modificate! Sei ora piu' offensivo.\n");
-                break;
-            case 2:
-                giocatori[i]->difesa_psichica  += MODIFICA_ATTACCO_DIFESA;
-                giocatori[i]->attacco_psichico -= MODIFICA_ATTACCO_DIFESA;
-                if (giocatori[i]->attacco_psichico < 1) {
-                    giocatori[i]->attacco_psichico = 1;
-                }
-                printf("Abilita' modificate! Sei ora piu' difensivo.\n");
-                break;
-            case 3:
-                if (undici_disponibile) {
-                    giocatori[i]->attacco_psichico += BONUS_UNDICI_ATTACCO;
-                    giocatori[i]->difesa_psichica  += BONUS_UNDICI_DIFESA;
-                    giocatori[i]->fortuna          -= MALUS_UNDICI_FORTUNA;
-                    if (giocatori[i]->fortuna < 1) {
-                        giocatori[i]->fortuna = 1;
-                    }
-                    strncpy(giocatori[i]->nome, "UndiciVirgolaCinque", NOME_MAX - 1);
-                    giocatori[i]->nome[NOME_MAX - 1] = '\0';
-                    undici_disponibile = 0;
-                    printf("\n*** SEI DIVENTATO UNDICIVIRGOLACINQUE! ***\n");
-                    printf("Poteri aumentati, ma la fortuna ti ha abbandonato!\n");
-                } else {
-                    printf("UndiciVirgolaCinque non e' piu' disponibile!\n");
-                    printf("Un altro giocatore ha gia' preso questo ruolo.\n");
-                }
-                break;
-            default:
-                printf("Nessuna modifica applicata.\n");
-                break;
-        }
-        // Imposta la posizione iniziale del giocatore nel Mondo Reale (prima zona)
-        giocatori[i]->mondo          = MONDO_REALE;
-        giocatori[i]->pos_mondoreale = NULL;
-        giocatori[i]->pos_soprasotto = NULL;
-
-        {
-            int j;
-            for (j = 0; j < ZAINO_MAX; j++) {
-                giocatori[i]->zaino[j] = NESSUN_OGGETTO;
+        // Salta se il giocatore e' morto durante questo round
+        if (!giocatore_vivo(p, p->giocatore_corrente)) {
+            p->idx_turno++;
+            if (p->idx_turno >= p->num_vivi_round) { // Se abbiamo finito i giocatori vivi per questo round, resetta l'ordine e inizia un nuovo round
+                p->idx_turno = 0;
             }
+            continue;
         }
 
-        printf("\nGiocatore %d configurato con successo!\n", i + 1);
-        printf("Abilita' finali:\n");
-        printf("  Attacco: %d | Difesa: %d | Fortuna: %d\n",
-               giocatori[i]->attacco_psichico,
-               giocatori[i]->difesa_psichica,
-               giocatori[i]->fortuna);
+        break;
     }
 
-    /* ========================================================================
-     * FASE 2: CREAZIONE MAPPA
-     * ======================================================================== */
+    registra_segno(p);
+    annuncia_turno(p);
+}
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                         CREAZIONE MAPPA                                        \n");
-    printf("================================================================================\n");
-    printf("\nOra devi creare la mappa del gioco.\n");
-    printf("Puoi generare una mappa casuale o costruirla manualmente.\n");
-    printf("Ricorda: servono almeno %d zone e 1 Demotorzone!\n", ZONE_MINIME);
-
-    do {
-        printf("\n--- Menu Creazione Mappa ---\n");
-        printf("1) Genera mappa casuale (%d zone)\n", ZONE_MINIME);
-        printf("2) Inserisci zona manualmente\n");
-        printf("3) Cancella zona\n");
-        printf("4) Visualizza mappa completa\n");
-        printf("5) Visualizza singola zona\n");
-        printf("6) Chiudi mappa e termina impostazione\n");
-        printf("Scegli: ");
-
-        if (scanf("%d", &scelta_menu) != 1) {
-            while (getchar() != '\n');
-            printf("Errore: devi inserire un numero intero!\n");
-            continue;
-        }
-        while (getchar() != '\n');
-
-        switch (scelta_menu) {
-            case 1: genera_mappa();    break;
-            case 2: inserisci_zona();  break;
-            case 3: cancella_zona();   break;
-            case 4: stampa_mappa();    break;
-            case 5: stampa_zona();     break;
-            case 6:
-                chiudi_mappa();
-                if (mappa_chiusa) {
-                    gioco_impostato = 1;
-                }
-                break;
-            default:
-                printf("Scelta non valida! Inserisci un numero da 1 a 6.\n");
-                break;
-        }
-    } while (!mappa_chiusa);
+// Annuncia il turno del giocatore corrente e attende la prima azione
+static void annuncia_turno(Partita* p) {
+    Giocatore* g = &p->giocatori[p->giocatore_corrente];
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                   IMPOSTAZIONE COMPLETATA!                                     \n");
-    printf("================================================================================\n");
-    printf("\nIl gioco e' pronto. Torna al menu principale e scegli \"Gioca\"!\n");
-}
+    metrica_conta(METRICA_TURNI, 1);
 
-/* ============================================================================
- * FUNZIONI DI GIOCO - VISUALIZZAZIONE
- * ============================================================================ */
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                    Turno di: %s                                   \n", nome_giocatore(p, g));
+    scrivi(p, "================================================================================\n");
 
-// Stampa le informazioni dettagliate di un giocatore, inclusi nome, mondo, statistiche e inventario
-static void stampa_giocatore_info(Giocatore* g) {
-    int i;
+    stampa_zona_corrente(p, g);
 
-    if (g == NULL) {
-        printf("Errore: giocatore non valido!\n");
-        return;
-    }
+    p->nemico_presente         = ha_nemico_zona(p, g);
+    p->mossa_effettuata        = 0;
+    p->appena_mosso_con_nemico = 0;
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                     SCHEDA GIOCATORE                                           \n");
-    printf("================================================================================\n");
-    printf("\n");
-    printf("Nome: %s\n", g->nome);
-    printf("Mondo attuale: %s\n", g->mondo == MONDO_REALE ? "Mondo Reale" : "Soprasotto");
-    printf("\n--- Statistiche ---\n");
-    printf("Punti Vita:       %d/%d\n", g->punti_vita, PV_INIZIALI);
-    printf("Attacco Psichico: %d\n",    g->attacco_psichico);
-    printf("Difesa Psichica:  %d\n",    g->difesa_psichica);
-    printf("Fortuna:          %d\n",    g->fortuna);
-    printf("\n--- Inventario ---\n");
+    stampa_menu_azioni(p);
+    p->stato = STATO_AZIONE;
+}
 
-    for (i = 0; i < ZAINO_MAX; i++) {
-        printf("  Slot %d: %s\n", i + 1, tipo_oggetto_to_string(g->zaino[i]));
+// Chiude il turno del giocatore corrente e passa al prossimo giocatore vivo nell'ordine del turno
+static void termina_turno(Partita* p) {
+    p->idx_turno++;
+    if (p->idx_turno >= p->num_vivi_round) {
+        p->idx_turno = 0;
     }
-    printf("\n");
-    printf("================================================================================\n");
+    inizia_turno(p);
 }
 
-// Stampa le informazioni dettagliate della zona in cui si trova il giocatore, inclusi tipo di zona, nemici presenti e oggetti disponibili
-static void stampa_zona_corrente(Giocatore* g) {
-    if (g == NULL) {
-        printf("Errore: giocatore non valido!\n");
-        return;
+// Applica l'esito di un combattimento concluso: morte del giocatore, vittoria finale o vittoria normale
+static void concludi_combattimento(Partita* p, int risultato_combattimento) {
+    Giocatore* g = &p->giocatori[p->giocatore_corrente];
+
+    metrica_combattimento((int)p->nemico, risultato_combattimento == -1 ? COMBATTIMENTO_PERSO : COMBATTIMENTO_VINTO);
+    registra_statistiche(p, g);
+    registra_effetti(p, g);
+    if (termina_effetti_temporanei(g, zaino_giocatore(p, g)) && risultato_combattimento != -1) {
+        scrivi(p, "\nGli effetti temporanei degli oggetti svaniscono.\n");
     }
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                     DOVE TI TROVI                                              \n");
-    printf("================================================================================\n");
+    if (risultato_combattimento == -1) {
+        /* Giocatore morto */
+        scrivi(p, "\n");
+        scrivi(p, ">>> %s e' caduto in battaglia... <<<\n", nome_giocatore(p, g));
+        scrivi(p, "Il suo nome sara' ricordato negli annali di Occhinz.\n");
+        racconta(p, g, CRONACA_MORTE, (int)p->nemico, 0, 0, 0);
+        registra_morte(p, p->giocatore_corrente);
+        esci_zona(p, g);
+        rimuovi_giocatore(p, p->giocatore_corrente);
+        termina_turno(p);
+
+    } else if (risultato_combattimento == 2) {
+        // Vittoria finale: Demotorzone sconfitto
+        scrivi(p, "\n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "                    *** VITTORIA FINALE ***                                    \n");
+        scrivi(p, "================================================================================\n");
+        scrivi(p, "\n");
+        scrivi(p, "Con il Demotorzone sconfitto, i portali cominciano a chiudersi!\n");
+        scrivi(p, "Il Soprasotto si dissolve, la realta' torna normale!\n");
+        scrivi(p, "\n");
+        scrivi(p, ">>> %s ha salvato Occhinz! <<<\n", nome_giocatore(p, g));
+        scrivi(p, "\n");
+        scrivi(p, "La citta' e' salva. Le biciclette scomparse riappaiono misteriosamente.\n");
+        scrivi(p, "I Waffle Undici non sono mai stati cosi' buoni.\n");
+        scrivi(p, "Sei un eroe!\n");
+        scrivi(p, "================================================================================\n");
+        racconta(p, g, CRONACA_VITTORIA, (int)p->nemico, g->punti_vita, 0, 0);
+        registra_esito(p, g);
+
+        p->gioco_impostato = 0;
+        torna_al_menu(p);
 
-    if (g->mondo == MONDO_REALE) {
-        if (g->pos_mondoreale != NULL) {
-            printf("\nSei nel MONDO REALE\n");
-            printf("Zona: %s\n", tipo_zona_to_string(g->pos_mondoreale->tipo));
-            printf("\n");
-
-            if (g->pos_mondoreale->nemico != NESSUN_NEMICO) {// C'e' un nemico nella zona
-                printf("*** ATTENZIONE: PRESENZA NEMICA! ***\n\n");
-                switch (g->pos_mondoreale->nemico) {
-                    case BILLI:
-                        printf("Una presenza inquietante si muove nell'ombra...\n");
-                        printf("E' Billi! Un ragazzo ribelle e violento che e' stato posseduto.\n");
-                        printf("Ti blocca il passaggio con uno sguardo vuoto e minaccioso!\n");
-                        break;
-                    case DEMOCANE:
-                        printf("Un ringhio sordo risuona nell'aria gelida...\n");
-                        printf("Un Democane emerge dall'oscurita', mostrando i denti!\n");
-                        printf("Le sue zanne brillano nella penombra.\n");
-                        break;
-                    case DEMOTORZONE:
-                        printf("L'aria diventa elettrica, i capelli si rizzano...\n");
-                        printf("IL DEMOTORZONE! La creatura piu' temibile di tutte!\n");
-                        printf("Ma aspetta... non dovrebbe essere qui!\n");
-                        break;
-                    default:
-                        break;
+    } else {
+        /* Vittoria normale */
+        p->nemico_presente = 0;
+        scrivi(p, "\nOra puoi muoverti liberamente!\n");
+        p->stato = STATO_AZIONE;
+        stampa_menu_azioni(p);
+    }
+}
+
+// Esegue l'azione scelta dal menu del turno
+static void gestisci_azione(Partita* p, int scelta) {
+    Giocatore* g = &p->giocatori[p->giocatore_corrente];
+    int turno_finito = 0;
+
+    switch (scelta) {
+        case 1:
+            /* Avanza */
+            if (p->nemico_presente) {
+                scrivi(p, "\n*** IMPOSSIBILE AVANZARE! ***\n");
+                scrivi(p, "C'e' un nemico che ti blocca il passaggio!\n");
+                scrivi(p, "Devi sconfiggerlo prima di procedere!\n");
+            } else if (p->mossa_effettuata) {
+                scrivi(p, "\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
+                scrivi(p, "Puoi fare una sola mossa di movimento per turno.\n");
+            } else {
+                avanza(p, g);
+                p->mossa_effettuata = 1;
+
+                if (ha_nemico_zona(p, g)) {
+                    scrivi(p, "\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
+                    scrivi(p, "Turno terminato.\n");
+                    scrivi(p, "Dovrai affrontarlo nel prossimo turno.\n");
+                    p->appena_mosso_con_nemico = 1;
                 }
-            } else { // Nessun nemico nella zona
-                printf("L'area sembra tranquilla... per ora.\n");
-                printf("Nessuna minaccia immediata, ma resta vigile.\n");
             }
+            break;
 
-            if (g->pos_mondoreale->oggetto != NESSUN_OGGETTO) { // C'e' un oggetto nella zona
-                printf("\n");
-                printf(">>> Noti qualcosa che luccica a terra <<<\n");
-                printf("E' %s!\n", tipo_oggetto_to_string(g->pos_mondoreale->oggetto));
-                if (g->pos_mondoreale->nemico == NESSUN_NEMICO) {
-                    printf("Potresti raccoglierlo se vuoi.\n");
-                } else {
-                    printf("Ma prima devi liberarti del nemico!\n");
+        case 2:
+            /* Indietreggia */
+            if (p->nemico_presente) {
+                scrivi(p, "\n*** IMPOSSIBILE INDIETREGGIARE! ***\n");
+                scrivi(p, "C'e' un nemico che ti blocca!\n");
+                scrivi(p, "Devi sconfiggerlo prima di muoverti!\n");
+            } else if (p->mossa_effettuata) {
+                scrivi(p, "\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
+                scrivi(p, "Puoi fare una sola mossa di movimento per turno.\n");
+            } else {
+                indietreggia(p, g);
+                p->mossa_effettuata = 1;
+
+                if (ha_nemico_zona(p, g)) {
+                    scrivi(p, "\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
+                    scrivi(p, "Turno terminato.\n");
+                    scrivi(p, "Dovrai affrontarlo nel prossimo turno.\n");
+                    p->appena_mosso_con_nemico = 1;
                 }
             }
-        } else {
-            printf("Errore: posizione non valida!\n");
-        }
-    } else {
-        if (g->pos_soprasotto != NULL) { // Soprasotto
-            printf("\nSei nel SOPRASOTTO - La Dimensione Oscura\n");
-            printf("Zona: %s (versione distorta e inquietante)\n",
-                   tipo_zona_to_string(g->pos_soprasotto->tipo));
-            printf("\n");
-            printf("L'aria e' gelida e spettrale.\n");
-            printf("Tutto sembra sbagliato qui. Le ombre si muovono da sole.\n");
-            printf("Il silenzio e' assordante.\n");
-
-            if (g->pos_soprasotto->nemico != NESSUN_NEMICO) { // C'e' un nemico nel Soprasotto
-                printf("\n*** PERICOLO IMMINENTE! ***\n\n");
-                switch (g->pos_soprasotto->nemico) {
-                    case DEMOCANE:
-                        printf("Un ululato spettrale echeggia nelle tenebre...\n");
-                        printf("Un Democane del Soprasotto ti ha trovato!\n");
-                        printf("E' ancora piu' mostruoso della sua controparte reale!\n");
-                        break;
-                    case DEMOTORZONE:
-                        printf("****************************************************\n");
-                        printf("*                                                  *\n");
-                        printf("*   Una forza elettrica riempie l'aria!            *\n");
-                        printf("*   IL DEMOTORZONE SI ERGE DAVANTI A TE!           *\n");
-                        printf("*   Questa e' la tua unica possibilita' di         *\n");
-                        printf("*   salvare Occhinz!                               *\n");
-                        printf("*                                                  *\n");
-                        printf("****************************************************\n");
-                        break;
-                    default:
-                        break;
-                }
+            break;
+
+        case 3:
+            /* Cambia mondo */
+            if (p->nemico_presente && g->mondo == MONDO_REALE) { // Il giocatore non puo' attraversare il portale se c'e' un nemico nel Mondo Reale, ma puo' farlo se e' nel Soprasotto (tentativo di fuga disperato)
+                scrivi(p, "\n*** IMPOSSIBILE CAMBIARE MONDO! ***\n");
+                scrivi(p, "C'e' un nemico che ti blocca!\n");
+                scrivi(p, "Devi sconfiggerlo prima di attraversare il portale!\n");
+            } else if (p->mossa_effettuata) {
+                scrivi(p, "\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
+                scrivi(p, "Puoi fare una sola mossa per turno.\n");
             } else {
-                printf("\nPer ora non vedi minacce...\n");
-                printf("Ma non abbassare la guardia. Qualcosa potrebbe essere in agguato.\n");
+                if (p->nemico_presente && g->mondo == SOPRASOTTO) {
+                    scrivi(p, "\n>>> TENTATIVO DI FUGA DAL NEMICO! <<<\n");
+                }
+                if (cambia_mondo(p, g)) { // Se il cambio mondo e' riuscito, controlla se c'e' un nemico nella nuova zona
+                    p->mossa_effettuata = 1;
+                    p->nemico_presente  = ha_nemico_zona(p, g);
+
+                    if (p->nemico_presente) {
+                        scrivi(p, "\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
+                        scrivi(p, "Turno terminato.\n");
+                        p->appena_mosso_con_nemico = 1;
+                    }
+                } else if (g->mondo == SOPRASOTTO) {
+                    scrivi(p, "\nSei ancora nel Soprasotto con il nemico!\n");
+                }
             }
-        } else {
-            printf("Errore: posizione non valida!\n");
-        }
-    }
+            break;
 
-    printf("\n");
-    printf("================================================================================\n");
-}
+        case 4:
+            /* Combatti */
+            if (p->appena_mosso_con_nemico) {
+                scrivi(p, "\n*** NON PUOI COMBATTERE ORA! ***\n");
+                scrivi(p, "Hai appena fatto una mossa in questo turno!\n");
+                scrivi(p, "Dovrai aspettare il prossimo turno.\n");
+            } else if (inizia_combattimento(p, g)) { // Combatti il nemico presente nella zona
+                stampa_turno_combattimento(p, g);
+                p->stato = STATO_COMBATTIMENTO;
+                return;
+            }
+            break;
 
-/* ============================================================================
- * FUNZIONI DI GIOCO - AZIONI GIOCATORE
- * ============================================================================ */
+        case 5:
+            stampa_giocatore_info(p, g);
+            break;
 
-// Permette al giocatore di raccogliere un oggetto presente nella zona del Mondo Reale, se non ci sono nemici
-static void raccogli_oggetto(Giocatore* g) {
-    int i;
-    int spazio_trovato = 0;
+        case 6:
+            stampa_zona_corrente(p, g);
+            break;
 
-    if (g == NULL) {//
-        printf("Errore: giocatore non valido!\n");
-        return;
-    }
+        case 7:
+            raccogli_oggetto(p, g);
+            break;
 
-    if (g->mondo != MONDO_REALE) {// Il giocatore e' nel Soprasotto, non puo' raccogliere oggetti
-        printf("\nNel Soprasotto non ci sono oggetti da raccogliere...\n");
-        printf("Solo oscurita' e pericolo ti circondano.\n");
-        return;
+        case 8:
+            mostra_zaino(p, g);
+            p->stato         = STATO_ZAINO;
+            p->stato_ritorno = STATO_AZIONE;
+            return;
+
+        case 9:
+            if (p->nemico_presente && !p->appena_mosso_con_nemico) { // Il giocatore non puo' passare il turno se c'e' un nemico presente e non ha appena fatto una mossa (per evitare di passare dopo essere entrati in una zona con nemico)
+                scrivi(p, "\nNon puoi passare il turno! C'e' un nemico!\n");
+                scrivi(p, "Devi combatterlo!\n");
+            } else {
+                scrivi(p, "\nPassi il turno.\n");
+                turno_finito = 1;
+            }
+            break;
+
+        default:
+            scrivi(p, "Scelta non valida!\n");
+            break;
     }
 
-    if (g->pos_mondoreale == NULL) {// Non dovrebbe mai succedere, ma meglio controllare
-        printf("Errore: posizione non valida!\n");
+    /* Termina il turno se il giocatore ha passato
+     * o si e' mosso in una zona con nemico */
+    if (turno_finito || p->appena_mosso_con_nemico) {
+        termina_turno(p);
         return;
     }
 
-    if (g->pos_mondoreale->nemico != NESSUN_NEMICO) {// C'e' un nemico nella zona, non si puo' raccogliere
-        printf("\n*** IMPOSSIBILE RACCOGLIERE! ***\n");
-        printf("C'e' %s qui!\n", tipo_nemico_to_string(g->pos_mondoreale->nemico));
-        printf("E' troppo pericoloso raccogliere oggetti ora!\n");
-        printf("Sconfiggilo prima di frugare in giro!\n");
+    stampa_menu_azioni(p);
+}
+
+// Esegue l'azione scelta durante il combattimento; l'uso di un oggetto non consuma il round
+static void gestisci_combattimento(Partita* p, int scelta) {
+    Giocatore* g = &p->giocatori[p->giocatore_corrente];
+    int risultato_combattimento;
+
+    if (scelta == 4) {
+        mostra_zaino(p, g);
+        p->stato         = STATO_ZAINO;
+        p->stato_ritorno = STATO_COMBATTIMENTO;
         return;
     }
 
-    if (g->pos_mondoreale->oggetto == NESSUN_OGGETTO) {// Non c'e' nessun oggetto nella zona
-        printf("\nGuardi attentamente in giro ma non trovi nulla di utile.\n");
-        printf("La zona e' vuota.\n");
-        return;
+    risultato_combattimento = round_combattimento(p, g, scelta);
+
+    if (risultato_combattimento == 0) {
+        stampa_turno_combattimento(p, g);
+    } else {
+        concludi_combattimento(p, risultato_combattimento);
     }
+}
 
-    for (i = 0; i < ZAINO_MAX; i++) {// Cerca uno slot vuoto nello zaino
-        if (g->zaino[i] == NESSUN_OGGETTO) {// Slot vuoto trovato
-            printf("\nTi avvicini cautamente all'oggetto...\n");
-            printf("\n>>> RACCOLTO: %s! <<<\n", tipo_oggetto_to_string(g->pos_mondoreale->oggetto));
-            printf("Lo infili nello zaino (slot %d).\n", i + 1);
-            printf("Potrebbe tornare molto utile!\n");
+// Usa l'oggetto scelto dallo zaino e torna al menu da cui e' stato aperto
+static void gestisci_zaino(Partita* p, int input_valido, int scelta) {
+    Giocatore* g = &p->giocatori[p->giocatore_corrente];
 
-            g->zaino[i] = g->pos_mondoreale->oggetto;
-            g->pos_mondoreale->oggetto = NESSUN_OGGETTO;
-            spazio_trovato = 1;
-            break;
-        }
+    if (!input_valido) {
+        scrivi(p, "Errore: devi inserire un numero!\n");
+    } else {
+        utilizza_oggetto(p, g, scelta);
     }
 
-    if (!spazio_trovato) {// Nessuno slot vuoto trovato, lo zaino e' pieno
-        printf("\n*** ZAINO PIENO! ***\n");
-        printf("Il tuo zaino e' pieno zeppo!\n");
-        printf("Devi usare qualcosa prima di raccogliere altro.\n");
-        printf("Apri l'inventario e utilizza un oggetto per fare spazio.\n");
+    p->stato = p->stato_ritorno;
+    if (p->stato == STATO_COMBATTIMENTO) {
+        stampa_turno_combattimento(p, g);
+    } else {
+        stampa_menu_azioni(p);
     }
 }
 
-// Permette al giocatore di utilizzare un oggetto presente nel suo zaino, applicando i bonus corrispondenti e consumando l'oggetto
-static void utilizza_oggetto(Giocatore* g) {
-    int scelta;
-    int i;
+/* ============================================================================
+ * SESSIONE E MENU PRINCIPALE
+ * ============================================================================ */
 
-    if (g == NULL) {// Controllo di sicurezza
-        printf("Errore: giocatore non valido!\n");
-        return;
-    }
+/**
+ * Controlla se la partita sta raccogliendo i dati dell'impostazione
+ * @param p Partita
+ * @return 1 durante imposta_gioco, 0 altrimenti
+ */
+static int in_impostazione(const Partita* p) {
+    return p->stato >= STATO_NUMERO_GIOCATORI && p->stato <= STATO_STAMPA_ZONA_POSIZIONE;
+}
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                        IL TUO ZAINO                                            \n");
-    printf("================================================================================\n");
-    printf("\n");
-    for (i = 0; i < ZAINO_MAX; i++) {// Elenca gli oggetti presenti nello zaino
-        printf("%d) %s\n", i + 1, tipo_oggetto_to_string(g->zaino[i]));
-    }
-    printf("%d) Annulla\n", ZAINO_MAX + 1);
-    printf("\n");
-    printf("Quale oggetto vuoi usare? ");
+/**
+ * Controlla se la partita e' nella fase dei turni di gioco
+ * @param p Partita
+ * @return 1 durante gioca, 0 altrimenti
+ */
+static int in_gioco(const Partita* p) {
+    return p->stato >= STATO_AZIONE && p->stato <= STATO_ZAINO;
+}
 
-    if (scanf("%d", &scelta) != 1) {
-        while (getchar() != '\n');
-        printf("Errore: devi inserire un numero!\n");
-        return;
-    }
-    while (getchar() != '\n');
+// Mostra il menu principale di una sessione remota e ne attende la scelta
+static void stampa_menu_principale(Partita* p) {
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                              COSESTRANE                                        \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+    scrivi(p, "1) Imposta gioco\n");
+    scrivi(p, "2) Gioca\n");
+    scrivi(p, "3) Esci\n");
+    scrivi(p, "4) Visualizza crediti\n");
+    scrivi(p, "\n");
+    scrivi(p, "Scegli un'opzione (1-4): ");
+    p->stato = STATO_MENU_PRINCIPALE;
+}
 
-    if (scelta < 1 || scelta > ZAINO_MAX + 1) {
-        printf("Scelta non valida!\n");
-        return;
+// Chiude la fase in corso: le sessioni remote tornano al menu principale, la partita da console resta in attesa del prossimo comando di main
+static void torna_al_menu(Partita* p) {
+    if (p->con_menu) {
+        stampa_menu_principale(p);
+    } else {
+        p->stato = STATO_INATTIVA;
     }
+}
 
-    if (scelta == ZAINO_MAX + 1) {// Il giocatore ha scelto di annullare
-        printf("Operazione annullata.\n");
-        return;
+// Stampa i crediti del gioco e le statistiche delle ultime partite
+static void stampa_crediti(Partita* p) {
+    Esito_partita ultime[3];
+    Voce_classifica migliori[5];
+    uint64_t partite;
+    uint64_t vinte;
+    int n;
+    int i;
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                            CREDITI                                             \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+    scrivi(p, "Gioco: Cosestrane\n");
+    scrivi(p, "Creato da: Hanaji Tancre'\n");
+    scrivi(p, "Anno: 2025-2026\n");
+    scrivi(p, "Corso: Programmazione Procedurale\n");
+    scrivi(p, "\n");
+    if (classifica_gioco == NULL) {
+        scrivi(p, "Classifica non disponibile.\n");
+    } else {
+        classifica_aggiorna(classifica_gioco); // Conta anche le partite degli altri processi
+        partite = classifica_partite(classifica_gioco, &vinte);
+        scrivi(p, "Partite giocate: %llu (vinte: %llu)\n", (unsigned long long)partite, (unsigned long long)vinte);
+        scrivi(p, "\n");
+        scrivi(p, "Ultime partite:\n");
+        n = classifica_ultime(classifica_gioco, ultime, 3);
+        for (i = 0; i < n; i++) {
+            if (ultime[i].vincitore[0] != '\0') {
+                scrivi(p, "  %d) %s, %u round\n", i + 1, ultime[i].vincitore, ultime[i].turni);
+            } else {
+                scrivi(p, "  %d) Nessuno (tutti caduti), %u round\n", i + 1, ultime[i].turni);
+            }
+        }
+        if (n == 0) {
+            scrivi(p, "  Nessuna\n");
+        }
+        scrivi(p, "\n");
+        scrivi(p, "Migliori vincitori:\n");
+        n = classifica_migliori(classifica_gioco, migliori, 5);
+        for (i = 0; i < n; i++) {
+            scrivi(p, "  %d) %s: %u vittorie, record %u round\n", i + 1, migliori[i].nome,
+                   migliori[i].vittorie, migliori[i].miglior_turni);
+        }
+        if (n == 0) {
+            scrivi(p, "  Nessuno\n");
+        }
     }
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\n");
+}
+
+// Saluta il giocatore e libera giocatori e mappe della partita
+static void saluta(Partita* p) {
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                         ARRIVEDERCI!                                           \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "\nGrazie per aver giocato a Cosestrane!\n");
+    scrivi(p, "Alla prossima avventura!\n\n");
+
+    libera_giocatori(p);
+    libera_mappe(p);
+}
 
-    if (g->zaino[scelta - 1] == NESSUN_OGGETTO) {// Lo slot scelto e' vuoto, non c'e' niente da usare
-        printf("\nNessun oggetto in questa posizione dello zaino!\n");
+// Esegue la scelta del menu principale di una sessione remota
+static void gestisci_menu_principale(Partita* p, int input_valido, int scelta) {
+    if (!input_valido) {
+        scrivi(p, "\nErrore: devi inserire un numero intero tra 1 e 4!\n");
+        stampa_menu_principale(p);
         return;
     }
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                    UTILIZZO OGGETTO                                            \n");
-    printf("================================================================================\n");
-    printf("\n");
-
-    switch (g->zaino[scelta - 1]) {
-        case BICICLETTA: // BONUS: +2 Fortuna (PERMANENTE)
-            printf("Usi la Bicicletta!\n");
-            printf("Pedalare ti fa sentire piu' fortunato e fiducioso.\n");
-            printf("Fortuna +%d (PERMANENTE)\n", BONUS_BICICLETTA_FORTUNA);
-            g->fortuna += BONUS_BICICLETTA_FORTUNA;
+    switch (scelta) {
+        case 1:
+            avvia_impostazione(p);
             break;
-
-        case MAGLIETTA_FUOCOINFERNO: // BONUS: +3 Attacco Psichico (PERMANENTE)
-            printf("Indossi la Maglietta Fuocoinferno!\n");
-            printf("Senti il potere del fuoco scorrere in te!\n");
-            printf("Attacco Psichico +%d (PERMANENTE)\n", BONUS_MAGLIETTA_ATTACCO);
-            g->attacco_psichico += BONUS_MAGLIETTA_ATTACCO;
+        case 2:
+            partita_inizia(p);
             break;
-
-        case BUSSOLA:
-            printf("Usi la Bussola!\n"); // BONUS: +2 Fortuna (PERMANENTE)
-            printf("Ti orienti meglio, trovando la via giusta.\n");
-            printf("La tua intuizione migliora.\n");
-            printf("Fortuna +%d (PERMANENTE)\n", BONUS_BUSSOLA_FORTUNA);
-            g->fortuna += BONUS_BUSSOLA_FORTUNA;
+        case 3:
+            saluta(p);
+            p->stato = STATO_CHIUSA;
             break;
-
-        case SCHITARRATA_METALLICA:// BONUS: +2 Attacco Psichico, +1 Difesa Psichica (PERMANENTE)
-            printf("Suoni una Schitarrata Metallica!\n");
-            printf("La musica ti da' forza e coraggio!\n");
-            printf("Attacco +%d, Difesa +%d (PERMANENTE)\n",
-                   BONUS_SCHITARRATA_ATTACCO, BONUS_SCHITARRATA_DIFESA);
-            g->attacco_psichico += BONUS_SCHITARRATA_ATTACCO;
-            g->difesa_psichica  += BONUS_SCHITARRATA_DIFESA;
+        case 4:
+            stampa_crediti(p);
+            stampa_menu_principale(p);
             break;
-
         default:
-            printf("Oggetto sconosciuto!\n");
-            return;
+            scrivi(p, "\nErrore: scelta non valida! Inserisci un numero da 1 a 4.\n");
+            stampa_menu_principale(p);
+            break;
     }
+}
 
-    g->zaino[scelta - 1] = NESSUN_OGGETTO; // Consuma l'oggetto, lo slot torna vuoto
+/* ============================================================================
+ * EVENTI DI TURNO
+ * ============================================================================ */
 
-    printf("\nOggetto utilizzato e consumato.\n");
-    printf("Lo slot %d del tuo zaino e' ora vuoto.\n", scelta);
-    printf("\n");
-    printf("================================================================================\n");
+/**
+ * Esegue un evento di turno se e' valido nello stato corrente della partita
+ * @param p Partita
+ * @param evento Evento da eseguire
+ */
+static void esegui_evento(Partita* p, Evento_turno evento) {
+    if (p->stato == STATO_AZIONE && evento.tipo == EVENTO_AZIONE) {
+        gestisci_azione(p, evento.scelta);
+    } else if (p->stato == STATO_COMBATTIMENTO && evento.tipo == EVENTO_COMBATTIMENTO) {
+        gestisci_combattimento(p, evento.scelta);
+    } else if (p->stato == STATO_ZAINO && evento.tipo == EVENTO_OGGETTO) {
+        gestisci_zaino(p, 1, evento.scelta);
+    } else if (in_gioco(p)) { // Evento arrivato per una fase gia' conclusa
+        scrivi(p, "\nComando ignorato: non disponibile in questo momento.\n");
+    }
 }
 
-// Controlla se c'e' un nemico nella zona in cui si trova il giocatore, restituendo 1 se c'e' un nemico e 0 altrimenti
-static int ha_nemico_zona(Giocatore* g) {
-    if (g == NULL) return 0; // Controllo di sicurezza
+/**
+ * Traduce la scelta numerica di una riga nell'evento della fase corrente
+ * @param p Partita nella fase di gioco
+ * @param scelta Numero letto
+ * @return Evento corrispondente
+ */
+static Evento_turno evento_da_scelta(const Partita* p, int scelta) {
+    Evento_turno evento;
 
-    if (g->mondo == MONDO_REALE) {// Controlla il Mondo Reale
-        if (g->pos_mondoreale != NULL && g->pos_mondoreale->nemico != NESSUN_NEMICO) {
-            return 1;
-        }
-    } else {// Controlla il Soprasotto
-        if (g->pos_soprasotto != NULL && g->pos_soprasotto->nemico != NESSUN_NEMICO) {
-            return 1;
-        }
+    if (p->stato == STATO_COMBATTIMENTO) {
+        evento.tipo = EVENTO_COMBATTIMENTO;
+    } else if (p->stato == STATO_ZAINO) {
+        evento.tipo = EVENTO_OGGETTO;
+    } else {
+        evento.tipo = EVENTO_AZIONE;
     }
-
-    return 0;
+    evento.scelta = (unsigned char)(scelta >= 0 && scelta <= 255 ? scelta : 255); // 255 non e' valido in nessun menu
+    return evento;
 }
 
-// Permette al giocatore di avanzare alla zona successiva, se non ci sono nemici che bloccano il passaggio
-static void avanza(Giocatore* g) {
-    if (g == NULL) {
-        printf("Errore: giocatore non valido!\n");
-        return;
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: PARTITA
+ * ============================================================================ */
+
+Partita* partita_crea(void) {
+    Partita* p = (Partita*)calloc(1, sizeof(Partita));
+
+    if (p != NULL) {
+        metrica_allocazione(sizeof(Partita));
+        p->sessione = atomic_fetch_add(&ultima_sessione, 1) + 1;
     }
+    return p;
+}
 
- 
-    if (ha_nemico_zona(g)) { // C'e' un nemico nella zona, non si puo' avanzare
-        printf("\n*** IMPOSSIBILE AVANZARE! ***\n");
-        printf("C'e' un nemico che ti blocca il passaggio!\n");
-        printf("Devi sconfiggerlo prima di procedere!\n");
+void partita_distruggi(Partita* p) {
+    if (p == NULL) {
         return;
     }
+    libera_giocatori(p);
+    libera_mappe(p);
+    libera_diario(p);
+    free(p->uscita.dati);
+    free(p);
+}
 
-    if (g->mondo == MONDO_REALE) {// Avanza nel Mondo Reale
-        if (g->pos_mondoreale != NULL) {
-            if (g->pos_mondoreale->avanti != NULL) {
-                g->pos_mondoreale = g->pos_mondoreale->avanti;
-                printf("\n>>> Ti fai strada verso la zona successiva... <<<\n");
-                stampa_zona_corrente(g);
-            } else { // Non c'e' una zona successiva, sei alla fine del percorso
-                printf("\n*** FINE DEL PERCORSO ***\n");
-                printf("Davanti a te c'e' solo il vuoto.\n");
-                printf("Non puoi andare oltre.\n");
+// Cambia la mappa usata dalle prossime impostazioni; la mappa propria o condivisa attuale viene lasciata
+void partita_usa_mappa_condivisa(Partita* p, const Mappa_condivisa* m) {
+    libera_mappe(p);
+    p->mappa_condivisa = m;
+    p->mappa_chiusa    = 0;
+    p->gioco_impostato = 0;
+}
+
+// Copia mappa e giocatori in un nuovo ramo, per esplorare varianti della partita senza toccarla
+Ramo* partita_ramifica(Partita* p, Arena_rami* a, uint64_t seme) {
+    Zona_mondoreale* mr = p->mappa_condivisa != NULL ? mappa_condivisa_mondoreale(p->mappa_condivisa) : p->prima_zona_mondoreale;
+    Zona_soprasotto* ss = p->mappa_condivisa != NULL ? mappa_condivisa_soprasotto(p->mappa_condivisa) : p->prima_zona_soprasotto;
+    Contenuto_zona* zone;
+    Giocatore_ramo* giocatori;
+    Zona_mondoreale* z;
+    Ramo* r;
+    int n = 0;
+    int i;
+    int j;
+
+    if (mr == NULL || p->giocatori == NULL || p->num_giocatori < 1) {
+        return NULL;
+    }
+    for (z = mr; z != NULL; z = z->avanti) {
+        n++;
+    }
+    zone      = (Contenuto_zona*)malloc((size_t)n * sizeof(Contenuto_zona));
+    giocatori = (Giocatore_ramo*)calloc((size_t)p->num_giocatori, sizeof(Giocatore_ramo));
+    if (zone == NULL || giocatori == NULL) {
+        free(zone);
+        free(giocatori);
+        return NULL;
+    }
+    metrica_allocazione((size_t)n * sizeof(Contenuto_zona) + (size_t)p->num_giocatori * sizeof(Giocatore_ramo));
+    metrica_conta(METRICA_ALLOCAZIONI, 1); // Due blocchi
+
+    for (i = 0; i < n; i++, mr = mr->avanti, ss = ss->avanti) {
+        zone[i].tipo      = (uint8_t)mr->tipo;
+        zone[i].nemico_mr = (uint8_t)nemico_mondoreale(p, mr);
+        zone[i].nemico_ss = (uint8_t)nemico_soprasotto(p, ss);
+        zone[i].oggetto   = (uint8_t)oggetto_mondoreale(p, mr);
+
+        /* Con una mappa propria la posizione si ricava dagli occupanti della zona */
+        if (p->mappa_condivisa == NULL) {
+            for (j = mr->primo_occupante; j >= 0; j = p->occupante_succ[j]) {
+                giocatori[j].posizione = i;
+            }
+            for (j = ss->primo_occupante; j >= 0; j = p->occupante_succ[j]) {
+                giocatori[j].posizione = i;
             }
         }
-    } else {// Avanza nel Soprasotto
-        if (g->pos_soprasotto != NULL) { // Controllo di sicurezza
-            if (g->pos_soprasotto->avanti != NULL) {// C'e' una zona successiva, puoi avanzare
-                g->pos_soprasotto = g->pos_soprasotto->avanti;
-                printf("\n>>> Avanzi cautamente nell'oscurita' del Soprasotto... <<<\n");
-                stampa_zona_corrente(g);
-            } else {// Non c'e' una zona successiva, sei alla fine del percorso
-                printf("\n*** FINE DEL PERCORSO ***\n");
-                printf("Davanti a te solo tenebra impenetrabile.\n");
-                printf("Non puoi proseguire oltre.\n");
-            }
+    }
+
+    for (i = 0; i < p->num_giocatori; i++) {
+        Giocatore* g = &p->giocatori[i];
+        Giocatore_ramo* gr = &giocatori[i];
+        const Zaino* zaino = zaino_giocatore(p, g);
+
+        if (p->mappa_condivisa != NULL && (g->mondo == MONDO_REALE ? g->pos_mondoreale != NULL : g->pos_soprasotto != NULL)) {
+            gr->posizione = indice_zona_condivisa(p, g);
+        }
+        gr->mondo      = g->mondo;
+        gr->vivo       = p->posto_vivo[i] >= 0;
+        gr->attacco    = g->attacco_psichico;
+        gr->difesa     = g->difesa_psichica;
+        gr->fortuna    = g->fortuna;
+        gr->punti_vita = g->punti_vita;
+        gr->hp_nemico  = (int16_t)(p->stato == STATO_COMBATTIMENTO && p->giocatore_corrente == i ? p->hp_nemico : 0);
+        gr->nemico_sconfitto = (uint8_t)(p->stato == STATO_AZIONE && p->giocatore_corrente == i
+                                         && !p->nemico_presente && ha_nemico_zona(p, g));
+        for (j = 0; j < p->dimensione_zaino; j++) {
+            gr->zaino[j] = (uint8_t)oggetto_nello_slot(zaino, j);
         }
     }
+
+    r = ramo_crea(a, zone, n, giocatori, p->num_giocatori, p->dimensione_zaino, seme);
+    free(zone);
+    free(giocatori);
+    return r;
 }
 
-// Permette al giocatore di tornare alla zona precedente, se non ci sono nemici che bloccano il passaggio
-static void indietreggia(Giocatore* g) {
-    if (g == NULL) {// Controllo di sicurezza
-        printf("Errore: giocatore non valido!\n");
-        return;
+int partita_turni_annullabili(const Partita* p) {
+    if (p->diario.guasto || p->diario.num_segni == 0 || p->giocatori == NULL) {
+        return 0;
     }
+    return (int)p->diario.num_segni - 1;
+}
 
-    
-    if (ha_nemico_zona(g)) {// C'e' un nemico nella zona, non si puo' indietreggiare
-        printf("\n*** IMPOSSIBILE INDIETREGGIARE! ***\n");
-        printf("C'e' un nemico che ti blocca!\n");
-        printf("Devi sconfiggerlo prima di muoverti!\n");
-        return;
+// Annulla le modifiche all'indietro fino al segno del turno scelto e lo fa ripartire
+int partita_riavvolgi(Partita* p, int turni) {
+    Diario_partita* diario = &p->diario;
+    const Segno_turno* s;
+    size_t k;
+
+    if (turni < 0 || diario->guasto || diario->num_segni == 0 || p->giocatori == NULL
+        || in_impostazione(p) || p->stato == STATO_CHIUSA) {
+        return -1;
     }
+    if ((size_t)turni >= diario->num_segni) {
+        turni = (int)diario->num_segni - 1;
+    }
+    k = diario->num_segni - 1 - (size_t)turni;
+    s = &diario->segni[k];
 
-    if (g->mondo == MONDO_REALE) {// Indietreggia nel Mondo Reale
-        if (g->pos_mondoreale != NULL) {
-            if (g->pos_mondoreale->indietro != NULL) {// C'e' una zona precedente, puoi indietreggiare
-                g->pos_mondoreale = g->pos_mondoreale->indietro;
-                printf("\n>>> Torni sui tuoi passi, verso la zona precedente... <<<\n");
-                stampa_zona_corrente(g);
-            } else {
-                printf("\n*** INIZIO DEL PERCORSO ***\n");
-                printf("Sei gia' all'inizio.\n");
-                printf("Non puoi tornare piu' indietro.\n");
-            }
-        }
-    } else {// Indietreggia nel Soprasotto
-        if (g->pos_soprasotto != NULL) {
-            if (g->pos_soprasotto->indietro != NULL) {
-                g->pos_soprasotto = g->pos_soprasotto->indietro;
-                printf("\n>>> Indietreggi nell'oscurita'... <<<\n");
-                stampa_zona_corrente(g);
-            } else {
-                printf("\n*** INIZIO DEL PERCORSO ***\n");
-                printf("Non puoi tornare piu' indietro.\n");
-                printf("Sei vicino al portale di entrata.\n");
-            }
-        }
+    while (diario->num_delta > s->delta) {
+        annulla_delta(p, &diario->delta[--diario->num_delta]);
     }
+    diario->num_ordini    = s->ordini;
+    diario->num_segni     = k + 1; // Il segno resta: il turno riparte da qui
+    p->rng                = s->rng;
+    p->turno              = s->turno;
+    p->idx_turno          = s->idx_turno;
+    p->num_vivi_round     = s->num_vivi_round;
+    p->giocatore_corrente = s->giocatore_corrente;
+    p->stato_ritorno      = s->stato_ritorno;
+    p->nemico             = s->nemico;
+    p->hp_nemico          = s->hp_nemico;
+    p->attacco_nemico     = s->attacco_nemico;
+    p->difesa_nemico      = s->difesa_nemico;
+    p->gioco_impostato    = 1; // Anche se la partita era finita nei turni annullati
+
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                    TURNI ANNULLATI: %d                                        \n", turni);
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "Si riprende dal round %d.\n", p->turno);
+    annuncia_turno(p);
+    return turni;
 }
 
-// Permette al giocatore di attraversare il portale tra il Mondo Reale e il Soprasotto, se si trovano nelle zone corrette e superano eventuali ostacoli
-static int cambia_mondo(Giocatore* g) {
-    int dado;
+int partita_in_gioco(const Partita* p) {
+    return in_gioco(p);
+}
 
-    if (g == NULL) {
-        printf("Errore: giocatore non valido!\n");
+// Scrive lo stato della partita in un blocco di memoria nuovo, da liberare con free
+size_t partita_istantanea(Partita* p, unsigned char** dati) {
+    Scrittore_istantanea s;
+
+    *dati = NULL;
+    if (!in_gioco(p) || p->giocatori == NULL) {
+        return 0;
+    }
+    memset(&s, 0, sizeof(s));
+    scrivi_istantanea(p, &s);
+    if (s.errore) {
+        free(s.dati);
         return 0;
     }
+    *dati = s.dati;
+    return s.lunghezza;
+}
 
-    if (g->mondo == MONDO_REALE) {// Dal Mondo Reale al Soprasotto: attraversamento automatico
-        if (g->pos_mondoreale != NULL) {
-            printf("\n");
-            printf("================================================================================\n");
-            printf("                    ATTRAVERSAMENTO PORTALE                                     \n");
-            printf("================================================================================\n");
-            printf("\n");
-            printf("Davanti a te si apre un portale dimensionale...\n");
-            printf("L'aria trema, la realta' si distorce.\n");
-            printf("Colori impossibili danzano ai bordi del portale.\n");
-            printf("\n");
-            printf("Fai un respiro profondo ed entri.\n");
-            printf("\n");
-            printf("*** VIENI CATAPULTATO NEL SOPRASOTTO! ***\n");
-            printf("\n");
-            printf("Tutto e' distorto, oscuro, sbagliato...\n");
-            printf("Il freddo ti penetra nelle ossa.\n");
-            printf("================================================================================\n");
+// Riporta una partita appena creata allo stato di un'istantanea
+int partita_ripristina(Partita* p, const unsigned char* dati, size_t n) {
+    Lettore_istantanea l;
 
-            g->pos_soprasotto = g->pos_mondoreale->link_soprasotto;
-            g->pos_mondoreale = NULL; /* FIX: pulisce il riferimento al mondo precedente */
-            g->mondo = SOPRASOTTO;
-            stampa_zona_corrente(g);
-            return 1;
-        }
+    if (p->giocatori != NULL || p->prima_zona_mondoreale != NULL) {
+        return 0;
+    }
+    l.dati      = dati;
+    l.lunghezza = n;
+    l.pos       = 0;
+    l.errore    = 0;
+    if (!leggi_istantanea(p, &l)) {
+        p->stato = STATO_INATTIVA;
+        return 0;
+    }
+    return 1;
+}
+
+// Ristampa la situazione e la richiesta a cui la partita ripristinata attende risposta
+void partita_riprendi(Partita* p) {
+    Giocatore* g;
+
+    if (!in_gioco(p)) {
+        return;
+    }
+    g = &p->giocatori[p->giocatore_corrente];
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                       PARTITA RIPRESA                                          \n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "Round %d, tocca a %s.\n", p->turno, nome_giocatore(p, g));
+    if (p->stato == STATO_COMBATTIMENTO) {
+        stampa_turno_combattimento(p, g);
+    } else if (p->stato == STATO_ZAINO) {
+        mostra_zaino(p, g);
     } else {
-        /* Dal Soprasotto al Mondo Reale: tiro di fortuna */
-        printf("\n");
-        printf("================================================================================\n");
-        printf("                    TENTATIVO DI FUGA                                           \n");
-        printf("================================================================================\n");
-        printf("\n");
-        printf("Cerchi disperatamente un portale per tornare a casa...\n");
-        printf("La paura ti attanaglia, ma devi provare!\n");
-        printf("Chiudi gli occhi e ti concentri sulla realta'...\n");
-        printf("Visualizzi il Mondo Reale, i colori veri, la luce...\n");
-        printf("\n");
+        stampa_zona_corrente(p, g);
+        stampa_menu_azioni(p);
+    }
+}
 
-        dado = lancia_dado();// Tiro di fortuna contro la fortuna del giocatore
+// Apre una sessione remota: benvenuto e menu principale
+void partita_apri(Partita* p) {
+    p->con_menu = 1;
 
-        printf("[Tiro di Fortuna: %d VS Tua Fortuna: %d]\n\n", dado, g->fortuna);
+    scrivi(p, "========================================\n");
+    scrivi(p, "       BENVENUTO IN COSESTRANE!\n");
+    scrivi(p, "========================================\n");
+    stampa_menu_principale(p);
+}
 
-        if (dado < g->fortuna) {// Successo: il giocatore riesce a tornare al Mondo Reale
-            printf("================================================================================\n");
-            printf("                         *** CE L'HAI FATTA! ***                                \n");
-            printf("================================================================================\n");
-            printf("\n");
-            printf("Un portale luminoso si apre davanti a te!\n");
-            printf("Ti tuffi attraverso con tutte le tue forze e...\n");
-            printf("\n");
-            printf("...TORNI AL MONDO REALE!\n");
-            printf("\n");
-            printf("L'aria fresca, i colori normali, il calore del sole...\n");
-            printf("Sei salvo! Almeno per ora.\n");
-            printf("================================================================================\n");
+// Prepara la partita impostata, posiziona i giocatori e annuncia il primo turno
+int partita_inizia(Partita* p) {
+    int i;
 
-            if (g->pos_soprasotto != NULL) {// Controllo di sicurezza
-                g->pos_mondoreale = g->pos_soprasotto->link_mondoreale;
-                g->pos_soprasotto = NULL; /* FIX: pulisce il riferimento al mondo precedente */
-                g->mondo = MONDO_REALE;
-                stampa_zona_corrente(g);
-                return 1;
-            }
-        } else {// Fallimento: il giocatore non riesce a tornare al Mondo Reale
-            printf("================================================================================\n");
-            printf("                        *** NON CE LA FAI! ***                                  \n");
-            printf("================================================================================\n");
-            printf("\n");
-            printf("Il portale sfarfalla per un momento...\n");
-            printf("Quasi... quasi riesci a vederlo...\n");
-            printf("Ma poi scompare!\n");
-            printf("\n");
-            printf("Sei ancora intrappolato nel Soprasotto!\n");
-            printf("L'oscurita' ti circonda.\n");
-            printf("Dovrai riprovare piu' tardi.\n");
-            printf("================================================================================\n");
-            return 0;
-        }
+    scrivi(p, "\n");
+    scrivi(p, "================================================================================\n");
+    scrivi(p, "                     L'AVVENTURA HA INIZIO                                      \n");
+    scrivi(p, "================================================================================\n");
+
+    if (!p->gioco_impostato) {// Controllo se il gioco e' stato impostato, altrimenti mostra un messaggio di errore e torna al menu principale
+        scrivi(p, "\n*** ERRORE ***\n");
+        scrivi(p, "Devi prima impostare il gioco dal menu principale!\n");
+        scrivi(p, "Seleziona l'opzione 1) Imposta gioco.\n");
+        torna_al_menu(p);
+        return 0;
     }
 
-    return 0;
-}
+    /* Posiziona tutti i giocatori nella prima zona del Mondo Reale */
+    azzera_occupanti(p);
+    for (i = 0; i < p->num_vivi; i++) {
+        Giocatore* g = &p->giocatori[p->vivi[i]];
+        g->pos_mondoreale = p->prima_zona_mondoreale;
+        g->pos_soprasotto = NULL;
+        g->mondo = MONDO_REALE;
+        entra_zona(p, g);
+    }
 
-/* ============================================================================
- * SISTEMA DI COMBATTIMENTO
- * ============================================================================ */
+    scrivi(p, "\n");
+    scrivi(p, "Ti trovi a Occhinz, la tranquilla cittadina ora infestata da portali.\n");
+    scrivi(p, "Davanti a te si estende il percorso verso il Soprasotto...\n");
+    scrivi(p, "Ricorda: solo sconfiggendo il Demotorzone salverai la citta'!\n");
+    scrivi(p, "\nTutti i giocatori partono dalla prima zona del Mondo Reale.\n");
+    scrivi(p, "Che l'avventura abbia inizio!\n");
+    scrivi(p, "================================================================================\n");
+
+    p->turno          = 0;
+    p->idx_turno      = 0;
+    p->num_vivi_round = 0;
+    GIORNALE(GIORNALE_INFO, "sessione %llu: partita iniziata con %lld giocatori", (long long)p->sessione, p->num_giocatori);
+    if (cronaca_attiva) { // Le zone si contano solo se servono
+        racconta(p, NULL, CRONACA_INIZIO, p->num_giocatori, conta_zone_mondoreale(p), 0, 0);
+    }
+    azzera_diario(p);
+    inizia_turno(p);
 
-// Inizializza le statistiche di un nemico in base al suo tipo, restituendo HP, attacco e difesa tramite parametri di output
-static void inizializza_statistiche_nemico(Tipo_nemico nemico, int* hp, int* attacco, int* difesa) {
-    switch (nemico) {
-        case BILLI:
-            *hp      = HP_BILLI;
-            *attacco = ATTACCO_BILLI;
-            *difesa  = DIFESA_BILLI;
-            break;
-        case DEMOCANE:
-            *hp      = HP_DEMOCANE;
-            *attacco = ATTACCO_DEMOCANE;
-            *difesa  = DIFESA_DEMOCANE;
-            break;
-        case DEMOTORZONE:
-            *hp      = HP_DEMOTORZONE;
-            *attacco = ATTACCO_DEMOTORZONE;
-            *difesa  = DIFESA_DEMOTORZONE;
-            break;
+    return in_gioco(p);
+}
+
+/**
+ * Riconosce il comando che una riga rappresenta nello stato corrente, per le latenze delle metriche
+ * @param p Partita (prima di consegnarle la riga)
+ * @param riga Riga ricevuta
+ * @return Comando della riga, COMANDO_NON_VALIDO se non corrisponde a una scelta del menu
+ */
+static Comando comando_della_riga(const Partita* p, const char* riga) {
+    int scelta = 0;
+    int valido = leggi_intero(riga, &scelta);
+
+    switch (p->stato) {
+        case STATO_MENU_PRINCIPALE:
+            return COMANDO_MENU;
+        case STATO_NUMERO_GIOCATORI:
+        case STATO_NOME_GIOCATORE:
+        case STATO_ABILITA_GIOCATORE:
+            return COMANDO_GIOCATORI;
+        case STATO_MENU_MAPPA:
+            return valido && scelta >= 1 && scelta <= 6 ? (Comando)(COMANDO_GENERA_MAPPA + scelta - 1)
+                                                        : COMANDO_NON_VALIDO;
+        case STATO_INSERISCI_POSIZIONE:
+        case STATO_INSERISCI_TIPO:
+        case STATO_INSERISCI_NEMICO:
+        case STATO_INSERISCI_OGGETTO:
+            return COMANDO_INSERISCI_ZONA;
+        case STATO_CANCELLA_POSIZIONE:
+            return COMANDO_CANCELLA_ZONA;
+        case STATO_SCELTA_MAPPA:
+            return COMANDO_STAMPA_MAPPA;
+        case STATO_STAMPA_ZONA_POSIZIONE:
+            return COMANDO_STAMPA_ZONA;
+        case STATO_AZIONE:
+            return valido && scelta >= 1 && scelta <= 9 ? (Comando)(COMANDO_AVANZA + scelta - 1) : COMANDO_NON_VALIDO;
+        case STATO_COMBATTIMENTO:
+            return valido && scelta >= 1 && scelta <= 4 ? (Comando)(COMANDO_ATTACCO + scelta - 1) : COMANDO_NON_VALIDO;
+        case STATO_ZAINO:
+            return COMANDO_USA_OGGETTO;
         default:
-            *hp      = 0;
-            *attacco = 0;
-            *difesa  = 0;
-            break;
+            return COMANDO_NON_VALIDO;
     }
 }
 
-// Gestisce il combattimento tra il giocatore e un nemico presente nella zona, restituendo 1 se il giocatore vince, 0 se perde o non c'e' nessun nemico
-static int combatti_nemico(Giocatore* g) {
-    Tipo_nemico nemico;
-    int hp_nemico;
-    int attacco_nemico;
-    int difesa_nemico;
-    int scelta;
-    int danno;
-    int dado_giocatore, dado_nemico;
-    int difesa_temporanea_attiva; // Flag per indicare se la difesa temporanea e' attiva (bonus di +3 difesa per un turno)
+/**
+ * Consegna una riga di input alla macchina a stati della partita
+ * @param p Partita
+ * @param riga Riga ricevuta
+ * @return 1 se la partita attende altro input
+ */
+static int esegui_riga(Partita* p, const char* riga) {
+    int scelta = 0;
+    int input_valido;
 
-    if (g == NULL) {
-        return 0;
+    if (in_impostazione(p)) {
+        gestisci_impostazione(p, riga);
+        return partita_attende_input(p);
     }
 
-    if (g->mondo == MONDO_REALE) {// Controlla se c'e' un nemico nel Mondo Reale
-        if (g->pos_mondoreale == NULL || g->pos_mondoreale->nemico == NESSUN_NEMICO) {
-            printf("\nNon c'e' nessun nemico da combattere qui!\n");
-            return 0;
-        }
-        nemico = g->pos_mondoreale->nemico;
-    } else {// Controlla se c'e' un nemico nel Soprasotto
-        if (g->pos_soprasotto == NULL || g->pos_soprasotto->nemico == NESSUN_NEMICO) {
-            printf("\nNon c'e' nessun nemico da combattere qui!\n");
-            return 0;
-        }
-        nemico = g->pos_soprasotto->nemico;
+    if (!partita_attende_input(p)) {
+        return 0;
     }
 
-    inizializza_statistiche_nemico(nemico, &hp_nemico, &attacco_nemico, &difesa_nemico);
+    if (riga_vuota(riga)) {
+        return 1;
+    }
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                       !!! COMBATTIMENTO !!!                                    \n");
-    printf("================================================================================\n");
-    printf("\n");
+    input_valido = leggi_intero(riga, &scelta);
 
-    switch (nemico) {
-        case BILLI:
-            printf("Billi ti fissa con occhi vuoti e minacciosi.\n");
-            printf("Le sue mani tremano, posseduto da una forza oscura.\n");
-            printf("Non hai scelta. Devi combattere per sopravvivere!\n");
-            break;
-        case DEMOCANE:
-            printf("Il Democane ringhia e si prepara ad attaccare!\n");
-            printf("Le sue fauci sbavano. La tensione e' palpabile.\n");
-            printf("Preparati a difenderti!\n");
+    switch (p->stato) {
+        case STATO_MENU_PRINCIPALE:
+            gestisci_menu_principale(p, input_valido, scelta);
             break;
-        case DEMOTORZONE:
-            printf("****************************************************\n");
-            printf("*                                                  *\n");
-            printf("*        IL DEMOTORZONE TI HA TROVATO!             *\n");
-            printf("*                                                  *\n");
-            printf("*   Scintille elettriche crepitano nell'aria!      *\n");
-            printf("*   Questa e' la battaglia finale!                 *\n");
-            printf("*   SCONFIGGILO PER SALVARE OCCHINZ!               *\n");
-            printf("*                                                  *\n");
-            printf("****************************************************\n");
+
+        case STATO_AZIONE:
+        case STATO_COMBATTIMENTO:
+        case STATO_ZAINO:
+            if (!input_valido && p->stato == STATO_ZAINO) {
+                gestisci_zaino(p, 0, 0);
+            } else if (!input_valido) {
+                scrivi(p, "Errore: devi inserire un numero!\n");
+                if (p->stato == STATO_AZIONE) {
+                    stampa_menu_azioni(p);
+                } else {
+                    stampa_turno_combattimento(p, &p->giocatori[p->giocatore_corrente]);
+                }
+            } else if (!partita_accoda(p, evento_da_scelta(p, scelta))) {
+                scrivi(p, "Errore: troppi comandi in attesa, riprova.\n");
+            }
+            partita_elabora_eventi(p);
             break;
+
         default:
-            printf("Un nemico ti sbarra la strada!\n");
             break;
     }
 
-    printf("\n");
-    printf("Statistiche nemico:\n");
-    printf("  HP: %d | Attacco: %d | Difesa: %d\n", hp_nemico, attacco_nemico, difesa_nemico);
-    printf("\n");
-    printf("================================================================================\n");
-
-    /* Loop di combattimento */
-    while (hp_nemico > 0 && g->punti_vita > 0) {
-
-        difesa_temporanea_attiva = 0; 
-
-        printf("\n");
-        printf("--- Turno di %s ---\n", g->nome);
-        printf("Tuoi PV: %d/%d\n", g->punti_vita, PV_INIZIALI);
-        printf("PV Nemico: %d\n", hp_nemico);
-        printf("\n");
-        printf("Azioni disponibili:\n");
-        printf("1) Attacco base (danno normale)\n");
-        printf("2) Attacco potenziato (-%d PV, danno x%.1f)\n",
-               COSTO_ATTACCO_POTENZIATO, MOLTIPLICATORE_POTENZIATO);
-        printf("3) Difesa (+%d difesa per questo turno)\n", BONUS_DIFESA_TEMPORANEO);
-        printf("4) Utilizza oggetto dallo zaino\n");
-        printf("Scegli azione: ");
-
-        if (scanf("%d", &scelta) != 1) {
-            while (getchar() != '\n');
-            printf("Errore: devi inserire un numero!\n");
-            continue;
-        }
-        while (getchar() != '\n');
-
-        switch (scelta) {
-            case 1:
-                /* Attacco base */
-                dado_giocatore = lancia_dado();
-                dado_nemico    = lancia_dado();
-                danno = (g->attacco_psichico + dado_giocatore) - (difesa_nemico + dado_nemico);
-
-                if (danno < 0) danno = 0;
-                hp_nemico -= danno;
-
-                printf("\n>>> ATTACCO BASE! <<<\n");
-                printf("Danno inflitto: %d\n", danno);
-                printf("(Tuo attacco: %d + dado %d = %d VS Difesa nemica: %d + dado %d = %d)\n",
-                       g->attacco_psichico, dado_giocatore, g->attacco_psichico + dado_giocatore,
-                       difesa_nemico,       dado_nemico,    difesa_nemico + dado_nemico);
-                break;
-
-            case 2:
-                /* Attacco potenziato */
-                if (g->punti_vita <= COSTO_ATTACCO_POTENZIATO) {// Il giocatore non ha abbastanza PV per usare l'attacco potenziato
-                    printf("\n*** NON HAI ABBASTANZA PV! ***\n");
-                    printf("Hai solo %d PV, l'attacco ne costa %d.\n",
-                           g->punti_vita, COSTO_ATTACCO_POTENZIATO);
-                    printf("Usa l'attacco base o difenditi!\n");
-                    continue;
-                }
+    return partita_attende_input(p);
+}
 
-                g->punti_vita -= COSTO_ATTACCO_POTENZIATO;
-                dado_giocatore = lancia_dado();
-                dado_nemico    = lancia_dado();
-                danno = ((int)((double)g->attacco_psichico * MOLTIPLICATORE_POTENZIATO) + dado_giocatore)
-                        - (difesa_nemico + dado_nemico);
-
-                if (danno < 0) danno = 0;
-                hp_nemico -= danno;
-
-                printf("\n>>> ATTACCO POTENZIATO! <<<\n");
-                printf("Sacrifichi %d PV per un attacco devastante!\n", COSTO_ATTACCO_POTENZIATO);
-                printf("Danno inflitto: %d\n", danno);
-                break;
-
-            case 3:
-                /* Difesa temporanea */
-                printf("\n>>> POSIZIONE DIFENSIVA! <<<\n");
-                printf("Ti metti in guardia!\n");
-                printf("Difesa +%d per questo turno.\n", BONUS_DIFESA_TEMPORANEO);
-                g->difesa_psichica += BONUS_DIFESA_TEMPORANEO;
-                difesa_temporanea_attiva = 1; 
-
-            case 4:
-                /* Usa oggetto: non consuma il turno di combattimento */
-                utilizza_oggetto(g);
-                continue;
+// Esegue la riga misurandone il tempo solo se le metriche sono attive
+int partita_invia(Partita* p, const char* riga) {
+    Comando comando;
+    uint64_t inizio;
+    uint64_t durata;
+    int attende;
 
-            default:
-                printf("Azione non valida!\n");
-                continue;
-        }
+    if (!metriche_attive) {
+        return esegui_riga(p, riga);
+    }
+    comando = comando_della_riga(p, riga); // Prima di eseguirla: dipende dallo stato in cui arriva
+    inizio  = metriche_adesso_ns();
+    attende = esegui_riga(p, riga);
+    durata  = metriche_adesso_ns() - inizio;
+    metrica_osserva(ISTOGRAMMA_RIGA_NS, durata);
+    metrica_comando(comando, p->sessione, inizio, durata);
+    return attende;
+}
 
-        /* Controlla se il nemico e' morto */
-        if (hp_nemico <= 0) {
-            if (difesa_temporanea_attiva) {
-                g->difesa_psichica -= BONUS_DIFESA_TEMPORANEO;
-            }
+int partita_attende_input(const Partita* p) {
+    return p->stato != STATO_INATTIVA && p->stato != STATO_CHIUSA;
+}
 
-            printf("\n");
-            printf("================================================================================\n");
-
-            if (nemico == DEMOTORZONE) {
-                printf("                    *** VITTORIA EPICA! ***                                     \n");
-                printf("================================================================================\n");
-                printf("\n");
-                printf("Il Demotorzone emette un ultimo urlo elettrico!\n");
-                printf("Scintille esplodono ovunque mentre crolla a terra!\n");
-                printf("\n");
-                printf("****************************************************\n");
-                printf("*   CE L'HAI FATTA! HAI SCONFITTO IL DEMOTORZONE!  *\n");
-                printf("*   HAI SALVATO OCCHINZ!                           *\n");
-                printf("****************************************************\n");
-            } else {
-                printf("                    *** NEMICO SCONFITTO! ***                                   \n");
-                printf("================================================================================\n");
-                printf("\n");
-                printf("%s cade a terra, sconfitto!\n", tipo_nemico_to_string(nemico));
-                printf("Hai vinto il combattimento!\n");
-            }
+int partita_accoda(Partita* p, Evento_turno evento) {
+    Coda_eventi* q = &p->eventi;
+    unsigned int pos = atomic_load_explicit(&q->coda, memory_order_relaxed);
 
-            /* Possibilita' che il nemico sparisca dalla zona */
-            if (rand() % 2 == 0) {
-                printf("\nIl corpo del nemico si dissolve nell'aria...\n");
-                printf("La zona e' ora sicura.\n");
-                if (g->mondo == MONDO_REALE) {
-                    g->pos_mondoreale->nemico = NESSUN_NEMICO;
-                } else {
-                    g->pos_soprasotto->nemico = NESSUN_NEMICO;
-                }
-            } else {// Il nemico rimane a terra, ma potrebbe essere ancora pericoloso
-                printf("\nIl nemico giace a terra, ma potrebbe non essere finita...\n");
-                printf("Potrebbe ancora essere qui se qualcun altro passa.\n");
+    while (1) {
+        unsigned int i = pos & (CODA_EVENTI_MAX - 1);
+        Posto_evento* posto = &q->posti[i];
+        unsigned int sequenza = atomic_load_explicit(&posto->sequenza, memory_order_acquire) + i;
+        int differenza = (int)(sequenza - pos);
+
+        if (differenza == 0) { // Posto libero: lo prenota avanzando la coda
+            if (atomic_compare_exchange_weak_explicit(&q->coda, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                posto->evento = evento;
+                atomic_store_explicit(&posto->sequenza, pos + 1 - i, memory_order_release);
+                return 1;
             }
+        } else if (differenza < 0) { // Il consumatore non ha ancora liberato il posto
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->coda, memory_order_relaxed);
+        }
+    }
+}
 
-            printf("\n");
-            printf("================================================================================\n");
+int partita_elabora_eventi(Partita* p) {
+    Coda_eventi* q = &p->eventi;
+    int eseguiti = 0;
 
-            if (nemico == DEMOTORZONE) {
-                return 2;
-            }
-            return 1;
+    while (1) {
+        unsigned int pos = q->testa;
+        unsigned int i = pos & (CODA_EVENTI_MAX - 1);
+        Posto_evento* posto = &q->posti[i];
+        Evento_turno evento;
+
+        if (atomic_load_explicit(&posto->sequenza, memory_order_acquire) + i != pos + 1) {
+            break; // Coda vuota (o posto prenotato ma non ancora scritto)
         }
+        evento = posto->evento;
+        atomic_store_explicit(&posto->sequenza, pos + CODA_EVENTI_MAX - i, memory_order_release);
+        q->testa = pos + 1;
 
-        /* ====================================================================
-         * TURNO DEL NEMICO
-         * ==================================================================== */
-        printf("\n");
-        printf("--- Il nemico contrattacca! ---\n");
-        dado_nemico    = lancia_dado();
-        dado_giocatore = lancia_dado();
-        danno = (attacco_nemico + dado_nemico) - (g->difesa_psichica + dado_giocatore);
+        esegui_evento(p, evento);
+        eseguiti++;
+    }
+    return eseguiti;
+}
 
-        if (danno < 0) danno = 0;
+const char* partita_uscita(const Partita* p, size_t* lunghezza) {
+    if (lunghezza != NULL) {
+        *lunghezza = p->uscita.lunghezza;
+    }
+    return p->uscita.dati != NULL ? p->uscita.dati : "";
+}
 
-        if (danno == 0) {
-            printf("\n>>> HAI PARATO L'ATTACCO! <<<\n");
-            printf("Nessun danno subito!\n");
-        } else {
-            g->punti_vita -= danno;
-
-            if (danno < 5) {
-                printf("\n%s ti graffia leggermente.\n", tipo_nemico_to_string(nemico));
-                printf("Danni subiti: %d\n", danno);
-            } else if (danno < 10) {
-                printf("\n%s ti colpisce duramente!\n", tipo_nemico_to_string(nemico));
-                printf("Danni subiti: %d\n", danno);
-                printf("Senti il dolore penetrarti!\n");
-            } else {
-                printf("\n*** COLPO DEVASTANTE! ***\n");
-                printf("%s sferra un attacco micidiale!\n", tipo_nemico_to_string(nemico));
-                printf("Danni subiti: %d\n", danno);
-                printf("Barcollando, riesci a rimanere in piedi!\n");
-            }
-        }
+void partita_svuota_uscita(Partita* p) {
+    p->uscita.lunghezza = 0;
+}
 
-        printf("(Attacco nemico: %d + dado %d = %d VS Tua difesa: %d + dado %d = %d)\n",
-               attacco_nemico,      dado_nemico,    attacco_nemico + dado_nemico,
-               g->difesa_psichica,  dado_giocatore, g->difesa_psichica + dado_giocatore);
+void partita_scrivi(Partita* p, const char* testo) {
+    scrivi(p, "%s", testo);
+}
 
-        
-        if (difesa_temporanea_attiva) {// Rimuove il bonus di difesa temporanea alla fine del turno del nemico
-            g->difesa_psichica -= BONUS_DIFESA_TEMPORANEO;
-            difesa_temporanea_attiva = 0;
-        }
-
-        /* Controlla se il giocatore e' morto */
-        if (g->punti_vita <= 0) {
-            printf("\n");
-            printf("================================================================================\n");
-            printf("                    *** SEI STATO SCONFITTO ***                                 \n");
-            printf("================================================================================\n");
-            printf("\n");
-            printf("Le tue forze ti abbandonano...\n");
-            printf("Le ginocchia cedono...\n");
-            printf("Tutto diventa nero...\n");
-            printf("\n");
-            printf(">>> %s e' morto. <<<\n", g->nome);
-            printf("\n");
-            printf("================================================================================\n");
-            return -1;
-        }
+void partita_compatta(Partita* p) {
+    if (p->uscita.lunghezza == 0) {
+        free(p->uscita.dati);
+        p->uscita.dati     = NULL;
+        p->uscita.capacita = 0;
     }
+}
 
-    return 0;
+// La riga MESSAGGI_INIZIO segna nell'uscita il passaggio ai messaggi compatti; il client riparte senza definizioni
+void partita_usa_messaggi_compatti(Partita* p, int attivi) {
+    if (attivi && !p->messaggi_compatti) {
+        scrivi(p, "\n" MESSAGGI_INIZIO "\n");
+        memset(p->messaggi_definiti, 0, sizeof(p->messaggi_definiti));
+    }
+    p->messaggi_compatti = attivi != 0;
 }
 
 /* ============================================================================
- * FUNZIONE PUBBLICA: GIOCA
+ * FUNZIONI PUBBLICHE: COMANDI DA TERMINALE
  * ============================================================================ */
 
-// Gestisce il flusso principale del gioco, alternando i turni dei giocatori, gestendo le azioni e i combattimenti, e controllando le condizioni di vittoria o sconfitta
-void gioca(void) {
-    int i;
-    int scelta;
-    int turno = 0;
-    int giocatori_vivi;
-    int num_vivi_round = 0; /* FIX: fisso per tutto il round */
-    int ordine_turno[4];
-    int idx_turno = 0;
-    int risultato_combattimento;
-    int giocatore_corrente;
-    int nemico_presente;
-    int mossa_effettuata;
-    int appena_mosso_con_nemico;
-    int turno_finito;
+/**
+ * Trova in un testo la riga che comincia con una posizione data
+ * @param testo Testo
+ * @param fine Posizione subito dopo la riga
+ * @return Inizio della riga
+ */
+static size_t inizio_riga(const char* testo, size_t fine) {
+    while (fine > 0 && testo[fine - 1] != '\n') {
+        fine--;
+    }
+    return fine;
+}
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                     L'AVVENTURA HA INIZIO                                      \n");
-    printf("================================================================================\n");
+/**
+ * Trova l'inizio del menu in fondo al testo di un'azione: la richiesta di input, con le opzioni numerate
+ * che la precedono e il loro titolo
+ * @param testo Testo prodotto dalla partita
+ * @param lunghezza Byte del testo
+ * @return Inizio del menu, lunghezza se il testo non finisce con una richiesta
+ */
+static size_t inizio_menu(const char* testo, size_t lunghezza) {
+    size_t menu;
+    size_t fine;
+    int opzioni = 0;
 
-    if (!gioco_impostato) {// Controllo se il gioco e' stato impostato, altrimenti mostra un messaggio di errore e torna al menu principale
-        printf("\n*** ERRORE ***\n");
-        printf("Devi prima impostare il gioco dal menu principale!\n");
-        printf("Seleziona l'opzione 1) Imposta gioco.\n");
-        return;
+    if (lunghezza == 0 || testo[lunghezza - 1] == '\n') {
+        return lunghezza;
     }
-
-    /* Posiziona tutti i giocatori nella prima zona del Mondo Reale */
-    for (i = 0; i < num_giocatori; i++) {
-        if (giocatori[i] != NULL) {
-            giocatori[i]->pos_mondoreale = prima_zona_mondoreale;
-            giocatori[i]->pos_soprasotto = NULL;
-            giocatori[i]->mondo = MONDO_REALE;
+    menu = inizio_riga(testo, lunghezza);
+    fine = menu;
+    while (fine > 0) {
+        size_t inizio = inizio_riga(testo, fine - 1); /* La riga finisce con l'a capo in fine - 1 */
+        size_t i = inizio;
+
+        while (i < fine - 1 && testo[i] == ' ') {
+            i++;
+        }
+        fine = inizio;
+        if (testo[i] == '\n') { // Riga vuota
+            continue;
         }
+        if (isdigit((unsigned char)testo[i])) { // Opzione numerata ("1) ...")
+            while (isdigit((unsigned char)testo[i])) {
+                i++;
+            }
+            if (testo[i] == ')') {
+                opzioni = 1;
+                menu    = inizio;
+                continue;
+            }
+        }
+        if (opzioni) { // Titolo delle opzioni
+            menu = inizio;
+        }
+        break;
     }
+    return menu;
+}
 
-    printf("\n");
-    printf("Ti trovi a Occhinz, la tranquilla cittadina ora infestata da portali.\n");
-    printf("Davanti a te si estende il percorso verso il Soprasotto...\n");
-    printf("Ricorda: solo sconfiggendo il Demotorzone salverai la citta'!\n");
-    printf("\nTutti i giocatori partono dalla prima zona del Mondo Reale.\n");
-    printf("Che l'avventura abbia inizio!\n");
-    printf("================================================================================\n");
-
-    /* ========================================================================
-     * LOOP PRINCIPALE DI GIOCO
-     * ======================================================================== */
-    while (1) {
+/**
+ * Cerca un testo dentro un altro
+ * @param testo Testo in cui cercare
+ * @param lunghezza Byte del testo
+ * @param cercato Testo da cercare
+ * @param n Byte del testo da cercare
+ * @return Posizione del testo cercato, lunghezza se manca
+ */
+static size_t cerca_testo(const char* testo, size_t lunghezza, const char* cercato, size_t n) {
+    size_t i;
 
-        // Ricalcola giocatori vivi all'inizio di ogni iterazione
-        giocatori_vivi = 0;
-        for (i = 0; i < num_giocatori; i++) {
-            if (giocatori[i] != NULL) giocatori_vivi++;
-        }
-
-        // Condizione di sconfitta 
-        if (giocatori_vivi == 0) {
-            printf("\n");
-            printf("================================================================================\n");
-            printf("                         GAME OVER                                              \n");
-            printf("================================================================================\n");
-            printf("\n");
-            printf("Tutti i giocatori sono caduti in battaglia...\n");
-            printf("Il Demotorzone continua a terrorizzare Occhinz.\n");
-            printf("La citta' e' perduta.\n");
-            printf("\n");
-            printf("Forse la prossima volta...\n");
-            printf("================================================================================\n");
-            gioco_impostato = 0;
-            break;
+    for (i = 0; n > 0 && i + n <= lunghezza; i++) {
+        if (testo[i] == cercato[0] && memcmp(testo + i, cercato, n) == 0) {
+            return i;
         }
+    }
+    return lunghezza;
+}
 
-        // Inizio nuovo round: genera ordine casuale e congela num_vivi_round 
-        if (idx_turno == 0) {
-            int temp_idx[4];
-
-            num_vivi_round = 0; 
-
-            for (i = 0; i < num_giocatori; i++) {
-                if (giocatori[i] != NULL) {
-                    temp_idx[num_vivi_round] = i;
-                    num_vivi_round++;
-                }
-            }
+/**
+ * Scrive la riga di stato dello schermo: round, giocatore di turno, PV, posizione, zaino ed eventuale nemico
+ * @param p Partita
+ * @param g Giocatore di turno, NULL fuori dai turni
+ */
+static void aggiorna_stato_schermo(Partita* p, Giocatore* g) {
+    char stato[SCHERMO_COLONNE_MAX + 1];
+    const char* zona = "?";
+    int n;
 
-        
-            for (i = 0; i < num_vivi_round; i++) {// Fisher-Yates shuffle per mescolare l'ordine dei giocatori
-                int r   = rand() % num_vivi_round;
-                int tmp = temp_idx[i];
-                temp_idx[i] = temp_idx[r];
-                temp_idx[r] = tmp;
-            }
+    if (g == NULL) {
+        schermo_stato(schermo_console, " Cose Strane");
+        return;
+    }
+    if (g->mondo == MONDO_REALE && g->pos_mondoreale != NULL) {
+        zona = tipo_zona_to_string(g->pos_mondoreale->tipo);
+    } else if (g->mondo == SOPRASOTTO && g->pos_soprasotto != NULL) {
+        zona = tipo_zona_to_string(g->pos_soprasotto->tipo);
+    }
+    n = snprintf(stato, sizeof(stato), " Round %d | %s | PV %d | %s: %s | Zaino %d/%d", p->turno,
+                 nome_giocatore(p, g), g->punti_vita, g->mondo == MONDO_REALE ? "Mondo Reale" : "Soprasotto", zona,
+                 __builtin_popcount(p->zaini[g - p->giocatori].occupati), p->dimensione_zaino);
+    if (p->stato == STATO_COMBATTIMENTO || p->stato_ritorno == STATO_COMBATTIMENTO) {
+        snprintf(stato + n, sizeof(stato) - (size_t)n, " | %s PV %d", tipo_nemico_to_string(p->nemico), p->hp_nemico);
+    }
+    schermo_stato(schermo_console, stato);
+}
 
-            for (i = 0; i < num_vivi_round; i++) {
-                ordine_turno[i] = temp_idx[i];
-            }
+/**
+ * Mostra sullo schermo a pannelli il testo prodotto dalla partita e svuota il buffer: il menu finale va nel
+ * suo pannello, la zona del giocatore di turno nel pannello della zona, il resto nel registro
+ * @param p Partita da console
+ */
+static void mostra_su_schermo(Partita* p) {
+    Buffer_testo* b = &p->uscita;
+    Giocatore* g = NULL;
+    size_t lunghezza = b->lunghezza;
+    size_t menu = inizio_menu(b->dati, lunghezza);
+    size_t zona = menu;
+    size_t fine_zona = menu;
+
+    if (p->stato == STATO_AZIONE || p->stato == STATO_COMBATTIMENTO || p->stato == STATO_ZAINO) {
+        size_t completa;
+        size_t descrizione;
+
+        /* La zona si descrive in fondo al buffer e poi si toglie: se il testo la contiene gia' non va nel registro */
+        g = &p->giocatori[p->giocatore_corrente];
+        stampa_zona_corrente(p, g);
+        completa = b->lunghezza;
+        descrivi_zona_corrente(p, g);
+        descrizione = b->lunghezza;
+
+        zona      = cerca_testo(b->dati, menu, b->dati + lunghezza, completa - lunghezza);
+        fine_zona = zona < menu ? zona + (completa - lunghezza) : menu;
+        schermo_zona(schermo_console, b->dati + completa, descrizione - completa);
+    } else {
+        schermo_zona(schermo_console, "", 0);
+    }
 
-            turno++;
-            printf("\n");
-            printf("================================================================================\n");
-            printf("                           ROUND %d                                             \n", turno);
-            printf("================================================================================\n");
-        }
+    schermo_registro(schermo_console, b->dati, zona);
+    schermo_registro(schermo_console, b->dati + fine_zona, menu - fine_zona);
+    schermo_menu(schermo_console, b->dati + menu, lunghezza - menu);
+    aggiorna_stato_schermo(p, g);
+    schermo_disegna(schermo_console);
+    partita_svuota_uscita(p);
+}
 
-        
-        if (idx_turno >= num_vivi_round) {//confronto con num_vivi_round, non con num_giocatori
-            idx_turno = 0;
-            continue;
-        }
+/**
+ * Stampa su stdout il testo prodotto dalla partita e svuota il buffer
+ * @param p Partita da cui leggere il testo
+ */
+static void svuota_su_stdout(Partita* p) {
+    size_t lunghezza;
+    const char* testo;
 
-        giocatore_corrente = ordine_turno[idx_turno];
+    if (schermo_console != NULL && partita_attende_input(p)) {
+        mostra_su_schermo(p);
+        return;
+    }
+    if (schermo_console != NULL) { // Fase conclusa: il suo ultimo testo resta sul terminale
+        schermo_sospendi(schermo_console);
+    }
+    testo = partita_uscita(p, &lunghezza);
+    fwrite(testo, 1, lunghezza, stdout);
+    fflush(stdout);
+    partita_svuota_uscita(p);
+}
 
-        // Salta se il giocatore e' morto durante questo round
-        if (giocatori[giocatore_corrente] == NULL) {
-            idx_turno++;
-            if (idx_turno >= num_vivi_round) { // Se abbiamo finito i giocatori vivi per questo round, resetta l'ordine e inizia un nuovo round
-                idx_turno = 0;
-            }
-            continue;
-        }
+/**
+ * Legge una riga da stdin scartando i caratteri che non entrano nel buffer
+ * @param riga Buffer di destinazione
+ * @param dimensione Dimensione del buffer
+ * @return 1 se e' stata letta una riga, 0 a fine input
+ */
+static int leggi_riga_stdin(char* riga, int dimensione) {
+    int c;
 
-        printf("\n");
-        printf("================================================================================\n");
-        printf("                    Turno di: %s                                   \n",
-               giocatori[giocatore_corrente]->nome);
-        printf("================================================================================\n");
-
-        stampa_zona_corrente(giocatori[giocatore_corrente]);
-
-        nemico_presente         = ha_nemico_zona(giocatori[giocatore_corrente]);
-        mossa_effettuata        = 0;
-        appena_mosso_con_nemico = 0;
-        turno_finito            = 0;
-
-        /* ====================================================================
-         * LOOP AZIONI DEL TURNO
-         * ==================================================================== */
-        while (!turno_finito) {
-            printf("\n");
-            printf("--- Azioni Disponibili ---\n");
-            printf("1) Avanza alla zona successiva\n");
-            printf("2) Indietreggia alla zona precedente\n");
-            printf("3) Cambia mondo (attraversa portale)\n");
-            printf("4) Combatti nemico\n");
-            printf("5) Visualizza valori giocatore\n");
-            printf("6) Visualizza zona corrente\n");
-            printf("7) Raccogli oggetto\n");
-            printf("8) Utilizza oggetto dallo zaino\n");
-            printf("9) Passa il turno\n");
-            printf("\n");
-            printf("Scegli azione: ");
-
-            if (scanf("%d", &scelta) != 1) {
-                while (getchar() != '\n');
-                printf("Errore: devi inserire un numero!\n");
-                continue;
-            }
-            while (getchar() != '\n');
-
-            switch (scelta) {
-                case 1:
-                    /* Avanza */
-                    if (nemico_presente) {
-                        printf("\n*** IMPOSSIBILE AVANZARE! ***\n");
-                        printf("C'e' un nemico che ti blocca il passaggio!\n");
-                        printf("Devi sconfiggerlo prima di procedere!\n");
-                    } else if (mossa_effettuata) {
-                        printf("\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
-                        printf("Puoi fare una sola mossa di movimento per turno.\n");
-                    } else {
-                        avanza(giocatori[giocatore_corrente]);
-                        mossa_effettuata = 1;
-
-                        if (ha_nemico_zona(giocatori[giocatore_corrente])) {
-                            printf("\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
-                            printf("Turno terminato.\n");
-                            printf("Dovrai affrontarlo nel prossimo turno.\n");
-                            appena_mosso_con_nemico = 1;
-                        }
-                    }
-                    break;
-
-                case 2:
-                    /* Indietreggia */
-                    if (nemico_presente) {
-                        printf("\n*** IMPOSSIBILE INDIETREGGIARE! ***\n");
-                        printf("C'e' un nemico che ti blocca!\n");
-                        printf("Devi sconfiggerlo prima di muoverti!\n");
-                    } else if (mossa_effettuata) {
-                        printf("\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
-                        printf("Puoi fare una sola mossa di movimento per turno.\n");
-                    } else {
-                        indietreggia(giocatori[giocatore_corrente]);
-                        mossa_effettuata = 1;
-
-                        if (ha_nemico_zona(giocatori[giocatore_corrente])) {
-                            printf("\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
-                            printf("Turno terminato.\n");
-                            printf("Dovrai affrontarlo nel prossimo turno.\n");
-                            appena_mosso_con_nemico = 1;
-                        }
-                    }
-                    break;
-
-                case 3:
-                    /* Cambia mondo */
-                    if (nemico_presente && giocatori[giocatore_corrente]->mondo == MONDO_REALE) { // Il giocatore non puo' attraversare il portale se c'e' un nemico nel Mondo Reale, ma puo' farlo se e' nel Soprasotto (tentativo di fuga disperato)
-                        printf("\n*** IMPOSSIBILE CAMBIARE MONDO! ***\n");
-                        printf("C'e' un nemico che ti blocca!\n");
-                        printf("Devi sconfiggerlo prima di attraversare il portale!\n");
-                    } else if (mossa_effettuata) {
-                        printf("\n*** HAI GIA' FATTO UNA MOSSA! ***\n");
-                        printf("Puoi fare una sola mossa per turno.\n");
-                    } else {
-                        if (nemico_presente && giocatori[giocatore_corrente]->mondo == SOPRASOTTO) {
-                            printf("\n>>> TENTATIVO DI FUGA DAL NEMICO! <<<\n");
-                        }
-                        if (cambia_mondo(giocatori[giocatore_corrente])) { // Se il cambio mondo e' riuscito, controlla se c'e' un nemico nella nuova zona
-                            mossa_effettuata = 1;
-                            nemico_presente  = ha_nemico_zona(giocatori[giocatore_corrente]);
-
-                            if (nemico_presente) {
-                                printf("\n>>> ATTENZIONE: NEMICO RILEVATO! <<<\n");
-                                printf("Turno terminato.\n");
-                                appena_mosso_con_nemico = 1;
-                            }
-                        } else if (giocatori[giocatore_corrente]->mondo == SOPRASOTTO) {
-                            printf("\nSei ancora nel Soprasotto con il nemico!\n");
-                        }
-                    }
-                    break;
-
-                case 4:
-                    /* Combatti */
-                    if (appena_mosso_con_nemico) {
-                        printf("\n*** NON PUOI COMBATTERE ORA! ***\n");
-                        printf("Hai appena fatto una mossa in questo turno!\n");
-                        printf("Dovrai aspettare il prossimo turno.\n");
-                    } else { // Combatti il nemico presente nella zona
-                        risultato_combattimento =
-                            combatti_nemico(giocatori[giocatore_corrente]);
-
-                        if (risultato_combattimento == -1) {
-                            /* Giocatore morto */
-                            printf("\n");
-                            printf(">>> %s e' caduto in battaglia... <<<\n",
-                                   giocatori[giocatore_corrente]->nome);
-                            printf("Il suo nome sara' ricordato negli annali di Occhinz.\n");
-                            free(giocatori[giocatore_corrente]);
-                            giocatori[giocatore_corrente] = NULL;
-                            turno_finito = 1;
-
-                        } else if (risultato_combattimento == 2) { 
-                            // Vittoria finale: Demotorzone sconfitto
-                            printf("\n");
-                            printf("================================================================================\n");
-                            printf("                    *** VITTORIA FINALE ***                                    \n");
-                            printf("================================================================================\n");
-                            printf("\n");
-                            printf("Con il Demotorzone sconfitto, i portali cominciano a chiudersi!\n");
-                            printf("Il Soprasotto si dissolve, la realta' torna normale!\n");
-                            printf("\n");
-                            printf(">>> %s ha salvato Occhinz! <<<\n",
-                                   giocatori[giocatore_corrente]->nome);
-                            printf("\n");
-                            printf("La citta' e' salva. Le biciclette scomparse riappaiono misteriosamente.\n");
-                            printf("I Waffle Undici non sono mai stati cosi' buoni.\n");
-                            printf("Sei un eroe!\n");
-                            printf("================================================================================\n");
-                            // Aggiorna la classifica degli ultimi vincitori
-                            strncpy(ultimo_vincitore[2], ultimo_vincitore[1], NOME_MAX);
-                            strncpy(ultimo_vincitore[1], ultimo_vincitore[0], NOME_MAX);
-                            strncpy(ultimo_vincitore[0],
-                                    giocatori[giocatore_corrente]->nome, NOME_MAX);
-                            partite_giocate++;
-
-                            gioco_impostato = 0;
-                            return;
-
-                        } else if (risultato_combattimento == 1) {
-                            /* Vittoria normale */
-                            nemico_presente = 0;
-                            printf("\nOra puoi muoverti liberamente!\n");
-                        }
-                    }
-                    break;
-
-                case 5:
-                    stampa_giocatore_info(giocatori[giocatore_corrente]);
-                    break;
-
-                case 6:
-                    stampa_zona_corrente(giocatori[giocatore_corrente]);
-                    break;
-
-                case 7:
-                    raccogli_oggetto(giocatori[giocatore_corrente]);
-                    break;
-
-                case 8:
-                    utilizza_oggetto(giocatori[giocatore_corrente]);
-                    break;
-
-                case 9:
-                    if (nemico_presente && !appena_mosso_con_nemico) { // Il giocatore non puo' passare il turno se c'e' un nemico presente e non ha appena fatto una mossa (per evitare di passare dopo essere entrati in una zona con nemico)
-                        printf("\nNon puoi passare il turno! C'e' un nemico!\n");
-                        printf("Devi combatterlo!\n");
-                    } else {
-                        printf("\nPassi il turno.\n");
-                        turno_finito = 1;
-                    }
-                    break;
+    if (fgets(riga, dimensione, stdin) == NULL) {
+        return 0;
+    }
+    if (strchr(riga, '\n') == NULL) {
+        while ((c = getchar()) != '\n' && c != EOF);
+    }
+    return 1;
+}
 
-                default:
-                    printf("Scelta non valida!\n");
-                    continue;
-            }
+/**
+ * Consegna alla partita le righe lette da stdin finche' la fase corrente non si conclude
+ * @param p Partita da console
+ */
+static void esegui_da_terminale(Partita* p) {
+    char riga[128];
 
-            /* Termina il turno se il giocatore e' morto, ha passato,
-             * o si e' mosso in una zona con nemico */
-            if (turno_finito || appena_mosso_con_nemico) {
-                break;
-            }
-        }
-        // Avanza al prossimo giocatore vivo nell'ordine del turno 
-        idx_turno++;
-        if (idx_turno >= num_vivi_round) { 
-            idx_turno = 0;
-        }
+    svuota_su_stdout(p);
+    while (partita_attende_input(p) && leggi_riga_stdin(riga, (int)sizeof(riga))) {
+        partita_invia(p, riga);
+        svuota_su_stdout(p);
     }
 }
 
-/* ============================================================================
- * FUNZIONI PUBBLICHE: TERMINA_GIOCO E CREDITI
- * ============================================================================ */
+// Permette di configurare il gioco, impostare i giocatori e preparare la mappa
+void imposta_gioco(void) {
+    avvia_impostazione(&partita_console);
+    esegui_da_terminale(&partita_console);
+}
+
+// Gestisce il flusso principale del gioco dal terminale: ogni riga letta viene consegnata alla macchina a stati dei turni
+void gioca(void) {
+    partita_inizia(&partita_console);
+    esegui_da_terminale(&partita_console);
+}
 
 /**
  * Termina il gioco, libera la memoria e saluta il giocatore
  */
 void termina_gioco(void) {
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                         ARRIVEDERCI!                                           \n");
-    printf("================================================================================\n");
-    printf("\nGrazie per aver giocato a Cosestrane!\n");
-    printf("Alla prossima avventura!\n\n");
-
-    libera_giocatori();
-    libera_mappe();
+    saluta(&partita_console);
+    svuota_su_stdout(&partita_console);
+    free(partita_console.uscita.dati);
+    partita_console.uscita.dati     = NULL;
+    partita_console.uscita.capacita = 0;
 }
 
 /**
  * Mostra i crediti del gioco e le statistiche delle ultime partite
  */
 void crediti(void) {
-    int i;
+    stampa_crediti(&partita_console);
+    svuota_su_stdout(&partita_console);
+}
+
+// Sceglie la classifica in cui finiscono le partite concluse
+void gioco_usa_classifica(Classifica* c) {
+    classifica_gioco = c;
+}
 
-    printf("\n");
-    printf("================================================================================\n");
-    printf("                            CREDITI                                             \n");
-    printf("================================================================================\n");
-    printf("\n");
-    printf("Gioco: Cosestrane\n");
-    printf("Creato da: Hanaji Tancre'\n");
-    printf("Anno: 2025-2026\n");
-    printf("Corso: Programmazione Procedurale\n");
-    printf("\n");
-    printf("Partite giocate: %d\n", partite_giocate);
-    printf("\n");
-    printf("Ultimi vincitori:\n");
-    for (i = 0; i < 3; i++) {
-        printf("  %d) %s\n", i + 1, ultimo_vincitore[i]);
-    }
-    printf("\n");
-    printf("================================================================================\n");
-    printf("\n");
+// Sceglie lo schermo a pannelli della partita da console
+void gioco_usa_schermo(Schermo* s) {
+    schermo_console = s;
 }
@@ -1,6 +1,9 @@
 #ifndef GAMELIB_H
 #define GAMELIB_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* ============================================================================
  * COSTANTI DI GIOCO
  * ============================================================================ */
@@ -9,7 +12,13 @@
 #define PV_INIZIALI  80
 #define ZONE_MINIME  15
 #define NOME_MAX     50
-#define ZAINO_MAX     3
+#define ZAINO_MAX     3          /* Posti predefiniti dello zaino */
+
+/* Numero massimo di giocatori in una partita */
+#define GIOCATORI_MAX  256
+
+/* Posti nella coda degli eventi di una partita (potenza di 2) */
+#define CODA_EVENTI_MAX  64
 
 /* Probabilità generazione nemici Mondo Reale (%) */
 #define PROB_NESSUN_NEMICO_MR    40
@@ -98,10 +107,23 @@ typedef enum {
     SOPRASOTTO
 } Tipo_mondo;
 
+// Tipi di evento di turno che si possono accodare a una partita
+typedef enum {
+    EVENTO_AZIONE,           /* Scelta 1-9 del menu delle azioni */
+    EVENTO_COMBATTIMENTO,    /* Scelta 1-4 del menu di combattimento */
+    EVENTO_OGGETTO           /* Slot dello zaino da usare (0 annulla) */
+} Tipo_evento;
+
 /* ============================================================================
  * STRUTTURE DATI
  * ============================================================================ */
 
+// Un'azione di turno gia' decodificata
+typedef struct {
+    unsigned char tipo;      /* Tipo_evento */
+    unsigned char scelta;
+} Evento_turno;
+
 
 typedef struct Zona_soprasotto Zona_soprasotto;
 
@@ -113,6 +135,8 @@ typedef struct Zona_mondoreale {
     struct Zona_mondoreale* avanti;      /* Puntatore alla zona successiva */
     struct Zona_mondoreale* indietro;    /* Puntatore alla zona precedente */
     Zona_soprasotto* link_soprasotto;    /* Link alla zona parallela nel Soprasotto */
+    int primo_occupante;                 /* Primo giocatore presente, -1 se la zona e' vuota */
+    int num_occupanti;                   /* Numero di giocatori presenti */
 } Zona_mondoreale;
 
 // Struttura per una zona del Soprasotto
@@ -122,21 +146,40 @@ struct Zona_soprasotto {
     struct Zona_soprasotto* avanti;      /* Puntatore alla zona successiva */
     struct Zona_soprasotto* indietro;    /* Puntatore alla zona precedente */
     Zona_mondoreale* link_mondoreale;    /* Link alla zona parallela nel Mondo Reale */
+    int primo_occupante;                 /* Primo giocatore presente, -1 se la zona e' vuota */
+    int num_occupanti;                   /* Numero di giocatori presenti */
 };
 
-// Struttura per rappresentare un giocatore
+// Struttura per rappresentare un giocatore: solo i campi letti a ogni azione,
+// in 32 byte allineati (due giocatori per linea di cache). Il nome, che serve
+// solo per le stampe, e lo zaino, di dimensione configurabile, stanno in
+// array separati della partita.
 typedef struct Giocatore {
-    char nome[NOME_MAX];                 /* Nome del giocatore */
-    Tipo_mondo mondo;                    /* Mondo in cui si trova attualmente 0=MONDO_REALE, 1=SOPRASOTTO */
-    Zona_mondoreale* pos_mondoreale;     /* Posizione nel Mondo Reale */
+    _Alignas(32) Zona_mondoreale* pos_mondoreale; /* Posizione nel Mondo Reale */
     Zona_soprasotto* pos_soprasotto;     /* Posizione nel Soprasotto */
-    int attacco_psichico;                /* Statistica di attacco */
-    int difesa_psichica;                 /* Statistica di difesa */
-    int fortuna;                         /* Statistica di fortuna */
-    int punti_vita;                      /* Punti vita correnti */
-    Tipo_oggetto zaino[ZAINO_MAX];       /* Inventario oggetti */
+    int16_t attacco_psichico;            /* Statistica di attacco */
+    int16_t difesa_psichica;             /* Statistica di difesa */
+    int16_t fortuna;                     /* Statistica di fortuna */
+    int16_t punti_vita;                  /* Punti vita correnti */
+    uint8_t mondo;                       /* Tipo_mondo in cui si trova attualmente */
 } Giocatore;
 
+// Stato di una partita (mappe, giocatori, turno in corso); definita in gamelib.c
+typedef struct Partita Partita;
+
+// Classifica persistente delle partite concluse; definita in classifica.c
+typedef struct Classifica Classifica;
+
+// Mappa in sola lettura condivisa da piu' partite; definita in mappa_condivisa.c
+typedef struct Mappa_condivisa Mappa_condivisa;
+
+// Schermo a pannelli del terminale; definito in schermo.c
+typedef struct Schermo Schermo;
+
+// Variante di una partita per la ricerca e la sua arena; definite in ramo.h e ramo.c
+typedef struct Ramo Ramo;
+typedef struct Arena_rami Arena_rami;
+
 /* ============================================================================
  * FUNZIONI PUBBLICHE
  * ============================================================================ */
@@ -153,4 +196,98 @@ void termina_gioco(void);
 //funzione per visualizzare i crediti del gioco
 void crediti(void);
 
+//registra nella classifica le partite concluse del processo, console e sessioni remote (NULL per non registrarle);
+//la classifica deve restare aperta finche' si gioca
+void gioco_usa_classifica(Classifica* c);
+
+//mostra la partita da console sullo schermo a pannelli, aggiornato solo dove cambia, finche' attende input;
+//il testo con cui si chiude una fase torna al terminale normale (NULL per avere sempre il testo che scorre)
+void gioco_usa_schermo(Schermo* s);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: PARTITA A EVENTI
+ *
+ * Una partita non blocca mai in attesa di input: partita_invia consegna una
+ * riga e restituisce subito, lasciando nel buffer di uscita il testo prodotto
+ * fino alla richiesta successiva. Un solo thread puo' cosi' gestire molte
+ * partite, risvegliandole solo quando arriva un comando.
+ * ============================================================================ */
+
+//crea una partita vuota, restituisce NULL se la memoria non basta
+Partita* partita_crea(void);
+
+//libera la partita con le sue mappe e i suoi giocatori
+void partita_distruggi(Partita* p);
+
+//apre una sessione remota: benvenuto e menu principale (imposta, gioca, esci, crediti)
+void partita_apri(Partita* p);
+
+//avvia i turni di una partita impostata; restituisce 1 se la partita attende input
+int partita_inizia(Partita* p);
+
+//consegna una riga di input alla partita; restituisce 1 se la partita attende altro input
+int partita_invia(Partita* p, const char* riga);
+
+//restituisce 1 se la partita attende input, 0 se e' inattiva o la sessione e' chiusa
+int partita_attende_input(const Partita* p);
+
+//testo prodotto dalla partita e non ancora consumato (termina con la richiesta di input)
+const char* partita_uscita(const Partita* p, size_t* lunghezza);
+
+//segnala che il testo di uscita e' stato consumato
+void partita_svuota_uscita(Partita* p);
+
+//accoda all'uscita un testo di chi ospita la partita (per esempio un avviso del server), dopo quello gia' prodotto
+void partita_scrivi(Partita* p, const char* testo);
+
+//rilascia la memoria del buffer di uscita se e' vuoto (sessioni inattive)
+void partita_compatta(Partita* p);
+
+//con attivi = 1 l'uscita diventa di messaggi compatti (vedi messaggi.h), dopo una riga MESSAGGI_INIZIO; con 0 torna testo
+void partita_usa_messaggi_compatti(Partita* p, int attivi);
+
+//fa giocare la partita sulla mappa condivisa (NULL per tornare alle mappe proprie): dopo i giocatori
+//l'impostazione non crea una mappa; la mappa deve restare valida finche' la partita esiste
+void partita_usa_mappa_condivisa(Partita* p, const Mappa_condivisa* m);
+
+//copia lo stato della partita in un nuovo ramo dell'arena (vedi ramo.h) con i dadi dal seme dato;
+//NULL se la mappa non c'e' ancora o la memoria non basta
+Ramo* partita_ramifica(Partita* p, Arena_rami* a, uint64_t seme);
+
+//turni gia' giocati che si possono annullare nella partita in corso (0 fuori dai turni di gioco)
+int partita_turni_annullabili(const Partita* p);
+
+//annulla gli ultimi turni e fa ripartire il turno a cui si arriva: 0 ricomincia il turno in corso,
+//piu' dei turni annullabili riporta al primo; turni annullati o -1 se non si puo' riavvolgere
+int partita_riavvolgi(Partita* p, int turni);
+
+//restituisce 1 se la partita e' nei turni di gioco (azione, combattimento o scelta dallo zaino)
+int partita_in_gioco(const Partita* p);
+
+//scrive in *dati (da liberare con free) un'istantanea della partita nei turni di gioco: mappa come la vede
+//la partita, giocatori, turno e dadi, senza il diario; restituisce i byte scritti, 0 fuori dal gioco o senza memoria
+size_t partita_istantanea(Partita* p, unsigned char** dati);
+
+//riporta una partita appena creata (dopo partita_usa_mappa_condivisa, se l'istantanea e' di una mappa condivisa)
+//allo stato dell'istantanea; restituisce 1 se riuscito, 0 se l'istantanea non e' valida o la memoria non basta
+int partita_ripristina(Partita* p, const unsigned char* dati, size_t n);
+
+//ristampa la zona e la richiesta a cui attende risposta una partita ripristinata
+void partita_riprendi(Partita* p);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: EVENTI DI TURNO
+ *
+ * Thread di rete e bot possono accodare azioni gia' decodificate senza lock;
+ * il thread che gestisce la partita le esegue tutte insieme con
+ * partita_elabora_eventi. Un evento non valido nello stato corrente viene
+ * scartato con un messaggio.
+ * ============================================================================ */
+
+//accoda un evento di turno (anche da piu' thread insieme); restituisce 0 se la coda e' piena
+int partita_accoda(Partita* p, Evento_turno evento);
+
+//esegue tutti gli eventi in coda (un solo thread per partita); restituisce quanti ne ha eseguiti
+int partita_elabora_eventi(Partita* p);
+
 #endif 
@@ -0,0 +1,410 @@
+#include <stdlib.h>
+#include "generatore.h"
+
+/* Le due facce dei dadi si sottraggono: lo scarto va da -19 a +19 */
+#define FACCE_DADO  20
+#define SCARTI      (2 * FACCE_DADO - 1)
+
+/* Passate di correzione della perdita di PV del percorso */
+#define GIRI_CORREZIONE  3
+
+// Zona del percorso con il costo del suo nemico, per ordinarle
+typedef struct {
+    double costo;
+    int indice;
+} Zona_costo;
+
+/* ============================================================================
+ * MODELLO DEL COMBATTIMENTO
+ * ============================================================================ */
+
+/**
+ * Probabilita' che il dado di chi colpisce superi quello di chi para di k
+ * @param k Scarto tra i due dadi, tra -19 e 19
+ * @return Probabilita' dello scarto
+ */
+static double probabilita_scarto(int k) {
+    return (double)(FACCE_DADO - abs(k)) / (double)(FACCE_DADO * FACCE_DADO);
+}
+
+/**
+ * Danno medio di un colpo come in round_combattimento: (attacco + dado) - (difesa + dado), mai negativo
+ * @param attacco Attacco di chi colpisce
+ * @param difesa Difesa di chi para
+ * @return Danno atteso
+ */
+static double danno_atteso(int attacco, int difesa) {
+    double totale = 0.0;
+    int k;
+
+    for (k = 1 - FACCE_DADO; k < FACCE_DADO; k++) {
+        if (attacco - difesa + k > 0) {
+            totale += probabilita_scarto(k) * (attacco - difesa + k);
+        }
+    }
+    return totale;
+}
+
+double pv_persi_attesi(int nemico, int attacco, int difesa) {
+    const Statistiche_nemico* s = registro_nemico(nemico);
+    double contrattacco;
+    double mancato = 0.0;                /* Probabilita' di un colpo senza danno */
+    double* persi;
+    double risultato;
+    int h, k;
+
+    if (nemico == NESSUN_NEMICO) {
+        return 0.0;
+    }
+
+    for (k = 1 - FACCE_DADO; k < FACCE_DADO; k++) {
+        if (attacco - s->difesa + k <= 0) {
+            mancato += probabilita_scarto(k);
+        }
+    }
+    if (mancato >= 1.0) {
+        return PV_PERSI_INFINITI;
+    }
+    contrattacco = danno_atteso(s->attacco, difesa);
+
+    /* persi[h] = PV persi attesi con il nemico a h punti vita. Ogni round il giocatore colpisce per
+     * primo: se il nemico resta in piedi arriva il contrattacco. Il colpo a vuoto ripete lo stato. */
+    persi = (double*)malloc(((size_t)s->hp + 1) * sizeof(double));
+    if (persi == NULL) {
+        return PV_PERSI_INFINITI;
+    }
+    persi[0] = 0.0;
+    for (h = 1; h <= s->hp; h++) {
+        double somma = mancato * contrattacco;
+
+        for (k = 1 - FACCE_DADO; k < FACCE_DADO; k++) {
+            int danno = attacco - s->difesa + k;
+            if (danno > 0 && danno < h) {
+                somma += probabilita_scarto(k) * (contrattacco + persi[h - danno]);
+            }
+        }
+        persi[h] = somma / (1.0 - mancato);
+    }
+
+    risultato = persi[s->hp];
+    free(persi);
+    return risultato;
+}
+
+/* ============================================================================
+ * CORREZIONE DELLE ZONE
+ * ============================================================================ */
+
+/**
+ * Mescola un array di indici (Fisher-Yates)
+ * @param v Indici
+ * @param n Numero di indici
+ */
+static void mescola(int* v, int n) {
+    int i;
+
+    for (i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+    }
+}
+
+/**
+ * Ordina le zone dal nemico piu' costoso al meno costoso
+ */
+static int confronta_costi(const void* a, const void* b) {
+    double ca = ((const Zona_costo*)a)->costo;
+    double cb = ((const Zona_costo*)b)->costo;
+
+    return (ca < cb) - (ca > cb);
+}
+
+/**
+ * Sceglie il nemico piu' costoso che non supera un costo massimo
+ * @param costo_tipo Costo di ogni tipo di nemico
+ * @param massimo Costo massimo ammesso
+ * @param anche_nessuno 1 se "nessun nemico" e' una scelta valida
+ * @return Tipo scelto, -1 se nessuno va bene
+ */
+static int nemico_entro(const double* costo_tipo, double massimo, int anche_nessuno) {
+    int scelto = anche_nessuno ? NESSUN_NEMICO : -1;
+    int t;
+
+    for (t = 1; t < registro_num_nemici(); t++) {
+        if (!registro_nemico(t)->finale && costo_tipo[t] <= massimo
+            && (scelto <= 0 || costo_tipo[t] > costo_tipo[scelto])) {
+            scelto = t;
+        }
+    }
+    return scelto;
+}
+
+/**
+ * Distanza tra due costi
+ */
+static double distanza(double a, double b) {
+    return a > b ? a - b : b - a;
+}
+
+/**
+ * Sceglie il nemico il cui costo e' piu' vicino a un costo desiderato
+ * @param costo_tipo Costo di ogni tipo di nemico
+ * @param desiderato Costo desiderato
+ * @param anche_nessuno 1 se "nessun nemico" e' una scelta valida
+ * @return Tipo scelto, -1 se nessuno va bene
+ */
+static int nemico_piu_vicino(const double* costo_tipo, double desiderato, int anche_nessuno) {
+    int scelto = anche_nessuno ? NESSUN_NEMICO : -1;
+    int t;
+
+    for (t = 1; t < registro_num_nemici(); t++) {
+        if (!registro_nemico(t)->finale
+            && (scelto < 0 || distanza(costo_tipo[t], desiderato) < distanza(costo_tipo[scelto], desiderato))) {
+            scelto = t;
+        }
+    }
+    return scelto;
+}
+
+/**
+ * Conta i nemici di fila nel Mondo Reale che avrebbe la zona i se ne avesse uno
+ * @param zone Zone
+ * @param n Numero di zone
+ * @param i Zona da controllare
+ * @param limite Oltre questo valore smette di contare
+ * @return Lunghezza della sequenza che conterrebbe la zona i
+ */
+static int sequenza_con(const Contenuto_zona* zone, int n, int i, int limite) {
+    int lunghezza = 1;
+    int j;
+
+    for (j = i - 1; j >= 0 && zone[j].nemico_mr != NESSUN_NEMICO && lunghezza <= limite; j--) {
+        lunghezza++;
+    }
+    for (j = i + 1; j < n && zone[j].nemico_mr != NESSUN_NEMICO && lunghezza <= limite; j++) {
+        lunghezza++;
+    }
+    return lunghezza;
+}
+
+/**
+ * Sceglie a caso la zona del nemico finale tra quelle abbastanza lontane dall'inizio
+ * da poter raggiungere la perdita minima con i nemici consecutivi ammessi
+ * @param n Numero di zone
+ * @param o Obiettivi
+ * @param costo_massimo Costo del nemico estraibile piu' caro
+ * @return Indice della zona
+ */
+static int scegli_posizione_finale(int n, const Obiettivi_mappa* o, double costo_massimo) {
+    double minimo = (double)(o->pv_persi - o->tolleranza);
+    int primo;
+
+    for (primo = 0; primo < n - 1; primo++) {
+        int lunghezza = primo + 1;
+        int nemici    = lunghezza - lunghezza / (o->nemici_consecutivi + 1); // Una zona libera ogni tanto
+
+        if ((double)nemici * costo_massimo >= minimo) {
+            break;
+        }
+    }
+    return primo + rand() % (n - primo);
+}
+
+/**
+ * Spezza le sequenze di nemici del Mondo Reale piu' lunghe del massimo
+ * @param zone Zone
+ * @param n Numero di zone
+ * @param massimo Nemici di fila ammessi
+ */
+static void limita_sequenze(Contenuto_zona* zone, int n, int massimo) {
+    int di_fila = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (zone[i].nemico_mr == NESSUN_NEMICO) {
+            di_fila = 0;
+        } else if (++di_fila > massimo) {
+            zone[i].nemico_mr = NESSUN_NEMICO;
+            di_fila = 0;
+        }
+    }
+}
+
+/**
+ * Porta la perdita di PV del percorso dentro l'intervallo obiettivo cambiando un nemico alla volta
+ * Se e' troppo alta alleggerisce prima le zone piu' care, se e' troppo bassa rinforza o popola zone a caso;
+ * ogni nemico nuovo e' quello che porta la perdita piu' vicino al centro dell'intervallo
+ * @param zone Zone
+ * @param n Numero di zone
+ * @param fine Ultima zona del percorso
+ * @param o Obiettivi
+ * @param costo_tipo Costo di ogni tipo di nemico
+ * @param lavoro Spazio per fine + 1 zone con costo
+ * @param ordine Spazio per fine + 1 indici
+ * @return Perdita di PV attesa del percorso finale
+ */
+static double correggi_percorso(Contenuto_zona* zone, int n, int fine, const Obiettivi_mappa* o,
+                                const double* costo_tipo, Zona_costo* lavoro, int* ordine) {
+    double minimo  = (double)(o->pv_persi - o->tolleranza);
+    double massimo = (double)(o->pv_persi + o->tolleranza);
+    double totale  = 0.0;
+    int giro;
+    int i;
+
+    for (i = 0; i <= fine; i++) {
+        totale += costo_tipo[zone[i].nemico_mr];
+    }
+
+    /* Un secondo giro rimedia a un primo che ha oltrepassato l'intervallo */
+    for (giro = 0; giro < GIRI_CORREZIONE && (totale < minimo || totale > massimo); giro++) {
+        int num = 0;
+
+        if (totale > massimo) {
+            for (i = 0; i <= fine; i++) {
+                if (zone[i].nemico_mr != NESSUN_NEMICO) {
+                    lavoro[num].costo  = costo_tipo[zone[i].nemico_mr];
+                    lavoro[num].indice = i;
+                    num++;
+                }
+            }
+            qsort(lavoro, (size_t)num, sizeof(Zona_costo), confronta_costi);
+
+            for (i = 0; i < num && totale > massimo; i++) {
+                int z = lavoro[i].indice;
+                int t = nemico_piu_vicino(costo_tipo, lavoro[i].costo + (double)o->pv_persi - totale, 1);
+
+                totale += costo_tipo[t] - lavoro[i].costo;
+                zone[z].nemico_mr = (uint8_t)t;
+            }
+        } else {
+            if (fine + 1 < n) {
+                zone[fine + 1].nemico_mr = NESSUN_NEMICO; // Fuori dal percorso: non deve bloccare le sequenze del percorso
+            }
+            for (i = 0; i <= fine; i++) {
+                ordine[num++] = i;
+            }
+            mescola(ordine, num);
+
+            for (i = 0; i < num && totale < minimo; i++) {
+                int z = ordine[i];
+                double attuale = costo_tipo[zone[z].nemico_mr];
+                int t;
+
+                if (zone[z].nemico_mr == NESSUN_NEMICO
+                    && sequenza_con(zone, n, z, o->nemici_consecutivi) > o->nemici_consecutivi) {
+                    continue;
+                }
+                t = nemico_piu_vicino(costo_tipo, attuale + (double)o->pv_persi - totale, 0); // Un nemico nuovo o piu' forte
+                if (t < 0 || costo_tipo[t] <= attuale) {
+                    continue;
+                }
+                totale += costo_tipo[t] - attuale;
+                zone[z].nemico_mr = (uint8_t)t;
+            }
+        }
+    }
+
+    return totale;
+}
+
+/**
+ * Porta il numero di zone con un oggetto al valore obiettivo togliendo o aggiungendo oggetti a caso
+ * @param zone Zone
+ * @param n Numero di zone
+ * @param obiettivo Zone con un oggetto richieste
+ * @param lavoro Spazio per n indici
+ * @return 1 se l'obiettivo e' raggiunto, 0 se il registro non ha oggetti estraibili
+ */
+static int correggi_oggetti(Contenuto_zona* zone, int n, int obiettivo, int* lavoro) {
+    int con_oggetto = 0;
+    int num = 0;
+    int togliere;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        con_oggetto += zone[i].oggetto != NESSUN_OGGETTO;
+    }
+    togliere = con_oggetto > obiettivo;
+
+    for (i = 0; i < n; i++) {
+        if ((zone[i].oggetto != NESSUN_OGGETTO) == togliere) {
+            lavoro[num++] = i;
+        }
+    }
+    mescola(lavoro, num);
+
+    for (i = 0; i < num && con_oggetto != obiettivo; i++) {
+        int z = lavoro[i];
+
+        if (togliere) {
+            zone[z].oggetto = NESSUN_OGGETTO;
+            con_oggetto--;
+        } else {
+            int oggetto = NESSUN_OGGETTO;
+            int tentativi;
+
+            for (tentativi = 0; tentativi < 64 && oggetto == NESSUN_OGGETTO; tentativi++) {
+                oggetto = registro_estrai_oggetto(); // Stessi pesi dell'estrazione normale, senza "nessuno"
+            }
+            if (oggetto == NESSUN_OGGETTO) {
+                return 0;
+            }
+            zone[z].oggetto = (uint8_t)oggetto;
+            con_oggetto++;
+        }
+    }
+    return con_oggetto == obiettivo;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+int genera_zone_vincolate(Contenuto_zona* zone, int n, const Obiettivi_mappa* o, int* posizione_finale) {
+    double costo_tipo[NEMICI_MAX];
+    Zona_costo* lavoro;
+    int* indici;
+    double totale;
+    int oggetti_ok;
+    int t;
+
+    registro_estrai_zone(zone, n);
+    *posizione_finale = rand() % n; // Senza memoria la mappa resta quella dei soli pesi di comparsa
+
+    lavoro = (Zona_costo*)malloc((size_t)n * sizeof(Zona_costo));
+    indici = (int*)malloc((size_t)n * sizeof(int));
+    if (lavoro == NULL || indici == NULL) {
+        free(lavoro);
+        free(indici);
+        return -1;
+    }
+
+    for (t = 0; t < registro_num_nemici(); t++) {
+        costo_tipo[t] = pv_persi_attesi(t, ATTACCO_RIFERIMENTO, DIFESA_RIFERIMENTO);
+    }
+    t = nemico_entro(costo_tipo, PV_PERSI_INFINITI, 1);
+    *posizione_finale = scegli_posizione_finale(n, o, costo_tipo[t]);
+
+    limita_sequenze(zone, n, o->nemici_consecutivi);
+    totale     = correggi_percorso(zone, n, *posizione_finale, o, costo_tipo, lavoro, indici);
+    oggetti_ok = correggi_oggetti(zone, n, (n * o->densita_oggetti + 50) / 100, indici);
+
+    free(lavoro);
+    free(indici);
+    return oggetti_ok
+        && totale >= (double)(o->pv_persi - o->tolleranza)
+        && totale <= (double)(o->pv_persi + o->tolleranza);
+}
+
+int genera_contenuti_mappa(Contenuto_zona* zone, int n, int* posizione_finale) {
+    const Obiettivi_mappa* obiettivi = registro_obiettivi_mappa();
+
+    if (obiettivi != NULL) { // Il registro chiede una difficolta' precisa
+        return genera_zone_vincolate(zone, n, obiettivi, posizione_finale);
+    }
+    *posizione_finale = rand() % n;
+    registro_estrai_zone(zone, n); // Tipi, nemici e oggetti di tutte le zone con i pesi del registro
+    return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef GENERATORE_H
+#define GENERATORE_H
+
+#include "registro.h"
+
+/* ============================================================================
+ * GENERATORE DI MAPPE CON OBIETTIVI DI DIFFICOLTA'
+ *
+ * Parte da un'estrazione normale delle zone e la corregge una zona alla
+ * volta finche' non rispetta gli obiettivi, invece di rigenerare mappe
+ * intere finche' una va bene.
+ *
+ * Il costo di un nemico e' la perdita di PV attesa di un giocatore di
+ * riferimento che lo combatte con attacchi base, calcolata esattamente
+ * sulla distribuzione dei due dadi da 20. Il costo del percorso e' la somma
+ * dei costi dei nemici del Mondo Reale dalla prima zona a quella del nemico
+ * finale: cambiare il nemico di una zona lo aggiorna in tempo costante.
+ * ============================================================================ */
+
+/* Statistiche del giocatore di riferimento (valore medio di un dado da 20) */
+#define ATTACCO_RIFERIMENTO  10
+#define DIFESA_RIFERIMENTO   10
+
+/* Costo di un nemico che il giocatore non puo' ferire */
+#define PV_PERSI_INFINITI    1e9
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//perdita di PV attesa combattendo il nemico con attacchi base fino a sconfiggerlo
+double pv_persi_attesi(int nemico, int attacco, int difesa);
+
+//riempie n zone rispettando gli obiettivi; posizione_finale riceve la zona del nemico finale nel Soprasotto.
+//restituisce 1 se gli obiettivi sono tutti rispettati, 0 se la mappa e' la piu' vicina trovata, -1 se
+//la memoria non basta (zone e posizione_finale valgono comunque, estratte solo con i pesi di comparsa)
+int genera_zone_vincolate(Contenuto_zona* zone, int n, const Obiettivi_mappa* o, int* posizione_finale);
+
+//riempie n zone con gli obiettivi del registro se ce ne sono, altrimenti solo con i pesi di comparsa.
+//restituisce 1 se riuscito, 0 se gli obiettivi del registro non sono stati rispettati, -1 se la memoria
+//non e' bastata per applicarli (la mappa resta valida, con i soli pesi di comparsa)
+int genera_contenuti_mappa(Contenuto_zona* zone, int n, int* posizione_finale);
+
+#endif
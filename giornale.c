@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "giornale.h"
+
+/* Byte del lotto di righe scritto con una sola write */
+#define LOTTO_GIORNALE     65536
+
+/* Byte al massimo di una riga del giornale */
+#define RIGA_MAX           512
+
+/* Pausa del thread di scrittura quando gli anelli sono vuoti */
+#define ATTESA_NS          10000000L
+
+/* ============================================================================
+ * VARIABILI GLOBALI
+ * ============================================================================ */
+
+int giornale_attivo = 0;
+int giornale_soglia = GIORNALE_INFO;
+_Thread_local Anello_giornale* giornale_thread = NULL;
+
+/* Ultimo anello registrato: la lista si allunga solo in testa, gli anelli non si liberano mai */
+static _Atomic(Anello_giornale*) anelli = NULL;
+
+/* Thread registrati, per numerarli nelle righe */
+static _Atomic int num_thread = 0;
+
+static char* percorso_giornale = NULL;
+static int fd_giornale = -1;
+static size_t dimensione_file = 0;       /* Byte del file in uso */
+static pthread_t scrittore;
+static _Atomic int termina = 0;
+
+/* Memoria del thread di scrittura */
+static char lotto[LOTTO_GIORNALE];
+static size_t lunghezza_lotto = 0;
+static time_t secondo_in_cache = -1;     /* Secondo gia' convertito in data e ora */
+static char data_in_cache[32];
+
+static const char* const nomi_livelli[] = {"DEBUG", "INFO", "AVVISO", "ERRORE"};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Scrive tutti i byte sul file, ripetendo le write interrotte o parziali
+ * @param fd File
+ * @param dati Byte
+ * @param n Numero di byte
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int scrivi_tutto(int fd, const char* dati, size_t n) {
+    while (n > 0) {
+        ssize_t scritti = write(fd, dati, n);
+
+        if (scritti < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        dati += scritti;
+        n    -= (size_t)scritti;
+    }
+    return 0;
+}
+
+/**
+ * Sposta ogni file del giornale al numero successivo (l'ultimo si perde) e ne apre uno vuoto
+ */
+static void ruota_file(void) {
+    size_t lunghezza = strlen(percorso_giornale) + 16;
+    char* vecchio = (char*)malloc(lunghezza);
+    char* nuovo = (char*)malloc(lunghezza);
+    int i;
+
+    if (vecchio != NULL && nuovo != NULL) {
+        for (i = GIORNALE_FILE_MAX - 1; i >= 1; i--) {
+            if (i > 1) {
+                snprintf(vecchio, lunghezza, "%s.%d", percorso_giornale, i - 1);
+            } else {
+                snprintf(vecchio, lunghezza, "%s", percorso_giornale);
+            }
+            snprintf(nuovo, lunghezza, "%s.%d", percorso_giornale, i);
+            rename(vecchio, nuovo);
+        }
+    }
+    free(vecchio);
+    free(nuovo);
+
+    close(fd_giornale);
+    fd_giornale = open(percorso_giornale, O_WRONLY | O_CREAT | O_APPEND | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_giornale < 0) {
+        perror(percorso_giornale);
+    }
+    dimensione_file = 0;
+}
+
+/**
+ * Scrive il lotto di righe nel file, passando al file successivo se quello in uso e' troppo grande
+ */
+static void scrivi_lotto(void) {
+    if (lunghezza_lotto == 0) {
+        return;
+    }
+    if (GIORNALE_FILE_MAX > 1 && dimensione_file > 0
+        && dimensione_file + lunghezza_lotto > GIORNALE_DIMENSIONE_MAX) {
+        ruota_file();
+    }
+    if (fd_giornale >= 0) { // Se il disco rifiuta il lotto le righe vanno perse: il gioco non deve saperlo
+        if (scrivi_tutto(fd_giornale, lotto, lunghezza_lotto) == 0) {
+            dimensione_file += lunghezza_lotto;
+        }
+    }
+    lunghezza_lotto = 0;
+}
+
+/**
+ * Aggiunge una riga al lotto con data, ora, livello e thread, scrivendo prima il lotto se non c'e' posto
+ * @param tempo Nanosecondi dall'epoca
+ * @param livello Livello del messaggio
+ * @param numero Numero del thread
+ * @param testo Testo del messaggio
+ */
+static void aggiungi_riga(int64_t tempo, int livello, int numero, const char* testo) {
+    time_t secondo = (time_t)(tempo / 1000000000LL);
+    struct tm data;
+    int n;
+
+    if (secondo != secondo_in_cache) { // La data si converte una volta al secondo
+        localtime_r(&secondo, &data);
+        strftime(data_in_cache, sizeof(data_in_cache), "%Y-%m-%d %H:%M:%S", &data);
+        secondo_in_cache = secondo;
+    }
+    if (LOTTO_GIORNALE - lunghezza_lotto < RIGA_MAX) {
+        scrivi_lotto();
+    }
+    n = snprintf(lotto + lunghezza_lotto, RIGA_MAX, "%s.%06lld %-6s [%d] %s\n", data_in_cache,
+                 (long long)(tempo % 1000000000LL / 1000), nomi_livelli[livello], numero, testo);
+    if (n >= RIGA_MAX) { // Riga troncata: si chiude comunque con un a capo
+        n = RIGA_MAX - 1;
+        lotto[lunghezza_lotto + RIGA_MAX - 2] = '\n';
+    }
+    if (n > 0) {
+        lunghezza_lotto += (size_t)n;
+    }
+}
+
+/**
+ * Formatta i record in attesa di tutti gli anelli e li aggiunge al lotto
+ * @return Record formattati
+ */
+static uint64_t svuota_anelli(void) {
+    Anello_giornale* a;
+    uint64_t totale = 0;
+    char testo[RIGA_MAX];
+
+    for (a = atomic_load(&anelli); a != NULL; a = a->succ) {
+        uint64_t letti = atomic_load_explicit(&a->letti, memory_order_relaxed);
+        uint64_t scritti = atomic_load_explicit(&a->scritti, memory_order_acquire);
+        uint64_t scartati = atomic_load_explicit(&a->scartati, memory_order_relaxed);
+
+        totale += scritti - letti;
+        for (; letti < scritti; letti++) {
+            const Record_giornale* r = &a->record[letti & (RECORD_ANELLO - 1)];
+
+            snprintf(testo, sizeof(testo), r->formato, r->argomenti[0], r->argomenti[1], r->argomenti[2],
+                     r->argomenti[3], r->argomenti[4], r->argomenti[5]);
+            aggiungi_riga(r->tempo, r->livello, a->numero, testo);
+        }
+        atomic_store_explicit(&a->letti, letti, memory_order_release); // Il thread puo' riusare i record
+
+        if (scartati != a->scartati_segnalati) {
+            struct timespec adesso;
+
+            clock_gettime(CLOCK_REALTIME, &adesso);
+            snprintf(testo, sizeof(testo), "%llu messaggi persi: anello pieno",
+                     (unsigned long long)(scartati - a->scartati_segnalati));
+            aggiungi_riga((int64_t)adesso.tv_sec * 1000000000LL + adesso.tv_nsec, GIORNALE_AVVISO, a->numero, testo);
+            a->scartati_segnalati = scartati;
+        }
+    }
+    scrivi_lotto();
+    return totale;
+}
+
+/**
+ * Ciclo del thread di scrittura: svuota gli anelli e dorme un poco quando sono vuoti
+ * @param arg Non usato
+ * @return NULL
+ */
+static void* ciclo_scrittore(void* arg) {
+    struct timespec attesa = {0, ATTESA_NS};
+
+    (void)arg;
+    while (!atomic_load(&termina)) {
+        if (svuota_anelli() == 0) {
+            nanosleep(&attesa, NULL);
+        }
+    }
+    svuota_anelli(); // Quello che i thread hanno scritto prima della chiusura
+    return NULL;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+// Apre il file del giornale e avvia il thread di scrittura
+int giornale_apri(const char* percorso, Livello_giornale soglia) {
+    struct stat info;
+
+    if (giornale_attivo) {
+        return -1;
+    }
+    percorso_giornale = strdup(percorso);
+    fd_giornale = open(percorso, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (percorso_giornale == NULL || fd_giornale < 0 || fstat(fd_giornale, &info) < 0) {
+        perror(percorso);
+        if (fd_giornale >= 0) {
+            close(fd_giornale);
+            fd_giornale = -1;
+        }
+        free(percorso_giornale);
+        percorso_giornale = NULL;
+        return -1;
+    }
+    dimensione_file = (size_t)info.st_size;
+    atomic_store(&termina, 0);
+    if (pthread_create(&scrittore, NULL, ciclo_scrittore, NULL) != 0) {
+        close(fd_giornale);
+        fd_giornale = -1;
+        free(percorso_giornale);
+        percorso_giornale = NULL;
+        return -1;
+    }
+    giornale_soglia = (int)soglia;
+    giornale_attivo = 1;
+    return 0;
+}
+
+// Ferma il thread di scrittura dopo l'ultimo svuotamento degli anelli e chiude il file
+void giornale_chiudi(void) {
+    if (!giornale_attivo) {
+        return;
+    }
+    giornale_attivo = 0;
+    atomic_store(&termina, 1);
+    pthread_join(scrittore, NULL);
+    if (fd_giornale >= 0) {
+        close(fd_giornale);
+    }
+    fd_giornale = -1;
+    free(percorso_giornale);
+    percorso_giornale = NULL;
+}
+
+// Converte il nome di un livello
+Livello_giornale giornale_livello(const char* nome) {
+    if (nome != NULL && strcmp(nome, "debug") == 0) {
+        return GIORNALE_DEBUG;
+    }
+    if (nome != NULL && strcmp(nome, "avviso") == 0) {
+        return GIORNALE_AVVISO;
+    }
+    if (nome != NULL && strcmp(nome, "errore") == 0) {
+        return GIORNALE_ERRORE;
+    }
+    return GIORNALE_INFO;
+}
+
+// Alloca e aggiunge in testa alla lista l'anello del thread corrente
+Anello_giornale* giornale_registra_thread(void) {
+    Anello_giornale* a = giornale_thread;
+
+    if (a != NULL) {
+        return a;
+    }
+    a = (Anello_giornale*)aligned_alloc(64, sizeof(Anello_giornale));
+    if (a == NULL) {
+        return NULL;
+    }
+    memset(a, 0, sizeof(*a));
+    a->numero = atomic_fetch_add(&num_thread, 1) + 1;
+    a->succ   = atomic_load(&anelli);
+    while (!atomic_compare_exchange_weak(&anelli, &a->succ, a)) {
+    }
+    giornale_thread = a;
+    return a;
+}
+
+// Copia un messaggio nel primo record libero dell'anello del thread, o lo conta come perso
+void giornale_registra(int livello, const char* formato, const long long* argomenti, int n) {
+    Anello_giornale* a = giornale_thread != NULL ? giornale_thread : giornale_registra_thread();
+    Record_giornale* r;
+    struct timespec adesso;
+    uint64_t scritti;
+    int i;
+
+    if (a == NULL) {
+        return;
+    }
+    scritti = atomic_load_explicit(&a->scritti, memory_order_relaxed);
+    if (scritti - atomic_load_explicit(&a->letti, memory_order_acquire) >= RECORD_ANELLO) {
+        atomic_store_explicit(&a->scartati, atomic_load_explicit(&a->scartati, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+
+    r = &a->record[scritti & (RECORD_ANELLO - 1)];
+    clock_gettime(CLOCK_REALTIME, &adesso);
+    r->tempo   = (int64_t)adesso.tv_sec * 1000000000LL + adesso.tv_nsec;
+    r->formato = formato;
+    r->livello = livello;
+    for (i = 0; i < GIORNALE_ARGOMENTI_MAX; i++) {
+        r->argomenti[i] = i < n ? argomenti[i] : 0;
+    }
+    atomic_store_explicit(&a->scritti, scritti + 1, memory_order_release);
+}
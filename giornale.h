@@ -0,0 +1,111 @@
+#ifndef GIORNALE_H
+#define GIORNALE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * GIORNALE DIAGNOSTICO ASINCRONO
+ *
+ * Messaggi diagnostici che non passano dalla printf del gioco e non
+ * aspettano mai il disco. Ogni thread ha un anello di RECORD_ANELLO record
+ * con un solo scrittore e un solo lettore, senza lock: un messaggio e' un
+ * record gia' pronto (istante, livello, formato e fino a
+ * GIORNALE_ARGOMENTI_MAX interi), copiato nell'anello in poche decine di
+ * nanosecondi. Il testo lo scrive un thread in sottofondo, che svuota tutti
+ * gli anelli, formatta le righe e le scrive a lotti con una sola write.
+ * Quando il file supera GIORNALE_DIMENSIONE_MAX passa a percorso.1 (e cosi'
+ * via fino a GIORNALE_FILE_MAX file) e si ricomincia da un file vuoto.
+ *
+ * Il formato deve essere una stringa letterale (il thread di scrittura lo
+ * legge piu' tardi) con sole conversioni %lld, %llu o %llx: gli argomenti
+ * diventano long long. Se un anello e' pieno il messaggio si scarta e si
+ * conta, e il giornale lo segnala alla prima occasione.
+ *
+ *     GIORNALE(GIORNALE_DEBUG, "round: danno %lld, PV nemico %lld", danno, hp);
+ * ============================================================================ */
+
+/* Record dell'anello di ogni thread (potenza di 2) */
+#define RECORD_ANELLO             1024
+
+/* Interi al massimo in un messaggio */
+#define GIORNALE_ARGOMENTI_MAX    6
+
+/* Byte oltre i quali il file del giornale passa al successivo */
+#define GIORNALE_DIMENSIONE_MAX   (8 * 1024 * 1024)
+
+/* File tenuti: percorso, percorso.1 ... percorso.(GIORNALE_FILE_MAX - 1) */
+#define GIORNALE_FILE_MAX         5
+
+// Livelli dei messaggi
+typedef enum {
+    GIORNALE_DEBUG = 0,
+    GIORNALE_INFO,
+    GIORNALE_AVVISO,
+    GIORNALE_ERRORE
+} Livello_giornale;
+
+// Messaggio in attesa di essere scritto
+typedef struct {
+    int64_t tempo;                       /* Nanosecondi dall'epoca */
+    const char* formato;                 /* Stringa letterale */
+    long long argomenti[GIORNALE_ARGOMENTI_MAX];
+    int livello;
+} Record_giornale;
+
+// Anello di un thread: scrive solo il thread proprietario, legge solo il thread del giornale
+typedef struct Anello_giornale {
+    Record_giornale record[RECORD_ANELLO];
+    _Alignas(64) _Atomic uint64_t scritti;   /* Record scritti da sempre */
+    _Atomic uint64_t scartati;               /* Messaggi persi perche' l'anello era pieno */
+    _Alignas(64) _Atomic uint64_t letti;     /* Record gia' formattati */
+    uint64_t scartati_segnalati;             /* Del thread del giornale */
+    int numero;                              /* Numero del thread nelle righe, in ordine di registrazione */
+    struct Anello_giornale* succ;            /* Anello registrato prima */
+} Anello_giornale;
+
+/* 1 mentre il giornale e' aperto */
+extern int giornale_attivo;
+
+/* Livello sotto il quale i messaggi si ignorano */
+extern int giornale_soglia;
+
+/* Anello del thread corrente, NULL prima del primo messaggio */
+extern _Thread_local Anello_giornale* giornale_thread;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//apre (o crea) il file del giornale e avvia il thread di scrittura; 0 se riuscito, -1 in caso di errore
+int giornale_apri(const char* percorso, Livello_giornale soglia);
+
+//scrive i messaggi rimasti negli anelli, ferma il thread di scrittura e chiude il file
+void giornale_chiudi(void);
+
+//livello con il nome indicato ("debug", "info", "avviso", "errore"); GIORNALE_INFO se il nome e' NULL o sconosciuto
+Livello_giornale giornale_livello(const char* nome);
+
+//registra l'anello del thread corrente al primo messaggio; NULL se non c'e' memoria
+Anello_giornale* giornale_registra_thread(void);
+
+//copia un messaggio nell'anello del thread corrente (usare GIORNALE)
+void giornale_registra(int livello, const char* formato, const long long* argomenti, int n);
+
+/* ============================================================================
+ * PUNTO DI SCRITTURA
+ * ============================================================================ */
+
+//registra un messaggio con fino a GIORNALE_ARGOMENTI_MAX argomenti interi; senza il giornale costa un confronto
+#define GIORNALE(livello, formato, ...)                                                                  \
+    do {                                                                                                 \
+        if (__builtin_expect(giornale_attivo, 0) && (int)(livello) >= giornale_soglia) {                 \
+            const long long argomenti_giornale_[] = {0, __VA_ARGS__};                                    \
+            _Static_assert(sizeof(argomenti_giornale_) / sizeof(long long) <= GIORNALE_ARGOMENTI_MAX + 1, \
+                           "troppi argomenti per il giornale");                                          \
+            giornale_registra((int)(livello), (formato), argomenti_giornale_ + 1,                        \
+                              (int)(sizeof(argomenti_giornale_) / sizeof(long long)) - 1);               \
+        }                                                                                                \
+    } while (0)
+
+#endif
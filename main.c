@@ -1,15 +1,195 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "classifica.h"
+#include "cronaca.h"
 #include "gamelib.h"
+#include "giornale.h"
+#include "mappa_condivisa.h"
+#include "messaggi.h"
+#include "metriche.h"
+#include "registro.h"
+#include "schermo.h"
+#include "server.h"
 
-//funzione principale del gioco, mostra il menu e gestisce le scelte dell'utente
-int main(void) {
+/**
+ * Stampa un evento della cronaca come riga CSV
+ * @param contesto Non usato
+ * @param e Evento
+ */
+static void stampa_evento_csv(void* contesto, const Evento_cronaca* e) {
+    static const char* const tipi[] = {"", "inizio", "mossa", "portale", "combattimento", "attacco", "contrattacco",
+                                       "raccolta", "uso", "morte", "vittoria", "sconfitta"};
+    int numero_tipi = (int)(sizeof(tipi) / sizeof(tipi[0]));
+
+    (void)contesto;
+    printf("%lld,%llu,%s,%d,%d,%d,%d,%d,%d,%d,%d\n", (long long)e->tempo, (unsigned long long)e->sessione,
+           e->tipo > 0 && e->tipo < numero_tipi ? tipi[e->tipo] : "?", e->turno, e->giocatore, e->mondo, e->zona,
+           e->a, e->b, e->c, e->d);
+}
+
+/**
+ * Ricostruisce su stdout il testo di una sessione letta da stdin, con i messaggi compatti dopo MESSAGGI_INIZIO
+ * @return 0 se riuscito, 1 se mancano memoria o righe valide
+ */
+static int rendi_messaggi(void) {
+    static char riga[65536];
+    Lettore_messaggi* l = messaggi_lettore_crea();
+    int compatti = 0;
+    int esito = 0;
+
+    if (l == NULL) {
+        return 1;
+    }
+    while (fgets(riga, sizeof(riga), stdin) != NULL) {
+        size_t n = strlen(riga);
+
+        if (!compatti) { // Testo della sessione prima del passaggio, cosi' com'e'
+            if (strcmp(riga, MESSAGGI_INIZIO "\n") == 0) {
+                compatti = 1;
+            } else {
+                fputs(riga, stdout);
+            }
+            continue;
+        }
+        if (n > 0 && riga[n - 1] == '\n') {
+            riga[n - 1] = '\0';
+        }
+        if (messaggi_rendi_riga(l, riga, stdout) < 0) {
+            fprintf(stderr, "Riga compatta non valida: %s\n", riga);
+            esito = 1;
+        }
+        fflush(stdout);
+    }
+    messaggi_lettore_distruggi(l);
+    return esito;
+}
+
+//funzione principale del gioco, mostra il menu e gestisce le scelte dell'utente (con --server ospita le partite via rete)
+int main(int argc, char* argv[]) {
+    Classifica* classifica;
+    Schermo* schermo = NULL;
+    const char* file_metriche = getenv("COSESTRANE_METRICHE");
+    const char* file_traccia = getenv("COSESTRANE_TRACCIA");
+    const char* file_cronaca = getenv("COSESTRANE_CRONACA");
+    const char* file_giornale = getenv("COSESTRANE_GIORNALE");
     int scelta = 0;
 
+    /* Con --cronaca si stampano in CSV gli eventi di un file della cronaca, senza giocare */
+    if (argc == 3 && strcmp(argv[1], "--cronaca") == 0) {
+        printf("tempo,sessione,tipo,turno,giocatore,mondo,zona,a,b,c,d\n");
+        if (cronaca_leggi(argv[2], stampa_evento_csv, NULL) < 0) {
+            perror(argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+
+    /* Con --rendi si ricostruisce il testo di una sessione in messaggi compatti, per esempio: nc host porta | cosestrane --rendi */
+    if (argc == 2 && strcmp(argv[1], "--rendi") == 0) {
+        return rendi_messaggi();
+    }
+
     /* Inizializza il generatore di numeri casuali una sola volta */
     srand((unsigned int)time(NULL));
 
+    /* Carica nemici e oggetti da file (COSESTRANE_REGISTRO o cosestrane.cfg), altrimenti usa quelli predefiniti */
+    if (registro_carica(getenv("COSESTRANE_REGISTRO")) != 0) {
+        return 1;
+    }
+
+    /* Apre la classifica delle partite concluse (COSESTRANE_CLASSIFICA o cosestrane.classifica), condivisa con
+       gli altri processi del gioco; senza classifica si gioca lo stesso */
+    classifica = classifica_apri(getenv("COSESTRANE_CLASSIFICA"));
+    if (classifica == NULL) {
+        fprintf(stderr, "Attenzione: impossibile aprire la classifica, le partite non verranno registrate.\n");
+    }
+    gioco_usa_classifica(classifica);
+
+    /* Con COSESTRANE_METRICHE il gioco conta turni, combattimenti, portali, oggetti e allocazioni, con
+       COSESTRANE_TRACCIA registra anche la traccia dei comandi */
+    if (file_metriche != NULL || file_traccia != NULL) {
+        metriche_attiva();
+    }
+
+    /* Con COSESTRANE_CRONACA gli eventi delle partite finiscono in quel file, per l'analisi (--cronaca lo legge) */
+    if (file_cronaca != NULL && cronaca_apri(file_cronaca) < 0) {
+        fprintf(stderr, "Attenzione: impossibile aprire la cronaca %s, gli eventi non verranno registrati.\n", file_cronaca);
+    }
+
+    /* Con COSESTRANE_GIORNALE i messaggi diagnostici (dal livello COSESTRANE_GIORNALE_LIVELLO in su) finiscono in
+       quel file, scritti da un thread in sottofondo */
+    if (file_giornale != NULL
+        && giornale_apri(file_giornale, giornale_livello(getenv("COSESTRANE_GIORNALE_LIVELLO"))) < 0) {
+        fprintf(stderr, "Attenzione: impossibile aprire il giornale %s.\n", file_giornale);
+    }
+
+    /* Modalita' server: ogni client connesso gioca una propria partita. Con la mappa del giorno tutte le
+       partite condividono la mappa generata dal seme, con il salvataggio sopravvivono a un crash del server,
+       con i lavoratori le righe delle sessioni si giocano su piu' core */
+    if (argc >= 3 && argc % 2 == 1 && strcmp(argv[1], "--server") == 0) {
+        Mappa_condivisa* mappa = NULL;
+        const char* seme = NULL;
+        const char* salvataggio = NULL;
+        const char* indirizzo_metriche = NULL;
+        const char* lavoratori = NULL;
+        int opzioni_valide = 1;
+        int esito;
+        int i;
+
+        for (i = 3; i < argc; i += 2) {
+            if (strcmp(argv[i], "--mappa-del-giorno") == 0) {
+                seme = argv[i + 1];
+            } else if (strcmp(argv[i], "--salvataggio") == 0) {
+                salvataggio = argv[i + 1];
+            } else if (strcmp(argv[i], "--metriche") == 0) {
+                indirizzo_metriche = argv[i + 1];
+            } else if (strcmp(argv[i], "--lavoratori") == 0) {
+                lavoratori = argv[i + 1];
+            } else {
+                opzioni_valide = 0;
+            }
+        }
+        if (opzioni_valide && indirizzo_metriche != NULL) {
+            metriche_attiva();
+        }
+        if (opzioni_valide && seme != NULL) {
+            mappa = mappa_condivisa_genera((unsigned int)strtoul(seme, NULL, 10), ZONE_MINIME);
+            if (mappa == NULL) {
+                fprintf(stderr, "Errore: impossibile creare la mappa del giorno!\n");
+                return 1;
+            }
+            srand((unsigned int)time(NULL)); // I dadi delle partite non devono dipendere dal seme della mappa
+        }
+        if (opzioni_valide) {
+            server_usa_metriche(indirizzo_metriche, file_metriche, file_traccia);
+            if (lavoratori != NULL) {
+                server_usa_lavoratori(atoi(lavoratori));
+            }
+            esito = server_avvia(argv[2], mappa, salvataggio);
+            mappa_condivisa_distruggi(mappa);
+            cronaca_chiudi();
+            giornale_chiudi();
+            classifica_chiudi(classifica);
+            return esito == 0 ? 0 : 1;
+        }
+    }
+    if (argc != 1) { // Argomenti non validi, anche dopo --server
+        fprintf(stderr, "Uso: %s [--server porta | host:porta | unix:/percorso [--mappa-del-giorno seme] [--salvataggio file] [--metriche indirizzo] [--lavoratori n]]\n", argv[0]);
+        fprintf(stderr, "     %s --cronaca file\n", argv[0]);
+        fprintf(stderr, "     %s --rendi\n", argv[0]);
+        cronaca_chiudi();
+        giornale_chiudi();
+        return 1;
+    }
+
+    /* Con COSESTRANE_SCHERMO i turni si giocano su uno schermo a pannelli, che manda al terminale solo le differenze */
+    if (getenv("COSESTRANE_SCHERMO") != NULL) {
+        schermo = schermo_crea(stdout, 0, 0);
+        gioco_usa_schermo(schermo);
+    }
+
     /* Stampa il banner di benvenuto */
     printf("========================================\n");
     printf("       BENVENUTO IN COSESTRANE!\n");
@@ -70,5 +250,16 @@ int main(void) {
 
     } while (scelta != 3);// Continua a mostrare il menu finché l'utente non sceglie di terminare il gioco
 
+    if (file_metriche != NULL && metriche_salva(file_metriche) < 0) {
+        fprintf(stderr, "Errore: impossibile scrivere le metriche in %s\n", file_metriche);
+    }
+    if (file_traccia != NULL && metriche_salva_traccia(file_traccia) < 0) {
+        fprintf(stderr, "Errore: impossibile scrivere la traccia in %s\n", file_traccia);
+    }
+    gioco_usa_schermo(NULL);
+    schermo_distruggi(schermo);
+    cronaca_chiudi();
+    giornale_chiudi();
+    classifica_chiudi(classifica);
     return 0;
 }
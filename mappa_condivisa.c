@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "generatore.h"
+#include "mappa_condivisa.h"
+#include "metriche.h"
+
+#define LINEA_CACHE          64
+#define OCCUPANTI_MINIMI      8          /* Posti minimi della tabella degli occupanti (potenza di 2) */
+#define MASCHERE              3          /* Nemici del Mondo Reale, nemici del Soprasotto, oggetti */
+#define MASCHERA_OGGETTI      2
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Testa del segmento condiviso, seguita dalle zone dei due mondi
+struct Mappa_condivisa {
+    size_t dimensione;                   /* Byte dell'intero segmento */
+    int num_zone;
+    Zona_mondoreale* mondoreale;
+    Zona_soprasotto* soprasotto;
+};
+
+// Posto della tabella degli occupanti di una sessione
+typedef struct {
+    int chiave;                          /* zona * 2 + mondo, -1 se il posto e' libero */
+    int primo;
+    int numero;
+} Posto_occupanti;
+
+struct Modifiche_mappa {
+    uint64_t* bit;                       /* MASCHERE maschere consecutive di "parole" parole */
+    int parole;
+    Posto_occupanti* occupanti;          /* Indirizzamento aperto, mai piu' di meta' pieno */
+    uint32_t maschera_occupanti;         /* Numero di posti - 1 */
+};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Controlla un bit delle maschere delle modifiche
+ * @param mod Modifiche
+ * @param maschera Quale maschera (mondo dei nemici o MASCHERA_OGGETTI)
+ * @param zona Indice della zona
+ * @return 1 se il bit e' acceso
+ */
+static int bit_acceso(const Modifiche_mappa* mod, int maschera, int zona) {
+    const uint64_t* parole = mod->bit + (size_t)maschera * (size_t)mod->parole;
+
+    return (int)((parole[zona >> 6] >> (zona & 63)) & 1u);
+}
+
+/**
+ * Accende un bit delle maschere delle modifiche
+ * @param mod Modifiche
+ * @param maschera Quale maschera (mondo dei nemici o MASCHERA_OGGETTI)
+ * @param zona Indice della zona
+ */
+static void accendi_bit(Modifiche_mappa* mod, int maschera, int zona) {
+    uint64_t* parole = mod->bit + (size_t)maschera * (size_t)mod->parole;
+
+    parole[zona >> 6] |= (uint64_t)1 << (zona & 63);
+}
+
+/**
+ * Spegne un bit delle maschere delle modifiche
+ * @param mod Modifiche
+ * @param maschera Quale maschera (mondo dei nemici o MASCHERA_OGGETTI)
+ * @param zona Indice della zona
+ */
+static void spegni_bit(Modifiche_mappa* mod, int maschera, int zona) {
+    uint64_t* parole = mod->bit + (size_t)maschera * (size_t)mod->parole;
+
+    parole[zona >> 6] &= ~((uint64_t)1 << (zona & 63));
+}
+
+/**
+ * Posto iniziale di una chiave nella tabella degli occupanti
+ * @param mod Modifiche
+ * @param chiave Chiave della zona
+ * @return Indice del posto
+ */
+static uint32_t posto_iniziale(const Modifiche_mappa* mod, int chiave) {
+    return ((uint32_t)chiave * 2654435761u) & mod->maschera_occupanti;
+}
+
+/**
+ * Cerca il posto di una zona nella tabella degli occupanti
+ * @param mod Modifiche
+ * @param chiave Chiave della zona
+ * @return Indice del posto della zona, o del posto libero dove andrebbe
+ */
+static uint32_t cerca_posto(const Modifiche_mappa* mod, int chiave) {
+    uint32_t i = posto_iniziale(mod, chiave);
+
+    while (mod->occupanti[i].chiave >= 0 && mod->occupanti[i].chiave != chiave) {
+        i = (i + 1) & mod->maschera_occupanti;
+    }
+    return i;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: MAPPA CONDIVISA
+ * ============================================================================ */
+
+Mappa_condivisa* mappa_condivisa_crea(const Contenuto_zona* zone, int n, int posizione_finale) {
+    size_t testa = (sizeof(Mappa_condivisa) + LINEA_CACHE - 1) / LINEA_CACHE * LINEA_CACHE;
+    size_t dimensione;
+    Mappa_condivisa* m;
+    int i;
+
+    if (n < 1 || n > MAPPA_CONDIVISA_ZONE_MAX || posizione_finale < 0 || posizione_finale >= n) {
+        return NULL;
+    }
+    dimensione = testa + (size_t)n * (sizeof(Zona_mondoreale) + sizeof(Zona_soprasotto));
+
+    m = (Mappa_condivisa*)mmap(NULL, dimensione, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    m->dimensione = dimensione;
+    m->num_zone   = n;
+    m->mondoreale = (Zona_mondoreale*)((char*)m + testa);
+    m->soprasotto = (Zona_soprasotto*)(m->mondoreale + n);
+
+    for (i = 0; i < n; i++) {
+        Zona_mondoreale* mr = &m->mondoreale[i];
+        Zona_soprasotto* ss = &m->soprasotto[i];
+
+        mr->tipo            = (Tipo_zona)zone[i].tipo;
+        mr->nemico          = (Tipo_nemico)zone[i].nemico_mr;
+        mr->oggetto         = (Tipo_oggetto)zone[i].oggetto;
+        mr->avanti          = i + 1 < n ? mr + 1 : NULL;
+        mr->indietro        = i > 0 ? mr - 1 : NULL;
+        mr->link_soprasotto = ss;
+        mr->primo_occupante = -1; // Gli occupanti stanno nelle modifiche di ogni sessione
+        mr->num_occupanti   = 0;
+
+        ss->tipo            = mr->tipo;
+        ss->nemico          = i == posizione_finale ? (Tipo_nemico)registro_nemico_finale()
+                                                    : (Tipo_nemico)zone[i].nemico_ss;
+        ss->avanti          = i + 1 < n ? ss + 1 : NULL;
+        ss->indietro        = i > 0 ? ss - 1 : NULL;
+        ss->link_mondoreale = mr;
+        ss->primo_occupante = -1;
+        ss->num_occupanti   = 0;
+    }
+
+    if (mprotect(m, dimensione, PROT_READ) != 0) {
+        munmap(m, dimensione);
+        return NULL;
+    }
+    return m;
+}
+
+// Usa rand(): chi chiama puo' reinizializzarlo dopo, se le sessioni non devono ripetere i dadi
+Mappa_condivisa* mappa_condivisa_genera(unsigned int seme, int n) {
+    Contenuto_zona* zone;
+    Mappa_condivisa* m;
+    int posizione_finale;
+
+    if (n < 1 || n > MAPPA_CONDIVISA_ZONE_MAX) {
+        return NULL;
+    }
+    zone = (Contenuto_zona*)malloc((size_t)n * sizeof(Contenuto_zona));
+    if (zone == NULL) {
+        return NULL;
+    }
+    metrica_allocazione((size_t)n * sizeof(Contenuto_zona));
+
+    srand(seme);
+    if (genera_contenuti_mappa(zone, n, &posizione_finale) < 0) { // Una mappa senza obiettivi non sarebbe quella attesa dal seme
+        free(zone);
+        return NULL;
+    }
+    metrica_conta(METRICA_MAPPE_GENERATE, 1);
+    m = mappa_condivisa_crea(zone, n, posizione_finale);
+    free(zone);
+    return m;
+}
+
+void mappa_condivisa_distruggi(Mappa_condivisa* m) {
+    if (m != NULL) {
+        munmap(m, m->dimensione);
+    }
+}
+
+int mappa_condivisa_num_zone(const Mappa_condivisa* m) {
+    return m->num_zone;
+}
+
+Zona_mondoreale* mappa_condivisa_mondoreale(const Mappa_condivisa* m) {
+    return m->mondoreale;
+}
+
+Zona_soprasotto* mappa_condivisa_soprasotto(const Mappa_condivisa* m) {
+    return m->soprasotto;
+}
+
+int mappa_condivisa_indice_mr(const Mappa_condivisa* m, const Zona_mondoreale* zona) {
+    return (int)(zona - m->mondoreale);
+}
+
+int mappa_condivisa_indice_ss(const Mappa_condivisa* m, const Zona_soprasotto* zona) {
+    return (int)(zona - m->soprasotto);
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: MODIFICHE DI SESSIONE
+ * ============================================================================ */
+
+Modifiche_mappa* modifiche_crea(const Mappa_condivisa* m, int num_giocatori) {
+    Modifiche_mappa* mod = (Modifiche_mappa*)calloc(1, sizeof(Modifiche_mappa));
+    uint32_t posti = OCCUPANTI_MINIMI;
+
+    if (mod == NULL) {
+        return NULL;
+    }
+    while (posti < 2u * (uint32_t)num_giocatori) { // Ogni giocatore occupa al massimo una zona
+        posti *= 2;
+    }
+
+    mod->parole             = (m->num_zone + 63) / 64;
+    mod->bit                = (uint64_t*)calloc((size_t)MASCHERE * (size_t)mod->parole, sizeof(uint64_t));
+    mod->occupanti          = (Posto_occupanti*)malloc(posti * sizeof(Posto_occupanti));
+    mod->maschera_occupanti = posti - 1;
+    if (mod->bit == NULL || mod->occupanti == NULL) {
+        modifiche_distruggi(mod);
+        return NULL;
+    }
+    metrica_allocazione(sizeof(Modifiche_mappa));
+    metrica_allocazione((size_t)MASCHERE * (size_t)mod->parole * sizeof(uint64_t));
+    metrica_allocazione(posti * sizeof(Posto_occupanti));
+    modifiche_azzera(mod);
+    return mod;
+}
+
+void modifiche_distruggi(Modifiche_mappa* mod) {
+    if (mod == NULL) {
+        return;
+    }
+    free(mod->bit);
+    free(mod->occupanti);
+    free(mod);
+}
+
+int modifiche_nemico_sconfitto(const Modifiche_mappa* mod, Tipo_mondo mondo, int zona) {
+    return bit_acceso(mod, (int)mondo, zona);
+}
+
+void modifiche_sconfiggi_nemico(Modifiche_mappa* mod, Tipo_mondo mondo, int zona) {
+    accendi_bit(mod, (int)mondo, zona);
+}
+
+void modifiche_ripristina_nemico(Modifiche_mappa* mod, Tipo_mondo mondo, int zona) {
+    spegni_bit(mod, (int)mondo, zona);
+}
+
+int modifiche_oggetto_raccolto(const Modifiche_mappa* mod, int zona) {
+    return bit_acceso(mod, MASCHERA_OGGETTI, zona);
+}
+
+void modifiche_raccogli_oggetto(Modifiche_mappa* mod, int zona) {
+    accendi_bit(mod, MASCHERA_OGGETTI, zona);
+}
+
+void modifiche_ripristina_oggetto(Modifiche_mappa* mod, int zona) {
+    spegni_bit(mod, MASCHERA_OGGETTI, zona);
+}
+
+void modifiche_occupanti(Modifiche_mappa* mod, Tipo_mondo mondo, int zona, int** primo, int** numero) {
+    int chiave = zona * 2 + (int)mondo;
+    uint32_t i = cerca_posto(mod, chiave);
+
+    if (mod->occupanti[i].chiave < 0) {
+        mod->occupanti[i].chiave = chiave;
+        mod->occupanti[i].primo  = -1;
+        mod->occupanti[i].numero = 0;
+    }
+    *primo  = &mod->occupanti[i].primo;
+    *numero = &mod->occupanti[i].numero;
+}
+
+void modifiche_rilascia_occupanti(Modifiche_mappa* mod, Tipo_mondo mondo, int zona) {
+    uint32_t i = cerca_posto(mod, zona * 2 + (int)mondo);
+    uint32_t j;
+
+    if (mod->occupanti[i].chiave < 0 || mod->occupanti[i].numero > 0) {
+        return;
+    }
+
+    /* Riporta indietro i posti successivi della stessa sequenza, cosi' le ricerche non si interrompono sul buco */
+    for (j = (i + 1) & mod->maschera_occupanti; mod->occupanti[j].chiave >= 0; j = (j + 1) & mod->maschera_occupanti) {
+        uint32_t k = posto_iniziale(mod, mod->occupanti[j].chiave);
+
+        if (((j - k) & mod->maschera_occupanti) >= ((j - i) & mod->maschera_occupanti)) {
+            mod->occupanti[i] = mod->occupanti[j];
+            i = j;
+        }
+    }
+    mod->occupanti[i].chiave = -1;
+}
+
+void modifiche_azzera(Modifiche_mappa* mod) {
+    uint32_t i;
+
+    memset(mod->bit, 0, (size_t)MASCHERE * (size_t)mod->parole * sizeof(uint64_t));
+    for (i = 0; i <= mod->maschera_occupanti; i++) {
+        mod->occupanti[i].chiave = -1;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef MAPPA_CONDIVISA_H
+#define MAPPA_CONDIVISA_H
+
+#include "registro.h"
+
+/* ============================================================================
+ * MAPPA CONDIVISA E MODIFICHE DI SESSIONE
+ *
+ * Per gli eventi "mappa del giorno" tutte le sessioni giocano la stessa
+ * mappa: le zone dei due mondi vengono costruite una volta sola in un
+ * segmento mmap condiviso, poi protetto in sola lettura, e nessuna sessione
+ * ne fa una copia. Il segmento e' MAP_SHARED, quindi anche i processi figli
+ * creati dopo con fork usano le stesse pagine fisiche.
+ *
+ * Cio' che una sessione cambia sta nelle sue Modifiche_mappa: un bit per
+ * zona per i nemici sconfitti nei due mondi e per gli oggetti raccolti, e
+ * una piccola tabella degli occupanti con un posto solo per le zone in cui
+ * c'e' almeno un giocatore. Le letture guardano prima le modifiche e poi la
+ * mappa condivisa; i campi nemico e oggetto delle zone condivise non
+ * cambiano mai, e nemmeno i loro occupanti (sempre vuoti).
+ * ============================================================================ */
+
+/* Zone massime di una mappa condivisa */
+#define MAPPA_CONDIVISA_ZONE_MAX  (1 << 24)
+
+// Modifiche di una sessione alla mappa condivisa; definite in mappa_condivisa.c
+typedef struct Modifiche_mappa Modifiche_mappa;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: MAPPA CONDIVISA
+ * ============================================================================ */
+
+//costruisce la mappa di n zone in un segmento condiviso in sola lettura; NULL in caso di errore
+Mappa_condivisa* mappa_condivisa_crea(const Contenuto_zona* zone, int n, int posizione_finale);
+
+//genera una mappa di n zone dal seme dato (stesso seme e registro, stessa mappa); NULL in caso di errore
+Mappa_condivisa* mappa_condivisa_genera(unsigned int seme, int n);
+
+//libera il segmento; nessuna sessione deve piu' usare la mappa
+void mappa_condivisa_distruggi(Mappa_condivisa* m);
+
+//numero di zone di ciascun mondo
+int mappa_condivisa_num_zone(const Mappa_condivisa* m);
+
+//prima zona del Mondo Reale (in sola lettura: scriverci termina il processo)
+Zona_mondoreale* mappa_condivisa_mondoreale(const Mappa_condivisa* m);
+
+//prima zona del Soprasotto (in sola lettura: scriverci termina il processo)
+Zona_soprasotto* mappa_condivisa_soprasotto(const Mappa_condivisa* m);
+
+//indice della zona del Mondo Reale nella mappa
+int mappa_condivisa_indice_mr(const Mappa_condivisa* m, const Zona_mondoreale* zona);
+
+//indice della zona del Soprasotto nella mappa
+int mappa_condivisa_indice_ss(const Mappa_condivisa* m, const Zona_soprasotto* zona);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: MODIFICHE DI SESSIONE
+ * ============================================================================ */
+
+//crea le modifiche vuote di una sessione con al massimo num_giocatori giocatori; NULL se la memoria non basta
+Modifiche_mappa* modifiche_crea(const Mappa_condivisa* m, int num_giocatori);
+
+//libera le modifiche
+void modifiche_distruggi(Modifiche_mappa* mod);
+
+//1 se nella sessione e' stato sconfitto il nemico della zona del mondo dato
+int modifiche_nemico_sconfitto(const Modifiche_mappa* mod, Tipo_mondo mondo, int zona);
+
+//segna come sconfitto il nemico della zona del mondo dato
+void modifiche_sconfiggi_nemico(Modifiche_mappa* mod, Tipo_mondo mondo, int zona);
+
+//rimette il nemico della zona del mondo dato (per annullare un turno)
+void modifiche_ripristina_nemico(Modifiche_mappa* mod, Tipo_mondo mondo, int zona);
+
+//1 se nella sessione e' stato raccolto l'oggetto della zona del Mondo Reale
+int modifiche_oggetto_raccolto(const Modifiche_mappa* mod, int zona);
+
+//segna come raccolto l'oggetto della zona del Mondo Reale
+void modifiche_raccogli_oggetto(Modifiche_mappa* mod, int zona);
+
+//rimette l'oggetto della zona del Mondo Reale (per annullare un turno)
+void modifiche_ripristina_oggetto(Modifiche_mappa* mod, int zona);
+
+//testa e numero degli occupanti della zona (un posto vuoto viene creato se manca);
+//i puntatori valgono fino alla prossima chiamata sulle stesse modifiche
+void modifiche_occupanti(Modifiche_mappa* mod, Tipo_mondo mondo, int zona, int** primo, int** numero);
+
+//libera il posto degli occupanti della zona se non c'e' piu' nessuno
+void modifiche_rilascia_occupanti(Modifiche_mappa* mod, Tipo_mondo mondo, int zona);
+
+//dimentica nemici sconfitti, oggetti raccolti e occupanti, per una nuova partita sulla stessa mappa
+void modifiche_azzera(Modifiche_mappa* mod);
+
+#endif
@@ -0,0 +1,540 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "messaggi.h"
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Tipo dell'argomento di una conversione printf
+typedef enum {
+    ARGOMENTO_INTERO,                    /* d, i */
+    ARGOMENTO_NATURALE,                  /* u, o, x, X */
+    ARGOMENTO_REALE,                     /* e, f, g, a */
+    ARGOMENTO_STRINGA,                   /* s */
+    ARGOMENTO_CARATTERE,                 /* c */
+    ARGOMENTO_PUNTATORE,                 /* p */
+    ARGOMENTO_NESSUNO,                   /* %% */
+    ARGOMENTO_SCONOSCIUTO                /* Conversione non gestita: il formato finisce qui */
+} Tipo_argomento;
+
+// Modificatori di lunghezza di una conversione
+typedef enum {
+    LUNGHEZZA_NORMALE,                   /* Anche hh e h, promossi a int */
+    LUNGHEZZA_LONG,                      /* l */
+    LUNGHEZZA_LONG_LONG,                 /* ll, q */
+    LUNGHEZZA_MASSIMA,                   /* j */
+    LUNGHEZZA_DIMENSIONE,                /* z */
+    LUNGHEZZA_DIFFERENZA,                /* t */
+    LUNGHEZZA_LONG_DOUBLE                /* L */
+} Lunghezza_argomento;
+
+// Conversione printf letta da un formato
+typedef struct {
+    char parti[32];                      /* Flag, larghezza e precisione, con * dove vanno presi dagli argomenti */
+    int asterischi;                      /* Argomenti int per larghezza e precisione */
+    Lunghezza_argomento lunghezza;
+    Tipo_argomento tipo;
+    char conversione;
+} Conversione;
+
+// Riga compatta in scrittura, con la semantica di snprintf
+typedef struct {
+    char* dati;
+    size_t capacita;
+    size_t lunghezza;                    /* Byte della riga intera, anche oltre la capacita' */
+} Riga_compatta;
+
+struct Lettore_messaggi {
+    char* formati[MESSAGGI_MAX];         /* Formati definiti dal server, NULL se non ancora definiti */
+};
+
+/* ============================================================================
+ * VARIABILI GLOBALI
+ * ============================================================================ */
+
+/* Formati internati, indicizzati dall'identificativo; una voce non cambia piu' dopo la prima scrittura */
+static _Atomic(char*) tabella[MESSAGGI_MAX];
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Hash FNV-1a di una stringa
+ * @param s Stringa
+ * @return Hash
+ */
+static uint32_t hash_formato(const char* s) {
+    uint32_t h = 2166136261u;
+
+    for (; *s != '\0'; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Aggiunge un carattere a flag, larghezza e precisione di una conversione
+ * @param c Conversione
+ * @param n Caratteri gia' scritti, avanzato
+ * @param carattere Carattere da aggiungere
+ * @return 1 se c'era posto, 0 se la conversione e' troppo lunga
+ */
+static int metti_parte(Conversione* c, size_t* n, char carattere) {
+    if (*n >= sizeof(c->parti) - 1) { // L'ultimo byte resta il terminatore
+        return 0;
+    }
+    c->parti[(*n)++] = carattere;
+    return 1;
+}
+
+/**
+ * Legge una conversione printf
+ * @param f Formato subito dopo il %
+ * @param c Conversione letta (ARGOMENTO_SCONOSCIUTO se malformata o troppo lunga)
+ * @return Formato dopo la conversione
+ */
+static const char* leggi_conversione(const char* f, Conversione* c) {
+    size_t n = 0;
+    int spazio = 1;
+
+    memset(c, 0, sizeof(*c));
+    while (spazio && *f != '\0' && strchr("-+ #0", *f) != NULL) {
+        spazio = metti_parte(c, &n, *f++);
+    }
+    if (spazio && *f == '*') {
+        c->asterischi++;
+        spazio = metti_parte(c, &n, *f++);
+    }
+    while (spazio && *f >= '0' && *f <= '9') {
+        spazio = metti_parte(c, &n, *f++);
+    }
+    if (spazio && *f == '.') {
+        spazio = metti_parte(c, &n, *f++);
+        if (spazio && *f == '*') {
+            c->asterischi++;
+            spazio = metti_parte(c, &n, *f++);
+        }
+        while (spazio && *f >= '0' && *f <= '9') {
+            spazio = metti_parte(c, &n, *f++);
+        }
+    }
+    if (!spazio) {
+        c->tipo = ARGOMENTO_SCONOSCIUTO;
+        return f;
+    }
+
+    if (*f == 'h') {
+        f += f[1] == 'h' ? 2 : 1;
+    } else if (*f == 'l' && f[1] == 'l') {
+        c->lunghezza = LUNGHEZZA_LONG_LONG;
+        f += 2;
+    } else if (*f == 'l') {
+        c->lunghezza = LUNGHEZZA_LONG;
+        f++;
+    } else if (*f == 'q') {
+        c->lunghezza = LUNGHEZZA_LONG_LONG;
+        f++;
+    } else if (*f == 'j') {
+        c->lunghezza = LUNGHEZZA_MASSIMA;
+        f++;
+    } else if (*f == 'z') {
+        c->lunghezza = LUNGHEZZA_DIMENSIONE;
+        f++;
+    } else if (*f == 't') {
+        c->lunghezza = LUNGHEZZA_DIFFERENZA;
+        f++;
+    } else if (*f == 'L') {
+        c->lunghezza = LUNGHEZZA_LONG_DOUBLE;
+        f++;
+    }
+
+    c->conversione = *f;
+    if (*f == '\0') {
+        c->tipo = ARGOMENTO_SCONOSCIUTO;
+        return f;
+    }
+    if (strchr("di", *f) != NULL) {
+        c->tipo = ARGOMENTO_INTERO;
+    } else if (strchr("ouxX", *f) != NULL) {
+        c->tipo = ARGOMENTO_NATURALE;
+    } else if (strchr("eEfFgGaA", *f) != NULL) {
+        c->tipo = ARGOMENTO_REALE;
+    } else if (*f == 's') {
+        c->tipo = ARGOMENTO_STRINGA;
+    } else if (*f == 'c') {
+        c->tipo = ARGOMENTO_CARATTERE;
+    } else if (*f == 'p') {
+        c->tipo = ARGOMENTO_PUNTATORE;
+    } else if (*f == '%') {
+        c->tipo = ARGOMENTO_NESSUNO;
+    } else {
+        c->tipo = ARGOMENTO_SCONOSCIUTO;
+    }
+    return f + 1;
+}
+
+/**
+ * Aggiunge un carattere alla riga
+ * @param r Riga
+ * @param c Carattere
+ */
+static void metti_carattere(Riga_compatta* r, char c) {
+    if (r->lunghezza + 1 < r->capacita) {
+        r->dati[r->lunghezza] = c;
+    }
+    r->lunghezza++;
+}
+
+/**
+ * Aggiunge una stringa alla riga cosi' com'e'
+ * @param r Riga
+ * @param s Stringa
+ */
+static void metti_testo(Riga_compatta* r, const char* s) {
+    for (; *s != '\0'; s++) {
+        metti_carattere(r, *s);
+    }
+}
+
+/**
+ * Aggiunge una stringa alla riga proteggendo \, a capo e tabulazioni
+ * @param r Riga
+ * @param s Stringa
+ */
+static void metti_protetta(Riga_compatta* r, const char* s) {
+    for (; *s != '\0'; s++) {
+        if (*s == '\\' || *s == '\n' || *s == '\t') {
+            metti_carattere(r, '\\');
+            metti_carattere(r, *s == '\n' ? 'n' : *s == '\t' ? 't' : '\\');
+        } else {
+            metti_carattere(r, *s);
+        }
+    }
+}
+
+/**
+ * Aggiunge un campo numerico alla riga, preceduto dalla tabulazione
+ * @param r Riga
+ * @param con_segno 1 per un intero con segno, 0 per uno senza
+ * @param valore Valore (come bit di un long long per gli interi con segno)
+ */
+static void metti_intero(Riga_compatta* r, int con_segno, unsigned long long valore) {
+    char cifre[24];
+
+    if (con_segno) {
+        snprintf(cifre, sizeof(cifre), "%lld", (long long)valore);
+    } else {
+        snprintf(cifre, sizeof(cifre), "%llu", valore);
+    }
+    metti_carattere(r, '\t');
+    metti_testo(r, cifre);
+}
+
+/**
+ * Chiude la riga con l'a capo e il terminatore, come snprintf
+ * @param r Riga
+ * @return Lunghezza della riga intera
+ */
+static int chiudi_riga(Riga_compatta* r) {
+    metti_carattere(r, '\n');
+    if (r->capacita > 0) {
+        r->dati[r->lunghezza < r->capacita ? r->lunghezza : r->capacita - 1] = '\0';
+    }
+    return (int)r->lunghezza;
+}
+
+/**
+ * Toglie la protezione di \, a capo e tabulazioni
+ * @param da Testo protetto
+ * @param n Byte del testo
+ * @param a Destinazione (almeno n + 1 byte)
+ */
+static void togli_protezione(const char* da, size_t n, char* a) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (da[i] == '\\' && i + 1 < n) {
+            i++;
+            *a++ = da[i] == 'n' ? '\n' : da[i] == 't' ? '\t' : da[i];
+        } else {
+            *a++ = da[i];
+        }
+    }
+    *a = '\0';
+}
+
+/**
+ * Legge il prossimo campo di un messaggio
+ * @param campo Posizione nella riga (dopo l'identificativo o il campo precedente), avanzata
+ * @param inizio Inizio del campo
+ * @return Byte del campo, -1 se i campi sono finiti
+ */
+static long prossimo_campo(const char** campo, const char** inizio) {
+    const char* fine;
+
+    if (**campo != '\t') {
+        return -1;
+    }
+    *inizio = *campo + 1;
+    fine    = strchr(*inizio, '\t');
+    if (fine == NULL) {
+        fine = *inizio + strlen(*inizio);
+    }
+    *campo = fine;
+    return (long)(fine - *inizio);
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+// Cerca il formato nella tabella a indirizzamento aperto, aggiungendolo con un compare-and-swap
+int messaggi_interna(const char* formato) {
+    uint32_t i = hash_formato(formato) & (MESSAGGI_MAX - 1);
+    char* copia = NULL;
+    int prove;
+
+    for (prove = 0; prove < MESSAGGI_MAX; prove++) {
+        char* voce = atomic_load_explicit(&tabella[i], memory_order_acquire);
+
+        if (voce == NULL) {
+            if (copia == NULL && (copia = strdup(formato)) == NULL) {
+                return -1;
+            }
+            if (atomic_compare_exchange_strong_explicit(&tabella[i], &voce, copia,
+                                                        memory_order_acq_rel, memory_order_acquire)) {
+                return (int)i;
+            }
+        }
+        if (strcmp(voce, formato) == 0) { // Internato anche da un altro thread nel frattempo
+            free(copia);
+            return (int)i;
+        }
+        i = (i + 1) & (MESSAGGI_MAX - 1);
+    }
+    free(copia);
+    return -1;
+}
+
+// Riga "=ID<tab>formato"
+int messaggi_definizione(char* dati, size_t capacita, int id) {
+    Riga_compatta r = {dati, capacita, 0};
+    char cifre[16];
+
+    snprintf(cifre, sizeof(cifre), "=%d\t", id);
+    metti_testo(&r, cifre);
+    metti_protetta(&r, atomic_load_explicit(&tabella[id], memory_order_acquire));
+    return chiudi_riga(&r);
+}
+
+// Riga "ID<tab>argomento..." con gli argomenti nell'ordine del formato
+int messaggi_codifica(char* dati, size_t capacita, int id, va_list argomenti) {
+    Riga_compatta r = {dati, capacita, 0};
+    const char* f = atomic_load_explicit(&tabella[id], memory_order_acquire);
+    char cifre[16];
+
+    snprintf(cifre, sizeof(cifre), "%d", id);
+    metti_testo(&r, cifre);
+    while (*f != '\0') {
+        Conversione c;
+        int k;
+
+        if (*f++ != '%') {
+            continue;
+        }
+        f = leggi_conversione(f, &c);
+        for (k = 0; k < c.asterischi; k++) {
+            metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, int));
+        }
+        switch (c.tipo) {
+            case ARGOMENTO_INTERO:
+                switch (c.lunghezza) {
+                    case LUNGHEZZA_LONG:      metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, long)); break;
+                    case LUNGHEZZA_LONG_LONG: metti_intero(&r, 1, (unsigned long long)va_arg(argomenti, long long)); break;
+                    case LUNGHEZZA_MASSIMA:   metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, intmax_t)); break;
+                    case LUNGHEZZA_DIMENSIONE:
+                    case LUNGHEZZA_DIFFERENZA: metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, ptrdiff_t)); break;
+                    default:                  metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, int)); break;
+                }
+                break;
+            case ARGOMENTO_NATURALE:
+                switch (c.lunghezza) {
+                    case LUNGHEZZA_LONG:      metti_intero(&r, 0, va_arg(argomenti, unsigned long)); break;
+                    case LUNGHEZZA_LONG_LONG: metti_intero(&r, 0, va_arg(argomenti, unsigned long long)); break;
+                    case LUNGHEZZA_MASSIMA:   metti_intero(&r, 0, va_arg(argomenti, uintmax_t)); break;
+                    case LUNGHEZZA_DIMENSIONE:
+                    case LUNGHEZZA_DIFFERENZA: metti_intero(&r, 0, va_arg(argomenti, size_t)); break;
+                    default:                  metti_intero(&r, 0, va_arg(argomenti, unsigned int)); break;
+                }
+                break;
+            case ARGOMENTO_REALE: {
+                double valore = c.lunghezza == LUNGHEZZA_LONG_DOUBLE ? (double)va_arg(argomenti, long double)
+                                                                     : va_arg(argomenti, double);
+                char testo[32];
+
+                snprintf(testo, sizeof(testo), "%.17g", valore);
+                metti_carattere(&r, '\t');
+                metti_testo(&r, testo);
+                break;
+            }
+            case ARGOMENTO_STRINGA: {
+                const char* s = va_arg(argomenti, const char*);
+
+                metti_carattere(&r, '\t');
+                metti_protetta(&r, s != NULL ? s : "(null)");
+                break;
+            }
+            case ARGOMENTO_CARATTERE:
+                metti_intero(&r, 1, (unsigned long long)(long long)va_arg(argomenti, int));
+                break;
+            case ARGOMENTO_PUNTATORE:
+                metti_intero(&r, 0, (unsigned long long)(uintptr_t)va_arg(argomenti, void*));
+                break;
+            case ARGOMENTO_NESSUNO:
+                break;
+            default: // Il resto del formato non si puo' interpretare: il client lo mostra cosi' com'e'
+                return chiudi_riga(&r);
+        }
+    }
+    return chiudi_riga(&r);
+}
+
+// Riga "\"testo"
+int messaggi_testo(char* dati, size_t capacita, const char* testo) {
+    Riga_compatta r = {dati, capacita, 0};
+
+    metti_carattere(&r, '"');
+    metti_protetta(&r, testo);
+    return chiudi_riga(&r);
+}
+
+Lettore_messaggi* messaggi_lettore_crea(void) {
+    return (Lettore_messaggi*)calloc(1, sizeof(Lettore_messaggi));
+}
+
+void messaggi_lettore_distruggi(Lettore_messaggi* l) {
+    int i;
+
+    if (l == NULL) {
+        return;
+    }
+    for (i = 0; i < MESSAGGI_MAX; i++) {
+        free(l->formati[i]);
+    }
+    free(l);
+}
+
+// Aggiorna la tabella o ricostruisce il testo di un messaggio sostituendo gli argomenti nel formato
+int messaggi_rendi_riga(Lettore_messaggi* l, const char* riga, FILE* uscita) {
+    const char* campo;
+    const char* f;
+    char* fine;
+    char* testo;
+    long id;
+
+    if (riga[0] == '"') {
+        testo = (char*)malloc(strlen(riga));
+        if (testo == NULL) {
+            return -1;
+        }
+        togli_protezione(riga + 1, strlen(riga + 1), testo);
+        fputs(testo, uscita);
+        free(testo);
+        return 0;
+    }
+
+    id = strtol(riga[0] == '=' ? riga + 1 : riga, &fine, 10);
+    if (fine == riga || id < 0 || id >= MESSAGGI_MAX || (*fine != '\t' && *fine != '\0')) {
+        return -1;
+    }
+    if (riga[0] == '=') {
+        if (*fine != '\t' || (testo = (char*)malloc(strlen(fine))) == NULL) {
+            return -1;
+        }
+        togli_protezione(fine + 1, strlen(fine + 1), testo);
+        free(l->formati[id]);
+        l->formati[id] = testo;
+        return 0;
+    }
+    if (l->formati[id] == NULL) {
+        return -1;
+    }
+
+    campo = fine;
+    f     = l->formati[id];
+    while (*f != '\0') {
+        Conversione c;
+        char specifica[64];
+        const char* inizio;
+        long n;
+        int k;
+        int usati;
+
+        if (*f != '%') {
+            fputc(*f++, uscita);
+            continue;
+        }
+        f = leggi_conversione(f + 1, &c);
+        if (c.tipo == ARGOMENTO_NESSUNO) {
+            fputc('%', uscita);
+            continue;
+        }
+        if (c.tipo == ARGOMENTO_SCONOSCIUTO) {
+            return 0;
+        }
+
+        usati = snprintf(specifica, sizeof(specifica), "%%");
+        for (k = 0; c.parti[k] != '\0'; k++) { // Le * diventano i valori ricevuti
+            if (c.parti[k] == '*') {
+                if ((n = prossimo_campo(&campo, &inizio)) < 0) {
+                    return -1;
+                }
+                usati += snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "%d", atoi(inizio));
+            } else {
+                specifica[usati++] = c.parti[k];
+            }
+        }
+        if ((n = prossimo_campo(&campo, &inizio)) < 0) {
+            return -1;
+        }
+        switch (c.tipo) {
+            case ARGOMENTO_INTERO:
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "ll%c", c.conversione);
+                fprintf(uscita, specifica, strtoll(inizio, NULL, 10));
+                break;
+            case ARGOMENTO_NATURALE:
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "ll%c", c.conversione);
+                fprintf(uscita, specifica, strtoull(inizio, NULL, 10));
+                break;
+            case ARGOMENTO_REALE:
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "%c", c.conversione);
+                fprintf(uscita, specifica, strtod(inizio, NULL));
+                break;
+            case ARGOMENTO_CARATTERE:
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "c");
+                fprintf(uscita, specifica, atoi(inizio));
+                break;
+            case ARGOMENTO_PUNTATORE:
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "p");
+                fprintf(uscita, specifica, (void*)(uintptr_t)strtoull(inizio, NULL, 10));
+                break;
+            default:
+                testo = (char*)malloc((size_t)n + 1);
+                if (testo == NULL) {
+                    return -1;
+                }
+                togli_protezione(inizio, (size_t)n, testo);
+                snprintf(specifica + usati, sizeof(specifica) - (size_t)usati, "s");
+                fprintf(uscita, specifica, testo);
+                free(testo);
+                break;
+        }
+    }
+    return 0;
+}
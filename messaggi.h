@@ -0,0 +1,67 @@
+#ifndef MESSAGGI_H
+#define MESSAGGI_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+/* ============================================================================
+ * MESSAGGI COMPATTI
+ *
+ * Quasi tutto il testo del gioco e' fatto di frasi fisse (cornici, racconti
+ * dei portali e dei combattimenti, menu) con pochi numeri o nomi in mezzo.
+ * In modo compatto una partita non manda il testo ma l'identificativo del
+ * formato printf che lo produce e i suoi argomenti, e il client lo
+ * ricostruisce da solo.
+ *
+ * I formati si internano in una tabella del processo, senza lock: il primo
+ * uso di un formato gli assegna un identificativo tra 0 e MESSAGGI_MAX - 1.
+ * Ogni sessione manda la definizione di un identificativo la prima volta
+ * che lo usa, quindi il client non ha bisogno di una tabella preparata.
+ *
+ * Il protocollo e' a righe, con i campi separati da tabulazioni; nei formati
+ * e nelle stringhe \, a capo e tabulazione diventano \\, \n e \t:
+ *   =ID<tab>formato            definizione di un identificativo
+ *   ID[<tab>argomento]...      messaggio: il formato con i suoi argomenti
+ *                              (interi e reali in decimale, stringhe)
+ *   "testo                     testo libero (tabella piena)
+ * Il passaggio al modo compatto a partita avviata e' segnato nel testo da
+ * una riga MESSAGGI_INIZIO.
+ * ============================================================================ */
+
+/* Riga di testo dopo la quale l'uscita di una partita e' fatta di messaggi compatti */
+#define MESSAGGI_INIZIO  "#compatto"
+
+/* Formati diversi che la tabella puo' internare (potenza di 2) */
+#define MESSAGGI_MAX  2048
+
+// Client che ricostruisce il testo dai messaggi compatti; definito in messaggi.c
+typedef struct Lettore_messaggi Lettore_messaggi;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//identificativo del formato, internandolo al primo uso; -1 se la tabella e' piena o manca la memoria
+int messaggi_interna(const char* formato);
+
+//scrive in dati (come snprintf) la riga di definizione di un identificativo; restituisce la lunghezza della riga
+int messaggi_definizione(char* dati, size_t capacita, int id);
+
+//scrive in dati (come vsnprintf) la riga del messaggio con gli argomenti letti da argomenti secondo il formato
+//dell'identificativo; restituisce la lunghezza della riga
+int messaggi_codifica(char* dati, size_t capacita, int id, va_list argomenti);
+
+//scrive in dati (come snprintf) un testo libero come riga compatta; restituisce la lunghezza della riga
+int messaggi_testo(char* dati, size_t capacita, const char* testo);
+
+//crea un lettore con la tabella vuota; NULL se manca la memoria
+Lettore_messaggi* messaggi_lettore_crea(void);
+
+//libera il lettore
+void messaggi_lettore_distruggi(Lettore_messaggi* l);
+
+//legge una riga compatta (senza l'a capo): una definizione aggiorna la tabella, un messaggio scrive il suo testo in uscita;
+//0 se riuscito, -1 se la riga non e' valida
+int messaggi_rendi_riga(Lettore_messaggi* l, const char* riga, FILE* uscita);
+
+#endif
@@ -0,0 +1,498 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "metriche.h"
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Testo delle metriche in costruzione
+typedef struct {
+    char* dati;
+    size_t lunghezza;
+    size_t capacita;
+    int guasto;                          /* 1 se la memoria non e' bastata */
+} Testo_metriche;
+
+// Descrizione di un contatore semplice per l'esposizione
+typedef struct {
+    const char* nome;
+    const char* aiuto;
+} Descrizione_metrica;
+
+static const Descrizione_metrica descrizioni[NUM_METRICHE] = {
+    {"cosestrane_turni_totale",               "Turni di gioco iniziati."},
+    {"cosestrane_attacchi_potenziati_totale", "Attacchi potenziati portati."},
+    {"cosestrane_portali_tentati_totale",     "Attraversamenti di portale tentati."},
+    {"cosestrane_portali_riusciti_totale",    "Attraversamenti di portale riusciti."},
+    {"cosestrane_oggetti_raccolti_totale",    "Oggetti raccolti."},
+    {"cosestrane_oggetti_usati_totale",       "Oggetti usati dallo zaino."},
+    {"cosestrane_mappe_generate_totale",      "Mappe casuali generate."},
+    {"cosestrane_allocazioni_totale",         "Allocazioni di memoria del motore."},
+    {"cosestrane_byte_allocati_totale",       "Byte chiesti dalle allocazioni del motore."}
+};
+
+static const Descrizione_metrica descrizioni_istogrammi[NUM_ISTOGRAMMI] = {
+    {"cosestrane_riga_nanosecondi",           "Tempo di elaborazione di una riga di input."},
+    {"cosestrane_round_partita",              "Round giocati nelle partite concluse."}
+};
+
+static const char* const nomi_esiti[NUM_ESITI_COMBATTIMENTO] = {"iniziato", "vinto", "perso"};
+
+static const char* const nomi_comandi[NUM_COMANDI] = {
+    "menu", "giocatori", "genera_mappa", "inserisci_zona", "cancella_zona", "scegli_mappa", "stampa_zona",
+    "chiudi_mappa", "stampa_mappa", "avanza", "indietreggia", "cambia_mondo", "combatti", "stampa_giocatore",
+    "stampa_zona_corrente", "raccogli", "apri_zaino", "passa", "attacco", "attacco_potenziato", "difesa",
+    "zaino_combattimento", "usa_oggetto", "non_valido"
+};
+
+/* Quantili esposti per le latenze dei comandi */
+static const double quantili[] = {0.5, 0.9, 0.99, 0.999};
+
+/* ============================================================================
+ * VARIABILI GLOBALI
+ * ============================================================================ */
+
+int metriche_attive = 0;
+_Thread_local Metriche_thread* metriche_thread = NULL;
+
+/* Ultimo blocco registrato: la lista si allunga solo in testa */
+static _Atomic(Metriche_thread*) blocchi = NULL;
+
+/* Blocco dei thread per cui non c'e' stata memoria: i suoi conteggi non vengono esposti */
+static Metriche_thread blocco_scarto;
+
+/* Thread registrati, per numerarli nella traccia */
+static _Atomic int num_thread = 0;
+
+/* Istante di metriche_attiva, origine dei tempi della traccia */
+static uint64_t origine_ns = 0;
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Aggiunge testo formattato alle metriche in costruzione
+ * @param t Testo
+ * @param formato Formato printf
+ */
+__attribute__((format(printf, 2, 3)))
+static void aggiungi(Testo_metriche* t, const char* formato, ...) {
+    va_list argomenti;
+    int n;
+
+    if (t->guasto) {
+        return;
+    }
+    va_start(argomenti, formato);
+    n = vsnprintf(t->dati + t->lunghezza, t->capacita - t->lunghezza, formato, argomenti);
+    va_end(argomenti);
+    if (n < 0) {
+        t->guasto = 1;
+        return;
+    }
+    if ((size_t)n >= t->capacita - t->lunghezza) { // Non c'e' posto: si raddoppia e si riscrive
+        size_t nuova_capacita = t->capacita * 2;
+        char* dati;
+
+        while (nuova_capacita - t->lunghezza <= (size_t)n) {
+            nuova_capacita *= 2;
+        }
+        dati = (char*)realloc(t->dati, nuova_capacita);
+        if (dati == NULL) {
+            t->guasto = 1;
+            return;
+        }
+        t->dati     = dati;
+        t->capacita = nuova_capacita;
+        va_start(argomenti, formato);
+        vsnprintf(t->dati + t->lunghezza, t->capacita - t->lunghezza, formato, argomenti);
+        va_end(argomenti);
+    }
+    t->lunghezza += (size_t)n;
+}
+
+/**
+ * Aggiunge il nome di un nemico come valore di un'etichetta, con le sequenze di escape di Prometheus
+ * @param t Testo
+ * @param nome Nome del nemico
+ */
+static void aggiungi_etichetta(Testo_metriche* t, const char* nome) {
+    for (; *nome != '\0'; nome++) {
+        if (*nome == '"' || *nome == '\\') {
+            aggiungi(t, "\\%c", *nome);
+        } else if (*nome == '\n') {
+            aggiungi(t, "\\n");
+        } else {
+            aggiungi(t, "%c", *nome);
+        }
+    }
+}
+
+/**
+ * Somma i blocchi di tutti i thread registrati
+ * @param totale Blocco in cui scrivere le somme
+ */
+static void somma_blocchi(Metriche_thread* totale) {
+    const Metriche_thread* m;
+    int i;
+    int j;
+
+    memset(totale, 0, sizeof(*totale));
+    for (m = atomic_load(&blocchi); m != NULL; m = m->succ) {
+        for (i = 0; i < NUM_METRICHE; i++) {
+            metriche_somma(&totale->contatori[i], atomic_load_explicit(&m->contatori[i], memory_order_relaxed));
+        }
+        for (i = 0; i < NEMICI_MAX; i++) {
+            for (j = 0; j < NUM_ESITI_COMBATTIMENTO; j++) {
+                metriche_somma(&totale->combattimenti[i][j],
+                               atomic_load_explicit(&m->combattimenti[i][j], memory_order_relaxed));
+            }
+        }
+        for (i = 0; i < NUM_ISTOGRAMMI; i++) {
+            for (j = 0; j < SECCHI_ISTOGRAMMA; j++) {
+                metriche_somma(&totale->secchi[i][j], atomic_load_explicit(&m->secchi[i][j], memory_order_relaxed));
+            }
+            metriche_somma(&totale->somme[i], atomic_load_explicit(&m->somme[i], memory_order_relaxed));
+        }
+        for (i = 0; i < NUM_COMANDI; i++) {
+            uint64_t massima = atomic_load_explicit(&m->latenza_massima[i], memory_order_relaxed);
+
+            for (j = 0; j < SECCHI_LATENZA; j++) {
+                metriche_somma(&totale->latenze[i][j], atomic_load_explicit(&m->latenze[i][j], memory_order_relaxed));
+            }
+            metriche_somma(&totale->latenza_totale[i],
+                           atomic_load_explicit(&m->latenza_totale[i], memory_order_relaxed));
+            if (massima > atomic_load_explicit(&totale->latenza_massima[i], memory_order_relaxed)) {
+                atomic_store_explicit(&totale->latenza_massima[i], massima, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/**
+ * Calcola il secchio HDR di una latenza: esatto sotto SOTTOSECCHI_LATENZA, poi i 4 bit dopo il piu' alto
+ * @param valore Latenza in nanosecondi
+ * @return Indice del secchio
+ */
+static int secchio_latenza(uint64_t valore) {
+    int bit;
+
+    if (valore < SOTTOSECCHI_LATENZA) {
+        return (int)valore;
+    }
+    bit = 63 - __builtin_clzll(valore);
+    if (bit >= 40) {
+        return SECCHI_LATENZA - 1;
+    }
+    return SOTTOSECCHI_LATENZA + (bit - 4) * SOTTOSECCHI_LATENZA
+           + (int)((valore >> (bit - 4)) - SOTTOSECCHI_LATENZA);
+}
+
+/**
+ * Restituisce il valore piu' alto che finisce in un secchio HDR
+ * @param secchio Indice del secchio
+ * @return Limite superiore del secchio in nanosecondi
+ */
+static uint64_t limite_latenza(int secchio) {
+    int bit;
+    uint64_t sotto;
+
+    if (secchio < SOTTOSECCHI_LATENZA) {
+        return (uint64_t)secchio;
+    }
+    bit   = (secchio - SOTTOSECCHI_LATENZA) / SOTTOSECCHI_LATENZA + 4;
+    sotto = (uint64_t)((secchio - SOTTOSECCHI_LATENZA) % SOTTOSECCHI_LATENZA);
+    return ((SOTTOSECCHI_LATENZA + sotto + 1) << (bit - 4)) - 1;
+}
+
+/**
+ * Calcola un quantile dall'istogramma HDR di un comando
+ * @param secchi Secchi del comando (somme di tutti i thread)
+ * @param conteggio Latenze registrate
+ * @param quantile Quantile tra 0 e 1
+ * @param massimo Latenza piu' alta registrata
+ * @return Limite superiore del secchio che contiene il quantile, mai oltre il massimo
+ */
+static uint64_t quantile_latenza(const _Atomic uint64_t* secchi, uint64_t conteggio, double quantile,
+                                 uint64_t massimo) {
+    uint64_t soglia = (uint64_t)(quantile * (double)conteggio + 0.5);
+    uint64_t cumulato = 0;
+    int i;
+
+    if (soglia == 0) {
+        soglia = 1;
+    }
+    for (i = 0; i < SECCHI_LATENZA; i++) {
+        cumulato += atomic_load_explicit(&secchi[i], memory_order_relaxed);
+        if (cumulato >= soglia) {
+            break;
+        }
+    }
+    return i < SECCHI_LATENZA && limite_latenza(i) < massimo ? limite_latenza(i) : massimo;
+}
+
+/**
+ * Scrive un testo in un file provvisorio e lo rinomina, cosi' chi legge non vede mai un testo a meta'
+ * @param percorso File da sostituire
+ * @param testo Testo
+ * @param n Lunghezza del testo
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int salva_testo(const char* percorso, const char* testo, size_t n) {
+    char* provvisorio = (char*)malloc(strlen(percorso) + 24);
+    FILE* f;
+    int esito = -1;
+
+    if (provvisorio == NULL) {
+        return -1;
+    }
+    sprintf(provvisorio, "%s.%ld", percorso, (long)getpid());
+    f = fopen(provvisorio, "w");
+    if (f != NULL) {
+        esito = fwrite(testo, 1, n, f) == n ? 0 : -1;
+        if (fclose(f) != 0) {
+            esito = -1;
+        }
+        if (esito == 0) {
+            esito = rename(provvisorio, percorso);
+        }
+        if (esito != 0) {
+            remove(provvisorio);
+        }
+    }
+    free(provvisorio);
+    return esito;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+// Accende i punti di misura
+void metriche_attiva(void) {
+    origine_ns      = metriche_adesso_ns();
+    metriche_attive = 1;
+}
+
+// Alloca il blocco del thread e lo aggiunge in testa alla lista con un compare-and-swap
+Metriche_thread* metriche_registra_thread(void) {
+    Metriche_thread* m = (Metriche_thread*)calloc(1, sizeof(Metriche_thread));
+
+    if (m == NULL) {
+        metriche_thread = &blocco_scarto;
+        return metriche_thread;
+    }
+    m->numero = atomic_fetch_add(&num_thread, 1) + 1;
+    m->succ   = atomic_load(&blocchi);
+    while (!atomic_compare_exchange_weak(&blocchi, &m->succ, m)) {
+    }
+    metriche_thread = m;
+    return m;
+}
+
+// Somma i thread ed espone contatori, combattimenti per nemico e istogrammi cumulativi
+size_t metriche_testo(char** testo) {
+    Metriche_thread* totale = (Metriche_thread*)malloc(sizeof(Metriche_thread));
+    Testo_metriche t;
+    int num_nemici = registro_num_nemici();
+    int i;
+    int j;
+
+    *testo = NULL;
+    t.capacita  = 8192;
+    t.lunghezza = 0;
+    t.guasto    = 0;
+    t.dati      = (char*)malloc(t.capacita);
+    if (totale == NULL || t.dati == NULL) {
+        free(totale);
+        free(t.dati);
+        return 0;
+    }
+    somma_blocchi(totale);
+
+    for (i = 0; i < NUM_METRICHE; i++) {
+        aggiungi(&t, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", descrizioni[i].nome, descrizioni[i].aiuto,
+                 descrizioni[i].nome, descrizioni[i].nome, (unsigned long long)totale->contatori[i]);
+    }
+
+    aggiungi(&t, "# HELP cosestrane_combattimenti_totale Combattimenti per tipo di nemico ed esito.\n"
+                 "# TYPE cosestrane_combattimenti_totale counter\n");
+    for (i = 1; i < num_nemici && i < NEMICI_MAX; i++) { // Il tipo 0 e' "nessun nemico"
+        for (j = 0; j < NUM_ESITI_COMBATTIMENTO; j++) {
+            aggiungi(&t, "cosestrane_combattimenti_totale{nemico=\"");
+            aggiungi_etichetta(&t, registro_nome_nemico(i));
+            aggiungi(&t, "\",esito=\"%s\"} %llu\n", nomi_esiti[j], (unsigned long long)totale->combattimenti[i][j]);
+        }
+    }
+
+    for (i = 0; i < NUM_ISTOGRAMMI; i++) {
+        const char* nome = descrizioni_istogrammi[i].nome;
+        unsigned long long cumulato = 0;
+
+        aggiungi(&t, "# HELP %s %s\n# TYPE %s histogram\n", nome, descrizioni_istogrammi[i].aiuto, nome);
+        for (j = 0; j < SECCHI_ISTOGRAMMA - 1; j++) {
+            cumulato += (unsigned long long)totale->secchi[i][j];
+            aggiungi(&t, "%s_bucket{le=\"%llu\"} %llu\n", nome, (1ull << j) - 1, cumulato);
+        }
+        cumulato += (unsigned long long)totale->secchi[i][SECCHI_ISTOGRAMMA - 1];
+        aggiungi(&t, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu\n%s_count %llu\n", nome, cumulato,
+                 nome, (unsigned long long)totale->somme[i], nome, cumulato);
+    }
+
+    // Latenze dei comandi come summary: i quantili si calcolano qui dai secchi HDR
+    aggiungi(&t, "# HELP cosestrane_comando_nanosecondi Latenza di un comando, dall'input alla richiesta successiva.\n"
+                 "# TYPE cosestrane_comando_nanosecondi summary\n");
+    for (i = 0; i < NUM_COMANDI; i++) {
+        uint64_t conteggio = 0;
+        size_t q;
+
+        for (j = 0; j < SECCHI_LATENZA; j++) {
+            conteggio += totale->latenze[i][j];
+        }
+        if (conteggio == 0) {
+            continue;
+        }
+        for (q = 0; q < sizeof(quantili) / sizeof(quantili[0]); q++) {
+            aggiungi(&t, "cosestrane_comando_nanosecondi{comando=\"%s\",quantile=\"%g\"} %llu\n", nomi_comandi[i],
+                     quantili[q], (unsigned long long)quantile_latenza(totale->latenze[i], conteggio, quantili[q],
+                                                                  totale->latenza_massima[i]));
+        }
+        aggiungi(&t, "cosestrane_comando_nanosecondi_sum{comando=\"%s\"} %llu\n"
+                     "cosestrane_comando_nanosecondi_count{comando=\"%s\"} %llu\n",
+                 nomi_comandi[i], (unsigned long long)totale->latenza_totale[i],
+                 nomi_comandi[i], (unsigned long long)conteggio);
+    }
+    aggiungi(&t, "# HELP cosestrane_comando_nanosecondi_massimo Latenza piu' alta di un comando.\n"
+                 "# TYPE cosestrane_comando_nanosecondi_massimo gauge\n");
+    for (i = 0; i < NUM_COMANDI; i++) {
+        if (totale->latenza_massima[i] != 0) {
+            aggiungi(&t, "cosestrane_comando_nanosecondi_massimo{comando=\"%s\"} %llu\n", nomi_comandi[i],
+                     (unsigned long long)totale->latenza_massima[i]);
+        }
+    }
+
+    free(totale);
+    if (t.guasto) {
+        free(t.dati);
+        return 0;
+    }
+    *testo = t.dati;
+    return t.lunghezza;
+}
+
+// Scrive il testo delle metriche sostituendo il file
+int metriche_salva(const char* percorso) {
+    char* testo;
+    size_t n = metriche_testo(&testo);
+    int esito;
+
+    if (n == 0) {
+        return -1;
+    }
+    esito = salva_testo(percorso, testo, n);
+    free(testo);
+    return esito;
+}
+
+// Secchio HDR, massimo e totale del comando, poi l'evento nell'anello protetto dal suo numero di sequenza
+void metrica_comando(Comando comando, uint64_t sessione, uint64_t inizio_ns, uint64_t durata_ns) {
+    Metriche_thread* m = metriche_locali();
+    uint64_t posizione = atomic_load_explicit(&m->eventi_tracciati, memory_order_relaxed);
+    Evento_traccia* e = &m->traccia[posizione & (EVENTI_TRACCIA - 1)];
+
+    metriche_somma(&m->latenze[comando][secchio_latenza(durata_ns)], 1);
+    metriche_somma(&m->latenza_totale[comando], durata_ns);
+    if (durata_ns > atomic_load_explicit(&m->latenza_massima[comando], memory_order_relaxed)) {
+        atomic_store_explicit(&m->latenza_massima[comando], durata_ns, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&e->sequenza, 2 * posizione + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&e->inizio, inizio_ns - origine_ns, memory_order_relaxed);
+    atomic_store_explicit(&e->durata, durata_ns, memory_order_relaxed);
+    atomic_store_explicit(&e->sessione, sessione, memory_order_relaxed);
+    atomic_store_explicit(&e->comando, (uint32_t)comando, memory_order_relaxed);
+    atomic_store_explicit(&e->sequenza, 2 * posizione + 2, memory_order_release);
+    atomic_store_explicit(&m->eventi_tracciati, posizione + 1, memory_order_release);
+}
+
+// Legge gli ultimi EVENTI_TRACCIA eventi di ogni thread; quelli riscritti durante la lettura si scartano
+size_t metriche_traccia(char** testo) {
+    const Metriche_thread* m;
+    Testo_metriche t;
+    const char* separatore = "";
+    int pid = (int)getpid();
+
+    *testo = NULL;
+    t.capacita  = 65536;
+    t.lunghezza = 0;
+    t.guasto    = 0;
+    t.dati      = (char*)malloc(t.capacita);
+    if (t.dati == NULL) {
+        return 0;
+    }
+
+    aggiungi(&t, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (m = atomic_load(&blocchi); m != NULL; m = m->succ) {
+        uint64_t fine = atomic_load_explicit(&m->eventi_tracciati, memory_order_acquire);
+        uint64_t posizione = fine > EVENTI_TRACCIA ? fine - EVENTI_TRACCIA : 0;
+
+        for (; posizione < fine; posizione++) {
+            const Evento_traccia* e = &m->traccia[posizione & (EVENTI_TRACCIA - 1)];
+            uint64_t sequenza = atomic_load_explicit(&e->sequenza, memory_order_acquire);
+            uint64_t inizio   = atomic_load_explicit(&e->inizio, memory_order_relaxed);
+            uint64_t durata   = atomic_load_explicit(&e->durata, memory_order_relaxed);
+            uint64_t sessione = atomic_load_explicit(&e->sessione, memory_order_relaxed);
+            uint32_t comando  = atomic_load_explicit(&e->comando, memory_order_relaxed);
+
+            atomic_thread_fence(memory_order_acquire);
+            if (sequenza != 2 * posizione + 2 || atomic_load_explicit(&e->sequenza, memory_order_relaxed) != sequenza
+                || comando >= NUM_COMANDI) {
+                continue;
+            }
+            aggiungi(&t, "%s\n{\"name\":\"%s\",\"cat\":\"comando\",\"ph\":\"X\",\"ts\":%llu.%03u,"
+                         "\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d,\"args\":{\"sessione\":%llu}}",
+                     separatore, nomi_comandi[comando], (unsigned long long)(inizio / 1000), (unsigned)(inizio % 1000),
+                     (unsigned long long)(durata / 1000), (unsigned)(durata % 1000), pid, m->numero,
+                     (unsigned long long)sessione);
+            separatore = ",";
+        }
+    }
+    aggiungi(&t, "\n]}\n");
+
+    if (t.guasto) {
+        free(t.dati);
+        return 0;
+    }
+    *testo = t.dati;
+    return t.lunghezza;
+}
+
+// Scrive la traccia JSON sostituendo il file
+int metriche_salva_traccia(const char* percorso) {
+    char* testo;
+    size_t n = metriche_traccia(&testo);
+    int esito;
+
+    if (n == 0) {
+        return -1;
+    }
+    esito = salva_testo(percorso, testo, n);
+    free(testo);
+    return esito;
+}
+
+// Orologio monotono
+uint64_t metriche_adesso_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
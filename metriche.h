@@ -0,0 +1,218 @@
+#ifndef METRICHE_H
+#define METRICHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "registro.h"
+
+/* ============================================================================
+ * METRICHE DEL MOTORE DI GIOCO
+ *
+ * Contatori e istogrammi di quello che fa il motore: turni, combattimenti
+ * per tipo di nemico, attacchi potenziati, portali, oggetti, mappe
+ * generate, allocazioni e tempo di elaborazione delle righe. Ogni thread
+ * conta in un blocco suo, allocato al primo uso e mai liberato, quindi un
+ * conteggio e' una load e una store sulla cache del thread, senza
+ * istruzioni atomiche con lock ne' linee di cache contese. I blocchi si
+ * sommano solo quando qualcuno chiede il testo delle metriche, nel formato
+ * di esposizione di Prometheus (metriche_testo).
+ *
+ * Finche' non si chiama metriche_attiva ogni punto di misura costa un solo
+ * confronto su una variabile che non cambia, ben predetto dal processore.
+ *
+ * Ogni riga consegnata a una partita e' anche un comando (il menu o la
+ * scelta dello stato in cui si trova), con la sua latenza dall'input alla
+ * richiesta successiva: un istogramma in stile HDR per comando, con
+ * SOTTOSECCHI_LATENZA secchi lineari per ogni potenza di 2 (errore
+ * relativo sotto il 7% su qualunque scala), e un evento nell'anello di
+ * traccia del thread, da esportare nel formato JSON dei Chrome trace
+ * (chrome://tracing, Perfetto). L'anello tiene gli ultimi EVENTI_TRACCIA
+ * eventi e si scrive senza lock: un numero di sequenza per evento, dispari
+ * durante la scrittura, fa scartare a chi legge gli eventi a meta'.
+ * ============================================================================ */
+
+// Contatori semplici
+typedef enum {
+    METRICA_TURNI = 0,                   /* Turni di gioco iniziati */
+    METRICA_ATTACCHI_POTENZIATI,         /* Attacchi potenziati portati */
+    METRICA_PORTALI_TENTATI,             /* Attraversamenti tentati in cambia_mondo */
+    METRICA_PORTALI_RIUSCITI,            /* Attraversamenti riusciti */
+    METRICA_OGGETTI_RACCOLTI,
+    METRICA_OGGETTI_USATI,
+    METRICA_MAPPE_GENERATE,              /* Mappe casuali, anche le mappe del giorno */
+    METRICA_ALLOCAZIONI,                 /* Allocazioni del motore (malloc, calloc, realloc) */
+    METRICA_BYTE_ALLOCATI,               /* Byte chiesti da quelle allocazioni */
+    NUM_METRICHE
+} Metrica;
+
+// Esiti dei combattimenti, contati per tipo di nemico
+typedef enum {
+    COMBATTIMENTO_INIZIATO = 0,
+    COMBATTIMENTO_VINTO,
+    COMBATTIMENTO_PERSO,
+    NUM_ESITI_COMBATTIMENTO
+} Esito_combattimento;
+
+// Istogrammi
+typedef enum {
+    ISTOGRAMMA_RIGA_NS = 0,              /* Nanosecondi per elaborare una riga di input (partita_invia) */
+    ISTOGRAMMA_ROUND_PARTITA,            /* Round giocati nelle partite concluse */
+    NUM_ISTOGRAMMI
+} Istogramma;
+
+// Comandi di una partita: scelte dei menu dell'impostazione e dei turni
+typedef enum {
+    COMANDO_MENU = 0,                    /* Menu principale delle sessioni remote */
+    COMANDO_GIOCATORI,                   /* Numero, nomi e abilita' dei giocatori */
+    COMANDO_GENERA_MAPPA,                /* Menu della mappa, nell'ordine delle scelte 1-6 */
+    COMANDO_INSERISCI_ZONA,
+    COMANDO_CANCELLA_ZONA,
+    COMANDO_SCEGLI_MAPPA,
+    COMANDO_STAMPA_ZONA,
+    COMANDO_CHIUDI_MAPPA,
+    COMANDO_STAMPA_MAPPA,                /* Stampa del mondo scelto */
+    COMANDO_AVANZA,                      /* Menu delle azioni, nell'ordine delle scelte 1-9 */
+    COMANDO_INDIETREGGIA,
+    COMANDO_CAMBIA_MONDO,
+    COMANDO_COMBATTI,
+    COMANDO_STAMPA_GIOCATORE,
+    COMANDO_STAMPA_ZONA_CORRENTE,
+    COMANDO_RACCOGLI,
+    COMANDO_APRI_ZAINO,
+    COMANDO_PASSA,
+    COMANDO_ATTACCO,                     /* Menu di combattimento, nell'ordine delle scelte 1-4 */
+    COMANDO_ATTACCO_POTENZIATO,
+    COMANDO_DIFESA,
+    COMANDO_ZAINO_COMBATTIMENTO,
+    COMANDO_USA_OGGETTO,                 /* Slot scelto dallo zaino */
+    COMANDO_NON_VALIDO,                  /* Scelta fuori dal menu o riga non numerica */
+    NUM_COMANDI
+} Comando;
+
+/* Secchi di un istogramma: il secchio k conta i valori fino a 2^k - 1, l'ultimo tutti quelli oltre */
+#define SECCHI_ISTOGRAMMA  34
+
+/* Istogrammi delle latenze: 16 secchi esatti sotto 16 ns, poi 16 secchi per potenza di 2 fino a 2^40 ns */
+#define SOTTOSECCHI_LATENZA  16
+#define SECCHI_LATENZA       (SOTTOSECCHI_LATENZA + 36 * SOTTOSECCHI_LATENZA)
+
+/* Eventi dell'anello di traccia di ogni thread (potenza di 2) */
+#define EVENTI_TRACCIA       4096
+
+// Evento dell'anello di traccia: un comando eseguito
+typedef struct {
+    _Atomic uint64_t sequenza;           /* 2 * posizione + 1 durante la scrittura, + 2 quando e' completo */
+    _Atomic uint64_t inizio;             /* Nanosecondi dall'attivazione delle metriche */
+    _Atomic uint64_t durata;             /* Nanosecondi */
+    _Atomic uint64_t sessione;           /* Identificativo della partita */
+    _Atomic uint32_t comando;
+} Evento_traccia;
+
+// Conteggi di un thread: li scrive solo il thread proprietario, li legge chi somma
+typedef struct Metriche_thread {
+    _Atomic uint64_t contatori[NUM_METRICHE];
+    _Atomic uint64_t combattimenti[NEMICI_MAX][NUM_ESITI_COMBATTIMENTO];
+    _Atomic uint64_t secchi[NUM_ISTOGRAMMI][SECCHI_ISTOGRAMMA];
+    _Atomic uint64_t somme[NUM_ISTOGRAMMI];
+    _Atomic uint64_t latenze[NUM_COMANDI][SECCHI_LATENZA];
+    _Atomic uint64_t latenza_massima[NUM_COMANDI];
+    _Atomic uint64_t latenza_totale[NUM_COMANDI];
+    Evento_traccia traccia[EVENTI_TRACCIA];
+    _Atomic uint64_t eventi_tracciati;   /* Eventi scritti nell'anello da sempre */
+    int numero;                          /* Numero del thread nella traccia, in ordine di registrazione */
+    struct Metriche_thread* succ;        /* Blocco registrato prima */
+} Metriche_thread;
+
+/* 1 dopo metriche_attiva; va chiamata prima di avviare i thread */
+extern int metriche_attive;
+
+/* Blocco del thread corrente, NULL prima del primo conteggio */
+extern _Thread_local Metriche_thread* metriche_thread;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//comincia a contare (per tutto il processo)
+void metriche_attiva(void);
+
+//registra il blocco del thread corrente alla prima misura; non restituisce mai NULL
+Metriche_thread* metriche_registra_thread(void);
+
+//scrive in *testo (da liberare con free) le metriche di tutti i thread nel formato di Prometheus;
+//restituisce la lunghezza del testo, 0 se la memoria non basta
+size_t metriche_testo(char** testo);
+
+//scrive le metriche nel file indicato, sostituendolo in modo atomico; 0 se riuscito, -1 in caso di errore
+int metriche_salva(const char* percorso);
+
+//registra un comando eseguito dal thread corrente (solo con le metriche attive): latenza e evento di traccia
+void metrica_comando(Comando comando, uint64_t sessione, uint64_t inizio_ns, uint64_t durata_ns);
+
+//scrive in *testo (da liberare con free) gli eventi di traccia di tutti i thread nel formato JSON dei Chrome trace;
+//restituisce la lunghezza del testo, 0 se la memoria non basta
+size_t metriche_traccia(char** testo);
+
+//scrive la traccia nel file indicato, sostituendolo in modo atomico; 0 se riuscito, -1 in caso di errore
+int metriche_salva_traccia(const char* percorso);
+
+//orologio monotono in nanosecondi, per misurare le durate
+uint64_t metriche_adesso_ns(void);
+
+/* ============================================================================
+ * PUNTI DI MISURA
+ * ============================================================================ */
+
+//somma n a un conteggio del thread corrente (un solo scrittore: niente operazioni atomiche con lock)
+static inline void metriche_somma(_Atomic uint64_t* conteggio, uint64_t n) {
+    atomic_store_explicit(conteggio, atomic_load_explicit(conteggio, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+//blocco del thread corrente
+static inline Metriche_thread* metriche_locali(void) {
+    Metriche_thread* m = metriche_thread;
+
+    return m != NULL ? m : metriche_registra_thread();
+}
+
+//somma n a un contatore
+static inline void metrica_conta(Metrica metrica, uint64_t n) {
+    if (__builtin_expect(metriche_attive, 0)) {
+        metriche_somma(&metriche_locali()->contatori[metrica], n);
+    }
+}
+
+//conta un combattimento contro un tipo di nemico
+static inline void metrica_combattimento(int nemico, Esito_combattimento esito) {
+    if (__builtin_expect(metriche_attive, 0) && nemico >= 0 && nemico < NEMICI_MAX) {
+        metriche_somma(&metriche_locali()->combattimenti[nemico][esito], 1);
+    }
+}
+
+//aggiunge un valore a un istogramma
+static inline void metrica_osserva(Istogramma istogramma, uint64_t valore) {
+    if (__builtin_expect(metriche_attive, 0)) {
+        Metriche_thread* m = metriche_locali();
+        int secchio = valore == 0 ? 0 : 64 - __builtin_clzll(valore);
+
+        if (secchio >= SECCHI_ISTOGRAMMA) {
+            secchio = SECCHI_ISTOGRAMMA - 1;
+        }
+        metriche_somma(&m->secchi[istogramma][secchio], 1);
+        metriche_somma(&m->somme[istogramma], valore);
+    }
+}
+
+//conta un'allocazione di n byte
+static inline void metrica_allocazione(size_t n) {
+    if (__builtin_expect(metriche_attive, 0)) {
+        Metriche_thread* m = metriche_locali();
+
+        metriche_somma(&m->contatori[METRICA_ALLOCAZIONI], 1);
+        metriche_somma(&m->contatori[METRICA_BYTE_ALLOCATI], n);
+    }
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gamelib.h"
+#include "registro.h"
+#include "mappa_condivisa.h"
+
+/* ============================================================================
+ * PROVA DEL RIAVVOLGIMENTO
+ *
+ * Gioca partite con scelte casuali, tiene l'istantanea di ogni inizio turno
+ * e ogni tanto annulla qualche turno: l'istantanea dopo partita_riavvolgi
+ * deve essere identica, byte per byte, a quella presa quando il turno era
+ * cominciato (ordine dei vivi e degli occupanti compresi). Prova sia le
+ * mappe proprie che una mappa condivisa.
+ *
+ *     gcc -O2 -pthread prova_riavvolgimento.c gamelib.c registro.c alias.c generatore.c mappa_condivisa.c ramo.c salvataggio.c classifica.c metriche.c cronaca.c giornale.c messaggi.c schermo.c crc32.c -o prova_riavvolgimento
+ *     ./prova_riavvolgimento [partite]
+ * ============================================================================ */
+
+/* Giocatori di ogni partita: abbastanza da avere morti e zone affollate */
+#define GIOCATORI_PROVA   4
+
+/* Scelte al massimo per partita, e in media una ogni quante si riavvolge */
+#define SCELTE_MAX        20000
+#define OGNI_RIAVVOLGI    200
+
+// Istantanea presa all'inizio di un turno
+typedef struct {
+    unsigned char* dati;
+    size_t n;
+} Istantanea;
+
+/**
+ * Estrae un numero casuale (xorshift64)
+ * @param rng Stato del generatore
+ * @return Numero estratto
+ */
+static uint64_t estrai(uint64_t* rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+/**
+ * Consegna una riga alla partita e scarta il testo prodotto
+ * @param p Partita
+ * @param riga Riga di input
+ */
+static void invia(Partita* p, const char* riga) {
+    partita_invia(p, riga);
+    partita_svuota_uscita(p);
+}
+
+/**
+ * Imposta una partita con GIOCATORI_PROVA giocatori e la avvia
+ * @param p Partita appena creata
+ * @param condivisa 1 se la partita usa una mappa condivisa (nessuna mappa da creare)
+ */
+static void imposta(Partita* p, int condivisa) {
+    char nome[16];
+    int i;
+
+    partita_apri(p);
+    partita_svuota_uscita(p);
+    invia(p, "1");                       /* Imposta gioco */
+    snprintf(nome, sizeof(nome), "%d", GIOCATORI_PROVA);
+    invia(p, nome);
+    for (i = 0; i < GIOCATORI_PROVA; i++) {
+        snprintf(nome, sizeof(nome), "G%d", i + 1);
+        invia(p, nome);
+        invia(p, "4");                   /* Nessuna modifica alle abilita' */
+    }
+    if (!condivisa) {
+        invia(p, "1");                   /* Genera mappa casuale */
+        invia(p, "6");                   /* Chiudi mappa */
+    }
+    invia(p, "2");                       /* Gioca */
+}
+
+/**
+ * Gioca una partita riavvolgendo ogni tanto e confronta le istantanee
+ * @param m Mappa condivisa, NULL per una mappa propria
+ * @param seme Seme delle scelte
+ * @param controlli Riavvolgimenti controllati, aumentato
+ * @return Riavvolgimenti con un'istantanea diversa, -1 se la memoria non basta
+ */
+static int prova_partita(const Mappa_condivisa* m, uint64_t seme, int* controlli) {
+    Istantanea* storia = (Istantanea*)calloc(SCELTE_MAX + 1, sizeof(Istantanea));
+    Partita* p = partita_crea();
+    uint64_t rng = seme * 0x9E3779B97F4A7C15ULL + 1;
+    int num_storia = 0;
+    int errori = 0;
+    int passo;
+    int i;
+
+    if (storia == NULL || p == NULL) {
+        free(storia);
+        partita_distruggi(p);
+        return -1;
+    }
+    partita_usa_mappa_condivisa(p, m);
+    srand((unsigned int)seme);
+    imposta(p, m != NULL);
+
+    for (passo = 0; passo < SCELTE_MAX && partita_in_gioco(p); passo++) {
+        int annullabili = partita_turni_annullabili(p);
+        char scelta[8];
+
+        if (annullabili + 1 > num_storia) { // Turno nuovo: se ne tiene l'istantanea
+            storia[num_storia].n = partita_istantanea(p, &storia[num_storia].dati);
+            num_storia++;
+        }
+
+        if (annullabili > 0 && estrai(&rng) % OGNI_RIAVVOLGI == 0) {
+            int turni = 1 + (int)(estrai(&rng) % (uint64_t)annullabili);
+            const Istantanea* attesa;
+            unsigned char* dati;
+            size_t n;
+
+            partita_riavvolgi(p, turni);
+            partita_svuota_uscita(p);
+            for (i = annullabili + 1 - turni; i < num_storia; i++) {
+                free(storia[i].dati);
+            }
+            num_storia = annullabili + 1 - turni;
+            attesa     = &storia[num_storia - 1];
+
+            n = partita_istantanea(p, &dati);
+            if (n != attesa->n || memcmp(dati, attesa->dati, n) != 0) {
+                fprintf(stderr, "Seme %llu: istantanea diversa dopo aver annullato %d turni\n",
+                        (unsigned long long)seme, turni);
+                errori++;
+            }
+            free(dati);
+            (*controlli)++;
+            continue;
+        }
+
+        snprintf(scelta, sizeof(scelta), "%d", 1 + (int)(estrai(&rng) % 9));
+        invia(p, scelta);
+    }
+
+    for (i = 0; i < num_storia; i++) {
+        free(storia[i].dati);
+    }
+    free(storia);
+    partita_distruggi(p);
+    return errori;
+}
+
+int main(int argc, char* argv[]) {
+    int partite = argc > 1 ? atoi(argv[1]) : 20;
+    Mappa_condivisa* m;
+    int controlli = 0;
+    int errori = 0;
+    int k;
+
+    registro_predefinito();
+    m = mappa_condivisa_genera(7, 20);
+    if (m == NULL) {
+        fprintf(stderr, "Errore: impossibile creare la mappa condivisa!\n");
+        return 1;
+    }
+
+    for (k = 1; k <= partite; k++) {
+        int propria   = prova_partita(NULL, (uint64_t)k, &controlli);
+        int condivisa = prova_partita(m, (uint64_t)k, &controlli);
+
+        if (propria < 0 || condivisa < 0) {
+            fprintf(stderr, "Errore: memoria insufficiente!\n");
+            mappa_condivisa_distruggi(m);
+            return 1;
+        }
+        errori += propria + condivisa;
+    }
+
+    printf("Partite: %d  Riavvolgimenti controllati: %d  Istantanee diverse: %d\n", partite * 2, controlli, errori);
+    mappa_condivisa_distruggi(m);
+    return errori != 0;
+}
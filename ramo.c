@@ -0,0 +1,711 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ramo.h"
+
+#define ALLINEAMENTO_ARENA  16
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Blocco di memoria dell'arena, riempito in ordine
+typedef struct Blocco_arena {
+    struct Blocco_arena* succ;
+    size_t usati;
+    _Alignas(ALLINEAMENTO_ARENA) unsigned char dati[ARENA_RAMI_BLOCCO];
+} Blocco_arena;
+
+struct Arena_rami {
+    Blocco_arena* primo;
+    Blocco_arena* corrente;
+    uint32_t prossimo_proprietario;
+};
+
+// Testa di ogni nodo degli alberi: un nodo si modifica sul posto solo dal ramo che lo ha creato
+typedef struct {
+    uint32_t proprietario;
+    uint32_t riservato;
+} Testa_nodo;
+
+// Nodo interno di un albero
+typedef struct {
+    Testa_nodo testa;
+    void* figli[RAMO_VIE];
+} Nodo_ramo;
+
+// Foglia di un albero: RAMO_VIE elementi consecutivi
+typedef struct {
+    Testa_nodo testa;
+    _Alignas(ALLINEAMENTO_ARENA) unsigned char dati[];
+} Foglia_ramo;
+
+/* ============================================================================
+ * ARENA
+ * ============================================================================ */
+
+/**
+ * Prende memoria dall'arena; non si libera mai da sola, solo con tutta l'arena
+ * @param a Arena
+ * @param dimensione Byte richiesti (al massimo ARENA_RAMI_BLOCCO)
+ * @return Memoria allineata a ALLINEAMENTO_ARENA, NULL se non ce n'e' piu'
+ */
+static void* arena_prendi(Arena_rami* a, size_t dimensione) {
+    void* p;
+
+    dimensione = (dimensione + ALLINEAMENTO_ARENA - 1) / ALLINEAMENTO_ARENA * ALLINEAMENTO_ARENA;
+    if (a->corrente->usati + dimensione > ARENA_RAMI_BLOCCO) {
+        if (a->corrente->succ == NULL) { // Nessun blocco avanzato da uno svuotamento precedente
+            Blocco_arena* nuovo = (Blocco_arena*)malloc(sizeof(Blocco_arena));
+            if (nuovo == NULL) {
+                return NULL;
+            }
+            nuovo->succ = NULL;
+            a->corrente->succ = nuovo;
+        }
+        a->corrente = a->corrente->succ;
+        a->corrente->usati = 0;
+    }
+    p = a->corrente->dati + a->corrente->usati;
+    a->corrente->usati += dimensione;
+    return p;
+}
+
+/**
+ * Assegna un numero di proprietario mai usato dall'ultimo svuotamento
+ * @param a Arena
+ * @return Numero del proprietario
+ */
+static uint32_t nuovo_proprietario(Arena_rami* a) {
+    return a->prossimo_proprietario++;
+}
+
+/* ============================================================================
+ * ALBERI PERSISTENTI
+ * ============================================================================ */
+
+/**
+ * Byte di un nodo dell'albero al livello dato (0 = foglia)
+ * @param t Albero
+ * @param livello Livello del nodo
+ * @return Dimensione del nodo
+ */
+static size_t dimensione_nodo(const Albero_ramo* t, int livello) {
+    return livello > 0 ? sizeof(Nodo_ramo) : sizeof(Foglia_ramo) + (size_t)RAMO_VIE * (size_t)t->dimensione;
+}
+
+/**
+ * Costruisce il sottoalbero che contiene gli elementi da primo in poi
+ * @param a Arena
+ * @param t Albero (per dimensione e numero degli elementi)
+ * @param dati Elementi di tutto l'albero
+ * @param livello Livello del nodo da costruire
+ * @param primo Indice del primo elemento del sottoalbero
+ * @param proprietario Proprietario dei nuovi nodi
+ * @return Nodo costruito, NULL se la memoria non basta
+ */
+static void* costruisci_nodo(Arena_rami* a, const Albero_ramo* t, const unsigned char* dati,
+                             int livello, int primo, uint32_t proprietario) {
+    void* nodo = arena_prendi(a, dimensione_nodo(t, livello));
+    int k;
+
+    if (nodo == NULL) {
+        return NULL;
+    }
+    ((Testa_nodo*)nodo)->proprietario = proprietario;
+
+    if (livello == 0) {
+        Foglia_ramo* f = (Foglia_ramo*)nodo;
+        int quanti = t->n - primo < RAMO_VIE ? t->n - primo : RAMO_VIE;
+
+        memset(f->dati, 0, (size_t)RAMO_VIE * (size_t)t->dimensione);
+        memcpy(f->dati, dati + (size_t)primo * (size_t)t->dimensione, (size_t)quanti * (size_t)t->dimensione);
+        return f;
+    }
+
+    for (k = 0; k < RAMO_VIE; k++) {
+        int inizio = primo + (k << (RAMO_BIT_VIE * livello));
+
+        ((Nodo_ramo*)nodo)->figli[k] = NULL;
+        if (inizio < t->n) {
+            ((Nodo_ramo*)nodo)->figli[k] = costruisci_nodo(a, t, dati, livello - 1, inizio, proprietario);
+            if (((Nodo_ramo*)nodo)->figli[k] == NULL) {
+                return NULL;
+            }
+        }
+    }
+    return nodo;
+}
+
+/**
+ * Costruisce un albero con una copia degli elementi dati
+ * @param a Arena
+ * @param t Albero da riempire
+ * @param dati Elementi
+ * @param n Numero di elementi (almeno 1)
+ * @param dimensione Byte di un elemento
+ * @param proprietario Proprietario dei nuovi nodi
+ * @return 1 se riuscito, 0 se la memoria non basta
+ */
+static int costruisci_albero(Arena_rami* a, Albero_ramo* t, const void* dati, int n, int dimensione,
+                             uint32_t proprietario) {
+    t->n          = n;
+    t->dimensione = dimensione;
+    t->profondita = 0;
+    while ((int64_t)1 << (RAMO_BIT_VIE * (t->profondita + 1)) < (int64_t)n) {
+        t->profondita++;
+    }
+    t->radice = costruisci_nodo(a, t, (const unsigned char*)dati, t->profondita, 0, proprietario);
+    return t->radice != NULL;
+}
+
+/**
+ * Legge un elemento dell'albero
+ * @param t Albero
+ * @param i Indice dell'elemento
+ * @return Puntatore all'elemento (da non modificare)
+ */
+static const void* leggi_elemento(const Albero_ramo* t, int i) {
+    const void* nodo = t->radice;
+    int livello;
+
+    for (livello = t->profondita; livello > 0; livello--) {
+        nodo = ((const Nodo_ramo*)nodo)->figli[(i >> (RAMO_BIT_VIE * livello)) & (RAMO_VIE - 1)];
+    }
+    return ((const Foglia_ramo*)nodo)->dati + (size_t)(i & (RAMO_VIE - 1)) * (size_t)t->dimensione;
+}
+
+/**
+ * Rende modificabile un elemento: copia i nodi del cammino che non appartengono al ramo
+ * @param a Arena
+ * @param t Albero del ramo
+ * @param i Indice dell'elemento
+ * @param proprietario Proprietario del ramo
+ * @return Puntatore all'elemento, NULL se la memoria non basta
+ */
+static void* modifica_elemento(Arena_rami* a, Albero_ramo* t, int i, uint32_t proprietario) {
+    void** posto = &t->radice;
+    int livello;
+
+    for (livello = t->profondita; ; livello--) {
+        if (((Testa_nodo*)*posto)->proprietario != proprietario) { // Condiviso con altri rami: copia
+            size_t dimensione = dimensione_nodo(t, livello);
+            void* copia = arena_prendi(a, dimensione);
+
+            if (copia == NULL) {
+                return NULL;
+            }
+            memcpy(copia, *posto, dimensione);
+            ((Testa_nodo*)copia)->proprietario = proprietario;
+            *posto = copia;
+        }
+        if (livello == 0) {
+            return ((Foglia_ramo*)*posto)->dati + (size_t)(i & (RAMO_VIE - 1)) * (size_t)t->dimensione;
+        }
+        posto = &((Nodo_ramo*)*posto)->figli[(i >> (RAMO_BIT_VIE * livello)) & (RAMO_VIE - 1)];
+    }
+}
+
+/* ============================================================================
+ * DADI
+ * ============================================================================ */
+
+/**
+ * Mescola 64 bit con splitmix64: ingressi vicini danno uscite scorrelate, ingressi diversi uscite diverse
+ * @param x Valore da mescolare
+ * @return Valore mescolato
+ */
+static uint64_t mescola(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Stato iniziale dei dadi da un seme
+ * @param x Seme di partenza
+ * @return Stato iniziale non nullo per xorshift64*
+ */
+static uint64_t mescola_seme(uint64_t x) {
+    x = mescola(x);
+    return x != 0 ? x : 1;
+}
+
+/**
+ * Lancia un dado da 20 facce con il generatore del ramo
+ * @param r Ramo
+ * @return Numero casuale tra 1 e 20 (inclusi)
+ */
+static int lancia_dado(Ramo* r) {
+    uint64_t x = r->rng;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    r->rng = x;
+    return (int)((((x * 0x2545F4914F6CDD1DULL) >> 32) * 20) >> 32) + 1;
+}
+
+/* ============================================================================
+ * HASH DI ZOBRIST
+ *
+ * L'hash di un ramo e' lo XOR di una chiave per ogni campo di ogni zona e di
+ * ogni giocatore. Invece di tabelle di chiavi casuali, grandi quanto la mappa,
+ * la chiave si calcola mescolando campo, indice e valore: e' sempre la stessa
+ * per gli stessi tre numeri. Chi modifica un elemento toglie il suo
+ * contributo con apri_* e lo rimette aggiornato con chiudi_*, quindi ogni
+ * azione aggiorna l'hash in O(1). I dadi non entrano nell'hash.
+ * ============================================================================ */
+
+// Campi che contribuiscono all'hash
+typedef enum {
+    CAMPO_TIPO_ZONA,
+    CAMPO_NEMICO_MR,
+    CAMPO_NEMICO_SS,
+    CAMPO_OGGETTO,
+    CAMPO_POSIZIONE,
+    CAMPO_MONDO,
+    CAMPO_VIVO,
+    CAMPO_ATTACCO,
+    CAMPO_DIFESA,
+    CAMPO_FORTUNA,
+    CAMPO_PUNTI_VITA,
+    CAMPO_HP_NEMICO,
+    CAMPO_NEMICO_SCONFITTO,
+    CAMPO_ZAINO                          /* CAMPO_ZAINO + slot */
+} Campo_zobrist;
+
+/**
+ * Chiave di Zobrist di un campo con un certo valore
+ * @param campo Campo_zobrist
+ * @param indice Indice della zona o del giocatore
+ * @param valore Valore del campo (ne contano i 24 bit bassi)
+ * @return Chiave a 64 bit
+ */
+static uint64_t chiave_zobrist(int campo, int indice, int valore) {
+    return mescola(((uint64_t)(unsigned int)campo << 56) ^ ((uint64_t)(unsigned int)indice << 24)
+                   ^ ((uint64_t)(unsigned int)valore & 0xFFFFFFu));
+}
+
+/**
+ * Contributo di una zona all'hash
+ * @param i Indice della zona
+ * @param z Contenuto della zona
+ * @return XOR delle chiavi dei suoi campi
+ */
+static uint64_t hash_zona(int i, const Contenuto_zona* z) {
+    return chiave_zobrist(CAMPO_TIPO_ZONA, i, z->tipo) ^ chiave_zobrist(CAMPO_NEMICO_MR, i, z->nemico_mr)
+         ^ chiave_zobrist(CAMPO_NEMICO_SS, i, z->nemico_ss) ^ chiave_zobrist(CAMPO_OGGETTO, i, z->oggetto);
+}
+
+/**
+ * Contributo di un giocatore all'hash
+ * @param i Indice del giocatore
+ * @param g Stato del giocatore
+ * @param dimensione_zaino Slot dello zaino
+ * @return XOR delle chiavi dei suoi campi
+ */
+static uint64_t hash_giocatore(int i, const Giocatore_ramo* g, int dimensione_zaino) {
+    uint64_t h = chiave_zobrist(CAMPO_POSIZIONE, i, g->posizione) ^ chiave_zobrist(CAMPO_MONDO, i, g->mondo)
+               ^ chiave_zobrist(CAMPO_VIVO, i, g->vivo) ^ chiave_zobrist(CAMPO_ATTACCO, i, g->attacco)
+               ^ chiave_zobrist(CAMPO_DIFESA, i, g->difesa) ^ chiave_zobrist(CAMPO_FORTUNA, i, g->fortuna)
+               ^ chiave_zobrist(CAMPO_PUNTI_VITA, i, g->punti_vita) ^ chiave_zobrist(CAMPO_HP_NEMICO, i, g->hp_nemico)
+               ^ chiave_zobrist(CAMPO_NEMICO_SCONFITTO, i, g->nemico_sconfitto);
+    int slot;
+
+    for (slot = 0; slot < dimensione_zaino; slot++) {
+        if (g->zaino[slot] != NESSUN_OGGETTO) { // Gli slot vuoti non contribuiscono
+            h ^= chiave_zobrist(CAMPO_ZAINO + slot, i, g->zaino[slot]);
+        }
+    }
+    return h;
+}
+
+/**
+ * Rende modificabile una zona e toglie il suo contributo dall'hash
+ * @param a Arena
+ * @param r Ramo
+ * @param i Indice della zona
+ * @return Zona da modificare e poi passare a chiudi_zona, NULL se la memoria non basta
+ */
+static Contenuto_zona* apri_zona(Arena_rami* a, Ramo* r, int i) {
+    Contenuto_zona* z = (Contenuto_zona*)modifica_elemento(a, &r->zone, i, r->proprietario);
+
+    if (z != NULL) {
+        r->hash ^= hash_zona(i, z);
+    }
+    return z;
+}
+
+/**
+ * Rimette nell'hash il contributo di una zona modificata
+ * @param r Ramo
+ * @param i Indice della zona
+ * @param z Zona restituita da apri_zona
+ */
+static void chiudi_zona(Ramo* r, int i, const Contenuto_zona* z) {
+    r->hash ^= hash_zona(i, z);
+}
+
+/**
+ * Rende modificabile un giocatore e toglie il suo contributo dall'hash
+ * @param a Arena
+ * @param r Ramo
+ * @param i Indice del giocatore
+ * @return Giocatore da modificare e poi passare a chiudi_giocatore, NULL se la memoria non basta
+ */
+static Giocatore_ramo* apri_giocatore(Arena_rami* a, Ramo* r, int i) {
+    Giocatore_ramo* g = (Giocatore_ramo*)modifica_elemento(a, &r->giocatori, i, r->proprietario);
+
+    if (g != NULL) {
+        r->hash ^= hash_giocatore(i, g, r->dimensione_zaino);
+    }
+    return g;
+}
+
+/**
+ * Rimette nell'hash il contributo di un giocatore modificato
+ * @param r Ramo
+ * @param i Indice del giocatore
+ * @param g Giocatore restituito da apri_giocatore
+ */
+static void chiudi_giocatore(Ramo* r, int i, const Giocatore_ramo* g) {
+    r->hash ^= hash_giocatore(i, g, r->dimensione_zaino);
+}
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO ALLE REGOLE
+ * ============================================================================ */
+
+/**
+ * Nemico presente nella zona del giocatore, nel suo mondo
+ * @param r Ramo
+ * @param g Giocatore
+ * @return Tipo di nemico
+ */
+static int nemico_del_giocatore(const Ramo* r, const Giocatore_ramo* g) {
+    const Contenuto_zona* z = ramo_zona(r, g->posizione);
+
+    return g->mondo == MONDO_REALE ? z->nemico_mr : z->nemico_ss;
+}
+
+/**
+ * Giocatore che puo' agire, se l'indice e' valido ed e' vivo
+ * @param r Ramo
+ * @param giocatore Indice del giocatore
+ * @return Giocatore, NULL se non puo' agire
+ */
+static const Giocatore_ramo* giocatore_attivo(const Ramo* r, int giocatore) {
+    const Giocatore_ramo* g;
+
+    if (giocatore < 0 || giocatore >= r->giocatori.n) {
+        return NULL;
+    }
+    g = ramo_giocatore(r, giocatore);
+    return g->vivo ? g : NULL;
+}
+
+/**
+ * Sposta il giocatore di una zona nel suo mondo, se nessun nemico lo blocca
+ * Come avanza e indietreggia di gioca, il nemico blocca anche dopo una vittoria che non lo ha dissolto
+ * @param a Arena
+ * @param r Ramo
+ * @param giocatore Indice del giocatore
+ * @param verso +1 per avanzare, -1 per indietreggiare
+ * @return 1 se spostato, 0 se le regole non lo permettono, -1 se la memoria non basta
+ */
+static int sposta(Arena_rami* a, Ramo* r, int giocatore, int verso) {
+    const Giocatore_ramo* g = giocatore_attivo(r, giocatore);
+    Giocatore_ramo* m;
+
+    if (g == NULL || nemico_del_giocatore(r, g) != NESSUN_NEMICO
+        || g->posizione + verso < 0 || g->posizione + verso >= r->zone.n) {
+        return 0;
+    }
+    m = apri_giocatore(a, r, giocatore);
+    if (m == NULL) {
+        return -1;
+    }
+    m->posizione       += verso;
+    m->nemico_sconfitto = 0;
+    chiudi_giocatore(r, giocatore, m);
+    return 1;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: ARENA
+ * ============================================================================ */
+
+Arena_rami* arena_rami_crea(void) {
+    Arena_rami* a = (Arena_rami*)malloc(sizeof(Arena_rami));
+
+    if (a == NULL) {
+        return NULL;
+    }
+    a->primo = (Blocco_arena*)malloc(sizeof(Blocco_arena));
+    if (a->primo == NULL) {
+        free(a);
+        return NULL;
+    }
+    a->primo->succ = NULL;
+    arena_rami_svuota(a);
+    return a;
+}
+
+void arena_rami_distruggi(Arena_rami* a) {
+    Blocco_arena* b;
+
+    if (a == NULL) {
+        return;
+    }
+    b = a->primo;
+    while (b != NULL) {
+        Blocco_arena* succ = b->succ;
+        free(b);
+        b = succ;
+    }
+    free(a);
+}
+
+void arena_rami_svuota(Arena_rami* a) {
+    a->corrente              = a->primo;
+    a->corrente->usati       = 0;
+    a->prossimo_proprietario = 1;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: RAMI
+ * ============================================================================ */
+
+Ramo* ramo_crea(Arena_rami* a, const Contenuto_zona* zone, int n, const Giocatore_ramo* g,
+                int num_giocatori, int dimensione_zaino, uint64_t seme) {
+    Ramo* r;
+    int i;
+
+    if (n < 1 || num_giocatori < 1 || dimensione_zaino < 1 || dimensione_zaino > ZAINO_SLOT_MAX) {
+        return NULL;
+    }
+    r = (Ramo*)arena_prendi(a, sizeof(Ramo));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->proprietario     = nuovo_proprietario(a);
+    r->rng              = mescola_seme(seme);
+    r->dimensione_zaino = dimensione_zaino;
+    if (!costruisci_albero(a, &r->zone, zone, n, (int)sizeof(Contenuto_zona), r->proprietario)
+        || !costruisci_albero(a, &r->giocatori, g, num_giocatori, (int)sizeof(Giocatore_ramo), r->proprietario)) {
+        return NULL;
+    }
+
+    r->hash = 0;
+    for (i = 0; i < n; i++) {
+        r->hash ^= hash_zona(i, &zone[i]);
+    }
+    for (i = 0; i < num_giocatori; i++) {
+        r->hash ^= hash_giocatore(i, &g[i], dimensione_zaino);
+    }
+    return r;
+}
+
+Ramo* ramo_dividi(Arena_rami* a, Ramo* r) {
+    Ramo* variante = (Ramo*)arena_prendi(a, sizeof(Ramo));
+
+    if (variante == NULL) {
+        return NULL;
+    }
+    *variante = *r;
+
+    /* Nessuno dei due possiede piu' i nodi attuali: chi li modifica per primo se li copia */
+    r->proprietario        = nuovo_proprietario(a);
+    variante->proprietario = nuovo_proprietario(a);
+    return variante;
+}
+
+void ramo_imposta_seme(Ramo* r, uint64_t seme) {
+    r->rng = mescola_seme(seme);
+}
+
+const Contenuto_zona* ramo_zona(const Ramo* r, int i) {
+    return (const Contenuto_zona*)leggi_elemento(&r->zone, i);
+}
+
+const Giocatore_ramo* ramo_giocatore(const Ramo* r, int i) {
+    return (const Giocatore_ramo*)leggi_elemento(&r->giocatori, i);
+}
+
+int ramo_scrivi_zona(Arena_rami* a, Ramo* r, int i, const Contenuto_zona* z) {
+    Contenuto_zona* m = apri_zona(a, r, i);
+
+    if (m == NULL) {
+        return -1;
+    }
+    *m = *z;
+    chiudi_zona(r, i, m);
+    return 1;
+}
+
+int ramo_scrivi_giocatore(Arena_rami* a, Ramo* r, int i, const Giocatore_ramo* g) {
+    Giocatore_ramo* m = apri_giocatore(a, r, i);
+
+    if (m == NULL) {
+        return -1;
+    }
+    *m = *g;
+    chiudi_giocatore(r, i, m);
+    return 1;
+}
+
+uint64_t ramo_hash(const Ramo* r) {
+    return r->hash;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: REGOLE
+ * ============================================================================ */
+
+int ramo_avanza(Arena_rami* a, Ramo* r, int giocatore) {
+    return sposta(a, r, giocatore, 1);
+}
+
+int ramo_indietreggia(Arena_rami* a, Ramo* r, int giocatore) {
+    return sposta(a, r, giocatore, -1);
+}
+
+int ramo_cambia_mondo(Arena_rami* a, Ramo* r, int giocatore) {
+    const Giocatore_ramo* g = giocatore_attivo(r, giocatore);
+    Giocatore_ramo* m;
+
+    if (g == NULL) {
+        return 0;
+    }
+    if (g->mondo == MONDO_REALE && nemico_del_giocatore(r, g) != NESSUN_NEMICO && !g->nemico_sconfitto) {
+        return 0;
+    }
+    if (g->mondo == SOPRASOTTO && lancia_dado(r) >= g->fortuna) { // Tiro di fortuna fallito
+        return 0;
+    }
+    m = apri_giocatore(a, r, giocatore);
+    if (m == NULL) {
+        return -1;
+    }
+    m->mondo            = m->mondo == MONDO_REALE ? SOPRASOTTO : MONDO_REALE;
+    m->nemico_sconfitto = 0;
+    chiudi_giocatore(r, giocatore, m);
+    return 1;
+}
+
+int ramo_raccogli(Arena_rami* a, Ramo* r, int giocatore) {
+    const Giocatore_ramo* g = giocatore_attivo(r, giocatore);
+    const Contenuto_zona* z;
+    Giocatore_ramo* m;
+    Contenuto_zona* mz;
+    int slot;
+    int i;
+
+    if (g == NULL || g->mondo != MONDO_REALE) {
+        return 0;
+    }
+    z = ramo_zona(r, g->posizione);
+    if (z->nemico_mr != NESSUN_NEMICO || z->oggetto == NESSUN_OGGETTO) {
+        return 0;
+    }
+    for (slot = 0; slot < r->dimensione_zaino && g->zaino[slot] != NESSUN_OGGETTO; slot++) {
+    }
+    if (slot == r->dimensione_zaino) { // Zaino pieno
+        return 0;
+    }
+
+    i  = g->posizione;
+    mz = apri_zona(a, r, i);
+    if (mz == NULL) {
+        return -1;
+    }
+    m = apri_giocatore(a, r, giocatore);
+    if (m == NULL) {
+        chiudi_zona(r, i, mz);
+        return -1;
+    }
+    m->zaino[slot] = mz->oggetto;
+    mz->oggetto    = NESSUN_OGGETTO;
+    chiudi_giocatore(r, giocatore, m);
+    chiudi_zona(r, i, mz);
+    return 1;
+}
+
+int ramo_combatti(Arena_rami* a, Ramo* r, int giocatore, int scelta) {
+    const Giocatore_ramo* g = giocatore_attivo(r, giocatore);
+    const Statistiche_nemico* s;
+    Giocatore_ramo* m;
+    Contenuto_zona* z;
+    int nemico;
+    int attacco;
+    int difesa;
+    int danno;
+    int esito = 0;
+
+    if (g == NULL || (nemico = nemico_del_giocatore(r, g)) == NESSUN_NEMICO
+        || scelta < 1 || scelta > 3 || (scelta == 2 && g->punti_vita <= COSTO_ATTACCO_POTENZIATO)) {
+        return -2;
+    }
+
+    /* La zona si apre prima dei dadi: se la memoria non basta il ramo resta com'era */
+    z = apri_zona(a, r, g->posizione);
+    if (z == NULL) {
+        return -2;
+    }
+    m = apri_giocatore(a, r, giocatore);
+    if (m == NULL) {
+        chiudi_zona(r, g->posizione, z);
+        return -2;
+    }
+    s = registro_nemico(nemico);
+    if (m->hp_nemico <= 0) { // Primo round contro questo nemico
+        m->hp_nemico = s->hp;
+    }
+
+    /* Turno del giocatore, come in round_combattimento */
+    attacco = m->attacco;
+    difesa  = m->difesa;
+    if (scelta == 2) {
+        m->punti_vita = (int16_t)(m->punti_vita - COSTO_ATTACCO_POTENZIATO);
+        attacco = (int)((double)attacco * MOLTIPLICATORE_POTENZIATO);
+    }
+    if (scelta == 3) {
+        difesa += BONUS_DIFESA_TEMPORANEO;
+    } else {
+        danno = attacco + lancia_dado(r);
+        danno -= s->difesa + lancia_dado(r);
+        if (danno > 0) {
+            m->hp_nemico = (int16_t)(m->hp_nemico - danno);
+        }
+    }
+
+    if (m->hp_nemico <= 0) {
+        m->hp_nemico = 0;
+        esito = s->finale ? 2 : 1;
+        if (lancia_dado(r) <= 10) { // Il nemico sparisce dalla zona una volta su due
+            if (m->mondo == MONDO_REALE) {
+                z->nemico_mr = NESSUN_NEMICO;
+            } else {
+                z->nemico_ss = NESSUN_NEMICO;
+            }
+        } else { // Resta nella zona, ma il vincitore puo' attraversare il portale
+            m->nemico_sconfitto = 1;
+        }
+    } else {
+        /* Contrattacco del nemico */
+        danno = s->attacco + lancia_dado(r);
+        danno -= difesa + lancia_dado(r);
+        if (danno > 0) {
+            m->punti_vita = (int16_t)(m->punti_vita - danno);
+        }
+        if (m->punti_vita <= 0) {
+            m->vivo      = 0;
+            m->hp_nemico = 0;
+            esito = -1;
+        }
+    }
+    chiudi_giocatore(r, giocatore, m);
+    chiudi_zona(r, m->posizione, z);
+    return esito;
+}
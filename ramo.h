@@ -0,0 +1,145 @@
+#ifndef RAMO_H
+#define RAMO_H
+
+#include <stdint.h>
+#include "registro.h"
+
+/* ============================================================================
+ * STATO DI GIOCO RAMIFICABILE
+ *
+ * Per bot e strumenti di analisi che esplorano molte varianti di una partita
+ * ("e se qui attraversassi il portale?"). Zone e giocatori stanno in alberi
+ * persistenti a 16 vie: un ramo e' una piccola testa con le radici dei due
+ * alberi e lo stato del generatore casuale, quindi ramo_dividi costa O(1)
+ * qualunque sia la dimensione della mappa. Una modifica copia solo i nodi
+ * sul cammino dalla radice alla zona o al giocatore toccato; i nodi che un
+ * ramo ha gia' copiato per se' vengono modificati sul posto.
+ *
+ * Tutti i rami e i nodi di una ricerca vengono da un'Arena_rami e si
+ * liberano insieme svuotandola o distruggendola.
+ *
+ * Ogni ramo tiene anche l'hash di Zobrist del suo stato, aggiornato da ogni
+ * modifica, per riconoscere le posizioni gia' viste (trasposizioni.h).
+ * ============================================================================ */
+
+/* Figli di ogni nodo e elementi di ogni foglia degli alberi */
+#define RAMO_BIT_VIE   4
+#define RAMO_VIE       (1 << RAMO_BIT_VIE)
+
+/* Byte di ogni blocco dell'arena */
+#define ARENA_RAMI_BLOCCO  (64 * 1024)
+
+// Stato di un giocatore in un ramo: la posizione e' l'indice della zona nel suo mondo
+typedef struct {
+    int32_t posizione;
+    uint8_t mondo;                       /* Tipo_mondo */
+    uint8_t vivo;
+    uint8_t nemico_sconfitto;            /* Ha vinto contro il nemico rimasto nella zona: puo' attraversare il portale */
+    int16_t attacco;
+    int16_t difesa;
+    int16_t fortuna;
+    int16_t punti_vita;
+    int16_t hp_nemico;                   /* PV del nemico che sta combattendo, 0 fuori dal combattimento */
+    uint8_t zaino[ZAINO_SLOT_MAX];       /* Oggetto in ogni slot, NESSUN_OGGETTO se vuoto */
+} Giocatore_ramo;
+
+// Albero persistente di elementi di dimensione fissa
+typedef struct {
+    void* radice;
+    int profondita;                      /* Livelli di nodi interni sopra le foglie */
+    int n;
+    int dimensione;                      /* Byte di un elemento */
+} Albero_ramo;
+
+// Una variante della partita; i campi si leggono, le modifiche passano dalle funzioni
+struct Ramo {
+    uint32_t proprietario;               /* Chi puo' modificare sul posto i nodi che portano questo numero */
+    uint64_t rng;                        /* Stato del generatore xorshift64* dei dadi del ramo */
+    uint64_t hash;                       /* Hash di Zobrist di zone e giocatori (non dei dadi) */
+    Albero_ramo zone;                    /* Contenuto_zona, con il nemico finale gia' in nemico_ss */
+    Albero_ramo giocatori;               /* Giocatore_ramo */
+    int dimensione_zaino;
+};
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: ARENA
+ * ============================================================================ */
+
+//crea un'arena vuota, NULL se la memoria non basta
+Arena_rami* arena_rami_crea(void);
+
+//libera l'arena con tutti i suoi rami
+void arena_rami_distruggi(Arena_rami* a);
+
+//invalida tutti i rami dell'arena in un colpo solo, tenendo la memoria per i prossimi
+void arena_rami_svuota(Arena_rami* a);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: RAMI
+ * ============================================================================ */
+
+//crea un ramo con una copia delle n zone e dei num_giocatori giocatori dati e i dadi dal seme dato;
+//NULL se la memoria non basta
+Ramo* ramo_crea(Arena_rami* a, const Contenuto_zona* zone, int n, const Giocatore_ramo* g,
+                int num_giocatori, int dimensione_zaino, uint64_t seme);
+
+//crea una variante del ramo in O(1); i due rami poi cambiano in modo indipendente e tirano
+//gli stessi dadi finche' uno dei due non cambia seme. NULL se la memoria non basta
+Ramo* ramo_dividi(Arena_rami* a, Ramo* r);
+
+//riparte i dadi del ramo dal seme dato
+void ramo_imposta_seme(Ramo* r, uint64_t seme);
+
+//contenuto della zona i (nel Soprasotto il nemico e' nemico_ss)
+const Contenuto_zona* ramo_zona(const Ramo* r, int i);
+
+//stato del giocatore i
+const Giocatore_ramo* ramo_giocatore(const Ramo* r, int i);
+
+//sostituisce la zona i, copiando i nodi condivisi con altri rami e aggiornando l'hash;
+//1 se riuscito, -1 se la memoria non basta
+int ramo_scrivi_zona(Arena_rami* a, Ramo* r, int i, const Contenuto_zona* z);
+
+//sostituisce il giocatore i, copiando i nodi condivisi con altri rami e aggiornando l'hash;
+//1 se riuscito, -1 se la memoria non basta
+int ramo_scrivi_giocatore(Arena_rami* a, Ramo* r, int i, const Giocatore_ramo* g);
+
+//hash di Zobrist del ramo: due rami con le stesse zone e gli stessi giocatori hanno lo stesso hash
+//qualunque sia la strada per arrivarci (i dadi non contano)
+uint64_t ramo_hash(const Ramo* r);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE: REGOLE
+ *
+ * Le stesse di gioca(): restituiscono 1 se l'azione e' stata eseguita, 0 se
+ * le regole non la permettono (nemico presente, fine del percorso, zaino
+ * pieno...) e -1 se manca la memoria per copiare i nodi. Come in gioca, un
+ * nemico nella zona blocca avanti, indietro e raccolta anche dopo averlo
+ * battuto, mentre il portale dal Mondo Reale si apre solo a chi lo ha
+ * battuto (nemico_sconfitto, che si azzera cambiando zona).
+ *
+ * Un ramo non ha turni, quindi restano fuori le regole legate al turno: una
+ * sola mossa per turno, il turno che finisce entrando in una zona con un
+ * nemico e il divieto di combattere subito dopo. Anche l'uso degli oggetti
+ * dello zaino non e' simulato.
+ * ============================================================================ */
+
+//avanza alla zona successiva del mondo corrente
+int ramo_avanza(Arena_rami* a, Ramo* r, int giocatore);
+
+//torna alla zona precedente del mondo corrente
+int ramo_indietreggia(Arena_rami* a, Ramo* r, int giocatore);
+
+//attraversa il portale (dal Soprasotto serve un tiro di fortuna: se fallisce restituisce 0);
+//dal Mondo Reale un nemico nella zona lo impedisce, se il giocatore non lo ha appena battuto
+int ramo_cambia_mondo(Arena_rami* a, Ramo* r, int giocatore);
+
+//raccoglie l'oggetto della zona del Mondo Reale nel primo slot libero
+int ramo_raccogli(Arena_rami* a, Ramo* r, int giocatore);
+
+//esegue un round di combattimento contro il nemico della zona (scelta 1-3 come nel menu):
+//0 se il combattimento continua, 1 nemico sconfitto, 2 nemico finale sconfitto, -1 giocatore morto,
+//-2 se non c'e' nessun nemico, la scelta non e' valida o manca la memoria (il ramo resta com'era)
+int ramo_combatti(Arena_rami* a, Ramo* r, int giocatore, int scelta);
+
+#endif
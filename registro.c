@@ -0,0 +1,696 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alias.h"
+#include "registro.h"
+
+#define RIGA_MAX     512
+
+#define TESTO(x)  #x
+#define NUMERO(x) TESTO(x)
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+_Static_assert(NEMICI_MAX <= ALIAS_MAX && OGGETTI_MAX <= ALIAS_MAX && TIPI_ZONA <= ALIAS_MAX,
+               "le tabelle alias devono contenere tutti i tipi del registro");
+
+// Registro completo: le statistiche usate in combattimento e gli effetti degli
+// oggetti stanno in array compatti a parte, nomi e testi servono solo per le stampe
+typedef struct {
+    Statistiche_nemico statistiche[NEMICI_MAX];
+    uint16_t peso[2][NEMICI_MAX];        /* Peso di comparsa per mondo; indice 0 = nessun nemico */
+    uint16_t messaggio[NEMICI_MAX][MSG_NEMICO_NUM]; /* Posizione in testi + 1, 0 = nessun testo */
+    char nome[NEMICI_MAX][NOME_NEMICO_MAX];
+    int num_nemici;
+    Tabella_alias alias[2];              /* Una per mondo, ricostruite a ogni caricamento */
+
+    Effetto_oggetto effetto[OGGETTI_MAX];
+    uint16_t peso_oggetto[OGGETTI_MAX];  /* Indice 0 = nessun oggetto */
+    uint16_t messaggio_oggetto[OGGETTI_MAX];
+    char nome_oggetto[OGGETTI_MAX][NOME_OGGETTO_MAX];
+    int num_oggetti;
+    Tabella_alias alias_oggetti;
+    int dimensione_zaino;
+
+    uint16_t peso_zona[TIPI_ZONA];       /* Nell'ordine di Tipo_zona */
+    Tabella_alias alias_zone;
+
+    Obiettivi_mappa obiettivi;
+    int con_obiettivi;                   /* 1 se il file contiene la voce "mappa" */
+
+    size_t lunghezza_testi;
+    char testi[TESTI_REGISTRO_MAX];
+} Registro;
+
+// Stato della lettura di un file, per unire le righe di testo consecutive
+typedef struct {
+    uint16_t* ultimo_messaggio;          /* Messaggio dell'ultima riga di testo, NULL dopo altre voci */
+    int riga;
+} Lettura;
+
+static Registro registro;
+static int registro_pronto = 0;
+
+/* Valori predefiniti, nello stesso formato del file di configurazione */
+static const char configurazione_predefinita[] =
+    "nessuno " NUMERO(PROB_NESSUN_NEMICO_MR) " " NUMERO(PROB_NESSUN_NEMICO_SS) "\n"
+    "nemico Billi " NUMERO(HP_BILLI) " " NUMERO(ATTACCO_BILLI) " " NUMERO(DIFESA_BILLI) " 30 0\n"
+    "nemico Democane " NUMERO(HP_DEMOCANE) " " NUMERO(ATTACCO_DEMOCANE) " " NUMERO(DIFESA_DEMOCANE)
+        " " NUMERO(PROB_DEMOCANE_MR) " 50\n"
+    "nemico Demotorzone " NUMERO(HP_DEMOTORZONE) " " NUMERO(ATTACCO_DEMOTORZONE) " " NUMERO(DIFESA_DEMOTORZONE)
+        " 0 0 finale\n"
+    "testo Billi zona_mr Una presenza inquietante si muove nell'ombra...\n"
+    "testo Billi zona_mr E' Billi! Un ragazzo ribelle e violento che e' stato posseduto.\n"
+    "testo Billi zona_mr Ti blocca il passaggio con uno sguardo vuoto e minaccioso!\n"
+    "testo Billi combattimento Billi ti fissa con occhi vuoti e minacciosi.\n"
+    "testo Billi combattimento Le sue mani tremano, posseduto da una forza oscura.\n"
+    "testo Billi combattimento Non hai scelta. Devi combattere per sopravvivere!\n"
+    "testo Democane zona_mr Un ringhio sordo risuona nell'aria gelida...\n"
+    "testo Democane zona_mr Un Democane emerge dall'oscurita', mostrando i denti!\n"
+    "testo Democane zona_mr Le sue zanne brillano nella penombra.\n"
+    "testo Democane zona_ss Un ululato spettrale echeggia nelle tenebre...\n"
+    "testo Democane zona_ss Un Democane del Soprasotto ti ha trovato!\n"
+    "testo Democane zona_ss E' ancora piu' mostruoso della sua controparte reale!\n"
+    "testo Democane combattimento Il Democane ringhia e si prepara ad attaccare!\n"
+    "testo Democane combattimento Le sue fauci sbavano. La tensione e' palpabile.\n"
+    "testo Democane combattimento Preparati a difenderti!\n"
+    "testo Demotorzone zona_mr L'aria diventa elettrica, i capelli si rizzano...\n"
+    "testo Demotorzone zona_mr IL DEMOTORZONE! La creatura piu' temibile di tutte!\n"
+    "testo Demotorzone zona_mr Ma aspetta... non dovrebbe essere qui!\n"
+    "testo Demotorzone zona_ss ****************************************************\n"
+    "testo Demotorzone zona_ss *                                                  *\n"
+    "testo Demotorzone zona_ss *   Una forza elettrica riempie l'aria!            *\n"
+    "testo Demotorzone zona_ss *   IL DEMOTORZONE SI ERGE DAVANTI A TE!           *\n"
+    "testo Demotorzone zona_ss *   Questa e' la tua unica possibilita' di         *\n"
+    "testo Demotorzone zona_ss *   salvare Occhinz!                               *\n"
+    "testo Demotorzone zona_ss *                                                  *\n"
+    "testo Demotorzone zona_ss ****************************************************\n"
+    "testo Demotorzone combattimento ****************************************************\n"
+    "testo Demotorzone combattimento *                                                  *\n"
+    "testo Demotorzone combattimento *        IL DEMOTORZONE TI HA TROVATO!             *\n"
+    "testo Demotorzone combattimento *                                                  *\n"
+    "testo Demotorzone combattimento *   Scintille elettriche crepitano nell'aria!      *\n"
+    "testo Demotorzone combattimento *   Questa e' la battaglia finale!                 *\n"
+    "testo Demotorzone combattimento *   SCONFIGGILO PER SALVARE OCCHINZ!               *\n"
+    "testo Demotorzone combattimento *                                                  *\n"
+    "testo Demotorzone combattimento ****************************************************\n"
+    "nessun_oggetto " NUMERO(PROB_NESSUN_OGGETTO) "\n"
+    "oggetto Bicicletta " NUMERO(PROB_BICICLETTA) " 0 0 " NUMERO(BONUS_BICICLETTA_FORTUNA) " 0 cumulabile\n"
+    "oggetto Maglietta_Fuocoinferno " NUMERO(PROB_MAGLIETTA) " " NUMERO(BONUS_MAGLIETTA_ATTACCO) " 0 0 0 cumulabile\n"
+    "oggetto Bussola " NUMERO(PROB_BUSSOLA) " 0 0 " NUMERO(BONUS_BUSSOLA_FORTUNA) " 0 cumulabile\n"
+    "oggetto Schitarrata_Metallica 10 " NUMERO(BONUS_SCHITARRATA_ATTACCO) " " NUMERO(BONUS_SCHITARRATA_DIFESA)
+        " 0 0 cumulabile\n"
+    "uso Bicicletta Usi la Bicicletta!\n"
+    "uso Bicicletta Pedalare ti fa sentire piu' fortunato e fiducioso.\n"
+    "uso Maglietta_Fuocoinferno Indossi la Maglietta Fuocoinferno!\n"
+    "uso Maglietta_Fuocoinferno Senti il potere del fuoco scorrere in te!\n"
+    "uso Bussola Usi la Bussola!\n"
+    "uso Bussola Ti orienti meglio, trovando la via giusta.\n"
+    "uso Bussola La tua intuizione migliora.\n"
+    "uso Schitarrata_Metallica Suoni una Schitarrata Metallica!\n"
+    "uso Schitarrata_Metallica La musica ti da' forza e coraggio!\n"
+    "zaino " NUMERO(ZAINO_MAX) "\n";
+
+/* ============================================================================
+ * LETTURA DELLA CONFIGURAZIONE
+ * ============================================================================ */
+
+/**
+ * Legge la prossima parola della riga, separata da spazi
+ * @param cursore Posizione corrente, avanzata oltre la parola
+ * @return Inizio della parola (terminata con '\0'), NULL se la riga e' finita
+ */
+static char* prossima_parola(char** cursore) {
+    char* inizio = *cursore;
+    char* fine;
+
+    while (*inizio != '\0' && isspace((unsigned char)*inizio)) {
+        inizio++;
+    }
+    if (*inizio == '\0') {
+        *cursore = inizio;
+        return NULL;
+    }
+
+    fine = inizio;
+    while (*fine != '\0' && !isspace((unsigned char)*fine)) {
+        fine++;
+    }
+    if (*fine != '\0') {
+        *fine++ = '\0';
+    }
+    *cursore = fine;
+    return inizio;
+}
+
+/**
+ * Legge un intero in un intervallo
+ * @param parola Testo da convertire
+ * @param minimo Valore minimo ammesso
+ * @param massimo Valore massimo ammesso
+ * @param valore Riceve il numero letto
+ * @return 1 se valido, 0 altrimenti
+ */
+static int leggi_numero(const char* parola, long minimo, long massimo, long* valore) {
+    char* fine;
+
+    if (parola == NULL) {
+        return 0;
+    }
+    errno  = 0;
+    *valore = strtol(parola, &fine, 10);
+    return errno == 0 && *fine == '\0' && *valore >= minimo && *valore <= massimo;
+}
+
+/**
+ * Copia un nome dal file; nei nomi del file '_' sta per uno spazio
+ * @param nome Riceve il nome leggibile
+ * @param dimensione Dimensione di nome
+ * @param parola Nome come scritto nel file
+ */
+static void copia_nome(char* nome, size_t dimensione, const char* parola) {
+    size_t i;
+
+    strncpy(nome, parola, dimensione - 1);
+    nome[dimensione - 1] = '\0';
+    for (i = 0; nome[i] != '\0'; i++) {
+        if (nome[i] == '_') {
+            nome[i] = ' ';
+        }
+    }
+}
+
+/**
+ * Cerca un nemico per nome
+ * @param r Registro
+ * @param parola Nome come scritto nel file
+ * @return Indice del nemico, -1 se non esiste
+ */
+static int cerca_nemico(const Registro* r, const char* parola) {
+    char nome[NOME_NEMICO_MAX];
+    int i;
+
+    copia_nome(nome, sizeof(nome), parola);
+    for (i = 1; i < r->num_nemici; i++) {
+        if (strcmp(r->nome[i], nome) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Cerca un oggetto per nome
+ * @param r Registro
+ * @param parola Nome come scritto nel file
+ * @return Indice dell'oggetto, -1 se non esiste
+ */
+static int cerca_oggetto(const Registro* r, const char* parola) {
+    char nome[NOME_OGGETTO_MAX];
+    int i;
+
+    copia_nome(nome, sizeof(nome), parola);
+    for (i = 1; i < r->num_oggetti; i++) {
+        if (strcmp(r->nome_oggetto[i], nome) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Aggiunge una riga a un messaggio, unendola se la riga precedente era dello stesso messaggio
+ * @param r Registro
+ * @param l Stato della lettura
+ * @param messaggio Posizione del messaggio nel registro (nemico e momento, o oggetto)
+ * @param testo Riga da aggiungere (senza a capo)
+ * @return 1 se riuscito, 0 se lo spazio per i testi e' finito
+ */
+static int aggiungi_testo(Registro* r, Lettura* l, uint16_t* messaggio, const char* testo) {
+    size_t len = strlen(testo);
+
+    if (l->ultimo_messaggio == messaggio) {
+        r->lunghezza_testi--; // Riapre il messaggio precedente togliendo il terminatore
+    } else {
+        *messaggio = (uint16_t)(r->lunghezza_testi + 1);
+    }
+
+    if (r->lunghezza_testi + len + 2 > TESTI_REGISTRO_MAX) {
+        return 0;
+    }
+    memcpy(r->testi + r->lunghezza_testi, testo, len);
+    r->lunghezza_testi += len;
+    r->testi[r->lunghezza_testi++] = '\n';
+    r->testi[r->lunghezza_testi++] = '\0';
+
+    l->ultimo_messaggio = messaggio;
+    return 1;
+}
+
+/**
+ * Interpreta una riga della configurazione
+ * @param r Registro in costruzione
+ * @param l Stato della lettura
+ * @param riga Riga da interpretare (viene modificata)
+ * @return Messaggio d'errore, NULL se la riga e' valida
+ */
+static const char* analizza_riga(Registro* r, Lettura* l, char* riga) {
+    char* cursore = riga;
+    char* comando;
+    long valori[5];
+    int i;
+
+    riga[strcspn(riga, "\r\n")] = '\0';
+    if (riga[strspn(riga, " \t")] == '#') {
+        return NULL;
+    }
+
+    comando = prossima_parola(&cursore);
+    if (comando == NULL) {
+        return NULL;
+    }
+    if (strcmp(comando, "testo") != 0 && strcmp(comando, "uso") != 0) {
+        l->ultimo_messaggio = NULL; // Le altre voci interrompono un messaggio su piu' righe
+    }
+
+    if (strcmp(comando, "nessuno") == 0) {
+        if (!leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[0]) ||
+            !leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[1])) {
+            return "pesi non validi";
+        }
+        r->peso[MONDO_REALE][0] = (uint16_t)valori[0];
+        r->peso[SOPRASOTTO][0]  = (uint16_t)valori[1];
+        return NULL;
+    }
+
+    if (strcmp(comando, "nemico") == 0) {
+        char* nome = prossima_parola(&cursore);
+        char* opzione;
+        Statistiche_nemico* s;
+        int n = r->num_nemici;
+
+        if (nome == NULL || strlen(nome) >= NOME_NEMICO_MAX) {
+            return "nome mancante o troppo lungo";
+        }
+        if (cerca_nemico(r, nome) >= 0) {
+            return "nemico gia' definito";
+        }
+        if (n >= NEMICI_MAX) {
+            return "troppi nemici";
+        }
+        if (!leggi_numero(prossima_parola(&cursore), 1, 32767, &valori[0]) ||
+            !leggi_numero(prossima_parola(&cursore), 0, 32767, &valori[1]) ||
+            !leggi_numero(prossima_parola(&cursore), 0, 32767, &valori[2])) {
+            return "statistiche non valide (hp attacco difesa)";
+        }
+        if (!leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[3]) ||
+            !leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[4])) {
+            return "pesi non validi (peso_mr peso_ss)";
+        }
+
+        s = &r->statistiche[n];
+        s->hp      = (int16_t)valori[0];
+        s->attacco = (int16_t)valori[1];
+        s->difesa  = (int16_t)valori[2];
+        s->finale  = 0;
+        r->peso[MONDO_REALE][n] = (uint16_t)valori[3];
+        r->peso[SOPRASOTTO][n]  = (uint16_t)valori[4];
+
+        opzione = prossima_parola(&cursore);
+        if (opzione != NULL) {
+            if (strcmp(opzione, "finale") != 0) {
+                return "opzione sconosciuta (atteso 'finale')";
+            }
+            s->finale = 1; // I nemici finali si piazzano, non si estraggono
+            r->peso[MONDO_REALE][n] = 0;
+            r->peso[SOPRASOTTO][n]  = 0;
+        }
+
+        copia_nome(r->nome[n], NOME_NEMICO_MAX, nome);
+        r->num_nemici++;
+        return NULL;
+    }
+
+    if (strcmp(comando, "testo") == 0) {
+        char* nome    = prossima_parola(&cursore);
+        char* momento = prossima_parola(&cursore);
+        int nemico;
+        int m;
+
+        nemico = nome != NULL ? cerca_nemico(r, nome) : -1;
+        if (nemico < 0) {
+            return "testo per un nemico non definito";
+        }
+        if (momento != NULL && strcmp(momento, "zona_mr") == 0) {
+            m = MSG_NEMICO_ZONA_MR;
+        } else if (momento != NULL && strcmp(momento, "zona_ss") == 0) {
+            m = MSG_NEMICO_ZONA_SS;
+        } else if (momento != NULL && strcmp(momento, "combattimento") == 0) {
+            m = MSG_NEMICO_COMBATTIMENTO;
+        } else {
+            return "momento non valido (zona_mr, zona_ss o combattimento)";
+        }
+        if (*cursore == ' ' || *cursore == '\t') { // Un solo separatore: gli spazi successivi fanno parte del testo
+            cursore++;
+        }
+        if (!aggiungi_testo(r, l, &r->messaggio[nemico][m], cursore)) {
+            return "spazio per i testi esaurito";
+        }
+        return NULL;
+    }
+
+    if (strcmp(comando, "nessun_oggetto") == 0) {
+        if (!leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[0])) {
+            return "peso non valido";
+        }
+        r->peso_oggetto[0] = (uint16_t)valori[0];
+        return NULL;
+    }
+
+    if (strcmp(comando, "oggetto") == 0) {
+        char* nome = prossima_parola(&cursore);
+        char* opzione;
+        Effetto_oggetto* e;
+        int n = r->num_oggetti;
+
+        if (nome == NULL || strlen(nome) >= NOME_OGGETTO_MAX) {
+            return "nome mancante o troppo lungo";
+        }
+        if (cerca_oggetto(r, nome) >= 0) {
+            return "oggetto gia' definito";
+        }
+        if (n >= OGGETTI_MAX) {
+            return "troppi oggetti";
+        }
+        if (!leggi_numero(prossima_parola(&cursore), 0, 65535, &valori[0])) {
+            return "peso non valido";
+        }
+        for (i = 1; i <= 4; i++) {
+            if (!leggi_numero(prossima_parola(&cursore), -100, 100, &valori[i])) {
+                return "effetto non valido (attacco difesa fortuna punti_vita, tra -100 e 100)";
+            }
+        }
+
+        e = &r->effetto[n];
+        r->peso_oggetto[n] = (uint16_t)valori[0];
+        e->attacco    = (int8_t)valori[1];
+        e->difesa     = (int8_t)valori[2];
+        e->fortuna    = (int8_t)valori[3];
+        e->punti_vita = (int8_t)valori[4];
+        e->temporaneo = 0;
+        e->cumulabile = 0;
+
+        while ((opzione = prossima_parola(&cursore)) != NULL) {
+            if (strcmp(opzione, "temporaneo") == 0) {
+                e->temporaneo = 1;
+            } else if (strcmp(opzione, "cumulabile") == 0) {
+                e->cumulabile = 1;
+            } else {
+                return "opzione sconosciuta (attesi 'temporaneo' o 'cumulabile')";
+            }
+        }
+
+        copia_nome(r->nome_oggetto[n], NOME_OGGETTO_MAX, nome);
+        r->num_oggetti++;
+        return NULL;
+    }
+
+    if (strcmp(comando, "uso") == 0) {
+        char* nome = prossima_parola(&cursore);
+        int oggetto;
+
+        oggetto = nome != NULL ? cerca_oggetto(r, nome) : -1;
+        if (oggetto < 0) {
+            return "testo per un oggetto non definito";
+        }
+        if (*cursore == ' ' || *cursore == '\t') {
+            cursore++;
+        }
+        if (!aggiungi_testo(r, l, &r->messaggio_oggetto[oggetto], cursore)) {
+            return "spazio per i testi esaurito";
+        }
+        return NULL;
+    }
+
+    if (strcmp(comando, "zone") == 0) {
+        long peso;
+
+        for (i = 0; i < TIPI_ZONA; i++) {
+            if (!leggi_numero(prossima_parola(&cursore), 0, 65535, &peso)) {
+                return "pesi delle zone non validi (uno per tipo di zona)";
+            }
+            r->peso_zona[i] = (uint16_t)peso;
+        }
+        return NULL;
+    }
+
+    if (strcmp(comando, "mappa") == 0) {
+        if (!leggi_numero(prossima_parola(&cursore), 0, 32767, &valori[0]) ||
+            !leggi_numero(prossima_parola(&cursore), 0, 32767, &valori[1])) {
+            return "perdita di PV non valida (pv_persi tolleranza)";
+        }
+        if (!leggi_numero(prossima_parola(&cursore), 0, 100, &valori[2])) {
+            return "densita' degli oggetti non valida (percentuale tra 0 e 100)";
+        }
+        if (!leggi_numero(prossima_parola(&cursore), 0, 32767, &valori[3])) {
+            return "numero massimo di nemici consecutivi non valido";
+        }
+        r->obiettivi.pv_persi           = (int)valori[0];
+        r->obiettivi.tolleranza         = (int)valori[1];
+        r->obiettivi.densita_oggetti    = (int)valori[2];
+        r->obiettivi.nemici_consecutivi = (int)valori[3];
+        r->con_obiettivi = 1;
+        return NULL;
+    }
+
+    if (strcmp(comando, "zaino") == 0) {
+        if (!leggi_numero(prossima_parola(&cursore), 1, ZAINO_SLOT_MAX, &valori[0])) {
+            return "posti dello zaino non validi (tra 1 e " NUMERO(ZAINO_SLOT_MAX) ")";
+        }
+        r->dimensione_zaino = (int)valori[0];
+        return NULL;
+    }
+
+    return "voce sconosciuta";
+}
+
+/**
+ * Prepara un registro vuoto con i soli "nessun nemico" e "nessun oggetto"
+ * @param r Registro da azzerare
+ * @param l Stato della lettura da azzerare
+ */
+static void registro_vuoto(Registro* r, Lettura* l) {
+    int i;
+
+    memset(r, 0, sizeof(Registro));
+    strcpy(r->nome[0], "Nessun nemico");
+    strcpy(r->nome_oggetto[0], "Nessun oggetto");
+    r->num_nemici       = 1;
+    r->num_oggetti      = 1;
+    r->dimensione_zaino = ZAINO_MAX;
+    for (i = 0; i < TIPI_ZONA; i++) { // Senza una voce "zone" i tipi di zona sono equiprobabili
+        r->peso_zona[i] = 1;
+    }
+    l->ultimo_messaggio = NULL;
+    l->riga             = 0;
+}
+
+/**
+ * Rende attivo un registro appena letto, ricostruendo le tabelle alias
+ * @param r Registro letto
+ */
+static void attiva_registro(Registro* r) {
+    alias_costruisci(&r->alias[MONDO_REALE], r->peso[MONDO_REALE], r->num_nemici);
+    alias_costruisci(&r->alias[SOPRASOTTO],  r->peso[SOPRASOTTO],  r->num_nemici);
+    alias_costruisci(&r->alias_oggetti,      r->peso_oggetto,      r->num_oggetti);
+    alias_costruisci(&r->alias_zone,         r->peso_zona,         TIPI_ZONA);
+    memcpy(&registro, r, sizeof(Registro));
+    registro_pronto = 1;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+void registro_predefinito(void) {
+    static Registro r;
+    Lettura l;
+    char riga[RIGA_MAX];
+    const char* inizio = configurazione_predefinita;
+
+    registro_vuoto(&r, &l);
+    while (*inizio != '\0') {
+        size_t len = strcspn(inizio, "\n");
+        memcpy(riga, inizio, len);
+        riga[len] = '\0';
+        analizza_riga(&r, &l, riga);
+        inizio += len + (inizio[len] == '\n');
+    }
+    attiva_registro(&r);
+}
+
+int registro_carica(const char* percorso) {
+    Registro* r;
+    Lettura l;
+    char riga[RIGA_MAX];
+    FILE* f;
+
+    if (percorso == NULL) {
+        percorso = REGISTRO_PREDEFINITO;
+    }
+
+    f = fopen(percorso, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) { // Nessun file: valori predefiniti
+            registro_predefinito();
+            return 0;
+        }
+        fprintf(stderr, "Errore: impossibile aprire il registro %s\n", percorso);
+        return -1;
+    }
+
+    r = (Registro*)malloc(sizeof(Registro));
+    if (r == NULL) {
+        fclose(f);
+        return -1;
+    }
+
+    registro_vuoto(r, &l);
+    while (fgets(riga, sizeof(riga), f) != NULL) {
+        const char* errore;
+
+        l.riga++;
+        errore = analizza_riga(r, &l, riga);
+        if (errore != NULL) {
+            fprintf(stderr, "Errore nel registro %s alla riga %d: %s\n", percorso, l.riga, errore);
+            free(r);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+
+    attiva_registro(r);
+    free(r);
+    return 0;
+}
+
+int registro_num_nemici(void) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return registro.num_nemici;
+}
+
+const Statistiche_nemico* registro_nemico(int tipo) {
+    if (tipo <= 0 || tipo >= registro_num_nemici()) {
+        return &registro.statistiche[0];
+    }
+    return &registro.statistiche[tipo];
+}
+
+const char* registro_nome_nemico(int tipo) {
+    if (tipo < 0 || tipo >= registro_num_nemici()) {
+        return "Sconosciuto";
+    }
+    return registro.nome[tipo];
+}
+
+const char* registro_messaggio_nemico(int tipo, Messaggio_nemico momento) {
+    if (tipo <= 0 || tipo >= registro_num_nemici() || registro.messaggio[tipo][momento] == 0) {
+        return "";
+    }
+    return registro.testi + registro.messaggio[tipo][momento] - 1;
+}
+
+int registro_estrai_nemico(Tipo_mondo mondo) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return alias_estrai(&registro.alias[mondo == SOPRASOTTO ? SOPRASOTTO : MONDO_REALE], (uint32_t)rand());
+}
+
+int registro_nemico_finale(void) {
+    int i;
+
+    for (i = 1; i < registro_num_nemici(); i++) {
+        if (registro.statistiche[i].finale) {
+            return i;
+        }
+    }
+    return NESSUN_NEMICO;
+}
+
+int registro_num_oggetti(void) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return registro.num_oggetti;
+}
+
+const Effetto_oggetto* registro_oggetto(int tipo) {
+    if (tipo <= 0 || tipo >= registro_num_oggetti()) {
+        return &registro.effetto[0];
+    }
+    return &registro.effetto[tipo];
+}
+
+const char* registro_nome_oggetto(int tipo) {
+    if (tipo < 0 || tipo >= registro_num_oggetti()) {
+        return "Sconosciuto";
+    }
+    return registro.nome_oggetto[tipo];
+}
+
+const char* registro_messaggio_oggetto(int tipo) {
+    if (tipo <= 0 || tipo >= registro_num_oggetti() || registro.messaggio_oggetto[tipo] == 0) {
+        return "";
+    }
+    return registro.testi + registro.messaggio_oggetto[tipo] - 1;
+}
+
+int registro_estrai_oggetto(void) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return alias_estrai(&registro.alias_oggetti, (uint32_t)rand());
+}
+
+const Obiettivi_mappa* registro_obiettivi_mappa(void) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return registro.con_obiettivi ? &registro.obiettivi : NULL;
+}
+
+int registro_dimensione_zaino(void) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    return registro.dimensione_zaino;
+}
+
+void registro_estrai_zone(Contenuto_zona* zone, int n) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    /* Una colonna alla volta: ogni passata legge una sola tabella */
+    alias_riempi(&registro.alias_zone,         &zone->tipo,      sizeof(Contenuto_zona), n);
+    alias_riempi(&registro.alias[MONDO_REALE], &zone->nemico_mr, sizeof(Contenuto_zona), n);
+    alias_riempi(&registro.alias_oggetti,      &zone->oggetto,   sizeof(Contenuto_zona), n);
+    alias_riempi(&registro.alias[SOPRASOTTO],  &zone->nemico_ss, sizeof(Contenuto_zona), n);
+}
+
+void registro_estrai_zona(Contenuto_zona* zona, const uint32_t casuali[4]) {
+    if (!registro_pronto) {
+        registro_predefinito();
+    }
+    zona->tipo      = (uint8_t)alias_estrai(&registro.alias_zone,         casuali[0]);
+    zona->nemico_mr = (uint8_t)alias_estrai(&registro.alias[MONDO_REALE], casuali[1]);
+    zona->oggetto   = (uint8_t)alias_estrai(&registro.alias_oggetti,      casuali[2]);
+    zona->nemico_ss = (uint8_t)alias_estrai(&registro.alias[SOPRASOTTO],  casuali[3]);
+}
@@ -0,0 +1,163 @@
+#ifndef REGISTRO_H
+#define REGISTRO_H
+
+#include <stdint.h>
+#include "gamelib.h"
+
+/* ============================================================================
+ * REGISTRO DEI NEMICI E DEGLI OGGETTI
+ *
+ * I tipi di nemico e di oggetto, le loro statistiche, i pesi di comparsa e i
+ * testi sono letti all'avvio da un file di configurazione (se manca si usano
+ * i valori predefiniti del gioco). Il codice Tipo_nemico o Tipo_oggetto di
+ * una zona e' l'indice nel registro: 0 e' sempre "nessun nemico" o "nessun
+ * oggetto", i tipi predefiniti coincidono con quelli delle enumerazioni.
+ *
+ * Formato del file (una voce per riga, '#' inizia un commento):
+ *
+ *     nessuno <peso_mr> <peso_ss>
+ *     nemico  <nome> <hp> <attacco> <difesa> <peso_mr> <peso_ss> [finale]
+ *     testo   <nome> zona_mr|zona_ss|combattimento <riga di testo>
+ *     nessun_oggetto <peso>
+ *     oggetto <nome> <peso> <attacco> <difesa> <fortuna> <punti_vita> [temporaneo] [cumulabile]
+ *     uso     <nome> <riga di testo>
+ *     zaino   <posti>
+ *     zone    <peso di ogni tipo di zona, nell'ordine di Tipo_zona>
+ *     mappa   <pv_persi> <tolleranza> <densita_oggetti> <nemici_consecutivi>
+ *
+ * Un nemico "finale" non viene mai estratto a caso: genera_mappa ne piazza
+ * uno nel Soprasotto e sconfiggerlo vince la partita. Righe "testo" o "uso"
+ * consecutive per lo stesso nemico e momento (o oggetto) formano un unico
+ * messaggio.
+ *
+ * Un oggetto "temporaneo" vale fino alla fine del combattimento in corso (o
+ * del prossimo, se usato fuori dal combattimento); i punti vita restano.
+ * Un oggetto "cumulabile" somma il suo effetto a ogni uso, gli altri hanno
+ * effetto una volta sola (per i temporanei: una volta per combattimento).
+ *
+ * La voce "mappa" fa generare le mappe casuali con gli obiettivi dati (vedi
+ * generatore.h): perdita di PV attesa fino alla zona del nemico finale, piu'
+ * o meno la tolleranza, percentuale di zone con un oggetto e numero massimo
+ * di nemici di fila nel Mondo Reale.
+ * ============================================================================ */
+
+/* Dimensioni massime del registro */
+#define NEMICI_MAX           64
+#define NOME_NEMICO_MAX      32
+#define OGGETTI_MAX          32          /* Uno per bit delle maschere degli zaini */
+#define NOME_OGGETTO_MAX     32
+#define TESTI_REGISTRO_MAX  16384
+
+/* Tipi di zona, nell'ordine di Tipo_zona */
+#define TIPI_ZONA            (STAZIONE_POLIZIA + 1)
+
+/* Posti massimi di uno zaino: uno per bit della maschera degli slot occupati */
+#define ZAINO_SLOT_MAX       32
+
+/* File letto se non ne viene indicato un altro */
+#define REGISTRO_PREDEFINITO  "cosestrane.cfg"
+
+// Momenti in cui viene mostrato un testo del nemico
+typedef enum {
+    MSG_NEMICO_ZONA_MR,                  /* Zona del Mondo Reale in cui si trova */
+    MSG_NEMICO_ZONA_SS,                  /* Zona del Soprasotto in cui si trova */
+    MSG_NEMICO_COMBATTIMENTO,            /* Inizio del combattimento */
+    MSG_NEMICO_NUM
+} Messaggio_nemico;
+
+// Dati di un nemico letti in combattimento: 8 byte, otto nemici per linea di cache
+typedef struct {
+    int16_t hp;
+    int16_t attacco;
+    int16_t difesa;
+    uint8_t finale;                      /* 1 se sconfiggerlo vince la partita */
+    uint8_t riservato;
+} Statistiche_nemico;
+
+// Effetto di un oggetto usato dallo zaino: 8 byte, applicato sommando i
+// campi senza distinguere il tipo di oggetto
+typedef struct {
+    int8_t attacco;
+    int8_t difesa;
+    int8_t fortuna;
+    int8_t punti_vita;
+    uint8_t temporaneo;                  /* 1 se vale solo fino alla fine del combattimento */
+    uint8_t cumulabile;                  /* 1 se ogni uso somma di nuovo l'effetto */
+    uint8_t riservato[2];
+} Effetto_oggetto;
+
+// Contenuto estratto per una zona dei due mondi: 4 byte, per riempire in un
+// colpo solo le zone di mappe grandi
+typedef struct {
+    uint8_t tipo;                        /* Tipo_zona, uguale nei due mondi */
+    uint8_t nemico_mr;
+    uint8_t nemico_ss;
+    uint8_t oggetto;                     /* Solo nel Mondo Reale */
+} Contenuto_zona;
+
+// Obiettivi di difficolta' delle mappe generate (voce "mappa")
+typedef struct {
+    int pv_persi;                        /* Perdita di PV attesa fino alla zona del nemico finale */
+    int tolleranza;                      /* Scarto ammesso su pv_persi */
+    int densita_oggetti;                 /* Percentuale di zone del Mondo Reale con un oggetto */
+    int nemici_consecutivi;              /* Massimo di zone di fila con un nemico nel Mondo Reale */
+} Obiettivi_mappa;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//carica il registro dal file indicato; se il file non esiste usa i valori predefiniti.
+//restituisce 0 se riuscito, -1 in caso di errore (il registro precedente resta valido)
+int registro_carica(const char* percorso);
+
+//ripristina i nemici predefiniti del gioco
+void registro_predefinito(void);
+
+//numero di tipi registrati, compreso "nessun nemico"
+int registro_num_nemici(void);
+
+//statistiche del tipo di nemico (quelle di "nessun nemico" per un tipo non valido)
+const Statistiche_nemico* registro_nemico(int tipo);
+
+//nome leggibile del tipo di nemico
+const char* registro_nome_nemico(int tipo);
+
+//testo del nemico per il momento dato, stringa vuota se non definito
+const char* registro_messaggio_nemico(int tipo, Messaggio_nemico momento);
+
+//estrae un tipo di nemico (o nessuno) per una zona del mondo dato, in tempo O(1)
+int registro_estrai_nemico(Tipo_mondo mondo);
+
+//primo nemico finale del registro, NESSUN_NEMICO se non ce ne sono
+int registro_nemico_finale(void);
+
+//numero di tipi di oggetto registrati, compreso "nessun oggetto"
+int registro_num_oggetti(void);
+
+//effetto del tipo di oggetto (quello nullo di "nessun oggetto" per un tipo non valido)
+const Effetto_oggetto* registro_oggetto(int tipo);
+
+//nome leggibile del tipo di oggetto
+const char* registro_nome_oggetto(int tipo);
+
+//testo mostrato quando si usa l'oggetto, stringa vuota se non definito
+const char* registro_messaggio_oggetto(int tipo);
+
+//estrae un tipo di oggetto (o nessuno) per una zona del Mondo Reale, in tempo O(1)
+int registro_estrai_oggetto(void);
+
+//estrae tipo, nemici e oggetto di n zone con i pesi del registro (mai il nemico finale)
+void registro_estrai_zone(Contenuto_zona* zone, int n);
+
+//come registro_estrai_zone per una sola zona, con quattro numeri casuali dati dal chiamante
+//(almeno 31 bit casuali ciascuno) invece di rand(): serve a chi ha un generatore proprio
+void registro_estrai_zona(Contenuto_zona* zona, const uint32_t casuali[4]);
+
+//obiettivi delle mappe generate, NULL se il registro non ne definisce
+const Obiettivi_mappa* registro_obiettivi_mappa(void);
+
+//numero di posti di ogni zaino, tra 1 e ZAINO_SLOT_MAX
+int registro_dimensione_zaino(void);
+
+#endif
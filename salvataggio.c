@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "salvataggio.h"
+
+/* Firma all'inizio di ogni file di salvataggio */
+#define FIRMA           "COSWAL1\n"
+#define LUNGHEZZA_FIRMA 8
+
+/* Byte dell'intestazione di un record: lunghezza, CRC32, tipo, sessione */
+#define INTESTAZIONE    17
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Il thread principale accoda i record in coda; salvataggio_spedisci scambia
+// coda e blocco e il thread di scrittura scrive il blocco mentre la coda si
+// riempie con il lotto successivo.
+struct Salvataggio {
+    char* percorso;
+    char* percorso_nuovo;                /* percorso + ".tmp" */
+    int fd;
+    int fd_nuovo;                        /* File aperto da salvataggio_nuovo_file, -1 se nessuno */
+    int notifica;                        /* eventfd scritto a ogni lotto confermato */
+    size_t dimensione;                   /* Byte passati al file in uso, confermati o in scrittura */
+    size_t dimensione_file;              /* Byte confermati nel file in uso (del thread di scrittura durante un lotto) */
+    size_t dimensione_nuovo;             /* Byte scritti nel file nuovo */
+    unsigned char* coda;                 /* Record del lotto in corso */
+    size_t lunghezza_coda;
+    size_t capacita_coda;
+    unsigned char* blocco;               /* Record del lotto in scrittura */
+    size_t lunghezza_blocco;
+    size_t capacita_blocco;
+    uint64_t lotto;                      /* Lotto dei record accodati adesso */
+    uint64_t in_scrittura;               /* Lotto affidato al thread di scrittura, 0 se nessuno */
+    _Atomic uint64_t confermato;         /* Ultimo lotto su disco */
+    _Atomic int termina;
+    int scrittore_avviato;
+    pthread_t scrittore;
+    pthread_mutex_t mutex;
+    pthread_cond_t sveglia;              /* C'e' un lotto da scrivere o bisogna terminare */
+    pthread_cond_t finito;               /* Il lotto in scrittura e' su disco */
+};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Scrive tutti i byte sul file, ripetendo le write interrotte o parziali
+ * @param fd File
+ * @param dati Byte
+ * @param n Numero di byte
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int scrivi_tutto(int fd, const unsigned char* dati, size_t n) {
+    while (n > 0) {
+        ssize_t scritti = write(fd, dati, n);
+
+        if (scritti < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        dati += scritti;
+        n    -= (size_t)scritti;
+    }
+    return 0;
+}
+
+/**
+ * Rende durevole la voce della directory del salvataggio (dopo un rename o una creazione)
+ * @param percorso Percorso del file
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int sincronizza_directory(const char* percorso) {
+    const char* barra = strrchr(percorso, '/');
+    char* directory;
+    int fd;
+    int esito;
+
+    if (barra == NULL) {
+        directory = strdup(".");
+    } else {
+        directory = strndup(percorso, barra == percorso ? 1 : (size_t)(barra - percorso));
+    }
+    if (directory == NULL) {
+        return -1;
+    }
+    fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(directory);
+    if (fd < 0) {
+        return -1;
+    }
+    esito = fsync(fd);
+    close(fd);
+    return esito;
+}
+
+/**
+ * Apre un file di salvataggio vuoto scrivendone la firma
+ * @param percorso Percorso del file (un file esistente viene svuotato)
+ * @return Descrittore del file, -1 in caso di errore
+ */
+static int crea_file(const char* percorso) {
+    int fd = open(percorso, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (scrivi_tutto(fd, (const unsigned char*)FIRMA, LUNGHEZZA_FIRMA) < 0 || fdatasync(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Scrive un blocco di record su un file e aspetta che sia su disco
+ * Se qualcosa va storto il file viene riportato alla dimensione di prima,
+ * cosi' un record scritto a meta' non nasconde quelli scritti dopo
+ * @param fd File
+ * @param dati Record
+ * @param n Byte dei record
+ * @param dimensione Byte validi nel file, aggiornati se la scrittura riesce
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int scrivi_blocco(int fd, const unsigned char* dati, size_t n, size_t* dimensione) {
+    if (scrivi_tutto(fd, dati, n) < 0 || fdatasync(fd) < 0) {
+        int ignorato = ftruncate(fd, (off_t)*dimensione);
+        (void)ignorato;
+        return -1;
+    }
+    *dimensione += n;
+    return 0;
+}
+
+/**
+ * Segnala al thread principale che un lotto e' su disco
+ * @param s Salvataggio
+ * @param lotto Lotto confermato
+ */
+static void segnala_confermato(Salvataggio* s, uint64_t lotto) {
+    uint64_t uno = 1;
+    ssize_t ignorato;
+
+    atomic_store(&s->confermato, lotto);
+    ignorato = write(s->notifica, &uno, sizeof(uno));
+    (void)ignorato;
+}
+
+/**
+ * Ciclo del thread di scrittura: scrive un lotto alla volta
+ * Se il disco non accetta i record si riprova finche' non riesce: intanto
+ * il lotto non e' confermato e chi aspetta la conferma continua ad aspettare
+ * @param arg Salvataggio
+ * @return NULL
+ */
+static void* ciclo_scrittore(void* arg) {
+    Salvataggio* s = (Salvataggio*)arg;
+    uint64_t lotto;
+    int esito;
+
+    pthread_mutex_lock(&s->mutex);
+    while (1) {
+        while (s->in_scrittura == 0 && !atomic_load(&s->termina)) {
+            pthread_cond_wait(&s->sveglia, &s->mutex);
+        }
+        if (s->in_scrittura == 0) {
+            break;
+        }
+        lotto = s->in_scrittura;
+        pthread_mutex_unlock(&s->mutex);
+
+        esito = scrivi_blocco(s->fd, s->blocco, s->lunghezza_blocco, &s->dimensione_file);
+        while (esito < 0 && !atomic_load(&s->termina)) {
+            perror(s->percorso);
+            sleep(1);
+            esito = scrivi_blocco(s->fd, s->blocco, s->lunghezza_blocco, &s->dimensione_file);
+        }
+
+        pthread_mutex_lock(&s->mutex);
+        s->in_scrittura = 0; // Prima della notifica: chi la riceve puo' gia' spedire il lotto successivo
+        pthread_cond_broadcast(&s->finito);
+        if (esito == 0) {
+            segnala_confermato(s, lotto);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/**
+ * Aspetta che il thread di scrittura abbia finito il suo lotto
+ * Dopo il thread principale puo' usare il file da solo
+ * @param s Salvataggio
+ */
+static void aspetta_scrittore(Salvataggio* s) {
+    pthread_mutex_lock(&s->mutex);
+    while (s->in_scrittura != 0) {
+        pthread_cond_wait(&s->finito, &s->mutex);
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/**
+ * Abbandona il file nuovo: i record tornano ad andare nel file in uso
+ * @param s Salvataggio con un file nuovo aperto
+ */
+static void abbandona_nuovo_file(Salvataggio* s) {
+    close(s->fd_nuovo);
+    unlink(s->percorso_nuovo);
+    s->fd_nuovo = -1;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+Salvataggio* salvataggio_apri(const char* percorso) {
+    Salvataggio* s = (Salvataggio*)calloc(1, sizeof(Salvataggio));
+    struct stat info;
+
+    if (s == NULL) {
+        return NULL;
+    }
+    s->fd             = -1;
+    s->fd_nuovo       = -1;
+    s->lotto          = 1;
+    s->notifica       = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    s->percorso       = strdup(percorso);
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->sveglia, NULL);
+    pthread_cond_init(&s->finito, NULL);
+    s->percorso_nuovo = (char*)malloc(strlen(percorso) + 5);
+    if (s->percorso == NULL || s->percorso_nuovo == NULL || s->notifica < 0) {
+        salvataggio_chiudi(s);
+        return NULL;
+    }
+    sprintf(s->percorso_nuovo, "%s.tmp", percorso);
+
+    s->fd = open(percorso, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (s->fd < 0 || fstat(s->fd, &info) < 0) {
+        perror(percorso);
+        salvataggio_chiudi(s);
+        return NULL;
+    }
+    if (info.st_size == 0) { // File nuovo: prima la firma, poi i record
+        if (scrivi_tutto(s->fd, (const unsigned char*)FIRMA, LUNGHEZZA_FIRMA) < 0
+            || fdatasync(s->fd) < 0 || sincronizza_directory(percorso) < 0) {
+            perror(percorso);
+            salvataggio_chiudi(s);
+            return NULL;
+        }
+        info.st_size = LUNGHEZZA_FIRMA;
+    }
+    s->dimensione      = (size_t)info.st_size;
+    s->dimensione_file = s->dimensione;
+
+    if (pthread_create(&s->scrittore, NULL, ciclo_scrittore, s) != 0) {
+        salvataggio_chiudi(s);
+        return NULL;
+    }
+    s->scrittore_avviato = 1;
+    return s;
+}
+
+void salvataggio_chiudi(Salvataggio* s) {
+    if (s == NULL) {
+        return;
+    }
+    if (s->scrittore_avviato) { // Il lotto in scrittura si finisce, la coda va persa
+        pthread_mutex_lock(&s->mutex);
+        atomic_store(&s->termina, 1);
+        pthread_cond_broadcast(&s->sveglia);
+        pthread_mutex_unlock(&s->mutex);
+        pthread_join(s->scrittore, NULL);
+    }
+    if (s->fd_nuovo >= 0) {
+        abbandona_nuovo_file(s);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    if (s->notifica >= 0) {
+        close(s->notifica);
+    }
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->sveglia);
+    pthread_cond_destroy(&s->finito);
+    free(s->percorso);
+    free(s->percorso_nuovo);
+    free(s->coda);
+    free(s->blocco);
+    free(s);
+}
+
+long salvataggio_leggi(Salvataggio* s, Lettore_record leggi, void* contesto) {
+    unsigned char* dati;
+    size_t letti = 0;
+    size_t pos = LUNGHEZZA_FIRMA;
+    long record = 0;
+
+    dati = (unsigned char*)malloc(s->dimensione);
+    if (dati == NULL) {
+        return -1;
+    }
+    while (letti < s->dimensione) {
+        ssize_t n = pread(s->fd, dati + letti, s->dimensione - letti, (off_t)letti);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(dati);
+            return -1;
+        }
+        letti += (size_t)n;
+    }
+    if (s->dimensione < LUNGHEZZA_FIRMA || memcmp(dati, FIRMA, LUNGHEZZA_FIRMA) != 0) {
+        fprintf(stderr, "Errore: %s non e' un file di salvataggio!\n", s->percorso);
+        free(dati);
+        return -1;
+    }
+
+    while (s->dimensione - pos >= INTESTAZIONE) {
+        uint32_t lunghezza;
+        uint32_t crc;
+        uint64_t sessione;
+
+        memcpy(&lunghezza, dati + pos, sizeof(lunghezza));
+        memcpy(&crc, dati + pos + 4, sizeof(crc));
+        memcpy(&sessione, dati + pos + 9, sizeof(sessione));
+        if (lunghezza > s->dimensione - pos - INTESTAZIONE
+            || crc32_aggiorna(0, dati + pos + 8, INTESTAZIONE - 8 + (size_t)lunghezza) != crc) {
+            break; // Record scritto a meta': da qui in poi non c'e' niente di confermato
+        }
+        leggi(contesto, (Tipo_record)dati[pos + 8], sessione, dati + pos + INTESTAZIONE, lunghezza);
+        pos += INTESTAZIONE + (size_t)lunghezza;
+        record++;
+    }
+    free(dati);
+
+    if (pos < s->dimensione) {
+        fprintf(stderr, "Salvataggio: scartati %zu byte di un record incompleto\n", s->dimensione - pos);
+        if (ftruncate(s->fd, (off_t)pos) < 0 || fdatasync(s->fd) < 0) {
+            return -1;
+        }
+        s->dimensione      = pos;
+        s->dimensione_file = pos;
+    }
+    return record;
+}
+
+int salvataggio_aggiungi(Salvataggio* s, Tipo_record tipo, uint64_t sessione, const void* dati, size_t n) {
+    unsigned char* record;
+    uint32_t lunghezza = (uint32_t)n;
+    uint32_t crc;
+
+    if (n > UINT32_MAX - INTESTAZIONE) {
+        return 0;
+    }
+    if (s->lunghezza_coda + INTESTAZIONE + n > s->capacita_coda) {
+        size_t nuova_capacita = s->capacita_coda > 0 ? s->capacita_coda : 4096;
+        unsigned char* nuova;
+
+        while (nuova_capacita < s->lunghezza_coda + INTESTAZIONE + n) {
+            nuova_capacita *= 2;
+        }
+        nuova = (unsigned char*)realloc(s->coda, nuova_capacita);
+        if (nuova == NULL) {
+            return 0;
+        }
+        s->coda          = nuova;
+        s->capacita_coda = nuova_capacita;
+    }
+
+    record    = s->coda + s->lunghezza_coda;
+    record[8] = (unsigned char)tipo;
+    memcpy(record + 9, &sessione, sizeof(sessione));
+    if (n > 0) {
+        memcpy(record + INTESTAZIONE, dati, n);
+    }
+    crc = crc32_aggiorna(0, record + 8, INTESTAZIONE - 8 + n);
+    memcpy(record, &lunghezza, sizeof(lunghezza));
+    memcpy(record + 4, &crc, sizeof(crc));
+    s->lunghezza_coda += INTESTAZIONE + n;
+    return 1;
+}
+
+uint64_t salvataggio_lotto(const Salvataggio* s) {
+    return s->lotto;
+}
+
+void salvataggio_spedisci(Salvataggio* s) {
+    unsigned char* dati;
+    size_t capacita;
+
+    if (s->lunghezza_coda == 0 || s->fd_nuovo >= 0) { // Il file nuovo si scrive solo con salvataggio_conferma
+        return;
+    }
+    pthread_mutex_lock(&s->mutex);
+    if (s->in_scrittura == 0) { // Se il thread e' occupato la coda aspetta e cresce col lotto successivo
+        dati                = s->blocco;
+        capacita            = s->capacita_blocco;
+        s->blocco           = s->coda;
+        s->capacita_blocco  = s->capacita_coda;
+        s->lunghezza_blocco = s->lunghezza_coda;
+        s->coda             = dati;
+        s->capacita_coda    = capacita;
+        s->lunghezza_coda   = 0;
+        s->dimensione      += s->lunghezza_blocco;
+        s->in_scrittura     = s->lotto++;
+        pthread_cond_signal(&s->sveglia);
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+uint64_t salvataggio_confermato(Salvataggio* s) {
+    uint64_t letto;
+    ssize_t ignorato = read(s->notifica, &letto, sizeof(letto));
+
+    (void)ignorato;
+    return atomic_load(&s->confermato);
+}
+
+int salvataggio_notifica(const Salvataggio* s) {
+    return s->notifica;
+}
+
+int salvataggio_conferma(Salvataggio* s) {
+    int esito = 0;
+
+    aspetta_scrittore(s);
+    if (s->fd_nuovo >= 0) { // Il file nuovo sostituisce il vecchio solo quando e' completo e su disco
+        if (scrivi_blocco(s->fd_nuovo, s->coda, s->lunghezza_coda, &s->dimensione_nuovo) == 0
+            && rename(s->percorso_nuovo, s->percorso) == 0) {
+            close(s->fd);
+            s->fd              = s->fd_nuovo;
+            s->fd_nuovo        = -1;
+            s->dimensione      = s->dimensione_nuovo;
+            s->dimensione_file = s->dimensione_nuovo;
+            s->lunghezza_coda  = 0;
+            segnala_confermato(s, s->lotto++);
+            return sincronizza_directory(s->percorso);
+        }
+        perror(s->percorso_nuovo);
+        abbandona_nuovo_file(s); // I record vanno comunque salvati, in coda al file vecchio
+    }
+
+    if (s->lunghezza_coda > 0) { // Se non riesce i record restano in coda per la prossima conferma
+        esito = scrivi_blocco(s->fd, s->coda, s->lunghezza_coda, &s->dimensione_file);
+        if (esito == 0) {
+            s->dimensione     = s->dimensione_file;
+            s->lunghezza_coda = 0;
+            segnala_confermato(s, s->lotto++);
+        }
+    }
+    return esito;
+}
+
+int salvataggio_nuovo_file(Salvataggio* s) {
+    if (s->fd_nuovo >= 0) {
+        abbandona_nuovo_file(s);
+    }
+    if (salvataggio_conferma(s) < 0) { // Cio' che e' gia' in coda appartiene al file vecchio
+        return -1;
+    }
+    s->fd_nuovo = crea_file(s->percorso_nuovo);
+    if (s->fd_nuovo < 0) {
+        perror(s->percorso_nuovo);
+        return -1;
+    }
+    s->dimensione_nuovo = LUNGHEZZA_FIRMA;
+    return 0;
+}
+
+size_t salvataggio_dimensione(const Salvataggio* s) {
+    return (s->fd_nuovo >= 0 ? s->dimensione_nuovo : s->dimensione) + s->lunghezza_coda;
+}
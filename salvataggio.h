@@ -0,0 +1,83 @@
+#ifndef SALVATAGGIO_H
+#define SALVATAGGIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * SALVATAGGIO DELLE SESSIONI (WRITE-AHEAD LOG)
+ *
+ * Un file di soli accodamenti in cui il server scrive, per ogni sessione in
+ * gioco, un'istantanea della partita e poi le righe di input che riceve:
+ * rileggendo il file dopo un crash ogni partita si ricostruisce
+ * dall'ultima istantanea ripetendo le righe successive.
+ *
+ * Ogni record ha una piccola intestazione con lunghezza e CRC32: un record
+ * scritto a meta' da un crash non supera il controllo, e la lettura tronca
+ * il file in quel punto. I record si accumulano in memoria a lotti: un
+ * thread di scrittura scrive ogni lotto con una sola write e un solo
+ * fdatasync, qualunque sia il numero di sessioni che lo hanno prodotto,
+ * mentre il thread principale riempie il lotto successivo. Ogni lotto
+ * confermato viene segnalato su un eventfd da aggiungere all'epoll.
+ *
+ * Per non far crescere il file all'infinito salvataggio_nuovo_file fa
+ * ripartire i record in un file nuovo, che alla conferma successiva prende
+ * il posto del vecchio con un rename atomico.
+ * ============================================================================ */
+
+// Tipi di record del salvataggio
+typedef enum {
+    RECORD_ISTANTANEA = 1,               /* Stato completo della sessione (partita_istantanea) */
+    RECORD_RIGA,                         /* Riga di input consegnata alla sessione */
+    RECORD_FINE                          /* La sessione non e' piu' da ripristinare */
+} Tipo_record;
+
+// File di salvataggio aperto; definito in salvataggio.c
+typedef struct Salvataggio Salvataggio;
+
+// Funzione chiamata da salvataggio_leggi per ogni record valido, nell'ordine del file
+typedef void (*Lettore_record)(void* contesto, Tipo_record tipo, uint64_t sessione,
+                               const unsigned char* dati, size_t n);
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//apre il file di salvataggio, creandolo se non esiste; NULL in caso di errore
+Salvataggio* salvataggio_apri(const char* percorso);
+
+//chiude il file; i record non ancora confermati vanno persi
+void salvataggio_chiudi(Salvataggio* s);
+
+//passa a leggi tutti i record validi del file e tronca il file dopo l'ultimo;
+//restituisce il numero di record letti, -1 in caso di errore
+long salvataggio_leggi(Salvataggio* s, Lettore_record leggi, void* contesto);
+
+//accoda un record in memoria fino alla prossima conferma; 1 se riuscito, 0 se la memoria non basta
+int salvataggio_aggiungi(Salvataggio* s, Tipo_record tipo, uint64_t sessione, const void* dati, size_t n);
+
+//lotto a cui appartengono i record accodati adesso
+uint64_t salvataggio_lotto(const Salvataggio* s);
+
+//affida il lotto in corso al thread di scrittura, se non ne sta gia' scrivendo uno, e ne comincia un altro;
+//non aspetta il disco
+void salvataggio_spedisci(Salvataggio* s);
+
+//ultimo lotto gia' su disco (i lotti si confermano in ordine); consuma la notifica
+uint64_t salvataggio_confermato(Salvataggio* s);
+
+//descrittore che diventa leggibile quando un lotto e' confermato
+int salvataggio_notifica(const Salvataggio* s);
+
+//scrive su disco tutti i record accodati e aspetta che siano al sicuro, senza il thread di scrittura;
+//0 se riuscito, -1 in caso di errore
+int salvataggio_conferma(Salvataggio* s);
+
+//fa scrivere i prossimi record in un file nuovo che sostituisce il vecchio alla prossima conferma:
+//dopo va accodato tutto cio' che serve per ripristinare le sessioni; 0 se riuscito, -1 in caso di errore
+int salvataggio_nuovo_file(Salvataggio* s);
+
+//byte del file di salvataggio, compresi i record non ancora confermati
+size_t salvataggio_dimensione(const Salvataggio* s);
+
+#endif
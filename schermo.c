@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "schermo.h"
+
+/* Righe al massimo del menu e del pannello della zona */
+#define RIGHE_MENU_MAX   12
+#define RIGHE_ZONA_MAX   10
+
+/* Carattere che non compare mai a video: una cella spedita con questo valore si ridisegna di sicuro */
+#define CELLA_SPORCA     '\1'
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Righe di testo di un pannello
+typedef struct {
+    char righe[SCHERMO_RIGHE_MAX][SCHERMO_COLONNE_MAX + 1];
+    int numero;
+} Pannello;
+
+struct Schermo {
+    FILE* uscita;
+    int righe_chieste;                   /* 0 se le dimensioni vengono dal terminale */
+    int colonne_chieste;
+    int righe;                           /* Dimensioni in uso */
+    int colonne;
+    int ridisegna;                       /* Il prossimo fotogramma riparte da uno schermo vuoto */
+    int attivo;                          /* Il terminale e' nel buffer alternativo */
+
+    /* Disposizione dei pannelli: prima riga e numero di righe */
+    int inizio_zona, righe_zona;
+    int inizio_registro, righe_registro;
+    int inizio_menu, righe_menu;
+
+    /* Contenuto dei pannelli */
+    char stato[SCHERMO_COLONNE_MAX + 1];
+    Pannello zona;
+    Pannello menu;
+    char registro[SCHERMO_RIGHE_MAX][SCHERMO_COLONNE_MAX + 1];  /* Anello delle ultime righe del registro */
+    int primo_registro;                  /* Riga piu' vecchia dell'anello */
+    int num_registro;
+    int registro_nuove;                  /* Righe aggiunte dopo l'ultimo fotogramma */
+
+    /* Fotogrammi: celle da mostrare e celle gia' spedite al terminale */
+    char celle[SCHERMO_RIGHE_MAX * SCHERMO_COLONNE_MAX];
+    char spedite[SCHERMO_RIGHE_MAX * SCHERMO_COLONNE_MAX];
+    int riga_cursore;
+    int colonna_cursore;
+
+    /* Byte del fotogramma in costruzione */
+    char* dati;
+    size_t lunghezza;
+    size_t capacita;
+    int guasto;                          /* 1 se la memoria non e' bastata */
+};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Aggiunge byte al fotogramma in costruzione
+ * @param s Schermo
+ * @param dati Byte
+ * @param n Numero di byte
+ */
+static void aggiungi(Schermo* s, const char* dati, size_t n) {
+    if (s->guasto) {
+        return;
+    }
+    if (s->lunghezza + n > s->capacita) {
+        size_t nuova_capacita = s->capacita > 0 ? s->capacita : 4096;
+        char* nuovi;
+
+        while (nuova_capacita < s->lunghezza + n) {
+            nuova_capacita *= 2;
+        }
+        nuovi = (char*)realloc(s->dati, nuova_capacita);
+        if (nuovi == NULL) {
+            s->guasto = 1;
+            return;
+        }
+        s->dati     = nuovi;
+        s->capacita = nuova_capacita;
+    }
+    memcpy(s->dati + s->lunghezza, dati, n);
+    s->lunghezza += n;
+}
+
+/**
+ * Aggiunge al fotogramma lo spostamento del cursore in una cella
+ * @param s Schermo
+ * @param riga Riga (da 0)
+ * @param colonna Colonna (da 0)
+ */
+static void sposta_cursore(Schermo* s, int riga, int colonna) {
+    char sequenza[32];
+    int n = snprintf(sequenza, sizeof(sequenza), "\x1b[%d;%dH", riga + 1, colonna + 1);
+
+    aggiungi(s, sequenza, (size_t)n);
+}
+
+/**
+ * Legge le dimensioni del terminale, o quelle chieste alla creazione
+ * @param s Schermo
+ * @param righe Righe lette
+ * @param colonne Colonne lette
+ */
+static void leggi_dimensioni(const Schermo* s, int* righe, int* colonne) {
+    struct winsize finestra;
+
+    *righe   = s->righe_chieste;
+    *colonne = s->colonne_chieste;
+    if (*righe <= 0 || *colonne <= 0) {
+        if (ioctl(fileno(s->uscita), TIOCGWINSZ, &finestra) == 0 && finestra.ws_row > 0 && finestra.ws_col > 0) {
+            *righe   = finestra.ws_row;
+            *colonne = finestra.ws_col;
+        } else {
+            *righe   = 24;
+            *colonne = 80;
+        }
+    }
+    if (*righe > SCHERMO_RIGHE_MAX) {
+        *righe = SCHERMO_RIGHE_MAX;
+    }
+    if (*colonne > SCHERMO_COLONNE_MAX) {
+        *colonne = SCHERMO_COLONNE_MAX;
+    }
+}
+
+/**
+ * Divide le righe tra i pannelli: stato, zona, registro e menu, separati da una riga, piu' la riga dell'eco in fondo
+ * @param s Schermo con le dimensioni gia' impostate
+ */
+static void disponi_pannelli(Schermo* s) {
+    s->righe_menu = s->righe / 2 - 1;
+    if (s->righe_menu > RIGHE_MENU_MAX) {
+        s->righe_menu = RIGHE_MENU_MAX;
+    }
+    s->righe_zona = (s->righe - s->righe_menu - 5) * 2 / 5;
+    if (s->righe_zona > RIGHE_ZONA_MAX) {
+        s->righe_zona = RIGHE_ZONA_MAX;
+    }
+    s->righe_registro  = s->righe - 5 - s->righe_menu - s->righe_zona;
+    s->inizio_zona     = 2;
+    s->inizio_registro = s->inizio_zona + s->righe_zona + 1;
+    s->inizio_menu     = s->inizio_registro + s->righe_registro + 1;
+}
+
+/**
+ * Copia le righe di un testo in un pannello, tagliate alla larghezza massima
+ * @param p Pannello
+ * @param testo Testo
+ * @param lunghezza Byte del testo
+ */
+static void riempi_pannello(Pannello* p, const char* testo, size_t lunghezza) {
+    size_t i = 0;
+
+    p->numero = 0;
+    while (i < lunghezza && p->numero < SCHERMO_RIGHE_MAX) {
+        size_t fine = i;
+        size_t n;
+        size_t k;
+        int vuota = 1;
+
+        while (fine < lunghezza && testo[fine] != '\n') {
+            fine++;
+        }
+        n = fine - i < SCHERMO_COLONNE_MAX ? fine - i : SCHERMO_COLONNE_MAX;
+        for (k = 0; k < n; k++) {
+            if (testo[i + k] != ' ' && testo[i + k] != '\r') {
+                vuota = 0;
+            }
+        }
+        if (!vuota) {
+            memcpy(p->righe[p->numero], testo + i, n);
+            p->righe[p->numero][n] = '\0';
+            p->numero++;
+        }
+        i = fine + 1;
+    }
+}
+
+/**
+ * Scrive un testo in una riga del fotogramma, tagliandolo alla larghezza dello schermo
+ * @param s Schermo
+ * @param riga Riga
+ * @param testo Testo
+ */
+static void metti_riga(Schermo* s, int riga, const char* testo) {
+    char* celle = s->celle + (size_t)riga * SCHERMO_COLONNE_MAX;
+    int i;
+
+    for (i = 0; i < s->colonne && testo[i] != '\0'; i++) {
+        celle[i] = testo[i] == '\r' || testo[i] == '\t' ? ' ' : testo[i];
+    }
+}
+
+/**
+ * Scrive una riga di separazione con un titolo
+ * @param s Schermo
+ * @param riga Riga
+ * @param titolo Titolo
+ */
+static void metti_separatore(Schermo* s, int riga, const char* titolo) {
+    char testo[SCHERMO_COLONNE_MAX + 1];
+    int n = snprintf(testo, sizeof(testo), "-- %s ", titolo);
+
+    while (n < s->colonne) {
+        testo[n++] = '-';
+    }
+    testo[n] = '\0';
+    metti_riga(s, riga, testo);
+}
+
+/**
+ * Compone il fotogramma con il contenuto dei pannelli
+ * @param s Schermo
+ */
+static void componi(Schermo* s) {
+    const char* richiesta = "";
+    int primo;
+    int i;
+
+    memset(s->celle, ' ', sizeof(s->celle));
+    metti_riga(s, 0, s->stato);
+    metti_separatore(s, 1, "Dove ti trovi");
+    metti_separatore(s, s->inizio_registro - 1, "Avvenimenti");
+    metti_separatore(s, s->inizio_menu - 1, "Cosa fai");
+
+    for (i = 0; i < s->zona.numero && i < s->righe_zona; i++) {
+        metti_riga(s, s->inizio_zona + i, s->zona.righe[i]);
+    }
+
+    /* Registro e menu sono allineati in basso: le righe nuove del registro entrano dall'ultima riga */
+    primo = s->num_registro > s->righe_registro ? s->num_registro - s->righe_registro : 0;
+    for (i = primo; i < s->num_registro; i++) {
+        metti_riga(s, s->inizio_registro + s->righe_registro - (s->num_registro - i),
+                   s->registro[(s->primo_registro + i) % SCHERMO_RIGHE_MAX]);
+    }
+    primo = s->menu.numero > s->righe_menu ? s->menu.numero - s->righe_menu : 0;
+    for (i = primo; i < s->menu.numero; i++) {
+        metti_riga(s, s->inizio_menu + s->righe_menu - (s->menu.numero - i), s->menu.righe[i]);
+    }
+
+    /* Il cursore aspetta dopo la richiesta di input, l'ultima riga del menu */
+    if (s->menu.numero > 0) {
+        richiesta = s->menu.righe[s->menu.numero - 1];
+    }
+    s->riga_cursore    = s->inizio_menu + s->righe_menu - 1;
+    s->colonna_cursore = (int)strlen(richiesta);
+    if (s->colonna_cursore >= s->colonne) {
+        s->colonna_cursore = s->colonne - 1;
+    }
+}
+
+/**
+ * Fa scorrere al terminale la regione del registro per le righe nuove, e allo stesso modo le celle spedite
+ * @param s Schermo
+ */
+static void scorri_registro(Schermo* s) {
+    char sequenza[32];
+    int k = s->registro_nuove;
+    int n;
+    int i;
+
+    n = snprintf(sequenza, sizeof(sequenza), "\x1b[%d;%dr", s->inizio_registro + 1,
+                 s->inizio_registro + s->righe_registro);
+    aggiungi(s, sequenza, (size_t)n);
+    sposta_cursore(s, s->inizio_registro + s->righe_registro - 1, 0);
+    for (i = 0; i < k; i++) {
+        aggiungi(s, "\n", 1);
+    }
+    aggiungi(s, "\x1b[r", 3);
+
+    memmove(s->spedite + (size_t)s->inizio_registro * SCHERMO_COLONNE_MAX,
+            s->spedite + (size_t)(s->inizio_registro + k) * SCHERMO_COLONNE_MAX,
+            (size_t)(s->righe_registro - k) * SCHERMO_COLONNE_MAX);
+    memset(s->spedite + (size_t)(s->inizio_registro + s->righe_registro - k) * SCHERMO_COLONNE_MAX, ' ',
+           (size_t)k * SCHERMO_COLONNE_MAX);
+}
+
+/**
+ * Aggiunge al fotogramma il tratto cambiato di una riga
+ * @param s Schermo
+ * @param riga Riga
+ */
+static void aggiorna_riga(Schermo* s, int riga) {
+    const char* nuove = s->celle + (size_t)riga * SCHERMO_COLONNE_MAX;
+    const char* vecchie = s->spedite + (size_t)riga * SCHERMO_COLONNE_MAX;
+    int primo = 0;
+    int ultimo = s->colonne - 1;
+    int fine = s->colonne;
+
+    while (primo < s->colonne && nuove[primo] == vecchie[primo]) {
+        primo++;
+    }
+    if (primo == s->colonne) {
+        return;
+    }
+    while (nuove[ultimo] == vecchie[ultimo]) {
+        ultimo--;
+    }
+    while (fine > 0 && nuove[fine - 1] == ' ') {
+        fine--;
+    }
+
+    sposta_cursore(s, riga, primo);
+    if (riga == 0) { // La riga di stato e' in negativo, anche negli spazi
+        aggiungi(s, "\x1b[7m", 4);
+        aggiungi(s, nuove + primo, (size_t)(ultimo - primo + 1));
+        aggiungi(s, "\x1b[0m", 4);
+    } else if (ultimo >= fine) { // Il resto della riga e' vuoto: lo cancella il terminale
+        if (fine > primo) {
+            aggiungi(s, nuove + primo, (size_t)(fine - primo));
+        }
+        aggiungi(s, "\x1b[K", 3);
+    } else {
+        aggiungi(s, nuove + primo, (size_t)(ultimo - primo + 1));
+    }
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+Schermo* schermo_crea(FILE* uscita, int righe, int colonne) {
+    Schermo* s;
+
+    if (righe <= 0 && !isatty(fileno(uscita))) {
+        return NULL;
+    }
+    s = (Schermo*)calloc(1, sizeof(Schermo));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->uscita          = uscita;
+    s->righe_chieste   = righe;
+    s->colonne_chieste = colonne;
+    leggi_dimensioni(s, &s->righe, &s->colonne);
+    if (s->righe < SCHERMO_RIGHE_MIN || s->colonne < SCHERMO_COLONNE_MIN) {
+        free(s);
+        return NULL;
+    }
+    disponi_pannelli(s);
+    s->ridisegna = 1;
+    return s;
+}
+
+void schermo_distruggi(Schermo* s) {
+    if (s == NULL) {
+        return;
+    }
+    schermo_sospendi(s);
+    free(s->dati);
+    free(s);
+}
+
+// Lascia il buffer alternativo; il terminale mostra di nuovo quello che c'era prima
+void schermo_sospendi(Schermo* s) {
+    if (!s->attivo) {
+        return;
+    }
+    fputs("\x1b[r\x1b[?1049l", s->uscita);
+    fflush(s->uscita);
+    s->attivo    = 0;
+    s->ridisegna = 1;
+}
+
+void schermo_stato(Schermo* s, const char* testo) {
+    snprintf(s->stato, sizeof(s->stato), "%s", testo);
+}
+
+void schermo_zona(Schermo* s, const char* testo, size_t lunghezza) {
+    riempi_pannello(&s->zona, testo, lunghezza);
+}
+
+// Ogni riga del testo diventa una o piu' righe dell'anello, spezzata alla larghezza dello schermo
+void schermo_registro(Schermo* s, const char* testo, size_t lunghezza) {
+    size_t i = 0;
+
+    while (i < lunghezza) {
+        size_t fine = i;
+
+        while (fine < lunghezza && testo[fine] != '\n') {
+            fine++;
+        }
+        do {
+            size_t n = fine - i < (size_t)s->colonne ? fine - i : (size_t)s->colonne;
+            int posto = (s->primo_registro + s->num_registro) % SCHERMO_RIGHE_MAX;
+
+            memcpy(s->registro[posto], testo + i, n);
+            s->registro[posto][n] = '\0';
+            if (s->num_registro < SCHERMO_RIGHE_MAX) {
+                s->num_registro++;
+            } else {
+                s->primo_registro = (s->primo_registro + 1) % SCHERMO_RIGHE_MAX;
+            }
+            s->registro_nuove++;
+            i += n;
+        } while (i < fine);
+        i = fine + 1;
+    }
+}
+
+void schermo_menu(Schermo* s, const char* testo, size_t lunghezza) {
+    riempi_pannello(&s->menu, testo, lunghezza);
+}
+
+// Confronta il fotogramma nuovo con le celle spedite e manda solo le differenze, in una sola scrittura
+size_t schermo_disegna(Schermo* s) {
+    size_t spediti;
+    char* eco;
+    int righe;
+    int colonne;
+    int i;
+
+    leggi_dimensioni(s, &righe, &colonne);
+    if (righe != s->righe || colonne != s->colonne) {
+        if (righe < SCHERMO_RIGHE_MIN || colonne < SCHERMO_COLONNE_MIN) { // Troppo piccolo: si aspetta
+            return 0;
+        }
+        s->righe   = righe;
+        s->colonne = colonne;
+        disponi_pannelli(s);
+        s->ridisegna = 1;
+    }
+
+    componi(s);
+    s->lunghezza = 0;
+    s->guasto    = 0;
+    if (!s->attivo) { // Il primo fotogramma passa al buffer alternativo
+        aggiungi(s, "\x1b[?1049h", 8);
+    }
+    if (s->ridisegna) {
+        aggiungi(s, "\x1b[r\x1b[H\x1b[2J", 10);
+        memset(s->spedite, ' ', sizeof(s->spedite));
+    } else if (s->registro_nuove > 0 && s->registro_nuove < s->righe_registro) {
+        scorri_registro(s);
+    }
+    for (i = 0; i < s->righe; i++) {
+        aggiorna_riga(s, i);
+    }
+    sposta_cursore(s, s->riga_cursore, s->colonna_cursore);
+    if (s->guasto) { // Senza memoria per il fotogramma si riprova da capo al prossimo
+        s->ridisegna = 1;
+        return 0;
+    }
+
+    fwrite(s->dati, 1, s->lunghezza, s->uscita);
+    fflush(s->uscita);
+    spediti           = s->lunghezza;
+    s->attivo         = 1;
+    s->ridisegna      = 0;
+    s->registro_nuove = 0;
+    memcpy(s->spedite, s->celle, sizeof(s->celle));
+
+    /* L'eco di quello che scrive il giocatore sporca la richiesta dopo il cursore e l'ultima riga */
+    eco = s->spedite + (size_t)s->riga_cursore * SCHERMO_COLONNE_MAX;
+    memset(eco + s->colonna_cursore, CELLA_SPORCA, (size_t)(s->colonne - s->colonna_cursore));
+    memset(s->spedite + (size_t)(s->righe - 1) * SCHERMO_COLONNE_MAX, CELLA_SPORCA, (size_t)s->colonne);
+    return spediti;
+}
@@ -0,0 +1,69 @@
+#ifndef SCHERMO_H
+#define SCHERMO_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* ============================================================================
+ * SCHERMO A PANNELLI CON AGGIORNAMENTI INCREMENTALI
+ *
+ * Invece di far scorrere tutto il testo di ogni azione, il terminale si
+ * divide in pannelli fissi: stato (una riga in alto), zona, registro degli
+ * avvenimenti e menu (in basso, con la richiesta di input). L'ultima riga
+ * resta vuota per l'eco di quello che scrive il giocatore.
+ *
+ * Lo schermo tiene le celle dell'ultimo fotogramma spedito: schermo_disegna
+ * compone il fotogramma nuovo e manda solo le righe cambiate, e di ogni
+ * riga solo il tratto tra la prima e l'ultima cella diversa (con un
+ * cancella-fino-a-fine-riga se il resto e' vuoto). Le righe nuove del
+ * registro si aggiungono facendo scorrere al terminale la sola regione del
+ * registro, quindi le righe gia' presenti non si rispediscono. Tutto il
+ * fotogramma parte con una sola scrittura.
+ *
+ * Lo schermo usa il buffer alternativo del terminale, dal primo fotogramma
+ * fino a schermo_sospendi: poi torna il contenuto di prima e si puo'
+ * stampare normalmente. Se il terminale cambia dimensioni il fotogramma
+ * successivo si ridisegna per intero.
+ * ============================================================================ */
+
+/* Righe e colonne al massimo usate dello schermo */
+#define SCHERMO_RIGHE_MAX     200
+#define SCHERMO_COLONNE_MAX   256
+
+/* Righe al minimo del terminale per usare i pannelli */
+#define SCHERMO_RIGHE_MIN     16
+#define SCHERMO_COLONNE_MIN   40
+
+// Schermo a pannelli; definito in schermo.c
+typedef struct Schermo Schermo;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//crea uno schermo sul terminale di uscita (righe e colonne 0 per chiederle al terminale);
+//NULL se l'uscita non e' un terminale, e' troppo piccola o manca la memoria
+Schermo* schermo_crea(FILE* uscita, int righe, int colonne);
+
+//riporta il terminale com'era e libera lo schermo
+void schermo_distruggi(Schermo* s);
+
+//riporta il terminale com'era; il prossimo fotogramma torna al buffer alternativo e ridisegna tutto
+void schermo_sospendi(Schermo* s);
+
+//sostituisce il testo della riga di stato
+void schermo_stato(Schermo* s, const char* testo);
+
+//sostituisce il testo del pannello della zona (le righe vuote si saltano)
+void schermo_zona(Schermo* s, const char* testo, size_t lunghezza);
+
+//aggiunge righe in fondo al registro; le righe piu' lunghe dello schermo vanno a capo
+void schermo_registro(Schermo* s, const char* testo, size_t lunghezza);
+
+//sostituisce il testo del menu (le righe vuote si saltano); l'ultima riga e' la richiesta di input
+void schermo_menu(Schermo* s, const char* testo, size_t lunghezza);
+
+//spedisce al terminale le differenze dall'ultimo fotogramma; restituisce i byte spediti
+size_t schermo_disegna(Schermo* s);
+
+#endif
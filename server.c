@@ -0,0 +1,1174 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cronaca.h"
+#include "esecutore.h"
+#include "gamelib.h"
+#include "giornale.h"
+#include "metriche.h"
+#include "salvataggio.h"
+#include "server.h"
+
+#define MAX_EVENTI 256
+
+/* Secchi della tabella delle sessioni orfane (potenza di 2) */
+#define SECCHI_ORFANE 1024
+
+/* Client della porta delle metriche serviti insieme, e secondi concessi a ciascuno per la richiesta */
+#define CLIENTI_METRICHE  16
+#define TIMEOUT_METRICHE   5
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Una connessione di un client con la sua partita
+typedef struct Connessione {
+    Compito compito;                     /* Primo campo: il compito di lettura e' la connessione */
+    int esito_lettura;                   /* Ultima ricevi_righe: 1 dati ricevuti, 0 nessuno, -1 client chiuso */
+    int fd;
+    Partita* partita;
+    size_t inviati;                      /* Byte dell'uscita della partita gia' spediti */
+    int chiudi_dopo_invio;               /* La sessione e' finita: chiudere appena spedito tutto */
+    int attende_scrittura;               /* Registrata per EPOLLOUT (socket pieno) */
+    int lettura_sospesa;                 /* Troppo testo in attesa o sessione finita: non si legge piu' */
+    int scarta_riga;                     /* La riga corrente ha superato SERVER_RIGA_MAX */
+    int salvata;                         /* La partita ha un'istantanea nel salvataggio */
+    int righe_salvate;                   /* Righe salvate dopo l'ultima istantanea */
+    int attende_conferma;                /* L'uscita si spedisce dopo la conferma del salvataggio */
+    uint64_t lotto_atteso;               /* Lotto del salvataggio con l'ultima riga della sessione */
+    uint64_t codice;                     /* Codice della sessione nel salvataggio */
+    time_t ultima_attivita;
+    struct Connessione* prec;            /* Lista in ordine di attivita', la piu' vecchia in testa */
+    struct Connessione* succ;
+    size_t len_ingresso;
+    char ingresso[SERVER_RIGA_MAX];      /* Riga in costruzione */
+} Connessione;
+
+// Client della porta delle metriche che non ha ancora mandato la sua richiesta
+typedef struct {
+    int fd;                              /* -1 se il posto e' libero */
+    time_t dal;
+} Cliente_metriche;
+
+// Partita ripristinata dal salvataggio che aspetta il suo client ("riprendi <codice>")
+typedef struct Sessione_orfana {
+    uint64_t codice;
+    Partita* partita;
+    int righe_salvate;
+    struct Sessione_orfana* succ;        /* Prossima orfana dello stesso secchio */
+} Sessione_orfana;
+
+/* Stato del server */
+static int epfd = -1;
+static Connessione* piu_vecchia = NULL;
+static Connessione* piu_recente = NULL;
+static int num_connessioni = 0;
+static const Mappa_condivisa* mappa_del_giorno = NULL;  /* Mappa di tutte le nuove partite, o NULL */
+
+/* Salvataggio delle sessioni, o NULL */
+static Salvataggio* salvataggio = NULL;
+static Esecutore* esecutore = NULL;      /* Legge le connessioni pronte, NULL se lo fa il ciclo epoll */
+static int lavoratori = -1;              /* Da server_usa_lavoratori, -1 senza esecutore */
+static pthread_mutex_t condivisi = PTHREAD_MUTEX_INITIALIZER; /* Salvataggio, uscite trattenute e orfane durante le letture */
+static int segnale_salvataggio;          /* Il suo indirizzo identifica in epoll la notifica del salvataggio */
+static Connessione** in_attesa = NULL;   /* Connessioni con l'uscita trattenuta fino alla conferma */
+static int num_in_attesa = 0;
+static int capacita_in_attesa = 0;
+static Sessione_orfana* orfane[SECCHI_ORFANE];
+static int num_orfane = 0;
+static time_t orfane_dal;                /* Istante del ripristino, da cui scade il tempo per riprenderle */
+
+/* Esposizione delle metriche */
+static const char* indirizzo_metriche = NULL;  /* Porta per Prometheus, o NULL */
+static const char* file_metriche = NULL;       /* File scritto a ogni SIGUSR1, o NULL */
+static const char* file_traccia = NULL;        /* File della traccia JSON scritto a ogni SIGUSR1, o NULL */
+static int ascolto_metriche = -1;
+static int segnale_metriche;             /* Il suo indirizzo identifica in epoll la porta delle metriche */
+static Cliente_metriche clienti_metriche[CLIENTI_METRICHE];
+static volatile sig_atomic_t metriche_richieste = 0;
+
+/* ============================================================================
+ * LISTA DELLE CONNESSIONI (TIMEOUT DI INATTIVITA')
+ * ============================================================================ */
+
+/**
+ * Toglie una connessione dalla lista di attivita'
+ * @param c Connessione
+ */
+static void stacca_connessione(Connessione* c) {
+    if (c->prec != NULL) {
+        c->prec->succ = c->succ;
+    } else {
+        piu_vecchia = c->succ;
+    }
+    if (c->succ != NULL) {
+        c->succ->prec = c->prec;
+    } else {
+        piu_recente = c->prec;
+    }
+    c->prec = NULL;
+    c->succ = NULL;
+}
+
+/**
+ * Segna attivita' sulla connessione spostandola in fondo alla lista
+ * La lista resta ordinata per ultima attivita' senza scansioni
+ * @param c Connessione
+ * @param adesso Istante corrente
+ */
+static void tocca_connessione(Connessione* c, time_t adesso) {
+    if (piu_recente != c) {
+        if (c->prec != NULL || c->succ != NULL || piu_vecchia == c) {
+            stacca_connessione(c);
+        }
+        c->prec = piu_recente;
+        if (piu_recente != NULL) {
+            piu_recente->succ = c;
+        } else {
+            piu_vecchia = c;
+        }
+        piu_recente = c;
+    }
+    c->ultima_attivita = adesso;
+}
+
+/* ============================================================================
+ * GESTIONE DELLE CONNESSIONI
+ * ============================================================================ */
+
+/**
+ * Chiude il socket e libera la connessione con la sua partita
+ * @param c Connessione
+ */
+static void chiudi_connessione(Connessione* c) {
+    int i;
+
+    if (c->salvata) { // La partita finisce qui: al ripristino non va ricostruita
+        salvataggio_aggiungi(salvataggio, RECORD_FINE, c->codice, NULL, 0);
+    }
+    if (c->attende_conferma) {
+        for (i = 0; i < num_in_attesa; i++) {
+            if (in_attesa[i] == c) {
+                in_attesa[i] = NULL;
+            }
+        }
+    }
+    stacca_connessione(c);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    partita_distruggi(c->partita);
+    free(c);
+    num_connessioni--;
+    GIORNALE(GIORNALE_INFO, "connessione chiusa, ne restano %lld", num_connessioni);
+}
+
+/**
+ * Aggiorna gli eventi epoll di interesse in base allo stato della connessione
+ * @param c Connessione
+ */
+static void aggiorna_eventi(Connessione* c) {
+    struct epoll_event ev;
+
+    ev.events   = c->chiudi_dopo_invio ? 0 : EPOLLRDHUP; // Sessione finita: l'ingresso non serve piu'
+    ev.data.ptr = c;
+    if (!c->lettura_sospesa) {
+        ev.events |= EPOLLIN;
+    }
+    if (c->attende_scrittura) {
+        ev.events |= EPOLLOUT;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/**
+ * Spedisce al client il testo prodotto dalla partita, finche' il socket lo accetta
+ * @param c Connessione
+ * @return 0 se la connessione resta aperta, -1 se e' stata chiusa
+ */
+static int invia_uscita(Connessione* c) {
+    size_t lunghezza;
+    const char* testo = partita_uscita(c->partita, &lunghezza);
+    int sospesa   = c->lettura_sospesa;
+    int in_attesa = c->attende_scrittura;
+
+    while (c->inviati < lunghezza) {
+        ssize_t n = send(c->fd, testo + c->inviati, lunghezza - c->inviati, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { // Socket pieno: si riprende con EPOLLOUT
+                break;
+            }
+            chiudi_connessione(c);
+            return -1;
+        }
+        c->inviati += (size_t)n;
+    }
+
+    if (c->inviati == lunghezza) { // Tutto spedito: il buffer della partita si puo' liberare
+        partita_svuota_uscita(c->partita);
+        partita_compatta(c->partita);
+        c->inviati = 0;
+        lunghezza  = 0;
+        if (c->chiudi_dopo_invio) {
+            chiudi_connessione(c);
+            return -1;
+        }
+    }
+
+    c->attende_scrittura = c->inviati < lunghezza;
+    c->lettura_sospesa   = c->chiudi_dopo_invio || lunghezza - c->inviati > SERVER_USCITA_MAX;
+    if (c->attende_scrittura != in_attesa || c->lettura_sospesa != sospesa) {
+        aggiorna_eventi(c);
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * SALVATAGGIO DELLE SESSIONI
+ *
+ * Quando una partita entra nei turni di gioco il server ne salva
+ * un'istantanea, poi ogni riga che riceve; ogni SERVER_RIGHE_ISTANTANEA
+ * righe un'istantanea nuova sostituisce le precedenti. I record di ogni
+ * giro del ciclo epoll formano un lotto che il thread di scrittura porta
+ * su disco mentre il ciclo continua; le uscite prodotte da queste righe
+ * vengono spedite solo quando il loro lotto e' confermato: un client non
+ * vede mai lo stato di una partita che un crash potrebbe cancellare.
+ * ============================================================================ */
+
+/**
+ * Cerca una sessione orfana nella tabella
+ * @param codice Codice della sessione
+ * @return Posto che punta all'orfana, o al NULL in fondo al suo secchio se non c'e'
+ */
+static Sessione_orfana** cerca_orfana(uint64_t codice) {
+    Sessione_orfana** o = &orfane[codice & (SECCHI_ORFANE - 1)];
+
+    while (*o != NULL && (*o)->codice != codice) {
+        o = &(*o)->succ;
+    }
+    return o;
+}
+
+/**
+ * Toglie una sessione orfana dalla tabella
+ * @param o Posto che punta all'orfana
+ * @return Partita dell'orfana, che passa al chiamante
+ */
+static Partita* stacca_orfana(Sessione_orfana** o) {
+    Sessione_orfana* orfana = *o;
+    Partita* p = orfana->partita;
+
+    *o = orfana->succ;
+    free(orfana);
+    num_orfane--;
+    return p;
+}
+
+/**
+ * Genera il codice di una nuova sessione
+ * @return Codice diverso da 0 e da quelli delle sessioni orfane
+ */
+static uint64_t nuovo_codice(void) {
+    static uint64_t contatore = 0;
+    uint64_t codice = 0;
+
+    while (codice == 0 || *cerca_orfana(codice) != NULL) {
+        if (getrandom(&codice, sizeof(codice), GRND_NONBLOCK) != (ssize_t)sizeof(codice)) {
+            codice = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ ++contatore;
+        }
+    }
+    return codice;
+}
+
+/**
+ * Accoda al salvataggio l'istantanea di una partita
+ * @param codice Codice della sessione
+ * @param p Partita nei turni di gioco
+ * @return 1 se accodata, 0 se la memoria non basta
+ */
+static int salva_istantanea(uint64_t codice, Partita* p) {
+    unsigned char* dati;
+    size_t n = partita_istantanea(p, &dati);
+    int esito;
+
+    pthread_mutex_lock(&condivisi);
+    esito = n > 0 && salvataggio_aggiungi(salvataggio, RECORD_ISTANTANEA, codice, dati, n);
+    pthread_mutex_unlock(&condivisi);
+    free(dati);
+    return esito;
+}
+
+/**
+ * Trattiene l'uscita della connessione finche' il lotto in corso del salvataggio non e' confermato
+ * Senza memoria per trattenerla l'uscita parte subito. Durante le letture va chiamata con condivisi
+ * @param c Connessione
+ */
+static void trattieni_uscita(Connessione* c) {
+    c->lotto_atteso = salvataggio_lotto(salvataggio);
+    if (c->attende_conferma) {
+        return;
+    }
+    if (num_in_attesa == capacita_in_attesa) {
+        int nuova_capacita = capacita_in_attesa > 0 ? capacita_in_attesa * 2 : MAX_EVENTI;
+        Connessione** nuove = (Connessione**)realloc(in_attesa, (size_t)nuova_capacita * sizeof(Connessione*));
+
+        if (nuove == NULL) {
+            return;
+        }
+        in_attesa          = nuove;
+        capacita_in_attesa = nuova_capacita;
+    }
+    in_attesa[num_in_attesa++] = c;
+    c->attende_conferma = 1;
+}
+
+/**
+ * Salva la riga appena consegnata alla partita di una connessione
+ * Se un record non si puo' accodare la sessione riparte alla riga
+ * successiva con un'istantanea nuova
+ * @param c Connessione
+ * @param riga Riga consegnata
+ */
+static void salva_riga(Connessione* c, const char* riga) {
+    if (!partita_in_gioco(c->partita)) {
+        if (c->salvata) { // Partita finita o abbandonata
+            pthread_mutex_lock(&condivisi);
+            salvataggio_aggiungi(salvataggio, RECORD_FINE, c->codice, NULL, 0);
+            c->salvata = 0;
+            trattieni_uscita(c);
+            pthread_mutex_unlock(&condivisi);
+        }
+        return;
+    }
+
+    if (c->salvata && c->righe_salvate < SERVER_RIGHE_ISTANTANEA) {
+        pthread_mutex_lock(&condivisi);
+        c->salvata = salvataggio_aggiungi(salvataggio, RECORD_RIGA, c->codice, riga, strlen(riga));
+        pthread_mutex_unlock(&condivisi);
+        c->righe_salvate++;
+    } else {
+        c->salvata       = salva_istantanea(c->codice, c->partita);
+        c->righe_salvate = 0;
+    }
+    pthread_mutex_lock(&condivisi);
+    trattieni_uscita(c);
+    pthread_mutex_unlock(&condivisi);
+}
+
+/**
+ * Affida a una connessione la sessione orfana con il codice scritto dal client
+ * @param c Connessione
+ * @param testo Codice in esadecimale
+ */
+static void riprendi_sessione(Connessione* c, const char* testo) {
+    Sessione_orfana** o;
+    char* fine;
+    uint64_t codice = strtoull(testo, &fine, 16);
+
+    pthread_mutex_lock(&condivisi);
+    o = cerca_orfana(codice);
+    if (fine == testo || *o == NULL) { // L'avviso segue l'uscita ancora da spedire, con invia_uscita
+        pthread_mutex_unlock(&condivisi);
+        partita_scrivi(c->partita, "Nessuna partita da riprendere con questo codice.\n");
+        return;
+    }
+
+    partita_distruggi(c->partita);
+    c->righe_salvate = (*o)->righe_salvate;
+    c->partita       = stacca_orfana(o);
+    pthread_mutex_unlock(&condivisi);
+    c->codice        = codice;
+    c->salvata       = 1;
+    c->inviati       = 0;
+    partita_riprendi(c->partita);
+}
+
+/**
+ * Riscrive il salvataggio in un file nuovo con un'istantanea di ogni sessione da ripristinare
+ */
+static void compatta_salvataggio(void) {
+    Connessione* c;
+    Sessione_orfana* o;
+    int i;
+
+    if (salvataggio_nuovo_file(salvataggio) < 0) {
+        return;
+    }
+    for (c = piu_vecchia; c != NULL; c = c->succ) {
+        if (c->salvata) {
+            c->salvata       = salva_istantanea(c->codice, c->partita);
+            c->righe_salvate = 0;
+        }
+    }
+    for (i = 0; i < SECCHI_ORFANE; i++) {
+        for (o = orfane[i]; o != NULL; o = o->succ) {
+            salva_istantanea(o->codice, o->partita);
+            o->righe_salvate = 0;
+        }
+    }
+    if (salvataggio_conferma(salvataggio) < 0) {
+        perror("salvataggio");
+    }
+}
+
+/**
+ * Spedisce le uscite trattenute il cui lotto e' ormai su disco
+ */
+static void rilascia_confermate(void) {
+    uint64_t confermato = salvataggio_confermato(salvataggio);
+    int rimaste = 0;
+    int i;
+
+    for (i = 0; i < num_in_attesa; i++) {
+        Connessione* c = in_attesa[i];
+
+        if (c != NULL && c->lotto_atteso > confermato) {
+            in_attesa[rimaste++] = c;
+        } else if (c != NULL) {
+            in_attesa[i]        = NULL;
+            c->attende_conferma = 0;
+            invia_uscita(c); // Se chiude la connessione non trova piu' c tra quelle in attesa
+        }
+    }
+    num_in_attesa = rimaste;
+}
+
+/**
+ * Chiude il lotto del giro di epoll passandolo al thread di scrittura
+ * e riscrive il salvataggio se e' diventato troppo grande
+ */
+static void chiudi_lotto(void) {
+    if (salvataggio_dimensione(salvataggio) > SERVER_SALVATAGGIO_MAX) {
+        compatta_salvataggio();
+    }
+    salvataggio_spedisci(salvataggio);
+}
+
+/**
+ * Ricostruisce una sessione orfana da un record del salvataggio
+ * @param contesto Non usato
+ * @param tipo Tipo del record
+ * @param sessione Codice della sessione
+ * @param dati Contenuto del record
+ * @param n Byte del contenuto
+ */
+static void ripristina_record(void* contesto, Tipo_record tipo, uint64_t sessione,
+                             const unsigned char* dati, size_t n) {
+    Sessione_orfana** o = cerca_orfana(sessione);
+    char riga[SERVER_RIGA_MAX];
+    Partita* p;
+
+    (void)contesto;
+    switch (tipo) {
+        case RECORD_ISTANTANEA:
+            p = partita_crea();
+            if (p != NULL && mappa_del_giorno != NULL) {
+                partita_usa_mappa_condivisa(p, mappa_del_giorno);
+            }
+            if (p == NULL || !partita_ripristina(p, dati, n)) {
+                fprintf(stderr, "Salvataggio: impossibile ripristinare la sessione %016llx\n", (unsigned long long)sessione);
+                partita_distruggi(p);
+                if (*o != NULL) {
+                    partita_distruggi(stacca_orfana(o));
+                }
+                return;
+            }
+            if (*o == NULL) {
+                *o = (Sessione_orfana*)calloc(1, sizeof(Sessione_orfana));
+                if (*o == NULL) {
+                    partita_distruggi(p);
+                    return;
+                }
+                (*o)->codice = sessione;
+                num_orfane++;
+            } else {
+                partita_distruggi((*o)->partita);
+            }
+            (*o)->partita       = p;
+            (*o)->righe_salvate = 0;
+            break;
+
+        case RECORD_RIGA:
+            if (*o == NULL || n >= sizeof(riga)) {
+                return;
+            }
+            memcpy(riga, dati, n);
+            riga[n] = '\0';
+            partita_invia((*o)->partita, riga);
+            partita_svuota_uscita((*o)->partita);
+            (*o)->righe_salvate++;
+            if (!partita_in_gioco((*o)->partita)) {
+                partita_distruggi(stacca_orfana(o));
+            }
+            break;
+
+        case RECORD_FINE:
+            if (*o != NULL) {
+                partita_distruggi(stacca_orfana(o));
+            }
+            break;
+    }
+}
+
+/**
+ * Apre il salvataggio e ricostruisce le sessioni che erano in gioco
+ * @param percorso File di salvataggio
+ * @param adesso Istante corrente
+ * @return 0 se riuscito, -1 in caso di errore
+ */
+static int apri_salvataggio(const char* percorso, time_t adesso) {
+    salvataggio = salvataggio_apri(percorso);
+    if (salvataggio == NULL) {
+        return -1;
+    }
+    if (salvataggio_leggi(salvataggio, ripristina_record, NULL) < 0) {
+        salvataggio_chiudi(salvataggio);
+        salvataggio = NULL;
+        return -1;
+    }
+    orfane_dal = adesso;
+    compatta_salvataggio(); // Il file riparte dalle sole istantanee delle sessioni ripristinate
+    fprintf(stderr, "Salvataggio %s: %d partite da riprendere\n", percorso, num_orfane);
+    return 0;
+}
+
+/**
+ * Abbandona le sessioni orfane che nessun client ha ripreso in tempo
+ * @param adesso Istante corrente
+ */
+static void scadi_orfane(time_t adesso) {
+    int i;
+
+    if (num_orfane == 0 || adesso - orfane_dal < SERVER_TIMEOUT_INATTIVITA) {
+        return;
+    }
+    for (i = 0; i < SECCHI_ORFANE; i++) {
+        while (orfane[i] != NULL) {
+            salvataggio_aggiungi(salvataggio, RECORD_FINE, orfane[i]->codice, NULL, 0);
+            partita_distruggi(stacca_orfana(&orfane[i]));
+        }
+    }
+}
+
+/**
+ * Consegna alla partita una riga completa, salvandola se il server ha un salvataggio
+ * @param c Connessione con la riga in ingresso
+ */
+static void consegna_riga(Connessione* c) {
+    if (salvataggio != NULL && !c->salvata && strncmp(c->ingresso, "riprendi ", 9) == 0) {
+        riprendi_sessione(c, c->ingresso + 9);
+        return;
+    }
+    if (strcmp(c->ingresso, "compatto") == 0) { // Scelta del client, non della partita: non si salva
+        partita_usa_messaggi_compatti(c->partita, 1);
+        return;
+    }
+    if (!partita_invia(c->partita, c->ingresso)) { // La sessione e' terminata
+        c->chiudi_dopo_invio = 1;
+    }
+    if (salvataggio != NULL) {
+        salva_riga(c, c->ingresso);
+    }
+}
+
+/**
+ * Consegna alla partita le righe complete presenti nei dati ricevuti
+ * @param c Connessione
+ * @param dati Byte letti dal socket
+ * @param n Numero di byte
+ */
+static void consegna_righe(Connessione* c, const char* dati, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && !c->chiudi_dopo_invio; i++) {
+        if (dati[i] == '\n') {
+            if (!c->scarta_riga) {
+                c->ingresso[c->len_ingresso] = '\0';
+                consegna_riga(c);
+            }
+            c->len_ingresso = 0;
+            c->scarta_riga  = 0;
+        } else if (c->len_ingresso < SERVER_RIGA_MAX - 1) {
+            c->ingresso[c->len_ingresso++] = dati[i];
+        } else {
+            c->scarta_riga = 1;
+        }
+    }
+}
+
+/**
+ * Legge tutto il disponibile dal socket e lo consegna alla partita, scrivendo l'esito in esito_lettura
+ * Puo' girare su un lavoratore: tocca solo la connessione, il resto passa per condivisi
+ * @param c Connessione
+ */
+static void ricevi_righe(Connessione* c) {
+    char dati[4096];
+
+    c->esito_lettura = 0;
+    while (!c->chiudi_dopo_invio) {
+        ssize_t n = recv(c->fd, dati, sizeof(dati), 0);
+        if (n > 0) {
+            consegna_righe(c, dati, (size_t)n);
+            c->esito_lettura = 1;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        c->esito_lettura = -1; // Il client ha chiuso o errore di lettura
+        return;
+    }
+}
+
+/**
+ * Compito dell'esecutore: legge una connessione pronta
+ * @param t Compito, primo campo della connessione
+ */
+static void esegui_lettura(Compito* t) {
+    ricevi_righe((Connessione*)t);
+}
+
+/**
+ * Fa leggere una connessione pronta all'esecutore, o subito se non c'e'
+ * @param c Connessione
+ */
+static void avvia_lettura(Connessione* c) {
+    if (esecutore != NULL) {
+        esecutore_invia(esecutore, &c->compito);
+    } else {
+        ricevi_righe(c);
+    }
+}
+
+/**
+ * Completa la lettura di una connessione nel ciclo epoll, dopo esecutore_attendi
+ * @param c Connessione
+ * @param adesso Istante corrente
+ * @return 0 se la connessione resta aperta, -1 se e' stata chiusa
+ */
+static int concludi_lettura(Connessione* c, time_t adesso) {
+    if (c->esito_lettura < 0) {
+        chiudi_connessione(c);
+        return -1;
+    }
+    if (c->esito_lettura > 0) {
+        tocca_connessione(c, adesso);
+    }
+    if (c->chiudi_dopo_invio && !c->lettura_sospesa) { // Non si legge piu': EPOLLIN non deve svegliare il ciclo
+        c->lettura_sospesa = 1;
+        aggiorna_eventi(c);
+    }
+    if (c->attende_conferma) { // Si spedisce in conferma_salvataggio
+        return 0;
+    }
+    return invia_uscita(c);
+}
+
+/**
+ * Accetta tutte le connessioni in attesa sul socket di ascolto
+ * @param ascolto Socket di ascolto
+ * @param adesso Istante corrente
+ */
+static void accetta_connessioni(int ascolto, time_t adesso) {
+    while (1) {
+        struct epoll_event ev;
+        Connessione* c;
+        int fd = accept4(ascolto, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        c = (Connessione*)calloc(1, sizeof(Connessione));
+        if (c != NULL) {
+            c->partita = partita_crea();
+        }
+        if (c == NULL || c->partita == NULL) {
+            fprintf(stderr, "Errore: memoria insufficiente per una nuova connessione!\n");
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        compito_inizializza(&c->compito, esegui_lettura);
+        c->fd       = fd;
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            partita_distruggi(c->partita);
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        num_connessioni++;
+        GIORNALE(GIORNALE_INFO, "connessione aperta (fd %lld), connessioni %lld", fd, num_connessioni);
+        tocca_connessione(c, adesso);
+        if (mappa_del_giorno != NULL) {
+            partita_usa_mappa_condivisa(c->partita, mappa_del_giorno);
+        }
+        if (salvataggio != NULL) { // Il codice serve per riprendere la partita dopo un crash del server
+            char avviso[160];
+            ssize_t ignorato;
+            int n;
+
+            c->codice = nuovo_codice();
+            n = snprintf(avviso, sizeof(avviso), "Codice della sessione: %016llx\n"
+                         "(se il server si interrompe, riconnettiti e scrivi \"riprendi <codice>\")\n",
+                         (unsigned long long)c->codice);
+            ignorato = send(fd, avviso, (size_t)n, MSG_NOSIGNAL);
+            (void)ignorato;
+        }
+        partita_apri(c->partita);
+        invia_uscita(c);
+    }
+}
+
+/* ============================================================================
+ * METRICHE (PORTA PER PROMETHEUS E SIGUSR1)
+ * ============================================================================ */
+
+/**
+ * Gestore di SIGUSR1: le metriche si scrivono nel ciclo principale, non nel gestore
+ * @param segnale Segnale ricevuto
+ */
+static void richiedi_metriche(int segnale) {
+    (void)segnale;
+    metriche_richieste = 1;
+}
+
+/**
+ * Restituisce il client delle metriche a cui appartiene un evento
+ * @param dato Puntatore dell'evento di epoll
+ * @return Client delle metriche, NULL se l'evento e' di un'altra sorgente
+ */
+static Cliente_metriche* cliente_metriche(void* dato) {
+    uintptr_t scarto = (uintptr_t)dato - (uintptr_t)clienti_metriche;
+
+    return scarto < sizeof(clienti_metriche) ? (Cliente_metriche*)dato : NULL;
+}
+
+/**
+ * Accetta i client della porta delle metriche, finche' ci sono posti liberi
+ * @param adesso Istante corrente
+ */
+static void accetta_metriche(time_t adesso) {
+    while (1) {
+        struct epoll_event ev;
+        int i;
+        int fd = accept4(ascolto_metriche, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        for (i = 0; i < CLIENTI_METRICHE && clienti_metriche[i].fd >= 0; i++) {
+        }
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = &clienti_metriche[i];
+        if (i == CLIENTI_METRICHE || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        clienti_metriche[i].fd  = fd;
+        clienti_metriche[i].dal = adesso;
+    }
+}
+
+/**
+ * Risponde alla richiesta HTTP di un client delle metriche e lo chiude: "GET /traccia" riceve la
+ * traccia JSON dei comandi, qualunque altra richiesta il testo di Prometheus. Il resto della richiesta
+ * si legge solo per non chiudere con dati non letti, che farebbero mandare un reset al posto della risposta
+ * @param m Client delle metriche
+ */
+static void rispondi_metriche(Cliente_metriche* m) {
+    static const char errore[] = "HTTP/1.0 500 Internal Server Error\r\nConnection: close\r\n\r\n";
+    char richiesta[4096];
+    char intestazione[160];
+    char* testo;
+    size_t n;
+    int lunghezza;
+    int traccia;
+    ssize_t letti = recv(m->fd, richiesta, sizeof(richiesta), 0);
+    ssize_t ignorato;
+
+    traccia = letti >= 12 && memcmp(richiesta, "GET /traccia", 12) == 0;
+    while (letti == (ssize_t)sizeof(richiesta)) {
+        letti = recv(m->fd, richiesta, sizeof(richiesta), 0);
+    }
+    n = traccia ? metriche_traccia(&testo) : metriche_testo(&testo);
+    if (n == 0) {
+        ignorato = send(m->fd, errore, sizeof(errore) - 1, MSG_NOSIGNAL);
+    } else {
+        lunghezza = snprintf(intestazione, sizeof(intestazione), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+                             "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                             traccia ? "application/json" : "text/plain; version=0.0.4", n);
+        ignorato = send(m->fd, intestazione, (size_t)lunghezza, MSG_NOSIGNAL | MSG_MORE);
+        ignorato = send(m->fd, testo, n, MSG_NOSIGNAL);
+        free(testo);
+    }
+    (void)ignorato;
+    close(m->fd);
+    m->fd = -1;
+}
+
+/**
+ * Chiude i client delle metriche che non hanno mandato la richiesta entro TIMEOUT_METRICHE secondi
+ * @param adesso Istante corrente
+ */
+static void scadi_clienti_metriche(time_t adesso) {
+    int i;
+
+    for (i = 0; i < CLIENTI_METRICHE; i++) {
+        if (clienti_metriche[i].fd >= 0 && adesso - clienti_metriche[i].dal >= TIMEOUT_METRICHE) {
+            close(clienti_metriche[i].fd);
+            clienti_metriche[i].fd = -1;
+        }
+    }
+}
+
+/**
+ * Chiude le connessioni rimaste inattive oltre SERVER_TIMEOUT_INATTIVITA
+ * Scorre solo la testa della lista, che contiene le piu' vecchie
+ * @param adesso Istante corrente
+ */
+static void chiudi_inattive(time_t adesso) {
+    static const char avviso[] = "\nDisconnesso per inattivita'.\n";
+
+    while (piu_vecchia != NULL && adesso - piu_vecchia->ultima_attivita >= SERVER_TIMEOUT_INATTIVITA) {
+        Connessione* c = piu_vecchia;
+        ssize_t ignorato = send(c->fd, avviso, sizeof(avviso) - 1, MSG_NOSIGNAL);
+        (void)ignorato;
+        chiudi_connessione(c);
+    }
+    if (salvataggio != NULL) {
+        scadi_orfane(adesso);
+    }
+    if (ascolto_metriche >= 0) {
+        scadi_clienti_metriche(adesso);
+    }
+}
+
+/* ============================================================================
+ * SOCKET DI ASCOLTO
+ * ============================================================================ */
+
+/**
+ * Apre un socket Unix in ascolto sul percorso dato
+ * @param percorso Percorso del socket (un file esistente viene sostituito)
+ * @return Descrittore del socket, -1 in caso di errore
+ */
+static int ascolta_unix(const char* percorso) {
+    struct sockaddr_un indirizzo;
+    int fd;
+
+    if (strlen(percorso) >= sizeof(indirizzo.sun_path)) {
+        fprintf(stderr, "Errore: percorso del socket troppo lungo!\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&indirizzo, 0, sizeof(indirizzo));
+    indirizzo.sun_family = AF_UNIX;
+    strcpy(indirizzo.sun_path, percorso);
+    unlink(percorso);
+
+    if (bind(fd, (struct sockaddr*)&indirizzo, sizeof(indirizzo)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("bind/listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Apre un socket TCP in ascolto su "porta" o "host:porta"
+ * @param indirizzo Indirizzo da interpretare
+ * @return Descrittore del socket, -1 in caso di errore
+ */
+static int ascolta_tcp(const char* indirizzo) {
+    struct addrinfo suggerimenti;
+    struct addrinfo* risultati;
+    struct addrinfo* r;
+    char host[256];
+    const char* porta = indirizzo;
+    const char* due_punti = strrchr(indirizzo, ':');
+    int fd = -1;
+    int errore;
+
+    host[0] = '\0';
+    if (due_punti != NULL) {
+        size_t len = (size_t)(due_punti - indirizzo);
+        if (len >= sizeof(host)) {
+            fprintf(stderr, "Errore: nome host troppo lungo!\n");
+            return -1;
+        }
+        memcpy(host, indirizzo, len);
+        host[len] = '\0';
+        porta = due_punti + 1;
+    }
+
+    memset(&suggerimenti, 0, sizeof(suggerimenti));
+    suggerimenti.ai_family   = AF_UNSPEC;
+    suggerimenti.ai_socktype = SOCK_STREAM;
+    suggerimenti.ai_flags    = AI_PASSIVE;
+
+    errore = getaddrinfo(host[0] != '\0' ? host : NULL, porta, &suggerimenti, &risultati);
+    if (errore != 0) {
+        fprintf(stderr, "Errore: indirizzo non valido (%s)\n", gai_strerror(errore));
+        return -1;
+    }
+
+    for (r = risultati; r != NULL; r = r->ai_next) {
+        int si = 1;
+
+        fd = socket(r->ai_family, r->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, r->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &si, sizeof(si));
+        if (bind(fd, r->ai_addr, r->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(risultati);
+
+    if (fd < 0) {
+        perror("bind/listen");
+    }
+    return fd;
+}
+
+/**
+ * Apre un socket in ascolto su "porta", "host:porta" oppure "unix:/percorso"
+ * @param indirizzo Indirizzo di ascolto
+ * @return Descrittore del socket, -1 in caso di errore
+ */
+static int apri_ascolto(const char* indirizzo) {
+    if (strncmp(indirizzo, "unix:", 5) == 0) {
+        return ascolta_unix(indirizzo + 5);
+    }
+    return ascolta_tcp(indirizzo);
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+void server_usa_metriche(const char* indirizzo, const char* percorso, const char* percorso_traccia) {
+    indirizzo_metriche = indirizzo;
+    file_metriche      = percorso;
+    file_traccia       = percorso_traccia;
+}
+
+void server_usa_lavoratori(int n) {
+    lavoratori = n;
+}
+
+int server_avvia(const char* indirizzo, const Mappa_condivisa* mappa, const char* percorso_salvataggio) {
+    struct epoll_event eventi[MAX_EVENTI];
+    struct epoll_event ev;
+    int ascolto;
+
+    signal(SIGPIPE, SIG_IGN);
+    mappa_del_giorno = mappa;
+    if (percorso_salvataggio != NULL && apri_salvataggio(percorso_salvataggio, time(NULL)) < 0) {
+        return -1;
+    }
+
+    ascolto = apri_ascolto(indirizzo);
+    if (ascolto < 0) {
+        return -1;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        close(ascolto);
+        return -1;
+    }
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL; // NULL identifica il socket di ascolto
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, ascolto, &ev) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
+        close(ascolto);
+        return -1;
+    }
+
+    if (salvataggio != NULL) {
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &segnale_salvataggio;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, salvataggio_notifica(salvataggio), &ev) < 0) {
+            perror("epoll_ctl");
+            close(epfd);
+            close(ascolto);
+            return -1;
+        }
+    }
+
+    if (indirizzo_metriche != NULL) {
+        int i;
+
+        for (i = 0; i < CLIENTI_METRICHE; i++) {
+            clienti_metriche[i].fd = -1;
+        }
+        ascolto_metriche = apri_ascolto(indirizzo_metriche);
+        ev.events        = EPOLLIN;
+        ev.data.ptr      = &segnale_metriche;
+        if (ascolto_metriche < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, ascolto_metriche, &ev) < 0) {
+            if (ascolto_metriche >= 0) {
+                perror("epoll_ctl");
+                close(ascolto_metriche);
+            }
+            close(epfd);
+            close(ascolto);
+            return -1;
+        }
+        fprintf(stderr, "Metriche su %s\n", indirizzo_metriche);
+    }
+    if (file_metriche != NULL || file_traccia != NULL) { // Senza SA_RESTART: il segnale interrompe epoll_wait
+        struct sigaction azione;
+
+        memset(&azione, 0, sizeof(azione));
+        azione.sa_handler = richiedi_metriche;
+        sigemptyset(&azione.sa_mask);
+        sigaction(SIGUSR1, &azione, NULL);
+    }
+
+    if (lavoratori >= 0) {
+        esecutore = esecutore_crea(lavoratori);
+        if (esecutore == NULL) {
+            fprintf(stderr, "Errore: impossibile avviare i lavoratori!\n");
+            close(epfd);
+            close(ascolto);
+            return -1;
+        }
+        fprintf(stderr, "Righe eseguite da %d lavoratori\n", esecutore_lavoratori(esecutore));
+    }
+
+    fprintf(stderr, "Server Cosestrane in ascolto su %s\n", indirizzo);
+
+    while (1) {
+        int i;
+        int confermati = 0;
+        int n = epoll_wait(epfd, eventi, MAX_EVENTI, 1000);
+        time_t adesso = time(NULL);
+
+        if (metriche_richieste) {
+            metriche_richieste = 0;
+            if (file_metriche != NULL && metriche_salva(file_metriche) < 0) {
+                fprintf(stderr, "Errore: impossibile scrivere le metriche in %s\n", file_metriche);
+            }
+            if (file_traccia != NULL && metriche_salva_traccia(file_traccia) < 0) {
+                fprintf(stderr, "Errore: impossibile scrivere la traccia in %s\n", file_traccia);
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        if (n == 0) { // Un secondo senza attivita': gli eventi raccolti finora vanno nel file della cronaca
+            cronaca_spedisci(); // Quelli dei lavoratori partono al loro prossimo evento
+        }
+
+        /* Prima si leggono tutte le connessioni pronte, in parallelo sui lavoratori; fino a
+           esecutore_attendi il ciclo non tocca connessioni, partite, salvataggio ne' orfane */
+        for (i = 0; i < n; i++) {
+            void* dato = eventi[i].data.ptr;
+
+            if (dato != NULL && dato != &segnale_salvataggio && dato != &segnale_metriche
+                && cliente_metriche(dato) == NULL
+                && (eventi[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                avvia_lettura((Connessione*)dato);
+            }
+        }
+        if (esecutore != NULL) {
+            esecutore_attendi(esecutore);
+        }
+
+        for (i = 0; i < n; i++) {
+            Connessione* c = (Connessione*)eventi[i].data.ptr;
+
+            if (c == NULL) {
+                accetta_connessioni(ascolto, adesso);
+                continue;
+            }
+            if (eventi[i].data.ptr == &segnale_salvataggio) { // Dopo il giro: puo' chiudere connessioni ancora in eventi
+                confermati = 1;
+                continue;
+            }
+            if (eventi[i].data.ptr == &segnale_metriche) {
+                accetta_metriche(adesso);
+                continue;
+            }
+            if (cliente_metriche(eventi[i].data.ptr) != NULL) {
+                rispondi_metriche(cliente_metriche(eventi[i].data.ptr));
+                continue;
+            }
+
+            if (eventi[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if (concludi_lettura(c, adesso) < 0) {
+                    continue;
+                }
+            }
+            if ((eventi[i].events & EPOLLOUT) && c->attende_conferma) { // Si riprende dopo la conferma
+                c->attende_scrittura = 0;
+                aggiorna_eventi(c);
+            } else if (eventi[i].events & EPOLLOUT) {
+                invia_uscita(c);
+            }
+        }
+
+        if (confermati) {
+            rilascia_confermate();
+        }
+        chiudi_inattive(adesso);
+        if (salvataggio != NULL) { // Una sola scrittura su disco per tutte le sessioni del giro
+            chiudi_lotto();
+        }
+    }
+
+    esecutore_distruggi(esecutore);
+    esecutore = NULL;
+    close(epfd);
+    close(ascolto);
+    return -1;
+}
@@ -0,0 +1,57 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "gamelib.h"
+
+/* ============================================================================
+ * SERVER DI GIOCO MULTI-CLIENT
+ *
+ * Un solo processo ospita molte sessioni (imposta_gioco + gioca) su socket
+ * TCP o Unix non bloccanti gestiti con epoll. Ogni connessione ha la sua
+ * Partita: le righe ricevute vengono consegnate con partita_invia e il testo
+ * prodotto viene rispedito al client. Con una mappa del giorno tutte le
+ * partite giocano la stessa mappa condivisa invece di crearne una propria.
+ *
+ * Con un file di salvataggio (salvataggio.h) le partite in gioco
+ * sopravvivono a un crash del server: al riavvio vengono ricostruite e il
+ * client le riprende scrivendo "riprendi <codice>" dopo essersi connesso.
+ *
+ * Con dei lavoratori (esecutore.h) le connessioni pronte in un giro di
+ * epoll vengono lette e giocate in parallelo, una per compito: ogni sessione
+ * torna di preferenza al lavoratore che l'ha servita l'ultima volta. Il
+ * ciclo aspetta la fine del giro prima di spedire le uscite.
+ * ============================================================================ */
+
+/* Secondi senza input dopo cui una connessione viene chiusa */
+#define SERVER_TIMEOUT_INATTIVITA   300
+
+/* Lunghezza massima di una riga di input (le righe piu' lunghe vengono scartate) */
+#define SERVER_RIGA_MAX             128
+
+/* Oltre questa quantita' di testo non ancora spedito si smette di leggere dal client */
+#define SERVER_USCITA_MAX         65536
+
+/* Righe salvate di una sessione dopo cui se ne salva una nuova istantanea */
+#define SERVER_RIGHE_ISTANTANEA     256
+
+/* Oltre questa dimensione il salvataggio si riscrive con le sole istantanee delle sessioni */
+#define SERVER_SALVATAGGIO_MAX    (64 * 1024 * 1024)
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//espone le metriche (metriche.h) del prossimo server_avvia: una richiesta HTTP su indirizzo riceve il testo
+//per Prometheus (la traccia JSON dei comandi con GET /traccia), un SIGUSR1 scrive il testo nel file percorso
+//e la traccia in percorso_traccia; NULL per non usare l'uno o l'altro
+void server_usa_metriche(const char* indirizzo, const char* percorso, const char* percorso_traccia);
+
+//esegue le righe ricevute dal prossimo server_avvia su n lavoratori (0 = uno per core);
+//senza questa chiamata le esegue il thread del ciclo epoll
+void server_usa_lavoratori(int n);
+
+//avvia il server su "porta", "host:porta" oppure "unix:/percorso", con la mappa del giorno e il file di
+//salvataggio se non sono NULL (le partite salvate vengono ripristinate); ritorna solo in caso di errore
+int server_avvia(const char* indirizzo, const Mappa_condivisa* mappa, const char* percorso_salvataggio);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trasposizioni.h"
+
+#define LINEA_CACHE  64
+
+/* Bit del campo limite che segna una voce scritta: una voce vuota (tutta a zero) non vale per nessun hash, neanche 0 */
+#define VOCE_OCCUPATA  0x80u
+
+/* ============================================================================
+ * STRUTTURE DATI
+ * ============================================================================ */
+
+// Voce della tabella: verifica vale hash XOR dati, cosi' le due parole si controllano a vicenda
+typedef struct {
+    _Atomic uint64_t verifica;
+    _Atomic uint64_t dati;
+} Voce_trasposizione;
+
+// Gruppo di voci nella stessa linea di cache
+typedef struct {
+    _Alignas(LINEA_CACHE) Voce_trasposizione voci[TRASPOSIZIONI_VOCI_GRUPPO];
+} Gruppo_trasposizioni;
+
+struct Tabella_trasposizioni {
+    Gruppo_trasposizioni* gruppi;
+    uint64_t maschera;                   /* Numero di gruppi - 1 */
+};
+
+/* ============================================================================
+ * FUNZIONI DI SUPPORTO
+ * ============================================================================ */
+
+/**
+ * Impacchetta una valutazione in 64 bit, segnando la voce come occupata
+ * @param v Valutazione
+ * @return Dati da salvare nella voce
+ */
+static uint64_t impacchetta(const Valutazione* v) {
+    Valutazione occupata = *v;
+    uint64_t dati;
+
+    occupata.limite = (uint8_t)(occupata.limite | VOCE_OCCUPATA);
+    memcpy(&dati, &occupata, sizeof(dati));
+    return dati;
+}
+
+/**
+ * Spacchetta i dati di una voce
+ * @param dati Dati della voce
+ * @param v Riceve la valutazione, senza il segno di voce occupata
+ * @return 1 se la voce e' occupata, 0 se e' vuota
+ */
+static int spacchetta(uint64_t dati, Valutazione* v) {
+    int occupata;
+
+    memcpy(v, &dati, sizeof(*v));
+    occupata  = (v->limite & VOCE_OCCUPATA) != 0;
+    v->limite = (uint8_t)(v->limite & ~VOCE_OCCUPATA);
+    return occupata;
+}
+
+/**
+ * Legge una voce se appartiene all'hash dato
+ * @param voce Voce della tabella
+ * @param hash Hash cercato
+ * @param v Riceve la valutazione della voce
+ * @return 1 se la voce e' occupata, e' dell'hash e non e' stata scritta a meta', 0 altrimenti
+ */
+static int leggi_voce(const Voce_trasposizione* voce, uint64_t hash, Valutazione* v) {
+    uint64_t verifica = atomic_load_explicit(&voce->verifica, memory_order_relaxed);
+    uint64_t dati     = atomic_load_explicit(&voce->dati, memory_order_relaxed);
+
+    return spacchetta(dati, v) && (verifica ^ dati) == hash;
+}
+
+/**
+ * Profondita' salvata in una voce, qualunque sia il suo hash
+ * @param voce Voce della tabella
+ * @return Profondita' della valutazione (0 per una voce vuota)
+ */
+static int profondita_voce(const Voce_trasposizione* voce) {
+    Valutazione v;
+
+    spacchetta(atomic_load_explicit(&voce->dati, memory_order_relaxed), &v);
+    return v.profondita;
+}
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+Tabella_trasposizioni* trasposizioni_crea(size_t byte) {
+    Tabella_trasposizioni* t = (Tabella_trasposizioni*)malloc(sizeof(Tabella_trasposizioni));
+    size_t gruppi = 1;
+
+    if (t == NULL) {
+        return NULL;
+    }
+    while (gruppi * 2 * sizeof(Gruppo_trasposizioni) <= byte) { // Potenza di 2, per indicizzare con una maschera
+        gruppi *= 2;
+    }
+
+    t->gruppi   = (Gruppo_trasposizioni*)aligned_alloc(LINEA_CACHE, gruppi * sizeof(Gruppo_trasposizioni));
+    t->maschera = (uint64_t)gruppi - 1;
+    if (t->gruppi == NULL) {
+        free(t);
+        return NULL;
+    }
+    trasposizioni_svuota(t);
+    return t;
+}
+
+void trasposizioni_distruggi(Tabella_trasposizioni* t) {
+    if (t == NULL) {
+        return;
+    }
+    free(t->gruppi);
+    free(t);
+}
+
+void trasposizioni_svuota(Tabella_trasposizioni* t) {
+    memset(t->gruppi, 0, (size_t)(t->maschera + 1) * sizeof(Gruppo_trasposizioni));
+}
+
+int trasposizioni_cerca(const Tabella_trasposizioni* t, uint64_t hash, Valutazione* v) {
+    const Gruppo_trasposizioni* g = &t->gruppi[hash & t->maschera];
+    int i;
+
+    for (i = 0; i < TRASPOSIZIONI_VOCI_GRUPPO; i++) {
+        if (leggi_voce(&g->voci[i], hash, v)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void trasposizioni_salva(Tabella_trasposizioni* t, uint64_t hash, const Valutazione* v) {
+    Gruppo_trasposizioni* g = &t->gruppi[hash & t->maschera];
+    uint64_t dati = impacchetta(v);
+    Valutazione vecchia;
+    int scelta = 0;
+    int i;
+
+    for (i = 0; i < TRASPOSIZIONI_VOCI_GRUPPO; i++) {
+        if (leggi_voce(&g->voci[i], hash, &vecchia)) { // Stessa posizione: si aggiorna la sua voce
+            scelta = i;
+            break;
+        }
+        if (profondita_voce(&g->voci[i]) < profondita_voce(&g->voci[scelta])) {
+            scelta = i;
+        }
+    }
+
+    /* Due scritture separate: chi legge nel mezzo vede una verifica sbagliata e ignora la voce */
+    atomic_store_explicit(&g->voci[scelta].dati, dati, memory_order_relaxed);
+    atomic_store_explicit(&g->voci[scelta].verifica, hash ^ dati, memory_order_relaxed);
+}
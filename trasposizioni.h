@@ -0,0 +1,62 @@
+#ifndef TRASPOSIZIONI_H
+#define TRASPOSIZIONI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * TABELLA DELLE TRASPOSIZIONI
+ *
+ * Cache delle valutazioni dei bot, indicizzata dall'hash di Zobrist di un
+ * ramo (ramo_hash): la stessa posizione raggiunta per strade diverse, per
+ * esempio avanti e indietro o tiri di portale falliti, si valuta una volta
+ * sola. La tabella ha dimensione fissa e piu' thread di ricerca la leggono
+ * e scrivono insieme senza lock: ogni voce tiene i dati e l'hash in XOR con
+ * i dati, quindi una voce scritta a meta' da un altro thread non supera il
+ * controllo e viene vista come assente. Un bit del limite segna le voci
+ * scritte, quindi una voce vuota non corrisponde a nessun hash, neanche a 0.
+ * Una voce nuova sostituisce quella dello stesso hash o, nel suo gruppo,
+ * quella cercata a profondita' minore.
+ * ============================================================================ */
+
+/* Voci di ogni gruppo: un gruppo occupa una linea di cache */
+#define TRASPOSIZIONI_VOCI_GRUPPO  4
+
+// Che cosa dice il valore salvato rispetto a quello vero
+typedef enum {
+    LIMITE_ESATTO,
+    LIMITE_INFERIORE,                    /* Il valore vero e' almeno questo */
+    LIMITE_SUPERIORE                     /* Il valore vero e' al massimo questo */
+} Limite_valutazione;
+
+// Valutazione salvata: 8 byte, scritti con una sola operazione atomica
+typedef struct {
+    int32_t valore;
+    int16_t profondita;                  /* Mosse esplorate sotto la posizione */
+    uint8_t limite;                      /* Limite_valutazione (il bit alto e' riservato alla tabella) */
+    uint8_t mossa;                       /* Migliore azione trovata, a scelta del bot */
+} Valutazione;
+
+// Tabella condivisa tra i thread; definita in trasposizioni.c
+typedef struct Tabella_trasposizioni Tabella_trasposizioni;
+
+/* ============================================================================
+ * FUNZIONI PUBBLICHE
+ * ============================================================================ */
+
+//crea una tabella vuota grande al massimo byte byte (almeno un gruppo); NULL se la memoria non basta
+Tabella_trasposizioni* trasposizioni_crea(size_t byte);
+
+//libera la tabella; nessun thread deve piu' usarla
+void trasposizioni_distruggi(Tabella_trasposizioni* t);
+
+//dimentica tutte le valutazioni (da non chiamare mentre altri thread la usano)
+void trasposizioni_svuota(Tabella_trasposizioni* t);
+
+//cerca la valutazione della posizione con l'hash dato: 1 e la copia in v se c'e', 0 altrimenti
+int trasposizioni_cerca(const Tabella_trasposizioni* t, uint64_t hash, Valutazione* v);
+
+//salva la valutazione della posizione con l'hash dato
+void trasposizioni_salva(Tabella_trasposizioni* t, uint64_t hash, const Valutazione* v);
+
+#endif